@@ -9,12 +9,14 @@ import unreal
 import os, inspect, importlib, random, threading, ctypes, time, traceback, pprint, gc, shutil, re
 from pathlib import Path
 from contextlib import nullcontext
+from collections import OrderedDict
 import numpy as np
 import requests
 from diffusers.pipelines.stable_diffusion.convert_from_ckpt import download_from_original_stable_diffusion_ckpt
 
 
 import safetensors
+import safetensors.torch
 import torch
 from torch import autocast
 #from torchvision.transforms.functional import rgb_to_grayscale
@@ -26,7 +28,8 @@ import diffusers
 from diffusers import StableDiffusionImg2ImgPipeline, StableDiffusionPipeline, StableDiffusionInpaintPipeline, StableDiffusionDepth2ImgPipeline, StableDiffusionUpscalePipeline
 from diffusers.pipelines.stable_diffusion.safety_checker import StableDiffusionSafetyChecker
 from diffusers.schedulers.scheduling_utils import SchedulerMixin
-from diffusionconvertors import FColorAsPILImage, PILImageToFColorArray, PILImageToTexture
+from diffusionconvertors import FColorAsPILImage, FloatPixelsAsTensor, TensorAsPILImage, FloatImageToHalfFloatRGBA, HalfFloatRGBAAsUInt16Array, UInt16ArrayAsPILImage, PILImageToFColorArray, PILImageToTexture
+import latentformat
 from huggingface_hub.utils import HfFolder, scan_cache_dir
 from huggingface_hub.utils._errors import LocalEntryNotFoundError
 
@@ -220,12 +223,26 @@ class DiffusersBridge(unreal.StableDiffusionBridge):
     def __init__(self):
         unreal.StableDiffusionBridge.__init__(self)
         self.upsampler = None
+        self.upsampler_x2 = None
         self.pipe = None   
         self.compel = None
         self.executor = None
         self.abort = False
         self.update_frequency = 25
         self.start_timestep = -1
+        self.fast_preview = False
+        self.latent_family = unreal.LatentModelFamily.AUTO
+
+        # Scheduler the pipeline came with so swapped schedulers can be built from its config and reverted to
+        self.default_scheduler = None
+        self.scheduler_name = ""
+
+        # Recently used LoRA weights stay in memory so switching between them doesn't read them from disk again
+        self.lora_cache = OrderedDict()
+        self.lora_cache_size = 4
+
+        # Textual inversion files whose tokens are already in the loaded pipeline's tokenizer
+        self.loaded_textual_inversions = set()
 
 
     @unreal.ufunction(override=True)
@@ -414,6 +431,8 @@ class DiffusersBridge(unreal.StableDiffusionBridge):
         exec(new_pipeline_asset.options.python_pipeline_post_init_script, post_init_script_args, post_init_script_locals)
         self.pipe = post_init_script_locals["pipeline"] if "pipeline" in post_init_script_locals else self.pipe
         
+        self.default_scheduler = self.pipe.scheduler
+        self.scheduler_name = new_pipeline_asset.options.scheduler
         if scheduler_cls:
             self.pipe.scheduler = scheduler_cls.from_config(self.pipe.scheduler.config)
 
@@ -430,35 +449,9 @@ class DiffusersBridge(unreal.StableDiffusionBridge):
         # High resolution support by tiling the VAE
         self.pipe.vae.enable_tiling()
 
-        # LoRA setup
-        lora_id = None
-        if lora_asset:
-            if lora_asset.options.model or lora_asset.options.external_url:
-                # Load LoRA weights into pipeline
-                lora_id = refresh_supplementary_model(lora_asset, self.get_settings_model_save_path().path)
-                if lora_id:
-                    # Force pipeline to CUDA until support is added for pipe.enable_model_cpu_offload()
-                    self.pipe.to("cuda")
-                    self.pipe.load_lora_weights(".", weight_name=lora_id)
-                    # Move model back to CPU so model offloading works
-                    self.pipe.to("cpu")
-
-        # Textual inversion setup
-        textual_inversion_id = None
-        if textual_inversion_asset:
-            if textual_inversion_asset.options.model or textual_inversion_asset.options.external_url:
-                # Load textual inversion weights into pipeline
-                textual_inversion_id = refresh_supplementary_model(textual_inversion_asset, self.get_settings_model_save_path().path)
-                if textual_inversion_id:
-                    # Force pipeline to CUDA until support is added for pipe.enable_model_cpu_offload()
-                    self.pipe.to("cuda")
-                    self.pipe.load_textual_inversion(textual_inversion_id)
-                    # Move model back to CPU so model offloading works
-                    self.pipe.to("cpu")
-        
-        # Cache assets
-        self.set_editor_property("LORAAsset", lora_asset)
-        self.set_editor_property("CachedTextualInversionAsset", textual_inversion_asset)
+        # Adapter setup
+        self.load_lora(lora_asset)
+        self.load_textual_inversion(textual_inversion_asset)
 
         print("Loaded Stable Diffusion model " + modelname)
 
@@ -473,6 +466,92 @@ class DiffusersBridge(unreal.StableDiffusionBridge):
 
         return result
 
+    def load_lora(self, lora_asset):
+        if lora_asset and (lora_asset.options.model or lora_asset.options.external_url):
+            lora_id = refresh_supplementary_model(lora_asset, self.get_settings_model_save_path().path)
+            if not lora_id:
+                return False
+
+            lora_weights = lora_id
+            if lora_id.endswith(".safetensors") and os.path.exists(lora_id):
+                if lora_id in self.lora_cache:
+                    self.lora_cache.move_to_end(lora_id)
+                else:
+                    self.lora_cache[lora_id] = safetensors.torch.load_file(lora_id)
+                    while len(self.lora_cache) > self.lora_cache_size:
+                        self.lora_cache.popitem(last=False)
+                # Diffusers pops keys while converting the weights so the cached dictionary is passed as a copy
+                lora_weights = dict(self.lora_cache[lora_id])
+
+            # Force pipeline to CUDA until support is added for pipe.enable_model_cpu_offload()
+            self.pipe.to("cuda")
+            if isinstance(lora_weights, dict):
+                self.pipe.load_lora_weights(lora_weights)
+            else:
+                self.pipe.load_lora_weights(".", weight_name=lora_weights)
+            # Move model back to CPU so model offloading works
+            self.pipe.to("cpu")
+
+        self.set_editor_property("LORAAsset", lora_asset)
+        return True
+
+    def load_textual_inversion(self, textual_inversion_asset):
+        if textual_inversion_asset and (textual_inversion_asset.options.model or textual_inversion_asset.options.external_url):
+            textual_inversion_id = refresh_supplementary_model(textual_inversion_asset, self.get_settings_model_save_path().path)
+            if not textual_inversion_id:
+                return False
+
+            # Tokens can't be added to the tokenizer twice so inversions that were loaded before are only made current again
+            if textual_inversion_id not in self.loaded_textual_inversions:
+                # Force pipeline to CUDA until support is added for pipe.enable_model_cpu_offload()
+                self.pipe.to("cuda")
+                self.pipe.load_textual_inversion(textual_inversion_id)
+                # Move model back to CPU so model offloading works
+                self.pipe.to("cpu")
+                self.loaded_textual_inversions.add(textual_inversion_id)
+
+        self.set_editor_property("CachedTextualInversionAsset", textual_inversion_asset)
+        return True
+
+    @unreal.ufunction(override=True)
+    def AttachLORA(self, lora_asset):
+        if not self.pipe or not hasattr(self.pipe, "unload_lora_weights"):
+            return False
+        try:
+            if self.get_editor_property("LORAAsset"):
+                self.pipe.unload_lora_weights()
+                self.set_editor_property("LORAAsset", None)
+            return self.load_lora(lora_asset)
+        except Exception as e:
+            print(f"Could not attach LoRA to the loaded pipeline. Exception was {e}")
+            return False
+
+    @unreal.ufunction(override=True)
+    def DetachLORA(self):
+        if not self.pipe or not hasattr(self.pipe, "unload_lora_weights"):
+            return False
+        self.pipe.unload_lora_weights()
+        self.set_editor_property("LORAAsset", None)
+        return True
+
+    @unreal.ufunction(override=True)
+    def AttachTextualInversion(self, textual_inversion_asset):
+        if not self.pipe:
+            return False
+        try:
+            return self.load_textual_inversion(textual_inversion_asset)
+        except Exception as e:
+            print(f"Could not attach textual inversion to the loaded pipeline. Exception was {e}")
+            return False
+
+    @unreal.ufunction(override=True)
+    def DetachTextualInversion(self):
+        if not self.pipe:
+            return False
+        # Loaded tokens only take effect when they are used in a prompt so they can stay in the tokenizer
+        self.set_editor_property("CachedTextualInversionAsset", None)
+        return True
+
     @unreal.ufunction(override=True)
     def AvailableSchedulers(self):
         if not self.pipe:
@@ -485,6 +564,19 @@ class DiffusersBridge(unreal.StableDiffusionBridge):
             raise("No pipeline loaded to get the current scheduler from")
         return self.pipe.scheduler.__class__.__name__
 
+    @unreal.ufunction(override=True)
+    def SetScheduler(self, scheduler):
+        if not self.pipe or not self.default_scheduler:
+            return False
+        try:
+            self.pipe.scheduler = getattr(diffusers, scheduler).from_config(self.default_scheduler.config) if scheduler else self.default_scheduler
+        except (AttributeError, ValueError) as e:
+            print(f"Could not set scheduler {scheduler} on the loaded pipeline. Exception was {e}")
+            return False
+        print(f"Using scheduler class: {self.pipe.scheduler.__class__.__name__}")
+        self.scheduler_name = scheduler
+        return True
+
     @unreal.ufunction(override=True)
     def GetTokenWebsiteHint(self):
         return "https://huggingface.co/settings/tokens"
@@ -493,10 +585,10 @@ class DiffusersBridge(unreal.StableDiffusionBridge):
     def GetRequiresToken(self):
         return True
 
-    def InitUpsampler(self):
+    def InitUpsampler(self, scale=4):
         upsampler = None
         try:
-            upsampler = RealESRGANModel.from_pretrained("nateraw/real-esrgan", cache_dir=self.get_settings_model_save_path().path)
+            upsampler = RealESRGANModel.from_pretrained("nateraw/real-esrgan", cache_dir=self.get_settings_model_save_path().path, scale=scale)
             upsampler = upsampler.to("cuda")
         except Exception as e:
             print("Could not load upsampler. Exception was ".format(e))
@@ -508,6 +600,8 @@ class DiffusersBridge(unreal.StableDiffusionBridge):
             if self.pipe:
                 del self.pipe
                 self.pipe = None
+        self.default_scheduler = None
+        self.loaded_textual_inversions = set()
         gc.collect()
         torch.cuda.empty_cache()
 
@@ -544,12 +638,22 @@ class DiffusersBridge(unreal.StableDiffusionBridge):
             layer_img = None
             if layer.output_type == unreal.ImageType.LATENT:
                 print("Loading latent data from layer")
-                layer_img = torch.load(io.BytesIO(bytearray(layer.latent_data)))
+                layer_img = latentformat.load_latents(bytes(unreal.StableDiffusionBlueprintLibrary.get_layer_latent_data(layer)), device=self.pipe.device)
             else:
-                layer_img = FColorAsPILImage(layer.layer_pixels, input.options.size_x, input.options.size_y).convert("RGB") if layer.layer_pixels else None
-                layer_img = layer_img.resize((input.options.out_size_x, input.options.out_size_y))
+                pixel_data, bit_depth = unreal.StableDiffusionBlueprintLibrary.get_layer_pixel_data(layer)
+                if bit_depth != unreal.LayerBitDepth.EIGHT_BIT and pixel_data:
+                    # Pass high bit depth layers on as float tensors so gradients survive
+                    linear_data = layer.processor.linear_data if layer.processor else False
+                    layer_img = FloatPixelsAsTensor(pixel_data, input.options.size_x, input.options.size_y, bit_depth == unreal.LayerBitDepth.SIXTEEN_BIT, srgb=not linear_data)
+                    layer_img = torch.nn.functional.interpolate(layer_img, size=(input.options.out_size_y, input.options.out_size_x), mode="bilinear", align_corners=False)
+                    if layer.processor and layer.processor.python_transform_script:
+                        layer_img = TensorAsPILImage(layer_img)
+                else:
+                    layer_pixels = unreal.StableDiffusionBlueprintLibrary.get_layer_pixels(layer)
+                    layer_img = FColorAsPILImage(layer_pixels, input.options.size_x, input.options.size_y).convert("RGB") if layer_pixels else None
+                    layer_img = layer_img.resize((input.options.out_size_x, input.options.out_size_y))
 
-            if layer.processor.python_transform_script and not layer.output_type == unreal.ImageType.LATENT:
+            if layer.processor and layer.processor.python_transform_script and not layer.output_type == unreal.ImageType.LATENT:
                 transform_script_locals = {}
                 transform_script_args = {"input_image": layer_img}
                 print(f"Running image transform script for layer {layer}")
@@ -591,9 +695,10 @@ class DiffusersBridge(unreal.StableDiffusionBridge):
                 role = layer.role if layer.layer_type == unreal.LayerImageType.CUSTOM else layer_type_name(layer.layer_type)
                 if hasattr(layer_img_mappings[role], "__len__"):
                     for img in layer_img_mappings[role]:
-                        img.show()
+                        (TensorAsPILImage(img) if torch.is_tensor(img) else img).show()
                 else:
-                    layer_img_mappings[key].show()
+                    img = layer_img_mappings[key]
+                    (TensorAsPILImage(img) if torch.is_tensor(img) else img).show()
 
         # Set seed
         max_seed = abs(int((2**31) / 2) - 1)
@@ -691,110 +796,139 @@ class DiffusersBridge(unreal.StableDiffusionBridge):
                 # How frequent we want the image preview to be updated during generation
                 self.update_frequency = input.preview_iteration_rate
 
-                # Set the timestep in the scheduler early so we can get the start timestep
-                self.pipe.scheduler.set_timesteps(input.options.iterations, device=self.pipe._execution_device)
-                print(self.pipe.scheduler.timesteps)
-                self.start_timestep = int(self.pipe.scheduler.timesteps.cpu().numpy()[0])
-                print(f"Start timestep is {self.start_timestep}")
-
-                # Fallback to prompts without compel weights if the pipeline doesn't support prompt_embeds
-                if no_prompt_weights_active:
-                    generation_args["prompt"] = " ".join([f"{split_p.strip()}" for prompt in input.options.positive_prompts for split_p in prompt.prompt.split(",")])
-                    generation_args["negative_prompt"] = " ".join([f"{split_p.strip()}" for prompt in input.options.negative_prompts for split_p in prompt.prompt.split(",")])
-                else:
-                    generation_args["prompt_embeds"] = prompt_tensors
-
-                # Different capability flags use different keywords in the pipeline
-                if strength_active:
-                    generation_args["strength"] = input.options.strength
-
-                # SDXL requires pooled prompt embeddings along with the regular prompt embeddings
-                if requires_pooled_active:
-                    generation_args["pooled_prompt_embeds"] = pooled_prompt_tensors
-                    #generation_args["negative_pooled_prompt_embeds"] = negative_pooled_prompt_tensors
-
-                # Add processed input layers                 
-                generation_args.update(layer_img_mappings)
-
-                # Set controlnet scales if available
-                if len(controlnet_scales):
-                    generation_args["controlnet_conditioning_scale"] = controlnet_scales if len(controlnet_scales) > 1 else controlnet_scales[0]
-
-                # Set whether we want to return an image or just latent data
-                if input.output_type == unreal.ImageType.LATENT:
-                    generation_args["output_type"] = "latent"
-
-                if pipeline_asset.options.python_pre_render_script:
-                    pre_render_script_locals = {}
-                    pre_render_script_args = {
-                        "input": input, 
-                        "pipeline_asset": pipeline_asset,
-                        "model_options": model_options
-                    }
-                    print(f"Running pre-render script")
-                    exec(pipeline_asset.options.python_pre_render_script, pre_render_script_args, pre_render_script_locals)
-                    if "generation_args" in pre_render_script_locals:
-                        print("Found updated generation_args in pre render script")
-                        generation_args.update(pre_render_script_locals["generation_args"])
-
-                if input.debug_python_images:
-                    print("Generation args:")
-                    pprint.pprint(generation_args)
-
-                # Reset progress bar
-                self.update_image_progress("inprogress", int(0), int(1), float(0.0), input.options.out_size_x, input.options.out_size_y, None)
+                # Fast previews skip the VAE and project latents to RGB natively
+                self.fast_preview = input.fast_preview
+                self.latent_family = self.get_latent_family(model_options)
+
+                # Swap the scheduler for this image only. Preview quality controllers use this to pick schedulers that converge in fewer steps
+                original_scheduler = None
+                if input.scheduler_override and input.scheduler_override != self.pipe.scheduler.__class__.__name__:
+                    print(f"Using scheduler {input.scheduler_override} for this image")
+                    original_scheduler = self.pipe.scheduler
+                    self.pipe.scheduler = getattr(diffusers, input.scheduler_override).from_config(original_scheduler.config)
+
+                try:
+                    # Set the timestep in the scheduler early so we can get the start timestep
+                    self.pipe.scheduler.set_timesteps(input.options.iterations, device=self.pipe._execution_device)
+                    print(self.pipe.scheduler.timesteps)
+                    self.start_timestep = int(self.pipe.scheduler.timesteps.cpu().numpy()[0])
+                    print(f"Start timestep is {self.start_timestep}")
+
+                    # Fallback to prompts without compel weights if the pipeline doesn't support prompt_embeds
+                    if no_prompt_weights_active:
+                        generation_args["prompt"] = " ".join([f"{split_p.strip()}" for prompt in input.options.positive_prompts for split_p in prompt.prompt.split(",")])
+                        generation_args["negative_prompt"] = " ".join([f"{split_p.strip()}" for prompt in input.options.negative_prompts for split_p in prompt.prompt.split(",")])
+                    else:
+                        generation_args["prompt_embeds"] = prompt_tensors
+
+                    # Different capability flags use different keywords in the pipeline
+                    if strength_active:
+                        generation_args["strength"] = input.options.strength
+
+                    # SDXL requires pooled prompt embeddings along with the regular prompt embeddings
+                    if requires_pooled_active:
+                        generation_args["pooled_prompt_embeds"] = pooled_prompt_tensors
+                        #generation_args["negative_pooled_prompt_embeds"] = negative_pooled_prompt_tensors
+
+                    # Add processed input layers                 
+                    generation_args.update(layer_img_mappings)
+
+                    # Set controlnet scales if available
+                    if len(controlnet_scales):
+                        generation_args["controlnet_conditioning_scale"] = controlnet_scales if len(controlnet_scales) > 1 else controlnet_scales[0]
+
+                    # Set whether we want to return an image or just latent data
+                    if input.output_type == unreal.ImageType.LATENT:
+                        generation_args["output_type"] = "latent"
+
+                    # Float output keeps the decoded image as a float array. Post render scripts expect PIL images so they use the 8 bit path.
+                    float_output = input.float_output and input.output_type == unreal.ImageType.IMAGE and not pipeline_asset.options.python_post_render_script
+                    if float_output:
+                        generation_args["output_type"] = "np"
+
+                    if pipeline_asset.options.python_pre_render_script:
+                        pre_render_script_locals = {}
+                        pre_render_script_args = {
+                            "input": input, 
+                            "pipeline_asset": pipeline_asset,
+                            "model_options": model_options
+                        }
+                        print(f"Running pre-render script")
+                        exec(pipeline_asset.options.python_pre_render_script, pre_render_script_args, pre_render_script_locals)
+                        if "generation_args" in pre_render_script_locals:
+                            print("Found updated generation_args in pre render script")
+                            generation_args.update(pre_render_script_locals["generation_args"])
+
+                    if input.debug_python_images:
+                        print("Generation args:")
+                        pprint.pprint(generation_args)
+
+                    # Reset progress bar
+                    self.update_image_progress("inprogress", int(0), int(1), float(0.0), input.options.out_size_x, input.options.out_size_y, None)
             
-                # Create executor to generate the image in its own thread that we can abort if needed
-                self.executor = AbortableExecutor("ImageThread", lambda generation_args=generation_args: self.pipe(**generation_args))
-                self.executor.start()
+                    # Create executor to generate the image in its own thread that we can abort if needed
+                    self.executor = AbortableExecutor("ImageThread", lambda generation_args=generation_args: self.pipe(**generation_args))
+                    self.executor.start()
 
-                # Block until executor completes
-                self.executor.join()
-                if not self.executor.result or not self.executor.completed:
-                    print(f"Image generation was aborted")
-                    self.abort = False
+                    # Block until executor completes
+                    self.executor.join()
+                    if not self.executor.result or not self.executor.completed:
+                        print(f"Image generation was aborted")
+                        self.abort = False
 
-                # Gather result images
-                images = self.executor.result.images if self.executor.result else None #self.pipe(**generation_args).images
-                image = images[0] if not images is None else None
+                    # Gather result images
+                    images = self.executor.result.images if self.executor.result else None #self.pipe(**generation_args).images
+                    image = images[0] if not images is None else None
 
-                if input.debug_python_images and not image is None:
-                    image.show()
+                    if input.debug_python_images and not image is None:
+                        (Image.fromarray((np.clip(image, 0.0, 1.0) * 255.0 + 0.5).astype(np.uint8)) if float_output else image).show()
 
-                if image is None:
-                    print("No image was generated")
-                else:
-                    if pipeline_asset.options.python_post_render_script:
-                        post_render_script_locals = {}
-                        post_render_script_args = {"input_image": image, "generation_args": generation_args }
-                        print(f"Running post-render script")
-                        exec(pipeline_asset.options.python_post_render_script, post_render_script_args, post_render_script_locals)
-                        image = post_render_script_locals["result_image"]# if "result_image" in post_render_script_locals else image
+                    if image is None:
+                        print("No image was generated")
+                    else:
+                        if pipeline_asset.options.python_post_render_script:
+                            post_render_script_locals = {}
+                            post_render_script_args = {"input_image": image, "generation_args": generation_args }
+                            print(f"Running post-render script")
+                            exec(pipeline_asset.options.python_post_render_script, post_render_script_args, post_render_script_locals)
+                            image = post_render_script_locals["result_image"]# if "result_image" in post_render_script_locals else image
                 
-                # Gather result data
-                print(f"Result model options: {model_options}")
-                print(f"Result pipeline options: {pipeline_asset.options}")
-                result.model = model_options
-                result.pipeline = pipeline_asset.options
-                result.lora = lora_asset.options if lora_asset else unreal.StableDiffusionModelOptions()
-
-                # Save latent if required
-                if input.output_type == unreal.ImageType.LATENT:
-                    buffer = io.BytesIO()
-                    torch.save(image, buffer)
-                    result.out_latent = buffer.getvalue()
-                    result.out_width = input.options.out_size_x
-                    result.out_height = input.options.out_size_y
-                else:
-                    # Save texture
-                    result.out_texture = PILImageToTexture(image.convert("RGBA"), out_texture, True) if not image is None else None
-                    result.out_width = image.width if not image is None else input.options.out_size_x
-                    result.out_height = image.height if not image is None else input.options.out_size_y
+                    # Gather result data
+                    print(f"Result model options: {model_options}")
+                    print(f"Result pipeline options: {pipeline_asset.options}")
+                    result.model = model_options
+                    # The scheduler may have been swapped since the pipeline asset was loaded, or overridden for this image only
+                    result_pipeline = pipeline_asset.options.copy()
+                    result_pipeline.scheduler = input.scheduler_override if original_scheduler else self.scheduler_name
+                    result.pipeline = result_pipeline
+                    result.lora = lora_asset.options if lora_asset else unreal.StableDiffusionModelOptions()
+
+                    # Save latent if required
+                    if input.output_type == unreal.ImageType.LATENT:
+                        latent_bytes = latentformat.encode(image, family=self.latent_family.value)
+                        result = unreal.StableDiffusionBlueprintLibrary.set_result_latent_data(result, latent_bytes)
+                        result.out_width = input.options.out_size_x
+                        result.out_height = input.options.out_size_y
+                    elif float_output and not image is None:
+                        # Return linear half float pixels and leave the output texture untouched
+                        result = unreal.StableDiffusionBlueprintLibrary.set_result_float_pixels(result, FloatImageToHalfFloatRGBA(image))
+                        result.out_width = image.shape[1]
+                        result.out_height = image.shape[0]
+                    else:
+                        # Save texture
+                        result.out_texture = PILImageToTexture(image.convert("RGBA"), out_texture, True) if not image is None else None
+                        result.out_width = image.width if not image is None else input.options.out_size_x
+                        result.out_height = image.height if not image is None else input.options.out_size_y
                 
-                result.input = input
-                result.input.options.seed = seed
-                print(f"Seed was {seed}. Saved as {result.input.options.seed}")
-                result.completed = image is not None
+                    result.input = input
+                    result.input.options.seed = seed
+                    print(f"Seed was {seed}. Saved as {result.input.options.seed}")
+                    result.completed = image is not None
+
+                finally:
+                    # Put the pipeline's own scheduler back even if generation failed so later images don't inherit the override
+                    if original_scheduler:
+                        self.pipe.scheduler = original_scheduler
 
                 # Cleanup
                 self.start_timestep = -1
@@ -811,24 +945,42 @@ class DiffusersBridge(unreal.StableDiffusionBridge):
     def ImageProgressStep(self, step: int, timestep: int, latents: torch.FloatTensor) -> None:
         pct_complete = (self.start_timestep - timestep) / self.start_timestep
 
-        print(f"Step is {step}. Timestep is {timestep} Frequency is {self.update_frequency}. Modulo is {step % self.update_frequency}")
         texture = None
         image_size = (0,0)
-        if (step % self.update_frequency == 0 or step == 1) and self.preview_texture:
-            adjusted_latents = 1 / 0.18215 * latents
-            image = self.pipe.vae.decode(adjusted_latents).sample
-            image = (image / 2 + 0.5).clamp(0, 1)
-            image = image.detach().cpu().permute(0, 2, 3, 1).numpy()
-            image = self.pipe.numpy_to_pil(image)[0]
-            texture = PILImageToTexture(image.convert("RGBA"), self.preview_texture, True)
-            image_size = (image.width, image.height)
-        
-        self.update_image_progress("inprogress", int(step), int(timestep), float(pct_complete), image_size[0], image_size[1], texture)
+        preview_step = (step % self.update_frequency == 0 or step == 1) and self.preview_texture
+
+        # Fast previews only change where the preview comes from. Progress is still reported on every step.
+        if preview_step and self.fast_preview:
+            preview_latents = latents[0].detach().float().cpu().contiguous()
+            channels, height, width = preview_latents.shape
+            self.update_image_progress_from_latents("inprogress", int(step), int(timestep), float(pct_complete), preview_latents.numpy().tobytes(), channels, width, height, self.latent_family, self.preview_texture)
+        else:
+            if preview_step:
+                adjusted_latents = 1 / 0.18215 * latents
+                image = self.pipe.vae.decode(adjusted_latents).sample
+                image = (image / 2 + 0.5).clamp(0, 1)
+                image = image.detach().cpu().permute(0, 2, 3, 1).numpy()
+                image = self.pipe.numpy_to_pil(image)[0]
+                texture = PILImageToTexture(image.convert("RGBA"), self.preview_texture, True)
+                image_size = (image.width, image.height)
+            self.update_image_progress("inprogress", int(step), int(timestep), float(pct_complete), image_size[0], image_size[1], texture)
 
         # Image finished we can now abort image generation
         if self.abort and self.executor:
             self.executor.stop()
 
+    def get_latent_family(self, model_options):
+        if model_options.latent_family != unreal.LatentModelFamily.AUTO:
+            return model_options.latent_family
+
+        # SDXL shares the SD1 channel count so it can only be told apart by the pipeline
+        pipe_name = type(self.pipe).__name__ if self.pipe else ""
+        if "StableDiffusion3" in pipe_name:
+            return unreal.LatentModelFamily.SD3
+        if "XL" in pipe_name:
+            return unreal.LatentModelFamily.SDXL
+        return unreal.LatentModelFamily.AUTO
+
     def build_prompt_tensors(self, positive_prompts: list[unreal.Prompt], negative_prompts: list[unreal.Prompt], compel: Compel):
          # Collate prompts
         positive_prompts = " ".join([f"({split_p.strip()}){prompt.weight}" for prompt in positive_prompts for split_p in prompt.prompt.split(",")])
@@ -854,9 +1006,8 @@ class DiffusersBridge(unreal.StableDiffusionBridge):
 
     @unreal.ufunction(override=True)
     def StartUpsample(self):
-        if not hasattr(self, "upsampler"):
-            if not self.upsampler:
-                self.upsampler = self.InitUpsampler()
+        if not getattr(self, "upsampler", None):
+            self.upsampler = self.InitUpsampler()
 
     @unreal.ufunction(override=True)
     def StopUpsample(self):
@@ -865,17 +1016,44 @@ class DiffusersBridge(unreal.StableDiffusionBridge):
             if self.upsampler:
                 del self.upsampler
                 self.upsampler = None
+            if getattr(self, "upsampler_x2", None):
+                del self.upsampler_x2
+                self.upsampler_x2 = None
             gc.collect()
             torch.cuda.empty_cache()
 
+    @unreal.ufunction(override=True)
+    def UpsampleImageBatch(self, image_results):
+        # Load the upsampler once for the whole batch if the caller hasn't started it
+        local_upsampler = not self.upsampler
+        if local_upsampler:
+            self.StartUpsample()
+
+        results = [self.UpsampleImage(image_result, None) for image_result in image_results]
+
+        if local_upsampler:
+            self.StopUpsample()
+        return results
+
     @unreal.ufunction(override=True)
     def UpsampleImage(self, image_result: unreal.StableDiffusionImageResult, out_texture):
         upsampled_image = None
+        upsample_factor = 0.0
         active_upsampler = None
         local_upsampler = None
+
+        # Factors up to 2 run the x2 model, it's cheaper than running x4 and throwing half the pixels away
+        model_scale = 2 if image_result.upsample_factor <= 2.0 else 4
         if not self.upsampler:
-            local_upsampler = self.InitUpsampler()
+            local_upsampler = self.InitUpsampler(model_scale)
+            if not local_upsampler and model_scale != 4:
+                local_upsampler = self.InitUpsampler()
             active_upsampler = local_upsampler
+        elif model_scale == 2:
+            # Started upsamplers load the x2 model on first use and keep it until StopUpsample
+            if not getattr(self, "upsampler_x2", None):
+                self.upsampler_x2 = self.InitUpsampler(2)
+            active_upsampler = self.upsampler_x2 or self.upsampler
         else:
             active_upsampler = self.upsampler
 
@@ -883,11 +1061,33 @@ class DiffusersBridge(unreal.StableDiffusionBridge):
             if not isinstance(image_result, unreal.StableDiffusionImageResult):
                 raise ValueError(f"Wrong type passed to upscale. Expected {type(StableDiffusionImageResult)} or List. Received {type(image_result)}")
             
-            input_pixels = unreal.StableDiffusionBlueprintLibrary.read_pixels(image_result.out_texture)
-            image = FColorAsPILImage(input_pixels, image_result.out_texture.blueprint_get_size_x(), image_result.out_texture.blueprint_get_size_y()).convert("RGB")
-            print(f"Upscaling image result from {image_result.out_width}:{image_result.out_height} to {image_result.out_width * 4}:{image_result.out_height * 4}")
-            upsampled_image = active_upsampler(image)
-            print("Upsample complete")
+            float_input = unreal.StableDiffusionBlueprintLibrary.has_float_pixels(image_result)
+            if float_input:
+                # Frames coming straight from memory or disk without a texture. RealESRGAN takes 16 bit arrays so these skip the
+                # 8 bit PIL round trip. Values are still clamped to [0, 1] so HDR highlights don't survive the upsampler.
+                image = HalfFloatRGBAAsUInt16Array(unreal.StableDiffusionBlueprintLibrary.get_result_float_pixel_data(image_result), image_result.out_width, image_result.out_height)
+            else:
+                input_pixels = unreal.StableDiffusionBlueprintLibrary.read_pixels(image_result.out_texture)
+                image = FColorAsPILImage(input_pixels, image_result.out_texture.blueprint_get_size_x(), image_result.out_texture.blueprint_get_size_y()).convert("RGB")
+            if image_result.upsample_factor <= 1.0:
+                # Nothing for the model to do. Any downscale is left to the caller's resampler
+                upsampled_image = image
+                upsample_factor = 1.0
+            elif float_input:
+                # RealESRGAN upsamples by its model's scale so report that and let the caller resample to the requested factor
+                upsampled_image = active_upsampler(image, convert_to_pil=False)[:, :, ::-1]
+                upsample_factor = float(active_upsampler.scale)
+            else:
+                upsampled_image = active_upsampler(image)
+                upsample_factor = float(active_upsampler.scale)
+
+            if float_input and out_texture:
+                # Textures are 8 bit anyway
+                upsampled_image = UInt16ArrayAsPILImage(upsampled_image)
+            if isinstance(upsampled_image, np.ndarray):
+                upsampled_height, upsampled_width = upsampled_image.shape[:2]
+            else:
+                upsampled_width, upsampled_height = upsampled_image.size
         
         # Free local upsampler to restore VRAM
         if local_upsampler:
@@ -900,10 +1100,19 @@ class DiffusersBridge(unreal.StableDiffusionBridge):
         result.pipeline = image_result.pipeline
         result.lora = image_result.lora
         result.input = image_result.input
-        result.out_texture =  PILImageToTexture(upsampled_image.convert("RGBA"), out_texture, True) if upsampled_image else None
-        result.out_width = upsampled_image.width
-        result.out_height = upsampled_image.height
+        if upsampled_image is not None and not out_texture:
+            # No texture to write to so hand the pixels back as linear half floats
+            if isinstance(upsampled_image, np.ndarray):
+                srgb = upsampled_image.astype(np.float32) / (65535.0 if upsampled_image.dtype == np.uint16 else 255.0)
+            else:
+                srgb = np.asarray(upsampled_image.convert("RGB"), dtype=np.float32) / 255.0
+            result = unreal.StableDiffusionBlueprintLibrary.set_result_float_pixels(result, FloatImageToHalfFloatRGBA(srgb))
+        else:
+            result.out_texture = PILImageToTexture(upsampled_image.convert("RGBA"), out_texture, True) if upsampled_image is not None else None
+        result.out_width = upsampled_width if upsampled_image is not None else 0
+        result.out_height = upsampled_height if upsampled_image is not None else 0
         result.upsampled = True
+        result.upsample_factor = upsample_factor if upsampled_image is not None else 0.0
         result.completed = True
 
         # Cleanup
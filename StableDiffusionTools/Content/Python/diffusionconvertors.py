@@ -1,5 +1,6 @@
 from PIL import Image
 import numpy as np
+import torch
 import unreal
 
 def FColorAsPILImage(color_arr, image_width, image_height):
@@ -14,6 +15,37 @@ def FColorAsPILImage(color_arr, image_width, image_height):
     pix_arr = np.array(pixels, dtype=np.uint8)
     return Image.fromarray(pix_arr)
 
+def FloatPixelsAsTensor(pixel_data, image_width, image_height, half_float, srgb=True):
+    # High bit depth layers arrive as linear RGBA floats, keep them as a 1x3xHxW tensor in [0, 1] so nothing gets quantised.
+    # Colour layers are sRGB encoded to match what the pipelines see from 8 bit layers, data layers such as depth stay linear
+    pix_arr = np.clip(np.frombuffer(bytes(pixel_data), dtype=np.float16 if half_float else np.float32).reshape(image_height, image_width, 4)[..., :3].astype(np.float32), 0.0, 1.0)
+    if srgb:
+        pix_arr = np.where(pix_arr <= 0.0031308, pix_arr * 12.92, 1.055 * np.power(pix_arr, 1.0 / 2.4) - 0.055).astype(np.float32)
+    return torch.from_numpy(pix_arr).permute(2, 0, 1).unsqueeze(0)
+
+def TensorAsPILImage(tensor):
+    pix_arr = (tensor[0].permute(1, 2, 0).clamp(0.0, 1.0).cpu().float().numpy() * 255.0 + 0.5).astype(np.uint8)
+    return Image.fromarray(pix_arr)
+
+def FloatImageToHalfFloatRGBA(image):
+    # Diffusers returns sRGB encoded HxWx3 floats, Unreal expects linear RGBA half floats
+    srgb = np.clip(image.astype(np.float32), 0.0, 1.0)
+    linear = np.where(srgb <= 0.04045, srgb / 12.92, np.power((srgb + 0.055) / 1.055, 2.4))
+    alpha = np.ones(linear.shape[:2] + (1,), dtype=np.float32)
+    return np.concatenate([linear, alpha], axis=2).astype(np.float16).tobytes()
+
+def HalfFloatRGBAAsSRGB(pixel_data, image_width, image_height):
+    # Inverse of FloatImageToHalfFloatRGBA. Encodes linear half floats as sRGB HxWx3 floats in [0, 1]
+    linear = np.clip(np.frombuffer(bytes(pixel_data), dtype=np.float16).reshape(image_height, image_width, 4)[..., :3].astype(np.float32), 0.0, 1.0)
+    return np.where(linear <= 0.0031308, linear * 12.92, 1.055 * np.power(linear, 1.0 / 2.4) - 0.055)
+
+def HalfFloatRGBAAsUInt16Array(pixel_data, image_width, image_height):
+    # Encodes linear half floats as a 16 bit sRGB HxWx3 array so upsamplers that accept 16 bit input don't quantise them to 8 bit
+    return (HalfFloatRGBAAsSRGB(pixel_data, image_width, image_height) * 65535.0 + 0.5).astype(np.uint16)
+
+def UInt16ArrayAsPILImage(pix_arr):
+    return Image.fromarray((pix_arr.astype(np.float32) / 257.0 + 0.5).astype(np.uint8))
+
 def PILImageToFColorArray(image):
     output_pixels = []
     for pixel in list(image.getdata()):
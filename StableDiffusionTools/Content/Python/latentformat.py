@@ -0,0 +1,156 @@
+"""
+Latent container used to pass latents between pipeline stages and to store them in result assets.
+
+Layout (little endian). The header is 48 bytes so the payload stays 16 byte aligned when the file is memory mapped:
+
+    offset  size  field
+    0       4     magic "SDLT"
+    4       2     version (1)
+    6       1     dtype        0 = float32, 1 = float16
+    7       1     compression  0 = none, 1 = zlib over byte-shuffled data
+    8       1     layout       0 = NCHW
+    9       1     model family (matches ELatentModelFamily: 0 auto, 1 SD1, 2 SDXL, 3 SD3)
+    10      1     number of dimensions (1-4)
+    11      1     reserved
+    12      16    shape, 4 x int32. Unused trailing dimensions are 1
+    28      8     raw size, uint64. Size of the uncompressed data in bytes
+    36      8     payload size, uint64. Size of the data following the header in bytes
+    44      4     reserved
+
+Byte shuffling stores the n-th byte of every element together before compressing, which groups the slowly changing
+sign/exponent bytes and roughly doubles how well zlib does on float data. The C++ reader is FStableDiffusionLatent.
+"""
+import io
+import struct
+import time
+import zlib
+
+import numpy as np
+import torch
+
+MAGIC = b"SDLT"
+VERSION = 1
+HEADER_FORMAT = "<4sHBBBBBB4iQQ4x"
+HEADER_SIZE = struct.calcsize(HEADER_FORMAT)
+
+DTYPE_FLOAT32 = 0
+DTYPE_FLOAT16 = 1
+COMPRESSION_NONE = 0
+COMPRESSION_ZLIB = 1
+LAYOUT_NCHW = 0
+
+_NUMPY_DTYPES = {DTYPE_FLOAT32: np.float32, DTYPE_FLOAT16: np.float16}
+
+assert HEADER_SIZE == 48
+
+
+def is_latent_container(data) -> bool:
+    return data is not None and len(data) >= HEADER_SIZE and bytes(data[:4]) == MAGIC
+
+
+def _shuffle(raw: bytes, itemsize: int) -> bytes:
+    return np.frombuffer(raw, dtype=np.uint8).reshape(-1, itemsize).T.tobytes()
+
+
+def _unshuffle(shuffled: bytes, itemsize: int) -> bytes:
+    return np.frombuffer(shuffled, dtype=np.uint8).reshape(itemsize, -1).T.tobytes()
+
+
+def encode(latents: torch.Tensor, family: int = 0, dtype: int = None, compression: int = COMPRESSION_NONE, level: int = 1) -> bytes:
+    """Packs a latent tensor into a container. Keeps float16 latents as float16 unless a dtype is given, everything else is stored as float32."""
+    if latents.dim() < 1 or latents.dim() > 4:
+        raise ValueError(f"Latents must have between 1 and 4 dimensions, got {latents.dim()}")
+
+    if dtype is None:
+        dtype = DTYPE_FLOAT16 if latents.dtype == torch.float16 else DTYPE_FLOAT32
+
+    values = latents.detach().to(device="cpu", dtype=torch.float16 if dtype == DTYPE_FLOAT16 else torch.float32).contiguous().numpy()
+    raw = values.tobytes()
+    payload = zlib.compress(_shuffle(raw, values.itemsize), level) if compression == COMPRESSION_ZLIB else raw
+
+    shape = list(latents.shape) + [1] * (4 - latents.dim())
+    header = struct.pack(HEADER_FORMAT, MAGIC, VERSION, dtype, compression, LAYOUT_NCHW, int(family), latents.dim(), 0, *shape, len(raw), len(payload))
+    return header + payload
+
+
+def decode_header(data) -> dict:
+    if not is_latent_container(data):
+        raise ValueError("Data is not a latent container")
+
+    magic, version, dtype, compression, layout, family, ndim, _, s0, s1, s2, s3, raw_size, payload_size = struct.unpack_from(HEADER_FORMAT, data)
+    if version > VERSION:
+        raise ValueError(f"Latent container version {version} is newer than the supported version {VERSION}")
+
+    return {
+        "version": version,
+        "dtype": dtype,
+        "compression": compression,
+        "layout": layout,
+        "family": family,
+        "shape": [s0, s1, s2, s3][:ndim],
+        "raw_size": raw_size,
+        "payload_size": payload_size,
+    }
+
+
+def decode(data, device="cpu", torch_dtype=None) -> torch.Tensor:
+    """Unpacks a latent container into a tensor. The tensor keeps the stored precision unless a torch dtype is given."""
+    header = decode_header(data)
+    payload = memoryview(data)[HEADER_SIZE:HEADER_SIZE + header["payload_size"]]
+    np_dtype = _NUMPY_DTYPES[header["dtype"]]
+
+    if header["compression"] == COMPRESSION_ZLIB:
+        raw = _unshuffle(zlib.decompress(payload), np.dtype(np_dtype).itemsize)
+    else:
+        raw = bytes(payload)
+
+    if len(raw) != header["raw_size"]:
+        raise ValueError(f"Latent container holds {len(raw)} bytes but the header expects {header['raw_size']}")
+
+    tensor = torch.from_numpy(np.frombuffer(raw, dtype=np_dtype).reshape(header["shape"]).copy())
+    return tensor.to(device=device, dtype=torch_dtype) if torch_dtype else tensor.to(device=device)
+
+
+def load_latents(data, device="cpu", torch_dtype=None) -> torch.Tensor:
+    """Loads a latent container, falling back to tensor-only unpickling for latents saved by older versions with torch.save."""
+    if is_latent_container(data):
+        return decode(data, device, torch_dtype)
+
+    tensor = torch.load(io.BytesIO(bytes(data)), map_location=device, weights_only=True)
+    return tensor.to(dtype=torch_dtype) if torch_dtype else tensor
+
+
+def benchmark(latents: torch.Tensor = None, iterations: int = 20):
+    """Compares the container against the torch.save path for size and round trip time. Returns a list of result rows and prints them."""
+    if latents is None:
+        latents = torch.randn((1, 4, 128, 128), dtype=torch.float16)
+
+    def run(name, save_fn, load_fn):
+        data = save_fn()
+        start = time.perf_counter()
+        for _ in range(iterations):
+            data = save_fn()
+        save_ms = (time.perf_counter() - start) * 1000.0 / iterations
+
+        start = time.perf_counter()
+        for _ in range(iterations):
+            load_fn(data)
+        load_ms = (time.perf_counter() - start) * 1000.0 / iterations
+        return {"name": name, "bytes": len(data), "save_ms": save_ms, "load_ms": load_ms}
+
+    def torch_save():
+        buffer = io.BytesIO()
+        torch.save(latents, buffer)
+        return buffer.getvalue()
+
+    rows = [
+        run("torch.save", torch_save, lambda data: torch.load(io.BytesIO(data), weights_only=True)),
+        run("container fp32", lambda: encode(latents, dtype=DTYPE_FLOAT32), decode),
+        run("container fp16", lambda: encode(latents, dtype=DTYPE_FLOAT16), decode),
+        run("container fp16 zlib", lambda: encode(latents, dtype=DTYPE_FLOAT16, compression=COMPRESSION_ZLIB), decode),
+    ]
+
+    print(f"Latent serialisation benchmark for shape {list(latents.shape)} {latents.dtype}, {iterations} iterations")
+    for row in rows:
+        print(f"  {row['name']:<22} {row['bytes']:>10} bytes  save {row['save_ms']:8.3f} ms  load {row['load_ms']:8.3f} ms")
+    return rows
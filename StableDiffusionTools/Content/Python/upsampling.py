@@ -19,9 +19,12 @@ except ImportError as e:
         "pip install realesrgan"
     )
 
+# The x2 weights aren't part of the nateraw reupload so they come from the official release
+REALESRGAN_X2_URL = "https://github.com/xinntao/Real-ESRGAN/releases/download/v0.2.1/RealESRGAN_x2plus.pth"
+
 
 class RealESRGANModel(nn.Module):
-    def __init__(self, model_path, tile=0, tile_pad=10, pre_pad=0, fp32=False):
+    def __init__(self, model_path, tile=0, tile_pad=10, pre_pad=0, fp32=False, scale=4):
         super().__init__()
         try:
             from basicsr.archs.rrdbnet_arch import RRDBNet
@@ -32,18 +35,19 @@ class RealESRGANModel(nn.Module):
                 "pip install realesrgan"
             )
 
-        model = RRDBNet(num_in_ch=3, num_out_ch=3, num_feat=64, num_block=23, num_grow_ch=32, scale=4)
+        self.scale = scale
+        model = RRDBNet(num_in_ch=3, num_out_ch=3, num_feat=64, num_block=23, num_grow_ch=32, scale=scale)
         self.upsampler = RealESRGANer(
-            scale=4, model_path=model_path, model=model, tile=tile, tile_pad=tile_pad, pre_pad=pre_pad, half=not fp32
+            scale=scale, model_path=model_path, model=model, tile=tile, tile_pad=tile_pad, pre_pad=pre_pad, half=not fp32
         )
 
-    def forward(self, image, outscale=4, convert_to_pil=True):
+    def forward(self, image, outscale=None, convert_to_pil=True):
         """Upsample an image array or path.
 
         Args:
             image (Union[np.ndarray, str]): Either a np array or an image path. np array is assumed to be in RGB format,
                 and we convert it to BGR.
-            outscale (int, optional): Amount to upscale the image. Defaults to 4.
+            outscale (int, optional): Amount to upscale the image. Defaults to the model's scale.
             convert_to_pil (bool, optional): If True, return PIL image. Otherwise, return numpy array (BGR). Defaults to True.
 
         Returns:
@@ -51,14 +55,14 @@ class RealESRGANModel(nn.Module):
         """
         img = numpy.array(image)
         img = img[:, :, ::-1]
-        image, _ = self.upsampler.enhance(img, outscale=outscale)
+        image, _ = self.upsampler.enhance(img, outscale=outscale or self.scale)
         if convert_to_pil:
             image = Image.fromarray(image[:, :, ::-1])
 
         return image
 
     @classmethod
-    def from_pretrained(cls, model_name_or_path="nateraw/real-esrgan", cache_dir: Optional[str] = None):
+    def from_pretrained(cls, model_name_or_path="nateraw/real-esrgan", cache_dir: Optional[str] = None, scale=4):
         """Initialize a pretrained Real-ESRGAN upsampler.
 
         Example:
@@ -70,6 +74,7 @@ class RealESRGANModel(nn.Module):
 
         Args:
             model_name_or_path (str, optional): The Hugging Face repo ID or path to local model. Defaults to 'nateraw/real-esrgan'.
+            scale (int, optional): Upscale factor of the model, 2 or 4. Defaults to 4.
 
         Returns:
             stable_diffusion_videos.PipelineRealESRGAN: An instance of `PipelineRealESRGAN` instantiated from pretrained model.
@@ -78,9 +83,12 @@ class RealESRGANModel(nn.Module):
         # https://github.com/xinntao/Real-ESRGAN
         if Path(model_name_or_path).exists():
             file = model_name_or_path
+        elif scale == 2:
+            from basicsr.utils.download_util import load_file_from_url
+            file = load_file_from_url(REALESRGAN_X2_URL, model_dir=cache_dir)
         else:
             file = hf_hub_download(model_name_or_path, "RealESRGAN_x4plus.pth", cache_dir=cache_dir)
-        return cls(file)
+        return cls(file, scale=scale)
 
     def upsample_imagefolder(self, in_dir, out_dir, suffix="out", outfile_ext=".png"):
         in_dir, out_dir = Path(in_dir), Path(out_dir)
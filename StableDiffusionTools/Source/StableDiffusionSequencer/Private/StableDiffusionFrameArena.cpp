@@ -0,0 +1,172 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "StableDiffusionFrameArena.h"
+
+void FStableDiffusionFrameArena::Reserve(FIntPoint FrameSize, int32 NumOutputBuffers)
+{
+	const int64 NumPixels = (int64)FrameSize.X * FrameSize.Y;
+	if (NumPixels <= 0)
+		return;
+
+	FScopeLock Lock(&ArenaLock);
+	for (int32 BufferIdx = FreeOutputBuffers.Num(); BufferIdx < NumOutputBuffers; ++BufferIdx) {
+		TArray64<FFloat16Color>& Buffer = FreeOutputBuffers.AddDefaulted_GetRef();
+		Buffer.Reserve(NumPixels);
+		TrackAllocation(NumPixels * sizeof(FFloat16Color));
+	}
+}
+
+TArray64<FFloat16Color> FStableDiffusionFrameArena::TakeOutputBuffer(int64 NumPixels)
+{
+	FScopeLock Lock(&ArenaLock);
+
+	TArray64<FFloat16Color> Buffer;
+	const int32 FreeIdx = FreeOutputBuffers.IndexOfByPredicate([NumPixels](const TArray64<FFloat16Color>& Free) { return Free.Max() >= NumPixels; });
+	if (FreeIdx != INDEX_NONE) {
+		Buffer = MoveTemp(FreeOutputBuffers[FreeIdx]);
+		FreeOutputBuffers.RemoveAtSwap(FreeIdx, 1, false);
+		Stats.NumReuses++;
+	}
+	else {
+		// Nothing big enough is free so grow the largest free buffer rather than keeping a too small one around
+		if (FreeOutputBuffers.Num()) {
+			int32 LargestIdx = 0;
+			for (int32 BufferIdx = 1; BufferIdx < FreeOutputBuffers.Num(); ++BufferIdx) {
+				if (FreeOutputBuffers[BufferIdx].Max() > FreeOutputBuffers[LargestIdx].Max()) {
+					LargestIdx = BufferIdx;
+				}
+			}
+			Buffer = MoveTemp(FreeOutputBuffers[LargestIdx]);
+			FreeOutputBuffers.RemoveAtSwap(LargestIdx, 1, false);
+			Stats.CurrentBytes -= Buffer.Max() * sizeof(FFloat16Color);
+			Buffer.Empty(NumPixels);
+		}
+		else {
+			Buffer.Reserve(NumPixels);
+		}
+		TrackAllocation(NumPixels * sizeof(FFloat16Color));
+	}
+
+	Buffer.SetNumUninitialized(NumPixels, false);
+	return Buffer;
+}
+
+void FStableDiffusionFrameArena::ReturnOutputBuffer(TArray64<FFloat16Color>&& Buffer)
+{
+	if (!Buffer.Max())
+		return;
+
+	FScopeLock Lock(&ArenaLock);
+	FreeOutputBuffers.Add(MoveTemp(Buffer));
+}
+
+void FStableDiffusionFrameArena::NoteHandoff(int64 NumBytes)
+{
+	FScopeLock Lock(&ArenaLock);
+	Stats.NumHandoffs++;
+	Stats.CurrentBytes -= NumBytes;
+}
+
+void FStableDiffusionFrameArena::LendLayerBuffers(int32 StageIndex, int32 LayerIndex, FLayerProcessorContext& Layer)
+{
+	FScopeLock Lock(&ArenaLock);
+
+	FLayerSlot& Slot = LayerSlots.FindOrAdd(FIntPoint(StageIndex, LayerIndex));
+	Layer.SharedLayerPixels = MoveTemp(Slot.LayerPixels);
+	Layer.HalfFloatLayerPixels = MoveTemp(Slot.HalfFloatLayerPixels);
+	Layer.FloatLayerPixels = MoveTemp(Slot.FloatLayerPixels);
+	Slot.LentData = GetLayerData(Layer);
+	Slot.LentBytes = GetLayerBytes(Layer);
+}
+
+void FStableDiffusionFrameArena::ReclaimLayerBuffers(int32 StageIndex, int32 LayerIndex, FLayerProcessorContext& Layer)
+{
+	FScopeLock Lock(&ArenaLock);
+
+	FLayerSlot& Slot = LayerSlots.FindOrAdd(FIntPoint(StageIndex, LayerIndex));
+	const void* LayerData = GetLayerData(Layer);
+	if (LayerData && LayerData != Slot.LentData) {
+		// The readback allocated its own buffer so the slot now owns that one instead
+		const int64 LayerBytes = GetLayerBytes(Layer);
+		Stats.CurrentBytes -= Slot.LentBytes;
+		TrackAllocation(LayerBytes);
+		if (Slot.LentData) {
+			Stats.NumLayerReallocations++;
+		}
+	}
+	else if (LayerData) {
+		Stats.NumReuses++;
+	}
+
+	Slot.LayerPixels = MoveTemp(Layer.SharedLayerPixels);
+	Slot.HalfFloatLayerPixels = MoveTemp(Layer.HalfFloatLayerPixels);
+	Slot.FloatLayerPixels = MoveTemp(Layer.FloatLayerPixels);
+	Slot.LentData = nullptr;
+	Slot.LentBytes = 0;
+}
+
+void FStableDiffusionFrameArena::EndFrame()
+{
+	FScopeLock Lock(&ArenaLock);
+	if (++Stats.NumFrames == 1) {
+		Stats.FirstFrameAllocations = Stats.NumAllocations;
+		Stats.FirstFrameHandoffs = Stats.NumHandoffs;
+	}
+}
+
+void FStableDiffusionFrameArena::Reset()
+{
+	FScopeLock Lock(&ArenaLock);
+	FreeOutputBuffers.Empty();
+	LayerSlots.Empty();
+	Stats = FStableDiffusionFrameArenaStats();
+}
+
+FStableDiffusionFrameArenaStats FStableDiffusionFrameArena::GetStats() const
+{
+	FScopeLock Lock(&ArenaLock);
+	return Stats;
+}
+
+void FStableDiffusionFrameArena::LogStats(const TCHAR* Context) const
+{
+	const FStableDiffusionFrameArenaStats Current = GetStats();
+
+	// Every handed off buffer has to be replaced by an allocation so those don't count against the steady state
+	const int32 SteadyFrames = FMath::Max(Current.NumFrames - 1, 0);
+	const int32 SteadyAllocations = (Current.NumAllocations - Current.FirstFrameAllocations) - (Current.NumHandoffs - Current.FirstFrameHandoffs);
+
+	UE_LOG(LogTemp, Log, TEXT("%s frame arena: %d frames, %d allocations (%.1f MB), %d reuses, %d handoffs, %d layer reallocations, peak %.1f MB, %d allocations over %d steady state frames not caused by handoffs"),
+		Context,
+		Current.NumFrames,
+		Current.NumAllocations,
+		Current.AllocatedBytes / (1024.0 * 1024.0),
+		Current.NumReuses,
+		Current.NumHandoffs,
+		Current.NumLayerReallocations,
+		Current.PeakBytes / (1024.0 * 1024.0),
+		FMath::Max(SteadyAllocations, 0),
+		SteadyFrames);
+}
+
+const void* FStableDiffusionFrameArena::GetLayerData(const FLayerProcessorContext& Layer)
+{
+	if (Layer.FloatLayerPixels.Num())
+		return Layer.FloatLayerPixels.GetData();
+	if (Layer.HalfFloatLayerPixels.Num())
+		return Layer.HalfFloatLayerPixels.GetData();
+	return Layer.SharedLayerPixels.Num() ? Layer.SharedLayerPixels.GetData() : nullptr;
+}
+
+int64 FStableDiffusionFrameArena::GetLayerBytes(const FLayerProcessorContext& Layer)
+{
+	return Layer.SharedLayerPixels.NumBytes() + Layer.HalfFloatLayerPixels.NumBytes() + Layer.FloatLayerPixels.NumBytes();
+}
+
+void FStableDiffusionFrameArena::TrackAllocation(int64 NumBytes)
+{
+	Stats.NumAllocations++;
+	Stats.AllocatedBytes += NumBytes;
+	Stats.CurrentBytes += NumBytes;
+	Stats.PeakBytes = FMath::Max(Stats.PeakBytes, Stats.CurrentBytes);
+}
@@ -7,9 +7,9 @@
 #include "MoviePipelineQueue.h"
 #include "MoviePipeline.h"
 #include "Async/Async.h"
-#include "ImageUtils.h"
 #include "EngineModule.h"
 #include "IImageWrapperModule.h"
+#include "IImageWrapper.h"
 #include "LevelSequence.h"
 #include "Misc/FileHelper.h"
 #include "MoviePipelineOutputSetting.h"
@@ -21,9 +21,68 @@
 #include "ImageWriteTask.h"
 #include "ImageWriteQueue.h"
 #include "StableDiffusionBlueprintLibrary.h"
+#include "TiledUpsampler.h"
 #include "StableDiffusionToolsModule.h"
 #include "Runtime/Launch/Resources/Version.h"
+#include "MovieRenderPipelineDataTypes.h"
+#include "MoviePipelineOutputBuilder.h"
 
+namespace
+{
+	// Frames made of several tiles or samples have to be accumulated by MRQ from the render target. Overscanned frames also need
+	// the accumulator to crop them back to the output resolution.
+	bool CanSubmitFrameDirectly(const FMoviePipelineRenderPassMetrics& SampleState)
+	{
+		return SampleState.TileCounts == FIntPoint(1, 1) && SampleState.TemporalSampleCount <= 1 && SampleState.SpatialSampleCount <= 1 &&
+			SampleState.OverscanPercentage <= 0.0f && SampleState.OverlappedPad == FIntPoint::ZeroValue;
+	}
+
+	struct FDecodedExportFrame
+	{
+		FString SourceFile;
+		FIntPoint Size = FIntPoint::ZeroValue;
+		TArray<FFloat16Color> Pixels;
+	};
+
+	// Loads a rendered frame from disk into linear half float pixels. Safe to run on worker threads.
+	FDecodedExportFrame DecodeExportFrame(IImageWrapperModule& ImageWrapperModule, const FString& File)
+	{
+		FDecodedExportFrame Frame;
+		Frame.SourceFile = File;
+
+		TArray64<uint8> CompressedData;
+		if (!FFileHelper::LoadFileToArray(CompressedData, *File)) {
+			return Frame;
+		}
+
+		const EImageFormat Format = ImageWrapperModule.DetectImageFormat(CompressedData.GetData(), CompressedData.Num());
+		TSharedPtr<IImageWrapper> ImageWrapper = (Format != EImageFormat::Invalid) ? ImageWrapperModule.CreateImageWrapper(Format) : nullptr;
+		if (!ImageWrapper.IsValid() || !ImageWrapper->SetCompressed(CompressedData.GetData(), CompressedData.Num())) {
+			return Frame;
+		}
+
+		const FIntPoint Size((int32)ImageWrapper->GetWidth(), (int32)ImageWrapper->GetHeight());
+		const int32 NumPixels = Size.X * Size.Y;
+		TArray64<uint8> RawData;
+		if (ImageWrapper->GetRaw(ERGBFormat::RGBAF, 16, RawData) && RawData.Num() == (int64)NumPixels * sizeof(FFloat16Color)) {
+			// EXR frames are already linear half floats
+			Frame.Pixels.SetNumUninitialized(NumPixels);
+			FMemory::Memcpy(Frame.Pixels.GetData(), RawData.GetData(), RawData.Num());
+		}
+		else if (ImageWrapper->GetRaw(ERGBFormat::BGRA, 8, RawData) && RawData.Num() == (int64)NumPixels * sizeof(FColor)) {
+			const FColor* Colors = reinterpret_cast<const FColor*>(RawData.GetData());
+			Frame.Pixels.SetNumUninitialized(NumPixels);
+			for (int32 PixelIdx = 0; PixelIdx < NumPixels; ++PixelIdx) {
+				Frame.Pixels[PixelIdx] = FFloat16Color(FLinearColor(Colors[PixelIdx]));
+			}
+		}
+
+		if (Frame.Pixels.Num()) {
+			Frame.Size = Size;
+		}
+		return Frame;
+	}
+}
 
 
 UStableDiffusionMoviePipeline::UStableDiffusionMoviePipeline() : UMoviePipelineDeferredPassBase()
@@ -87,6 +146,12 @@ void UStableDiffusionMoviePipeline::SetupForPipelineImpl(UMoviePipeline* InPipel
 			LayerProcessorTracks.Add(LayerProcessorTrack);
 		}
 	}
+
+	// Size the frame buffers up front so the first frame doesn't have to
+	FrameArena = MakeShared<FStableDiffusionFrameArena, ESPMode::ThreadSafe>();
+	if (UMoviePipelineOutputSetting* OutputSettings = InPipeline->GetPipelineMasterConfig()->FindSetting<UMoviePipelineOutputSetting>()) {
+		FrameArena->Reserve(OutputSettings->OutputResolution);
+	}
 }
 
 void UStableDiffusionMoviePipeline::SetupImpl(const MoviePipeline::FMoviePipelineRenderPassInitSettings& InPassInitSettings)
@@ -97,6 +162,11 @@ void UStableDiffusionMoviePipeline::SetupImpl(const MoviePipeline::FMoviePipelin
 void UStableDiffusionMoviePipeline::TeardownForPipelineImpl(UMoviePipeline* InPipeline)
 {
 	PromptTracks.Reset();
+
+	if (FrameArena) {
+		FrameArena->LogStats(TEXT("Stable Diffusion movie pipeline"));
+		FrameArena.Reset();
+	}
 }
 
 void UStableDiffusionMoviePipeline::GatherOutputPassesImpl(TArray<FMoviePipelinePassIdentifier>& ExpectedRenderPasses) {
@@ -144,9 +214,9 @@ void UStableDiffusionMoviePipeline::RenderSample_GameThreadImpl(const FMoviePipe
 		auto SDSubsystem = GEditor->GetEditorSubsystem<UStableDiffusionSubsystem>();
 		if (SDSubsystem) {
 			// Get input image from rendered data
-			// TODO: Add float colour support to the generated images
 			FStableDiffusionInput Input;
 			Input.PreviewIterationRate = -1;
+			Input.bFloatOutput = true;
 			Input.DebugPythonImages = DebugPythonImages;
 			Input.Options.InSizeX = RenderTarget->GetSizeXY().X;
 			Input.Options.InSizeY = RenderTarget->GetSizeXY().Y;
@@ -201,7 +271,7 @@ void UStableDiffusionMoviePipeline::RenderSample_GameThreadImpl(const FMoviePipe
 			}
 
 			// Create output objects
-			UTexture2D* OutTexture = UTexture2D::CreateTransient(Input.Options.OutSizeX, Input.Options.OutSizeY);
+			UTexture2D* OutTexture = SDSubsystem->TexturePool->Acquire(FIntPoint(Input.Options.OutSizeX, Input.Options.OutSizeY));
 			FStableDiffusionImageResult LastStageResult;
 
 			// Generate new stable diffusion frame from pipeline stages
@@ -212,9 +282,8 @@ void UStableDiffusionMoviePipeline::RenderSample_GameThreadImpl(const FMoviePipe
 				if (!CurrentStage)
 					continue;
 
-				// Init model at the start of each stage.
-				// TODO: Cache last model and only re-init if model options have changed
-				SDSubsystem->InitModel(CurrentStage->Model->Options, CurrentStage->Pipeline, CurrentStage->LORAAsset, CurrentStage->TextualInversionAsset, CurrentStage->Layers, false, AllowNSFW, PaddingMode);
+				// Init model at the start of each stage. Stages sharing a base model only swap their adapters and scheduler.
+				SDSubsystem->InitModel(CurrentStage->Model->Options, CurrentStage->Pipeline, CurrentStage->LORAAsset, CurrentStage->TextualInversionAsset, CurrentStage->Layers, false, AllowNSFW, PaddingMode, CurrentStage->Scheduler);
 				if (SDSubsystem->GetModelStatus().ModelStatus != EModelStatus::Loaded) {
 					UE_LOG(LogTemp, Error, TEXT("Failed to load model. Check the output log for more information"));
 					continue;
@@ -239,7 +308,7 @@ void UStableDiffusionMoviePipeline::RenderSample_GameThreadImpl(const FMoviePipe
 					TargetLayer.Role = Layer.Role;
 					TargetLayer.Processor = Layer.Processor;
 					TargetLayer.ProcessorOptions = (Layer.ProcessorOptions) ? DuplicateObject(Layer.ProcessorOptions, GetPipeline()) : Layer.Processor->AllocateLayerOptions();
-					TargetLayer.LatentData = (TargetLayer.OutputType == EImageType::Latent && LastStageResult.Completed) ? LastStageResult.OutLatent : TArray<uint8>();
+					TargetLayer.SharedLatentData = (TargetLayer.OutputType == EImageType::Latent && LastStageResult.Completed) ? LastStageResult.SharedOutLatent : FSharedByteBuffer();
 					CurrentStageLayers.Add(TargetLayer);
 				}
 
@@ -248,8 +317,10 @@ void UStableDiffusionMoviePipeline::RenderSample_GameThreadImpl(const FMoviePipe
 				StageInput.InputLayers = CurrentStageLayers;
 
 				bool FirstView = true;
+				TArray<int32, TInlineAllocator<8>> CapturedLayerIndices;
 				// Start a new capture pass for each layer
-				for (auto& Layer : StageInput.InputLayers) {
+				for (int32 LayerIdx = 0; LayerIdx < StageInput.InputLayers.Num(); ++LayerIdx) {
+					FLayerProcessorContext& Layer = StageInput.InputLayers[LayerIdx];
 					if (Layer.Processor) {
 						// Prepare rendering the layer
 						TSharedPtr<FSceneViewFamilyContext> ViewFamily;
@@ -272,7 +343,9 @@ void UStableDiffusionMoviePipeline::RenderSample_GameThreadImpl(const FMoviePipe
 						GetRendererModule().BeginRenderingViewFamily(&Canvas, ViewFamily.Get());
 						FlushRenderingCommands();
 
-						if (!RenderTarget->ReadPixels(Layer.LayerPixels, FReadSurfaceDataFlags())) {
+						// Read into the buffers this layer used last frame
+						FrameArena->LendLayerBuffers((int32)StageIdx, LayerIdx, Layer);
+						if (!ULayerProcessorBase::ReadRenderTargetPixels(RenderTarget, Layer.Processor->GetOutputBitDepth(), Layer)) {
 							UE_LOG(LogTemp, Error, TEXT("Failed to read pixels from render target"));
 						}
 
@@ -281,6 +354,7 @@ void UStableDiffusionMoviePipeline::RenderSample_GameThreadImpl(const FMoviePipe
 						Layer.Processor->EndCaptureLayer(GetPipeline()->GetWorld());
 
 						StageInput.ProcessedLayers.Add(MoveTemp(Layer));
+						CapturedLayerIndices.Add(LayerIdx);
 					}
 				} 
 
@@ -289,48 +363,93 @@ void UStableDiffusionMoviePipeline::RenderSample_GameThreadImpl(const FMoviePipe
 					LastStageResult = SDSubsystem->GeneratorBridge->GenerateImageFromStartImage(StageInput, OutTexture, nullptr);
 				}
 
+				// The result keeps a copy of its input which still shares the lent buffers. Drop those references first or the next
+				// readback would have to copy the buffers instead of writing into them.
+				for (FLayerProcessorContext& ResultLayer : LastStageResult.Input.ProcessedLayers) {
+					ResultLayer.ResetPixels();
+				}
+
+				// Give the layer buffers back for the next frame
+				for (int32 CapturedIdx = 0; CapturedIdx < CapturedLayerIndices.Num(); ++CapturedIdx) {
+					FrameArena->ReclaimLayerBuffers((int32)StageIdx, CapturedLayerIndices[CapturedIdx], StageInput.ProcessedLayers[CapturedIdx]);
+				}
 
 			} // End of stage pipeline processing
 
-			// Convert generated image to 16 bit for the exr pipeline
+			// Single sample frames don't need accumulating so they can skip the render target and go straight to the output merger
+			const bool bSubmitDirectly = CanSubmitFrameDirectly(InSampleState);
+			FImagePixelPayloadPtr FramePayload = nullptr;
+			if (bSubmitDirectly) {
+				TSharedRef<FImagePixelDataPayload, ESPMode::ThreadSafe> PassPayload = MakeShared<FImagePixelDataPayload, ESPMode::ThreadSafe>();
+				PassPayload->PassIdentifier = LayerPassIdentifier;
+				PassPayload->SampleState = InSampleState;
+				PassPayload->SortingOrder = GetOutputFileSortingOrder() + 1;
+				FramePayload = PassPayload;
+			}
+
+			// Convert generated image to 16 bit for the exr pipeline. The frame is written straight into a buffer from the arena.
 			// TODO: Check bit depth of movie pipeline and convert to that instead
-			TUniquePtr<FImagePixelData> SDImageDataBuffer16bit;
-			if(IsValid(LastStageResult.OutTexture)){
+			TUniquePtr<TImagePixelData<FFloat16Color>> SDImageDataBuffer16bit;
+			if (UStableDiffusionBlueprintLibrary::HasFloatPixels(LastStageResult)) {
+				// Float results are already half floats so they skip the output texture and the quantisation pass
+				TArray64<FFloat16Color> HalfFloatPixels = FrameArena->TakeOutputBuffer(LastStageResult.OutHalfFloatPixels.Num());
+				FMemory::Memcpy(HalfFloatPixels.GetData(), LastStageResult.OutHalfFloatPixels.GetData(), LastStageResult.OutHalfFloatPixels.NumBytes());
+				SDImageDataBuffer16bit = MakeUnique<TImagePixelData<FFloat16Color>>(FIntPoint(LastStageResult.OutWidth, LastStageResult.OutHeight), MoveTemp(HalfFloatPixels), FramePayload);
+			}
+			else if(IsValid(LastStageResult.OutTexture)){
 				UStableDiffusionBlueprintLibrary::UpdateTextureSync(OutTexture);
-				TArray<FColor> Pixels = UStableDiffusionBlueprintLibrary::ReadPixels(OutTexture);
+				FScopedTexturePixels Pixels(OutTexture);
 
-				// Convert 8bit BGRA FColors returned from SD to 16bit BGRA
-				TUniquePtr<TImagePixelData<FColor>> SDImageDataBuffer8bit;
-				SDImageDataBuffer8bit = MakeUnique<TImagePixelData<FColor>>(FIntPoint(LastStageResult.OutWidth, LastStageResult.OutHeight), TArray64<FColor>(MoveTemp(Pixels)));
-				SDImageDataBuffer16bit = UE::MoviePipeline::QuantizeImagePixelDataToBitDepth(SDImageDataBuffer8bit.Get(), 16);
+				// Convert 8bit BGRA FColors returned from SD to 16bit linear colours without an intermediate 8 bit copy
+				TArray64<FFloat16Color> HalfFloatPixels = FrameArena->TakeOutputBuffer(Pixels.Num());
+				for (int32 PixelIdx = 0; PixelIdx < Pixels.Num(); ++PixelIdx) {
+					HalfFloatPixels[PixelIdx] = FFloat16Color(FLinearColor(Pixels[PixelIdx]));
+				}
+				SDImageDataBuffer16bit = MakeUnique<TImagePixelData<FFloat16Color>>(FIntPoint(LastStageResult.OutWidth, LastStageResult.OutHeight), MoveTemp(HalfFloatPixels), FramePayload);
 			}
 			else {
 				UE_LOG(LogTemp, Error, TEXT("Stable diffusion generator failed to return any pixel data on frame %d. Please add a model asset to the Options track or initialize the StableDiffusionSubsystem model."), EffectiveFrame.Value);
 
 				// Insert blank frame
-				TArray<FColor> EmptyPixels;
-				EmptyPixels.InsertUninitialized(0, Input.Options.OutSizeX * Input.Options.OutSizeY);
-				TUniquePtr<TImagePixelData<FColor>> SDImageDataBuffer8bit = MakeUnique<TImagePixelData<FColor>>(FIntPoint(Input.Options.OutSizeX, Input.Options.OutSizeY), TArray64<FColor>(MoveTemp(EmptyPixels)));
-				SDImageDataBuffer16bit = UE::MoviePipeline::QuantizeImagePixelDataToBitDepth(SDImageDataBuffer8bit.Get(), 16);
+				TArray64<FFloat16Color> EmptyPixels = FrameArena->TakeOutputBuffer((int64)Input.Options.OutSizeX * Input.Options.OutSizeY);
+				FMemory::Memzero(EmptyPixels.GetData(), EmptyPixels.Num() * sizeof(FFloat16Color));
+				SDImageDataBuffer16bit = MakeUnique<TImagePixelData<FFloat16Color>>(FIntPoint(Input.Options.OutSizeX, Input.Options.OutSizeY), MoveTemp(EmptyPixels), FramePayload);
 			}
 
-			// Render the result to the render target
-			ENQUEUE_RENDER_COMMAND(UpdateMoviePipelineRenderTarget)([this, Buffer=MoveTemp(SDImageDataBuffer16bit), RenderTarget](FRHICommandListImmediate& RHICmdList) {
-				int64 OutSize;
-				const void* OutRawData = nullptr;
-				Buffer->GetRawData(OutRawData, OutSize);
-				RHICmdList.UpdateTexture2D(
-					RenderTarget->GetRenderTargetTexture(),
-					0,
-					FUpdateTextureRegion2D(0, 0, 0, 0, RenderTarget->GetSizeXY().X, RenderTarget->GetSizeXY().Y),
-					RenderTarget->GetSizeXY().X * sizeof(FFloat16Color),
-					(uint8*)OutRawData
-				);
-				RHICmdList.ImmediateFlush(EImmediateFlushType::FlushRHIThread);
-			});
-
-			// Readback + Accumulate
-			PostRendererSubmission(InSampleState, LayerPassIdentifier, GetOutputFileSortingOrder() + 1, Canvas);
+			// Frame pixels have been copied out so the output texture can be reused by the next frame
+			SDSubsystem->TexturePool->Release(OutTexture);
+			FrameArena->EndFrame();
+
+			if (bSubmitDirectly) {
+				if (!InSampleState.bDiscardResult) {
+					// The output merger owns the frame from here on so the arena has to replace this buffer
+					FrameArena->NoteHandoff(SDImageDataBuffer16bit->Pixels.Max() * sizeof(FFloat16Color));
+					GetPipeline()->OutputBuilder->OnCompleteRenderPassDataAvailable_AnyThread(MoveTemp(SDImageDataBuffer16bit));
+				}
+				else {
+					FrameArena->ReturnOutputBuffer(MoveTemp(SDImageDataBuffer16bit->Pixels));
+				}
+			}
+			else {
+				// Render the result to the render target and hand the buffer back once it has been uploaded
+				ENQUEUE_RENDER_COMMAND(UpdateMoviePipelineRenderTarget)([Arena=FrameArena, Buffer=MoveTemp(SDImageDataBuffer16bit), RenderTarget](FRHICommandListImmediate& RHICmdList) {
+					int64 OutSize;
+					const void* OutRawData = nullptr;
+					Buffer->GetRawData(OutRawData, OutSize);
+					RHICmdList.UpdateTexture2D(
+						RenderTarget->GetRenderTargetTexture(),
+						0,
+						FUpdateTextureRegion2D(0, 0, 0, 0, RenderTarget->GetSizeXY().X, RenderTarget->GetSizeXY().Y),
+						RenderTarget->GetSizeXY().X * sizeof(FFloat16Color),
+						(uint8*)OutRawData
+					);
+					RHICmdList.ImmediateFlush(EImmediateFlushType::FlushRHIThread);
+					Arena->ReturnOutputBuffer(MoveTemp(Buffer->Pixels));
+				});
+
+				// Readback + Accumulate
+				PostRendererSubmission(InSampleState, LayerPassIdentifier, GetOutputFileSortingOrder() + 1, Canvas);
+			}
 		}
 #endif
 	}
@@ -373,86 +492,132 @@ void UStableDiffusionMoviePipeline::BeginExportImpl(){
 	// Free up loaded model so we have enough VRAM to upsample
 	SDSubsystem->ReleaseModel();
 
-	auto OutputData = GetPipeline()->GetOutputDataParams();
-	for (auto shot : OutputData.ShotData) {
-		for (auto renderpass : shot.RenderPassData) {
-			// We want to persist the upsampler model so we don't have to keep reloading it every frame
-			SDSubsystem->GeneratorBridge->StartUpsample();
+	// Export can run after the render passes have been torn down
+	if (!FrameArena) {
+		FrameArena = MakeShared<FStableDiffusionFrameArena, ESPMode::ThreadSafe>();
+	}
 
-			for (auto file : renderpass.Value.FilePaths) {
-				// Reload image from disk
-				UTexture2D* Image = FImageUtils::ImportFileAsTexture2D(file);
-				if (!IsValid(Image)) {
-					continue;
-				}
-				UStableDiffusionBlueprintLibrary::UpdateTextureSync(Image);
+	// Image wrappers are created on worker threads so make sure the module is loaded on the game thread first
+	IImageWrapperModule* ImageWrapperModule = &FModuleManager::LoadModuleChecked<IImageWrapperModule>(FName("ImageWrapper"));
+
+	// Frames flow through three stages that overlap: decoding on worker threads, upsampling on the game thread as the bridge
+	// runs python, and encoding on the image write queue. Both queues are bounded so memory stays flat on long sequences.
+	const int32 MaxQueuedFrames = FMath::Max(ExportQueueDepth, 1);
+	const double ExportStartTime = FPlatformTime::Seconds();
+	double DecodeWaitTime = 0.0;
+	double UpsampleTime = 0.0;
+	double EncodeWaitTime = 0.0;
+	int32 NumExportedFrames = 0;
+
+	TArray<FString> SourceFiles;
+	for (const auto& Shot : GetPipeline()->GetOutputDataParams().ShotData) {
+		for (const auto& RenderPass : Shot.RenderPassData) {
+			SourceFiles.Append(RenderPass.Value.FilePaths);
+		}
+	}
 
-				// Read half-float pixels from source texture
-				FFloat16Color* MipData = reinterpret_cast<FFloat16Color*>(Image->GetPlatformData()->Mips[0].BulkData.Lock(LOCK_READ_ONLY));
-				TArrayView64<FFloat16Color> SourceColors(MipData, Image->GetSizeX() * Image->GetSizeY());
+	// Large frames are upsampled in tiles so the upsampler never sees the whole frame at once
+	const FUpsampleTilingOptions TilingOptions = GetDefault<UStableDiffusionToolsSettings>()->GetUpsampleTilingOptions();
 
-				// Convert pixels from FFloat16Color to FColor
-				TArray<FColor> QuantitizedPixelData;
-				QuantitizedPixelData.InsertUninitialized(0, SourceColors.Num());
-				for (int idx = 0; idx < SourceColors.Num(); ++idx) {
-					QuantitizedPixelData[idx] = SourceColors[idx].GetFloats().ToFColor(true);
-				}
+	// We want to persist the upsampler model so we don't have to keep reloading it every frame
+	SDSubsystem->GeneratorBridge->StartUpsample();
 
-				// Unlock source texture since we've converted the pixel data
-				Image->GetPlatformData()->Mips[0].BulkData.Unlock();
-				
-				// Build our upsample parameters
-				FStableDiffusionImageResult UpsampleInput;
-				UpsampleInput.OutWidth = Image->GetSizeX();
-				UpsampleInput.OutHeight = Image->GetSizeY();
-				UpsampleInput.Upsampled = false;
-				UpsampleInput.Completed = false;
-				UpsampleInput.OutTexture = UStableDiffusionBlueprintLibrary::ColorBufferToTexture(QuantitizedPixelData, FIntPoint(Image->GetSizeX(), Image->GetSizeY()), nullptr, true);
-				UStableDiffusionBlueprintLibrary::UpdateTextureSync(UpsampleInput.OutTexture);
-				
-				// Create a destination texture that is 4x times larger than the input to hold the upsample result
-				// TODO: Allow for arbitary resize factors 
-				UTexture2D* UpsampledTexture = UTexture2D::CreateTransient(UpsampleInput.OutTexture->GetSizeX() * 4, UpsampleInput.OutTexture->GetSizeY() * 4);
-				FStableDiffusionImageResult UpsampleResult = SDSubsystem->GeneratorBridge->UpsampleImage(UpsampleInput, UpsampledTexture);
-
-				if (IsValid(UpsampleResult.OutTexture)) {
-					UStableDiffusionBlueprintLibrary::UpdateTextureSync(UpsampleResult.OutTexture);
-
-					// Build an export task that will async write the upsampled image to disk
-					TUniquePtr<FImageWriteTask> ExportTask = MakeUnique<FImageWriteTask>();
-					ExportTask->Format = EImageFormat::EXR;
-					ExportTask->CompressionQuality = (int32)EImageCompressionQuality::Default;
-					FString OutputName = FString::Printf(TEXT("%s%s"), *UpscaledFramePrefix, *FPaths::GetBaseFilename(file));
-					FString OutputDirectory = OutputSettings->OutputDirectory.Path;
-					FString OutputPath = FPaths::Combine(OutputDirectory, OutputName);
-					FString OutputPathResolved;
-
-					TMap<FString, FString> FormatOverrides{ {TEXT("ext"), *FPaths::GetExtension(file)} };
-					FMoviePipelineFormatArgs OutArgs;
-					GetPipeline()->ResolveFilenameFormatArguments(OutputPath, FormatOverrides, OutputPathResolved, OutArgs);
-					ExportTask->Filename = OutputPathResolved;
-
-					// Convert RGBA pixels back to FloatRGBA
-					TArray<FColor> SrcPixels = UStableDiffusionBlueprintLibrary::ReadPixels(UpsampleResult.OutTexture);
-					TArray64<FFloat16Color> ConvertedSrcPixels;
-					ConvertedSrcPixels.InsertUninitialized(0, SrcPixels.Num());
-					for (size_t idx = 0; idx < SrcPixels.Num(); ++idx) {
-						ConvertedSrcPixels[idx] = FFloat16Color(SrcPixels[idx]);
-					}
-					TUniquePtr<TImagePixelData<FFloat16Color>> UpscaledPixelData = MakeUnique<TImagePixelData<FFloat16Color>>(
-						FIntPoint(UpsampleResult.OutWidth, UpsampleResult.OutHeight),
-						MoveTemp(ConvertedSrcPixels)
-						);
-					ExportTask->PixelData = MoveTemp(UpscaledPixelData);
-					
-					// Enqueue image write
-					GetPipeline()->ImageWriteQueue->Enqueue(MoveTemp(ExportTask));
-				}
+	TArray<TFuture<FDecodedExportFrame>> PendingDecodes;
+	TArray<TFuture<bool>> PendingWrites;
+	int32 NextSourceIdx = 0;
+	auto QueueDecodes = [&]() {
+		while (NextSourceIdx < SourceFiles.Num() && PendingDecodes.Num() < MaxQueuedFrames) {
+			PendingDecodes.Add(Async(EAsyncExecution::ThreadPool, [ImageWrapperModule, File = SourceFiles[NextSourceIdx++]]() {
+				return DecodeExportFrame(*ImageWrapperModule, File);
+			}));
+		}
+	};
+
+	QueueDecodes();
+	while (PendingDecodes.Num()) {
+		double StageStartTime = FPlatformTime::Seconds();
+		FDecodedExportFrame Frame = PendingDecodes[0].Consume();
+		PendingDecodes.RemoveAt(0, 1, false);
+		DecodeWaitTime += FPlatformTime::Seconds() - StageStartTime;
+
+		// Keep the workers busy while this frame is upsampled
+		QueueDecodes();
+
+		if (!Frame.Pixels.Num()) {
+			UE_LOG(LogTemp, Warning, TEXT("Could not decode %s for upscaling"), *Frame.SourceFile);
+			continue;
+		}
+
+		// Upsample straight from the decoded pixels. Tiles are blended into the output buffer as their rows are finished.
+		StageStartTime = FPlatformTime::Seconds();
+		FStableDiffusionImageResult UpsampleInput;
+		UpsampleInput.OutWidth = Frame.Size.X;
+		UpsampleInput.OutHeight = Frame.Size.Y;
+		UpsampleInput.OutHalfFloatPixels = MoveTemp(Frame.Pixels);
+		UpsampleInput.Upsampled = false;
+		UpsampleInput.Completed = false;
+		UpsampleInput.UpsampleFactor = UpscaleFactor;
+
+		TArray64<FFloat16Color> UpscaledPixels;
+		FIntPoint UpscaledSize(0, 0);
+		const bool bUpsampled = FTiledUpsampler::Upsample(SDSubsystem->GeneratorBridge, UpsampleInput, TilingOptions, [this, &UpscaledPixels, &UpscaledSize](const FIntPoint& OutSize, int32 FirstRow, int32 NumRows, TArrayView<const FFloat16Color> Rows) {
+			if (!UpscaledPixels.Num()) {
+				UpscaledSize = OutSize;
+				UpscaledPixels = FrameArena->TakeOutputBuffer((int64)OutSize.X * OutSize.Y);
 			}
+			FMemory::Memcpy(&UpscaledPixels[(int64)FirstRow * OutSize.X], Rows.GetData(), Rows.Num() * sizeof(FFloat16Color));
+		});
+		UpsampleInput.OutHalfFloatPixels.Reset();
+		UpsampleTime += FPlatformTime::Seconds() - StageStartTime;
+
+		if (!bUpsampled) {
+			FrameArena->ReturnOutputBuffer(MoveTemp(UpscaledPixels));
+			UE_LOG(LogTemp, Warning, TEXT("Upsampler returned no pixels for %s"), *Frame.SourceFile);
+			continue;
+		}
 
-			SDSubsystem->GeneratorBridge->StopUpsample();
+		// Build an export task that will async write the upsampled image to disk
+		TUniquePtr<FImageWriteTask> ExportTask = MakeUnique<FImageWriteTask>();
+		ExportTask->Format = EImageFormat::EXR;
+		ExportTask->CompressionQuality = (int32)EImageCompressionQuality::Default;
+		FString OutputName = FString::Printf(TEXT("%s%s"), *UpscaledFramePrefix, *FPaths::GetBaseFilename(Frame.SourceFile));
+		FString OutputDirectory = OutputSettings->OutputDirectory.Path;
+		FString OutputPath = FPaths::Combine(OutputDirectory, OutputName);
+		FString OutputPathResolved;
+
+		TMap<FString, FString> FormatOverrides{ {TEXT("ext"), *FPaths::GetExtension(Frame.SourceFile)} };
+		FMoviePipelineFormatArgs OutArgs;
+		GetPipeline()->ResolveFilenameFormatArguments(OutputPath, FormatOverrides, OutputPathResolved, OutArgs);
+		ExportTask->Filename = OutputPathResolved;
+
+		// The write queue owns the pixels from here on
+		FrameArena->NoteHandoff(UpscaledPixels.Max() * sizeof(FFloat16Color));
+		ExportTask->PixelData = MakeUnique<TImagePixelData<FFloat16Color>>(UpscaledSize, MoveTemp(UpscaledPixels));
+		PendingWrites.Add(GetPipeline()->ImageWriteQueue->Enqueue(MoveTemp(ExportTask)));
+		FrameArena->EndFrame();
+		NumExportedFrames++;
+
+		// Only stall when the encoder falls too far behind
+		StageStartTime = FPlatformTime::Seconds();
+		while (PendingWrites.Num() > MaxQueuedFrames) {
+			PendingWrites[0].Wait();
+			PendingWrites.RemoveAt(0, 1, false);
 		}
+		EncodeWaitTime += FPlatformTime::Seconds() - StageStartTime;
 	}
+
+	const double FlushStartTime = FPlatformTime::Seconds();
+	for (TFuture<bool>& PendingWrite : PendingWrites) {
+		PendingWrite.Wait();
+	}
+	EncodeWaitTime += FPlatformTime::Seconds() - FlushStartTime;
+
+	SDSubsystem->GeneratorBridge->StopUpsample();
+
+	const double ExportTime = FPlatformTime::Seconds() - ExportStartTime;
+	UE_LOG(LogTemp, Log, TEXT("Upscaled %d of %d frames in %.2fs (%.2f fps). Waited %.2fs on decoding, %.2fs upsampling, waited %.2fs on encoding"),
+		NumExportedFrames, SourceFiles.Num(), ExportTime, (ExportTime > 0.0) ? NumExportedFrames / ExportTime : 0.0, DecodeWaitTime, UpsampleTime, EncodeWaitTime);
+	FrameArena->LogStats(TEXT("Stable Diffusion upscale export"));
 }
 
 void UStableDiffusionMoviePipeline::ApplyLayerOptions(TArray<FLayerProcessorContext>& Layers, size_t StageIndex, FFrameTime FrameTime) {
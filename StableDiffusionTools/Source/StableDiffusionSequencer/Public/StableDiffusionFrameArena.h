@@ -0,0 +1,91 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "StableDiffusionGenerationOptions.h"
+
+struct FStableDiffusionFrameArenaStats
+{
+	/* Buffers the arena had to allocate or grow */
+	int32 NumAllocations = 0;
+
+	/* Requests served from a buffer that was already big enough */
+	int32 NumReuses = 0;
+
+	/* Output buffers given away to MRQ or the image write queue. Their replacements have to be allocated */
+	int32 NumHandoffs = 0;
+
+	/* Layer reads where the render target readback replaced the lent buffer with its own allocation */
+	int32 NumLayerReallocations = 0;
+
+	/* Frames rendered with the arena */
+	int32 NumFrames = 0;
+
+	/* Allocations and handoffs recorded by the end of the first frame, used to work out the steady state */
+	int32 FirstFrameAllocations = 0;
+	int32 FirstFrameHandoffs = 0;
+
+	int64 AllocatedBytes = 0;
+	int64 CurrentBytes = 0;
+	int64 PeakBytes = 0;
+};
+
+/**
+ * Frame sized scratch buffers owned by the movie pipeline pass for the length of a job. Frames borrow their output
+ * and layer buffers from here instead of allocating them, so after the first frame the only allocations left
+ * are replacements for buffers whose ownership leaves the pass.
+ * Output buffers can be returned from any thread.
+ */
+class STABLEDIFFUSIONSEQUENCER_API FStableDiffusionFrameArena
+{
+public:
+	/** Preallocates output buffers for frames of the given size. */
+	void Reserve(FIntPoint FrameSize, int32 NumOutputBuffers = 2);
+
+	/** Gets a half float buffer holding NumPixels uninitialised pixels. */
+	TArray64<FFloat16Color> TakeOutputBuffer(int64 NumPixels);
+
+	/** Hands a buffer taken with TakeOutputBuffer back for the next frame. */
+	void ReturnOutputBuffer(TArray64<FFloat16Color>&& Buffer);
+
+	/** Records that a taken buffer was given to something outside the pass and will not come back. */
+	void NoteHandoff(int64 NumBytes);
+
+	/** Moves the pixel buffers kept for a stage's layer into the layer so the readback can write into them. */
+	void LendLayerBuffers(int32 StageIndex, int32 LayerIndex, FLayerProcessorContext& Layer);
+
+	/** Takes the pixel buffers back from a layer once the stage no longer needs them. */
+	void ReclaimLayerBuffers(int32 StageIndex, int32 LayerIndex, FLayerProcessorContext& Layer);
+
+	/** Marks the end of a frame for the steady state statistics. */
+	void EndFrame();
+
+	/** Frees every buffer and resets the statistics. */
+	void Reset();
+
+	FStableDiffusionFrameArenaStats GetStats() const;
+	void LogStats(const TCHAR* Context) const;
+
+private:
+	struct FLayerSlot
+	{
+		FSharedPixelBuffer LayerPixels;
+		TSharedImmutableBuffer<FFloat16Color> HalfFloatLayerPixels;
+		TSharedImmutableBuffer<FLinearColor> FloatLayerPixels;
+
+		// Allocation lent out with the slot's buffers so reclaiming can spot buffers that were replaced
+		const void* LentData = nullptr;
+		int64 LentBytes = 0;
+	};
+
+	static const void* GetLayerData(const FLayerProcessorContext& Layer);
+	static int64 GetLayerBytes(const FLayerProcessorContext& Layer);
+
+	void TrackAllocation(int64 NumBytes);
+
+	mutable FCriticalSection ArenaLock;
+	TArray<TArray64<FFloat16Color>> FreeOutputBuffers;
+	TMap<FIntPoint, FLayerSlot> LayerSlots;
+	FStableDiffusionFrameArenaStats Stats;
+};
@@ -11,6 +11,7 @@
 #include "MoviePipelineDeferredPasses.h"
 #include "Materials/MaterialInstanceDynamic.h"
 #include "StableDiffusionLayerProcessorTrack.h"
+#include "StableDiffusionFrameArena.h"
 #include "StableDiffusionMoviePipeline.generated.h"
 
 
@@ -58,6 +59,12 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "StableDiffusion|Outputs")
 	bool bUpscale;
 
+	/**
+	* How much larger each upscaled frame is than the rendered frame. Factors the upsampler doesn't support natively are reached by resampling its output.
+	*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "StableDiffusion|Outputs", meta = (EditCondition = "bUpscale", ClampMin = 0.1, UIMin = 1.0, UIMax = 8.0))
+	float UpscaleFactor = 4.0f;
+
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "StableDiffusion|Outputs")
 	TSubclassOf<UStableDiffusionBridge> ImageGeneratorOverride;
 
@@ -67,6 +74,12 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "StableDiffusion|Outputs")
 	FString UpscaledFramePrefix = "UP_";
 
+	/**
+	* Number of frames that can be waiting to be upscaled or written at once while exporting. Higher values overlap more work at the cost of memory.
+	*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "StableDiffusion|Outputs", meta = (ClampMin = 1, UIMin = 1, UIMax = 8))
+	int32 ExportQueueDepth = 3;
+
 	/**
 	* If you encounter false positive NSFW black frames in your animation, then enabling this option may help
 	*/
@@ -100,5 +113,8 @@ private:
 	TArray<UStableDiffusionPromptMovieSceneTrack*> PromptTracks;
 	TArray<UStableDiffusionLayerProcessorTrack*> LayerProcessorTracks;
 
+	// Frame sized scratch buffers reused by every frame of the job. Shared so render commands can return buffers to it.
+	TSharedPtr<FStableDiffusionFrameArena, ESPMode::ThreadSafe> FrameArena;
+
 	void ApplyLayerOptions(TArray<FLayerProcessorContext>& Layers, size_t StageIndex, FFrameTime FrameTime);
 };
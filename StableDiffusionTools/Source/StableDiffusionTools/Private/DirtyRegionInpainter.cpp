@@ -0,0 +1,319 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "DirtyRegionInpainter.h"
+
+namespace
+{
+	// Colours are blended in their stored encoding, 8 bit pixels on a 0 to 255 scale
+	FLinearColor ToLinear(const FColor& Color) { return FLinearColor(Color.R, Color.G, Color.B, Color.A); }
+	FLinearColor ToLinear(const FFloat16Color& Color) { return FLinearColor(Color); }
+	FLinearColor ToLinear(const FLinearColor& Color) { return Color; }
+
+	void FromLinear(const FLinearColor& Color, FColor& Out)
+	{
+		Out = FColor(
+			(uint8)FMath::Clamp(FMath::RoundToInt(Color.R), 0, 255),
+			(uint8)FMath::Clamp(FMath::RoundToInt(Color.G), 0, 255),
+			(uint8)FMath::Clamp(FMath::RoundToInt(Color.B), 0, 255),
+			(uint8)FMath::Clamp(FMath::RoundToInt(Color.A), 0, 255));
+	}
+	void FromLinear(const FLinearColor& Color, FFloat16Color& Out) { Out = FFloat16Color(Color); }
+	void FromLinear(const FLinearColor& Color, FLinearColor& Out) { Out = Color; }
+
+	float GetChannelScale(const FColor&) { return 1.0f / 255.0f; }
+	float GetChannelScale(const FFloat16Color&) { return 1.0f; }
+	float GetChannelScale(const FLinearColor&) { return 1.0f; }
+
+	template<typename PixelType>
+	FLinearColor SampleBilinear(TArrayView<const PixelType> Pixels, const FIntPoint& Size, float X, float Y)
+	{
+		X = FMath::Clamp(X, 0.0f, Size.X - 1.0f);
+		Y = FMath::Clamp(Y, 0.0f, Size.Y - 1.0f);
+		const int32 X0 = FMath::FloorToInt(X), Y0 = FMath::FloorToInt(Y);
+		const int32 X1 = FMath::Min(X0 + 1, Size.X - 1), Y1 = FMath::Min(Y0 + 1, Size.Y - 1);
+		const float FracX = X - X0, FracY = Y - Y0;
+		const FLinearColor Top = FMath::Lerp(ToLinear(Pixels[Y0 * Size.X + X0]), ToLinear(Pixels[Y0 * Size.X + X1]), FracX);
+		const FLinearColor Bottom = FMath::Lerp(ToLinear(Pixels[Y1 * Size.X + X0]), ToLinear(Pixels[Y1 * Size.X + X1]), FracX);
+		return FMath::Lerp(Top, Bottom, FracY);
+	}
+
+	// Resamples the part of a capture behind an output space rectangle to the rectangle's size
+	template<typename PixelType>
+	TArray<PixelType> CropCapture(TArrayView<const PixelType> Pixels, const FIntPoint& CaptureSize, const FIntPoint& OutSize, const FIntRect& Bounds)
+	{
+		const FVector2f Scale(float(CaptureSize.X) / OutSize.X, float(CaptureSize.Y) / OutSize.Y);
+		const FIntPoint RegionSize = Bounds.Size();
+		TArray<PixelType> Cropped;
+		Cropped.SetNumUninitialized(RegionSize.X * RegionSize.Y);
+		for (int32 Y = 0; Y < RegionSize.Y; ++Y) {
+			const float CaptureY = (Bounds.Min.Y + Y + 0.5f) * Scale.Y - 0.5f;
+			for (int32 X = 0; X < RegionSize.X; ++X) {
+				const float CaptureX = (Bounds.Min.X + X + 0.5f) * Scale.X - 0.5f;
+				FromLinear(SampleBilinear(Pixels, CaptureSize, CaptureX, CaptureY), Cropped[Y * RegionSize.X + X]);
+			}
+		}
+		return Cropped;
+	}
+
+	template<typename PixelType>
+	bool MarkChangedPixels(TArrayView<const PixelType> Previous, TArrayView<const PixelType> Current, float Threshold, TArray<uint8>& Changed)
+	{
+		if (Previous.Num() != Current.Num() || Current.Num() != Changed.Num())
+			return false;
+
+		const float ScaledThreshold = Threshold / GetChannelScale(PixelType());
+		for (int32 PixelIdx = 0; PixelIdx < Current.Num(); ++PixelIdx) {
+			const FLinearColor Difference = ToLinear(Current[PixelIdx]) - ToLinear(Previous[PixelIdx]);
+			if (FMath::Max3(FMath::Abs(Difference.R), FMath::Abs(Difference.G), FMath::Abs(Difference.B)) > ScaledThreshold) {
+				Changed[PixelIdx] = 1;
+			}
+		}
+		return true;
+	}
+
+	// Grows set pixels by Radius along one axis using a running count of set pixels in the window
+	void DilateAxis(TArray<uint8>& Mask, const FIntPoint& Size, int32 Radius, bool bVertical)
+	{
+		const int32 Length = bVertical ? Size.Y : Size.X;
+		const int32 NumLines = bVertical ? Size.X : Size.Y;
+		const int32 Stride = bVertical ? Size.X : 1;
+		const int32 LineStride = bVertical ? 1 : Size.X;
+		TArray<uint8> Line;
+		Line.SetNumUninitialized(Length);
+
+		for (int32 LineIdx = 0; LineIdx < NumLines; ++LineIdx) {
+			uint8* Start = &Mask[LineIdx * LineStride];
+			for (int32 Pos = 0; Pos < Length; ++Pos) {
+				Line[Pos] = Start[Pos * Stride];
+			}
+
+			int32 Count = 0;
+			for (int32 Pos = 0; Pos < FMath::Min(Radius, Length); ++Pos) {
+				Count += Line[Pos];
+			}
+			for (int32 Pos = 0; Pos < Length; ++Pos) {
+				if (Pos + Radius < Length)
+					Count += Line[Pos + Radius];
+				if (Pos - Radius - 1 >= 0)
+					Count -= Line[Pos - Radius - 1];
+				Start[Pos * Stride] = Count > 0 ? 1 : 0;
+			}
+		}
+	}
+
+	// Box blurs weights along one axis. Pixels outside the buffer count as 0.
+	void BlurAxis(TArray<float>& Weights, const FIntPoint& Size, int32 Radius, bool bVertical)
+	{
+		const int32 Length = bVertical ? Size.Y : Size.X;
+		const int32 NumLines = bVertical ? Size.X : Size.Y;
+		const int32 Stride = bVertical ? Size.X : 1;
+		const int32 LineStride = bVertical ? 1 : Size.X;
+		const float Scale = 1.0f / (2 * Radius + 1);
+		TArray<float> Line;
+		Line.SetNumUninitialized(Length);
+
+		for (int32 LineIdx = 0; LineIdx < NumLines; ++LineIdx) {
+			float* Start = &Weights[LineIdx * LineStride];
+			for (int32 Pos = 0; Pos < Length; ++Pos) {
+				Line[Pos] = Start[Pos * Stride];
+			}
+
+			float Sum = 0.0f;
+			for (int32 Pos = 0; Pos < FMath::Min(Radius, Length); ++Pos) {
+				Sum += Line[Pos];
+			}
+			for (int32 Pos = 0; Pos < Length; ++Pos) {
+				if (Pos + Radius < Length)
+					Sum += Line[Pos + Radius];
+				if (Pos - Radius - 1 >= 0)
+					Sum -= Line[Pos - Radius - 1];
+				Start[Pos * Stride] = Sum * Scale;
+			}
+		}
+	}
+
+	// Latent sizes have to be multiples of 8
+	int32 AlignDown(int32 Value) { return Value & ~7; }
+	int32 AlignUp(int32 Value) { return (Value + 7) & ~7; }
+
+	// Grows one axis of a region to at least MinLength around its centre without leaving the frame
+	void GrowAxis(int32& Min, int32& Max, int32 MinLength, int32 Length)
+	{
+		const int32 Missing = MinLength - (Max - Min);
+		if (Missing <= 0)
+			return;
+		Min -= Missing / 2;
+		Max += Missing - Missing / 2;
+		if (Min < 0) {
+			Max = FMath::Min(Max - Min, Length);
+			Min = 0;
+		}
+		if (Max > Length) {
+			Min = FMath::Max(Min - (Max - Length), 0);
+			Max = Length;
+		}
+	}
+}
+
+FIntPoint FDirtyRegionInpainter::GetCaptureSize(const FStableDiffusionInput& Input)
+{
+	if (Input.Options.InSizeX > 0 && Input.Options.InSizeY > 0)
+		return FIntPoint(Input.Options.InSizeX, Input.Options.InSizeY);
+	return FIntPoint(Input.Options.OutSizeX, Input.Options.OutSizeY);
+}
+
+bool FDirtyRegionInpainter::FindDirtyRegion(const FDirtyRegionBaseline& Baseline, const FStableDiffusionInput& Input, const FDirtyRegionOptions& Options, FDirtyRegion& OutRegion)
+{
+	const FIntPoint CaptureSize = GetCaptureSize(Input);
+	const FIntPoint OutSize(Input.Options.OutSizeX, Input.Options.OutSizeY);
+	if (!Baseline.IsValid() || Baseline.CaptureSize != CaptureSize || Baseline.Size != OutSize || Baseline.Layers.Num() != Input.ProcessedLayers.Num() || CaptureSize.X <= 0 || CaptureSize.Y <= 0)
+		return false;
+
+	// Mark every captured pixel that changed in any layer
+	TArray<uint8> Changed;
+	Changed.SetNumZeroed(CaptureSize.X * CaptureSize.Y);
+	for (int32 LayerIdx = 0; LayerIdx < Input.ProcessedLayers.Num(); ++LayerIdx) {
+		const FLayerProcessorContext& Previous = Baseline.Layers[LayerIdx];
+		const FLayerProcessorContext& Current = Input.ProcessedLayers[LayerIdx];
+		if (Previous.Processor != Current.Processor || Current.OutputType == EImageType::Latent)
+			return false;
+
+		bool bCompared = false;
+		if (Current.FloatLayerPixels)
+			bCompared = MarkChangedPixels(Previous.FloatLayerPixels.View(), Current.FloatLayerPixels.View(), Options.ChangeThreshold, Changed);
+		else if (Current.HalfFloatLayerPixels)
+			bCompared = MarkChangedPixels(Previous.HalfFloatLayerPixels.View(), Current.HalfFloatLayerPixels.View(), Options.ChangeThreshold, Changed);
+		else if (Current.SharedLayerPixels)
+			bCompared = MarkChangedPixels(Previous.SharedLayerPixels.View(), Current.SharedLayerPixels.View(), Options.ChangeThreshold, Changed);
+		if (!bCompared)
+			return false;
+	}
+
+	// Dilate in capture pixels
+	const int32 CaptureDilation = FMath::CeilToInt(FMath::Max(Options.Dilation, 0) * float(CaptureSize.X) / OutSize.X);
+	if (CaptureDilation > 0) {
+		DilateAxis(Changed, CaptureSize, CaptureDilation, false);
+		DilateAxis(Changed, CaptureSize, CaptureDilation, true);
+	}
+
+	FIntRect CaptureBounds(CaptureSize, FIntPoint::ZeroValue);
+	for (int32 Y = 0; Y < CaptureSize.Y; ++Y) {
+		for (int32 X = 0; X < CaptureSize.X; ++X) {
+			if (Changed[Y * CaptureSize.X + X]) {
+				CaptureBounds.Include(FIntPoint(X, Y));
+				CaptureBounds.Include(FIntPoint(X + 1, Y + 1));
+			}
+		}
+	}
+
+	OutRegion = FDirtyRegion();
+	if (CaptureBounds.Min.X >= CaptureBounds.Max.X)
+		return true;
+
+	// Move to output pixels, leave room for the feathering and align to the latent grid
+	const int32 Feather = FMath::Max(Options.Feather, 0);
+	FIntRect& Bounds = OutRegion.Bounds;
+	Bounds.Min.X = AlignDown(FMath::Max(FMath::FloorToInt(CaptureBounds.Min.X * float(OutSize.X) / CaptureSize.X) - Feather, 0));
+	Bounds.Min.Y = AlignDown(FMath::Max(FMath::FloorToInt(CaptureBounds.Min.Y * float(OutSize.Y) / CaptureSize.Y) - Feather, 0));
+	Bounds.Max.X = FMath::Min(AlignUp(FMath::CeilToInt(CaptureBounds.Max.X * float(OutSize.X) / CaptureSize.X) + Feather), OutSize.X);
+	Bounds.Max.Y = FMath::Min(AlignUp(FMath::CeilToInt(CaptureBounds.Max.Y * float(OutSize.Y) / CaptureSize.Y) + Feather), OutSize.Y);
+
+	// Very small regions don't give the model enough context
+	GrowAxis(Bounds.Min.X, Bounds.Max.X, 64, OutSize.X);
+	GrowAxis(Bounds.Min.Y, Bounds.Max.Y, 64, OutSize.Y);
+
+	// Sample the dilated mask into the region and feather it for compositing
+	const FIntPoint RegionSize = Bounds.Size();
+	OutRegion.Mask.SetNumUninitialized(RegionSize.X * RegionSize.Y);
+	OutRegion.Alpha.SetNumUninitialized(RegionSize.X * RegionSize.Y);
+	for (int32 Y = 0; Y < RegionSize.Y; ++Y) {
+		const int32 CaptureY = FMath::Min(int32((Bounds.Min.Y + Y + 0.5f) * CaptureSize.Y / OutSize.Y), CaptureSize.Y - 1);
+		for (int32 X = 0; X < RegionSize.X; ++X) {
+			const int32 CaptureX = FMath::Min(int32((Bounds.Min.X + X + 0.5f) * CaptureSize.X / OutSize.X), CaptureSize.X - 1);
+			const bool bChanged = Changed[CaptureY * CaptureSize.X + CaptureX] != 0;
+			OutRegion.Mask[Y * RegionSize.X + X] = bChanged ? 255 : 0;
+			OutRegion.Alpha[Y * RegionSize.X + X] = bChanged ? 1.0f : 0.0f;
+		}
+	}
+	if (Feather > 0) {
+		BlurAxis(OutRegion.Alpha, RegionSize, Feather, false);
+		BlurAxis(OutRegion.Alpha, RegionSize, Feather, true);
+	}
+	return true;
+}
+
+bool FDirtyRegionInpainter::MakeRegionInput(const FDirtyRegionBaseline& Baseline, const FStableDiffusionInput& Input, const FDirtyRegion& Region, FStableDiffusionInput& OutInput)
+{
+	if (Region.IsEmpty() || !Baseline.IsValid())
+		return false;
+
+	const FIntPoint CaptureSize = GetCaptureSize(Input);
+	const FIntPoint OutSize(Input.Options.OutSizeX, Input.Options.OutSizeY);
+	const FIntPoint RegionSize = Region.Bounds.Size();
+
+	OutInput = Input;
+	OutInput.Options.InSizeX = OutInput.Options.OutSizeX = RegionSize.X;
+	OutInput.Options.InSizeY = OutInput.Options.OutSizeY = RegionSize.Y;
+
+	for (FLayerProcessorContext& Layer : OutInput.ProcessedLayers) {
+		if (Layer.FloatLayerPixels) {
+			Layer.FloatLayerPixels = CropCapture(Layer.FloatLayerPixels.View(), CaptureSize, OutSize, Region.Bounds);
+		}
+		else if (Layer.HalfFloatLayerPixels) {
+			Layer.HalfFloatLayerPixels = CropCapture(Layer.HalfFloatLayerPixels.View(), CaptureSize, OutSize, Region.Bounds);
+		}
+		else if (Layer.SharedLayerPixels) {
+			TArray<FColor> Cropped = CropCapture(Layer.SharedLayerPixels.View(), CaptureSize, OutSize, Region.Bounds);
+
+			// Inpainting keeps the unmasked pixels of the start image, which have to match the previous preview
+			if (Layer.LayerType == ELayerImageType::image) {
+				const TArrayView<const FColor> PreviousPixels = Baseline.Pixels.View();
+				for (int32 Y = 0; Y < RegionSize.Y; ++Y) {
+					for (int32 X = 0; X < RegionSize.X; ++X) {
+						if (!Region.Mask[Y * RegionSize.X + X]) {
+							Cropped[Y * RegionSize.X + X] = PreviousPixels[(Region.Bounds.Min.Y + Y) * OutSize.X + Region.Bounds.Min.X + X];
+						}
+					}
+				}
+			}
+			Layer.SharedLayerPixels = MoveTemp(Cropped);
+		}
+	}
+
+	// White marks the pixels the inpaint pipeline regenerates
+	TArray<FColor> MaskPixels;
+	MaskPixels.SetNumUninitialized(Region.Mask.Num());
+	for (int32 PixelIdx = 0; PixelIdx < Region.Mask.Num(); ++PixelIdx) {
+		MaskPixels[PixelIdx] = FColor(Region.Mask[PixelIdx], Region.Mask[PixelIdx], Region.Mask[PixelIdx], 255);
+	}
+	FLayerProcessorContext& MaskLayer = OutInput.ProcessedLayers.AddDefaulted_GetRef();
+	MaskLayer.LayerType = ELayerImageType::custom;
+	MaskLayer.Role = TEXT("mask_image");
+	MaskLayer.SharedLayerPixels = MoveTemp(MaskPixels);
+	return true;
+}
+
+TArray<FColor> FDirtyRegionInpainter::Composite(const FDirtyRegionBaseline& Baseline, const FDirtyRegion& Region, TArrayView<const FColor> RegionPixels, const FIntPoint& RegionPixelsSize)
+{
+	TArray<FColor> Pixels(Baseline.Pixels.View());
+	const FIntPoint RegionSize = Region.Bounds.Size();
+	if (Region.IsEmpty() || RegionPixels.Num() != RegionPixelsSize.X * RegionPixelsSize.Y || RegionPixels.Num() == 0)
+		return Pixels;
+
+	// Bridges may hand back a slightly different size so sample the result across the region
+	const FVector2f Scale(float(RegionPixelsSize.X) / RegionSize.X, float(RegionPixelsSize.Y) / RegionSize.Y);
+	for (int32 Y = 0; Y < RegionSize.Y; ++Y) {
+		for (int32 X = 0; X < RegionSize.X; ++X) {
+			const float Alpha = Region.Alpha[Y * RegionSize.X + X];
+			if (Alpha <= 0.0f)
+				continue;
+
+			FColor& Pixel = Pixels[(Region.Bounds.Min.Y + Y) * Baseline.Size.X + Region.Bounds.Min.X + X];
+			const FLinearColor Inpainted = (RegionPixelsSize == RegionSize)
+				? ToLinear(RegionPixels[Y * RegionSize.X + X])
+				: SampleBilinear(RegionPixels, RegionPixelsSize, (X + 0.5f) * Scale.X - 0.5f, (Y + 0.5f) * Scale.Y - 0.5f);
+			FromLinear(FMath::Lerp(ToLinear(Pixel), Inpainted, FMath::Min(Alpha, 1.0f)), Pixel);
+		}
+	}
+	return Pixels;
+}
@@ -0,0 +1,139 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "GenerationSignature.h"
+#include "LayerProcessorBase.h"
+#include "Hash/CityHash.h"
+
+namespace
+{
+	uint64 HashBytes(uint64 Hash, const void* Data, int64 NumBytes)
+	{
+		// The length keeps neighbouring buffers from running into each other
+		Hash = CityHash64WithSeed(reinterpret_cast<const char*>(&NumBytes), sizeof(NumBytes), Hash);
+		return NumBytes > 0 ? CityHash64WithSeed(static_cast<const char*>(Data), NumBytes, Hash) : Hash;
+	}
+
+	uint64 HashString(uint64 Hash, const FString& Value)
+	{
+		return HashBytes(Hash, *Value, Value.Len() * sizeof(TCHAR));
+	}
+
+	// Size of a captured layer's pixels. Texture captures don't record their input size so fall back to the output size.
+	bool GetLayerSize(const FStableDiffusionInput& Input, int32 NumPixels, FIntPoint& OutSize)
+	{
+		if (Input.Options.InSizeX > 0 && Input.Options.InSizeX * Input.Options.InSizeY == NumPixels) {
+			OutSize = FIntPoint(Input.Options.InSizeX, Input.Options.InSizeY);
+			return true;
+		}
+		if (Input.Options.OutSizeX * Input.Options.OutSizeY == NumPixels) {
+			OutSize = FIntPoint(Input.Options.OutSizeX, Input.Options.OutSizeY);
+			return true;
+		}
+		return false;
+	}
+
+	template<typename PixelType>
+	TArray<float> MakeThumbnail(TArrayView<const PixelType> Pixels, const FIntPoint& Size)
+	{
+		constexpr int32 ThumbnailSize = FGenerationSignature::ThumbnailSize;
+		TArray<float> Sums;
+		TArray<int32> Counts;
+		Sums.SetNumZeroed(ThumbnailSize * ThumbnailSize);
+		Counts.SetNumZeroed(ThumbnailSize * ThumbnailSize);
+
+		for (int32 Y = 0; Y < Size.Y; ++Y) {
+			const int32 CellRow = (Y * ThumbnailSize / Size.Y) * ThumbnailSize;
+			for (int32 X = 0; X < Size.X; ++X) {
+				const FLinearColor Color(Pixels[Y * Size.X + X]);
+				const int32 Cell = CellRow + X * ThumbnailSize / Size.X;
+				Sums[Cell] += FMath::Clamp(Color.GetLuminance(), 0.0f, 1.0f);
+				Counts[Cell]++;
+			}
+		}
+
+		for (int32 Cell = 0; Cell < Sums.Num(); ++Cell) {
+			Sums[Cell] /= FMath::Max(Counts[Cell], 1);
+		}
+		return Sums;
+	}
+}
+
+FGenerationSignature FGenerationSignature::Make(const FStableDiffusionInput& Input, const FString& ModelContext, bool bBuildThumbnails)
+{
+	FGenerationSignature Signature;
+
+	// The view itself is left out since the captured pixels already show whether it changed
+	FString Options;
+	FStableDiffusionGenerationOptions::StaticStruct()->ExportText(Options, &Input.Options, nullptr, nullptr, PPF_None, nullptr);
+	uint64 SettingsHash = HashString(0, ModelContext);
+	SettingsHash = HashString(SettingsHash, Options);
+	SettingsHash = HashString(SettingsHash, Input.SchedulerOverride);
+	const uint8 Flags[] = { (uint8)Input.OutputType.GetValue(), (uint8)Input.bFloatOutput, (uint8)Input.bFastPreview, (uint8)Input.bIsDraft };
+	SettingsHash = HashBytes(SettingsHash, Flags, sizeof(Flags));
+
+	uint64 PixelHash = 0;
+	for (const FLayerProcessorContext& Layer : Input.ProcessedLayers) {
+		SettingsHash = HashString(SettingsHash, Layer.Processor ? Layer.Processor->GetPathName() : FString());
+		SettingsHash = HashString(SettingsHash, Layer.Role);
+		if (const ULayerProcessorOptions* LayerOptions = Layer.ProcessorOptions) {
+			for (TFieldIterator<FProperty> It(LayerOptions->GetClass()); It; ++It) {
+				FString Value;
+				It->ExportTextItem_InContainer(Value, LayerOptions, nullptr, nullptr, PPF_None);
+				SettingsHash = HashString(SettingsHash, Value);
+			}
+		}
+		const uint8 LayerFlags[] = { (uint8)Layer.LayerType.GetValue(), (uint8)Layer.OutputType.GetValue(), (uint8)Layer.GetPixelBitDepth() };
+		SettingsHash = HashBytes(SettingsHash, LayerFlags, sizeof(LayerFlags));
+		SettingsHash = HashBytes(SettingsHash, Layer.SharedLatentData.GetData(), Layer.SharedLatentData.NumBytes());
+
+		PixelHash = HashBytes(PixelHash, Layer.SharedLayerPixels.GetData(), Layer.SharedLayerPixels.NumBytes());
+		PixelHash = HashBytes(PixelHash, Layer.HalfFloatLayerPixels.GetData(), Layer.HalfFloatLayerPixels.NumBytes());
+		PixelHash = HashBytes(PixelHash, Layer.FloatLayerPixels.GetData(), Layer.FloatLayerPixels.NumBytes());
+
+		if (bBuildThumbnails) {
+			FIntPoint Size;
+			TArray<float>& Thumbnail = Signature.Thumbnails.AddDefaulted_GetRef();
+			if (Layer.FloatLayerPixels && GetLayerSize(Input, Layer.FloatLayerPixels.Num(), Size)) {
+				Thumbnail = MakeThumbnail(Layer.FloatLayerPixels.View(), Size);
+			}
+			else if (Layer.HalfFloatLayerPixels && GetLayerSize(Input, Layer.HalfFloatLayerPixels.Num(), Size)) {
+				Thumbnail = MakeThumbnail(Layer.HalfFloatLayerPixels.View(), Size);
+			}
+			else if (Layer.SharedLayerPixels && GetLayerSize(Input, Layer.SharedLayerPixels.Num(), Size)) {
+				Thumbnail = MakeThumbnail(Layer.SharedLayerPixels.View(), Size);
+			}
+		}
+	}
+
+	// Zero marks an unset signature
+	Signature.SettingsHash = SettingsHash ? SettingsHash : 1;
+	Signature.PixelHash = PixelHash;
+	return Signature;
+}
+
+bool FGenerationSignature::Matches(const FGenerationSignature& Other, float Threshold) const
+{
+	if (!IsSet() || SettingsHash != Other.SettingsHash)
+		return false;
+	if (PixelHash == Other.PixelHash)
+		return true;
+	if (Threshold <= 0.0f || Thumbnails.Num() != Other.Thumbnails.Num())
+		return false;
+
+	for (int32 LayerIdx = 0; LayerIdx < Thumbnails.Num(); ++LayerIdx) {
+		const TArray<float>& Thumbnail = Thumbnails[LayerIdx];
+		const TArray<float>& OtherThumbnail = Other.Thumbnails[LayerIdx];
+
+		// Layers without a thumbnail can only match exactly, which already failed
+		if (Thumbnail.Num() == 0 || Thumbnail.Num() != OtherThumbnail.Num())
+			return false;
+
+		float Difference = 0.0f;
+		for (int32 Cell = 0; Cell < Thumbnail.Num(); ++Cell) {
+			Difference += FMath::Abs(Thumbnail[Cell] - OtherThumbnail[Cell]);
+		}
+		if (Difference / Thumbnail.Num() > Threshold)
+			return false;
+	}
+	return true;
+}
@@ -4,6 +4,59 @@
 #include "ImagePipelineRunner.h"
 #include "Editor.h"
 #include "StableDiffusionSubsystem.h"
+#include "StableDiffusionBlueprintLibrary.h"
+
+namespace
+{
+	FCachedStageResult MakeCachedResult(const FStableDiffusionImageResult& Result)
+	{
+		FCachedStageResult Cached;
+		Cached.OutputType = Result.OutputType;
+		Cached.Size = FIntPoint(Result.OutWidth, Result.OutHeight);
+		Cached.Pixels = Result.OutPixels;
+		Cached.HalfFloatPixels = Result.OutHalfFloatPixels;
+		Cached.Latent = Result.SharedOutLatent;
+		return Cached;
+	}
+
+	// Rebuilds a stage result from the cache. Cached pixels are uploaded to a fresh texture from the pool on the game thread.
+	FStableDiffusionImageResult RestoreCachedResult(UStableDiffusionSubsystem* Subsystem, const FCachedStageResult& Cached, const FStableDiffusionInput& Input, const UImagePipelineStageAsset* Stage)
+	{
+		FStableDiffusionImageResult Result;
+		Result.Input = Input;
+		Result.View = Input.View;
+		Result.Model = Stage->Model->Options;
+		Result.Pipeline = Stage->Pipeline ? Stage->Pipeline->Options : FStableDiffusionPipelineOptions();
+		if (!Stage->Scheduler.IsEmpty()) {
+			Result.Pipeline.Scheduler = Stage->Scheduler;
+		}
+		Result.LORA = Stage->LORAAsset ? Stage->LORAAsset->Options : FStableDiffusionModelOptions();
+		Result.OutputType = Cached.OutputType;
+		Result.OutWidth = Cached.Size.X;
+		Result.OutHeight = Cached.Size.Y;
+		Result.OutPixels = Cached.Pixels;
+		Result.OutHalfFloatPixels = Cached.HalfFloatPixels;
+		Result.SharedOutLatent = Cached.Latent;
+		Result.Completed = true;
+
+		if (Cached.Pixels.Num() == Cached.Size.X * Cached.Size.Y && Cached.Pixels.Num()) {
+			TSharedPtr<TPromise<bool>> GameThreadPromise = MakeShared<TPromise<bool>>();
+			AsyncTask(ENamedThreads::GameThread, [Subsystem, &Cached, &Result, GameThreadPromise]() {
+				UTexture2D* OutTexture = Subsystem->TexturePool->Acquire(Cached.Size);
+				Result.OutTexture = UStableDiffusionBlueprintLibrary::ColorBufferToTexture(Cached.Pixels.Get(), Cached.Size, OutTexture, true);
+				UStableDiffusionBlueprintLibrary::UpdateTextureSync(OutTexture);
+#if WITH_EDITOR
+				if (!UStableDiffusionBlueprintLibrary::IsDirectUploadTexture(OutTexture))
+					OutTexture->PostEditChange();
+#endif
+				Subsystem->TexturePool->Publish(OutTexture);
+				GameThreadPromise->SetValue(true);
+			});
+			GameThreadPromise->GetFuture().Wait();
+		}
+		return Result;
+	}
+}
 
 
 UImagePipelineRunner::UImagePipelineRunner(const FObjectInitializer& ObjectInitializer)
@@ -35,53 +88,19 @@ void UImagePipelineRunner::Activate()
 		Complete(LastStageResult);
 	}
 
-	// Gather custom schedulers from pipelines
-	TArray<TObjectPtr<UStableDiffusionPipelineAsset>> TempPipelines;
-	for (auto Stage : Stages) {
-		TObjectPtr<UStableDiffusionPipelineAsset> Pipeline = Stage->Pipeline;
-		
-		// Duplicate the pipelineasset and take ownership of it so we can modify it with our scheduler override
-		// Needs to happen before the async thread is run
-		if (!Stage->Scheduler.IsEmpty()) {
-			Pipeline = DuplicateObject<UStableDiffusionPipelineAsset>(Stage->Pipeline, this);
-			Pipeline->Options.Scheduler = Stage->Scheduler;
-		}
-
-		TempPipelines.Add(Pipeline);
-	}
-
-	AsyncTask(ENamedThreads::AnyHiPriThreadHiPriTask, [this, LastStageResult, TempPipelines]() mutable {
+	AsyncTask(ENamedThreads::AnyHiPriThreadHiPriTask, [this, LastStageResult]() mutable {
 		if (UStableDiffusionSubsystem* Subsystem = GEditor->GetEditorSubsystem<UStableDiffusionSubsystem>()) {
-			for (size_t StageIdx = 0; StageIdx < Stages.Num(); ++StageIdx) {
-				if (Subsystem->IsStopping()) {
-					break;
-				}
-
-				// In order to process the pipeline, we need to use both the previous and current stages
-				UImagePipelineStageAsset* PrevStage = (StageIdx) ? Stages[StageIdx - 1] : nullptr;
-				UImagePipelineStageAsset* CurrentStage = Stages[StageIdx];
-				TObjectPtr<UStableDiffusionPipelineAsset> TempPipelineAsset = TempPipelines[StageIdx];
-
-				// Init model at the start of each stage.
-				// TODO: Cache last model and only re-init if model options have changed
-				Subsystem->InitModel(CurrentStage->Model->Options, TempPipelineAsset, CurrentStage->LORAAsset, CurrentStage->TextualInversionAsset, CurrentStage->Layers, false, AllowNSFW, PaddingMode);
-				if (Subsystem->GetModelStatus().ModelStatus != EModelStatus::Loaded) {
-					UE_LOG(LogTemp, Error, TEXT("Failed to load model. Check the output log for more information"));
-					Subsystem->StopGeneratingImage();
-					if(Subsystem->GeneratorBridge){
-						Subsystem->GeneratorBridge->ModelStatus.ErrorMsg = "Failed to load the specified model";
-						Subsystem->GeneratorBridge->ModelStatus.ModelStatus = EModelStatus::Error;
-					}
-					
-					break;
-				}
+			FImagePipelineStageCache& StageCache = Subsystem->GetStageCache();
+			FString UpstreamHash;
 
-				// We may have cancelled the model load
-				if (Subsystem->IsStopping()) {
-					UE_LOG(LogTemp, Error, TEXT("Stopping image pipeline after modoel init"));
-					break;
-				}
+			// Randomly seeded stages never produce the same fingerprint twice and neither do the stages after them
+			bool bCacheable = true;
 
+			// Resolve every stage's input and capture the layers they need up front while the view is still the same.
+			// Stages asking for the same layer share one capture.
+			TArray<FStableDiffusionInput> StageInputs;
+			FLayerCaptureSet SharedCaptures;
+			for (UImagePipelineStageAsset* CurrentStage : Stages) {
 				// Optionally override global generation options with per-stage options
 				Input.Options.GuidanceScale = (CurrentStage->OverrideInputOptions.OverrideGuidanceScale) ? CurrentStage->OverrideInputOptions.GuidanceScale : Input.Options.GuidanceScale;
 				Input.Options.Iterations = (CurrentStage->OverrideInputOptions.OverrideIterations) ? CurrentStage->OverrideInputOptions.Iterations : Input.Options.Iterations;
@@ -98,17 +117,65 @@ void UImagePipelineRunner::Activate()
 				Input.OutputType = CurrentStage->OutputType;
 				Input.Options.Seed = (Input.Options.RandomSeed) ? FMath::Rand() : Input.Options.Seed;
 
+				Subsystem->CaptureLayers(Input, ImageSourceType, &SharedCaptures);
+				StageInputs.Add(Input);
+			}
+			SharedCaptures.LogSummary(TEXT("Image pipeline"));
+
+			for (size_t StageIdx = 0; StageIdx < Stages.Num(); ++StageIdx) {
+				if (Subsystem->IsStopping()) {
+					break;
+				}
+
+				// In order to process the pipeline, we need to use both the previous and current stages
+				UImagePipelineStageAsset* PrevStage = (StageIdx) ? Stages[StageIdx - 1] : nullptr;
+				UImagePipelineStageAsset* CurrentStage = Stages[StageIdx];
+				Input = MoveTemp(StageInputs[StageIdx]);
+
 				// Use last image result as input for next stage's layers
 				if (LastStageResult.Completed) {
-					for (auto& Layer : Input.InputLayers) {
+					for (auto& Layer : Input.ProcessedLayers) {
 						if (Layer.OutputType == EImageType::Latent) {
-							Layer.LatentData = LastStageResult.OutLatent;
+							Layer.SharedLatentData = LastStageResult.SharedOutLatent;
 						}
 					}
 				}
 
-				// Generate the image
-				LastStageResult = Subsystem->GenerateImageSync(Input, ImageSourceType);
+				const FString StageHash = FImagePipelineStageCache::HashStage(CurrentStage, Input, UpstreamHash, AllowNSFW, PaddingMode);
+				UpstreamHash = StageHash;
+				bCacheable &= !Input.Options.RandomSeed;
+
+				FCachedStageResult CachedResult;
+				if (bCacheable && StageCache.Find(StageHash, CachedResult)) {
+					UE_LOG(LogTemp, Log, TEXT("Reusing cached result for pipeline stage %d"), StageIdx);
+					LastStageResult = RestoreCachedResult(Subsystem, CachedResult, Input, CurrentStage);
+				}
+				else {
+					// Init model at the start of each stage. Stages sharing a base model only swap their adapters and scheduler.
+					Subsystem->InitModel(CurrentStage->Model->Options, CurrentStage->Pipeline, CurrentStage->LORAAsset, CurrentStage->TextualInversionAsset, CurrentStage->Layers, false, AllowNSFW, PaddingMode, CurrentStage->Scheduler);
+					if (Subsystem->GetModelStatus().ModelStatus != EModelStatus::Loaded) {
+						UE_LOG(LogTemp, Error, TEXT("Failed to load model. Check the output log for more information"));
+						Subsystem->StopGeneratingImage();
+						if(Subsystem->GeneratorBridge){
+							Subsystem->GeneratorBridge->ModelStatus.ErrorMsg = "Failed to load the specified model";
+							Subsystem->GeneratorBridge->ModelStatus.ModelStatus = EModelStatus::Error;
+						}
+						
+						break;
+					}
+
+					// We may have cancelled the model load
+					if (Subsystem->IsStopping()) {
+						UE_LOG(LogTemp, Error, TEXT("Stopping image pipeline after modoel init"));
+						break;
+					}
+
+					// Generate the image
+					LastStageResult = Subsystem->GenerateImageFromCapturedInput(Input);
+					if (bCacheable && LastStageResult.Completed && !Subsystem->IsStopping()) {
+						StageCache.Add(StageHash, MakeCachedResult(LastStageResult));
+					}
+				}
 
 				// Broadcast on game thread
 				if (StageIdx < Stages.Num() - 1) {
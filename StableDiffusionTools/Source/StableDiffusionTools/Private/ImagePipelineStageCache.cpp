@@ -0,0 +1,286 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "ImagePipelineStageCache.h"
+#include "LayerProcessorBase.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Misc/SecureHash.h"
+#include "HAL/FileManager.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+
+namespace
+{
+	constexpr uint32 CacheFileMagic = 'S' | ('D' << 8) | ('S' << 16) | ('C' << 24);
+	constexpr uint32 CacheFileVersion = 1;
+
+	void HashString(FSHA1& Hash, const FString& Value)
+	{
+		FTCHARToUTF8 Converted(*Value);
+		const int32 Length = Converted.Length();
+		Hash.Update(reinterpret_cast<const uint8*>(&Length), sizeof(Length));
+		Hash.Update(reinterpret_cast<const uint8*>(Converted.Get()), Length);
+	}
+
+	void HashBytes(FSHA1& Hash, const void* Data, int64 NumBytes)
+	{
+		Hash.Update(reinterpret_cast<const uint8*>(&NumBytes), sizeof(NumBytes));
+		if (NumBytes > 0) {
+			Hash.Update(static_cast<const uint8*>(Data), NumBytes);
+		}
+	}
+
+	void HashStruct(FSHA1& Hash, const UScriptStruct* Struct, const void* Value)
+	{
+		FString Exported;
+		Struct->ExportText(Exported, Value, nullptr, nullptr, PPF_None, nullptr);
+		HashString(Hash, Exported);
+	}
+
+	// Object references only export their path so instanced and referenced assets have to be hashed separately
+	void HashObject(FSHA1& Hash, const UObject* Object)
+	{
+		if (!Object) {
+			HashString(Hash, TEXT("None"));
+			return;
+		}
+
+		HashString(Hash, Object->GetClass()->GetPathName());
+		for (TFieldIterator<FProperty> It(Object->GetClass()); It; ++It) {
+			if (It->HasAnyPropertyFlags(CPF_Transient))
+				continue;
+
+			FString Exported;
+			It->ExportTextItem_InContainer(Exported, Object, nullptr, nullptr, PPF_None);
+			HashString(Hash, It->GetName());
+			HashString(Hash, Exported);
+		}
+	}
+
+	template<typename ElementType>
+	void WriteArray(FArchive& Ar, TArrayView<const ElementType> Values)
+	{
+		int32 Num = Values.Num();
+		Ar << Num;
+		Ar.Serialize(const_cast<ElementType*>(Values.GetData()), (int64)Num * sizeof(ElementType));
+	}
+
+	template<typename ElementType>
+	void ReadArray(FArchive& Ar, TArray<ElementType>& Values)
+	{
+		int32 Num = 0;
+		Ar << Num;
+		if (Num < 0 || (int64)Num * sizeof(ElementType) > Ar.TotalSize() - Ar.Tell()) {
+			Ar.SetError();
+			return;
+		}
+		Values.SetNumUninitialized(Num);
+		Ar.Serialize(Values.GetData(), (int64)Num * sizeof(ElementType));
+	}
+}
+
+FString FImagePipelineStageCache::HashStage(const UImagePipelineStageAsset* Stage, const FStableDiffusionInput& Input, const FString& UpstreamHash, bool AllowNSFW, EPaddingMode PaddingMode)
+{
+	FSHA1 Hash;
+	HashString(Hash, UpstreamHash);
+
+	// Stage asset and everything it points at
+	HashObject(Hash, Stage);
+	if (Stage) {
+		HashObject(Hash, Stage->Model);
+		HashObject(Hash, Stage->Pipeline);
+		HashObject(Hash, Stage->LORAAsset);
+		HashObject(Hash, Stage->TextualInversionAsset);
+	}
+
+	// Resolved options including the seed actually used
+	HashStruct(Hash, FStableDiffusionGenerationOptions::StaticStruct(), &Input.Options);
+	const uint8 Flags[] = { (uint8)Input.OutputType.GetValue(), (uint8)AllowNSFW, (uint8)PaddingMode, (uint8)Input.bFloatOutput };
+	HashBytes(Hash, Flags, sizeof(Flags));
+
+	// Captured layers
+	for (const FLayerProcessorContext& Layer : Input.ProcessedLayers) {
+		HashObject(Hash, Layer.Processor);
+		HashObject(Hash, Layer.ProcessorOptions);
+		HashString(Hash, Layer.Role);
+		const uint8 LayerFlags[] = { (uint8)Layer.LayerType.GetValue(), (uint8)Layer.OutputType.GetValue() };
+		HashBytes(Hash, LayerFlags, sizeof(LayerFlags));
+		HashBytes(Hash, Layer.SharedLayerPixels.GetData(), Layer.SharedLayerPixels.NumBytes());
+		HashBytes(Hash, Layer.HalfFloatLayerPixels.GetData(), Layer.HalfFloatLayerPixels.NumBytes());
+		HashBytes(Hash, Layer.FloatLayerPixels.GetData(), Layer.FloatLayerPixels.NumBytes());
+	}
+
+	Hash.Final();
+	FSHAHash Result;
+	Hash.GetHash(Result.Hash);
+	return Result.ToString();
+}
+
+bool FImagePipelineStageCache::Find(const FString& Key, FCachedStageResult& OutResult)
+{
+	{
+		FScopeLock Lock(&CacheLock);
+		if (const FCachedStageResult* Found = Entries.Find(Key)) {
+			OutResult = *Found;
+			UseOrder.Remove(Key);
+			UseOrder.Add(Key);
+			return true;
+		}
+	}
+
+	if (!bUseDisk || !LoadFromDisk(Key, OutResult))
+		return false;
+
+	AddToMemory(Key, OutResult);
+	return true;
+}
+
+void FImagePipelineStageCache::Add(const FString& Key, FCachedStageResult Result)
+{
+	if (bUseDisk) {
+		SaveToDisk(Key, Result);
+	}
+	AddToMemory(Key, Result);
+}
+
+void FImagePipelineStageCache::Clear(bool bIncludeDisk)
+{
+	{
+		FScopeLock Lock(&CacheLock);
+		Entries.Empty();
+		UseOrder.Empty();
+		MemoryBytes = 0;
+	}
+
+	if (bIncludeDisk) {
+		IFileManager::Get().DeleteDirectory(*GetCacheDirectory(), false, true);
+	}
+}
+
+FString FImagePipelineStageCache::GetCacheDirectory()
+{
+	return FPaths::ProjectSavedDir() / TEXT("StableDiffusionTools") / TEXT("StageCache");
+}
+
+FString FImagePipelineStageCache::GetCachePath(const FString& Key) const
+{
+	return GetCacheDirectory() / Key + TEXT(".sdstage");
+}
+
+bool FImagePipelineStageCache::LoadFromDisk(const FString& Key, FCachedStageResult& OutResult) const
+{
+	TArray<uint8> FileData;
+	const FString Path = GetCachePath(Key);
+	if (!IFileManager::Get().FileExists(*Path) || !FFileHelper::LoadFileToArray(FileData, *Path))
+		return false;
+
+	FMemoryReader Ar(FileData);
+	uint32 Magic = 0, Version = 0;
+	uint8 OutputType = 0;
+	Ar << Magic << Version;
+	if (Magic != CacheFileMagic || Version != CacheFileVersion) {
+		UE_LOG(LogTemp, Warning, TEXT("Ignoring stage cache file %s written by a different version"), *Path);
+		return false;
+	}
+
+	TArray<FColor> Pixels;
+	TArray<FFloat16Color> HalfFloatPixels;
+	TArray<uint8> Latent;
+	Ar << OutputType << OutResult.Size;
+	ReadArray(Ar, Pixels);
+	ReadArray(Ar, HalfFloatPixels);
+	ReadArray(Ar, Latent);
+	if (Ar.IsError()) {
+		UE_LOG(LogTemp, Warning, TEXT("Stage cache file %s is corrupt"), *Path);
+		return false;
+	}
+
+	OutResult.OutputType = (EImageType)OutputType;
+	OutResult.Pixels = MoveTemp(Pixels);
+	OutResult.HalfFloatPixels = MoveTemp(HalfFloatPixels);
+	OutResult.Latent = MoveTemp(Latent);
+
+	// The timestamp orders files for eviction so touch it on every hit
+	IFileManager::Get().SetTimeStamp(*Path, FDateTime::UtcNow());
+	return true;
+}
+
+void FImagePipelineStageCache::SaveToDisk(const FString& Key, const FCachedStageResult& Result) const
+{
+	TArray<uint8> FileData;
+	FileData.Reserve(Result.GetNumBytes() + 64);
+	FMemoryWriter Ar(FileData);
+
+	uint32 Magic = CacheFileMagic, Version = CacheFileVersion;
+	uint8 OutputType = (uint8)Result.OutputType.GetValue();
+	FIntPoint Size = Result.Size;
+	Ar << Magic << Version << OutputType << Size;
+	WriteArray(Ar, Result.Pixels.View());
+	WriteArray(Ar, Result.HalfFloatPixels.View());
+	WriteArray(Ar, Result.Latent.View());
+
+	const FString Path = GetCachePath(Key);
+	if (!FFileHelper::SaveArrayToFile(FileData, *Path)) {
+		UE_LOG(LogTemp, Warning, TEXT("Failed to write stage cache file %s"), *Path);
+		return;
+	}
+
+	TrimDisk();
+}
+
+void FImagePipelineStageCache::TrimDisk() const
+{
+	struct FCacheFile
+	{
+		FString Path;
+		FDateTime TimeStamp;
+		int64 Size;
+	};
+
+	TArray<FCacheFile> Files;
+	int64 TotalBytes = 0;
+	IFileManager::Get().IterateDirectoryStat(*GetCacheDirectory(), [&Files, &TotalBytes](const TCHAR* Path, const FFileStatData& Stat) {
+		if (!Stat.bIsDirectory && FPaths::GetExtension(Path) == TEXT("sdstage")) {
+			Files.Add({ Path, Stat.ModificationTime, Stat.FileSize });
+			TotalBytes += Stat.FileSize;
+		}
+		return true;
+	});
+
+	if (TotalBytes <= MaxDiskBytes)
+		return;
+
+	// Least recently used first
+	Files.Sort([](const FCacheFile& A, const FCacheFile& B) { return A.TimeStamp < B.TimeStamp; });
+	int32 NumDeleted = 0;
+	for (const FCacheFile& File : Files) {
+		if (TotalBytes <= MaxDiskBytes)
+			break;
+
+		if (IFileManager::Get().Delete(*File.Path, false, false, true)) {
+			TotalBytes -= File.Size;
+			NumDeleted++;
+		}
+	}
+	UE_LOG(LogTemp, Log, TEXT("Deleted %d stage cache files to stay within %.1f MB"), NumDeleted, MaxDiskBytes / (1024.0 * 1024.0));
+}
+
+void FImagePipelineStageCache::AddToMemory(const FString& Key, const FCachedStageResult& Result)
+{
+	FScopeLock Lock(&CacheLock);
+	if (const FCachedStageResult* Existing = Entries.Find(Key)) {
+		MemoryBytes -= Existing->GetNumBytes();
+	}
+	Entries.Add(Key, Result);
+	MemoryBytes += Result.GetNumBytes();
+	UseOrder.Remove(Key);
+	UseOrder.Add(Key);
+
+	while (UseOrder.Num() && (UseOrder.Num() > FMath::Max(MaxMemoryEntries, 0) || MemoryBytes > MaxMemoryBytes)) {
+		if (const FCachedStageResult* Evicted = Entries.Find(UseOrder[0])) {
+			MemoryBytes -= Evicted->GetNumBytes();
+		}
+		Entries.Remove(UseOrder[0]);
+		UseOrder.RemoveAt(0);
+	}
+}
@@ -0,0 +1,117 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "ImageResampler.h"
+#include "Async/ParallelFor.h"
+
+namespace
+{
+	// Source pixels and weights that contribute to one target pixel along an axis
+	struct FResampleTaps
+	{
+		TArray<int32> Starts;
+		TArray<int32> Counts;
+		TArray<float> Weights;
+		int32 MaxTaps = 0;
+	};
+
+	float Lanczos(float X, int32 Lobes)
+	{
+		if (FMath::Abs(X) < UE_SMALL_NUMBER)
+			return 1.0f;
+		if (FMath::Abs(X) >= Lobes)
+			return 0.0f;
+
+		const float PiX = UE_PI * X;
+		return Lobes * FMath::Sin(PiX) * FMath::Sin(PiX / Lobes) / (PiX * PiX);
+	}
+
+	FResampleTaps BuildTaps(int32 SourceLength, int32 TargetLength, int32 Lobes)
+	{
+		const float Scale = (float)TargetLength / (float)SourceLength;
+		const float FilterScale = FMath::Min(Scale, 1.0f);
+		const float Support = Lobes / FilterScale;
+
+		FResampleTaps Taps;
+		Taps.MaxTaps = FMath::CeilToInt(Support) * 2 + 1;
+		Taps.Starts.SetNumUninitialized(TargetLength);
+		Taps.Counts.SetNumUninitialized(TargetLength);
+		Taps.Weights.SetNumZeroed(TargetLength * Taps.MaxTaps);
+
+		for (int32 Target = 0; Target < TargetLength; ++Target) {
+			const float Center = (Target + 0.5f) / Scale - 0.5f;
+			const int32 First = FMath::Max(FMath::FloorToInt(Center - Support) + 1, 0);
+			const int32 Last = FMath::Min(FMath::CeilToInt(Center + Support) - 1, SourceLength - 1);
+			const int32 Count = FMath::Min(FMath::Max(Last - First + 1, 1), Taps.MaxTaps);
+
+			float* Weights = &Taps.Weights[Target * Taps.MaxTaps];
+			float WeightSum = 0.0f;
+			for (int32 Tap = 0; Tap < Count; ++Tap) {
+				Weights[Tap] = Lanczos((First + Tap - Center) * FilterScale, Lobes);
+				WeightSum += Weights[Tap];
+			}
+
+			// Normalise so flat areas stay flat at the edges where the kernel is cut off
+			if (FMath::Abs(WeightSum) > UE_SMALL_NUMBER) {
+				for (int32 Tap = 0; Tap < Count; ++Tap) {
+					Weights[Tap] /= WeightSum;
+				}
+			}
+
+			Taps.Starts[Target] = FMath::Min(First, SourceLength - 1);
+			Taps.Counts[Target] = Count;
+		}
+		return Taps;
+	}
+}
+
+void FImageResampler::ResampleLanczos(TArrayView<const FFloat16Color> Source, const FIntPoint& SourceSize, const FIntPoint& TargetSize, TArray<FFloat16Color>& OutPixels, int32 Lobes)
+{
+	OutPixels.SetNumUninitialized(FMath::Max(TargetSize.X * TargetSize.Y, 0));
+	if (TargetSize.X <= 0 || TargetSize.Y <= 0 || SourceSize.X <= 0 || SourceSize.Y <= 0 || Source.Num() != SourceSize.X * SourceSize.Y)
+		return;
+
+	if (SourceSize == TargetSize) {
+		FMemory::Memcpy(OutPixels.GetData(), Source.GetData(), Source.Num() * sizeof(FFloat16Color));
+		return;
+	}
+
+	const FResampleTaps XTaps = BuildTaps(SourceSize.X, TargetSize.X, Lobes);
+	const FResampleTaps YTaps = BuildTaps(SourceSize.Y, TargetSize.Y, Lobes);
+
+	// Horizontal pass into a float buffer of TargetSize.X x SourceSize.Y
+	TArray<FLinearColor> Horizontal;
+	Horizontal.SetNumUninitialized(TargetSize.X * SourceSize.Y);
+	ParallelFor(SourceSize.Y, [&](int32 Y) {
+		const FFloat16Color* SourceRow = &Source[Y * SourceSize.X];
+		FLinearColor* OutRow = &Horizontal[Y * TargetSize.X];
+		for (int32 X = 0; X < TargetSize.X; ++X) {
+			const float* Weights = &XTaps.Weights[X * XTaps.MaxTaps];
+			const FFloat16Color* Taps = &SourceRow[XTaps.Starts[X]];
+			FLinearColor Sum(0.0f, 0.0f, 0.0f, 0.0f);
+			for (int32 Tap = 0; Tap < XTaps.Counts[X]; ++Tap) {
+				Sum += FLinearColor(Taps[Tap]) * Weights[Tap];
+			}
+			OutRow[X] = Sum;
+		}
+	});
+
+	// Vertical pass into the output. Rows are accumulated whole so the reads stay sequential.
+	ParallelFor(TargetSize.Y, [&](int32 Y) {
+		const float* Weights = &YTaps.Weights[Y * YTaps.MaxTaps];
+		const int32 FirstRow = YTaps.Starts[Y];
+
+		TArray<FLinearColor> Sum;
+		Sum.SetNumZeroed(TargetSize.X);
+		for (int32 Tap = 0; Tap < YTaps.Counts[Y]; ++Tap) {
+			const FLinearColor* SourceRow = &Horizontal[(FirstRow + Tap) * TargetSize.X];
+			for (int32 X = 0; X < TargetSize.X; ++X) {
+				Sum[X] += SourceRow[X] * Weights[Tap];
+			}
+		}
+
+		FFloat16Color* OutRow = &OutPixels[Y * TargetSize.X];
+		for (int32 X = 0; X < TargetSize.X; ++X) {
+			OutRow[X] = FFloat16Color(Sum[X]);
+		}
+	});
+}
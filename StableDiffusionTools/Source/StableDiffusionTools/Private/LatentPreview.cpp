@@ -0,0 +1,149 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "LatentPreview.h"
+#include "Math/VectorRegister.h"
+
+namespace
+{
+	FLatentPreviewCoefficients MakeCoefficients(std::initializer_list<FVector> Factors, const FVector& Bias = FVector::ZeroVector)
+	{
+		FLatentPreviewCoefficients Coefficients;
+		Coefficients.ChannelFactors = TArray<FVector>(Factors);
+		Coefficients.Bias = Bias;
+		return Coefficients;
+	}
+}
+
+const FLatentPreviewCoefficients& FLatentPreview::GetDefaultCoefficients(ELatentModelFamily Family, int32 NumChannels)
+{
+	// SD1.x/2.x latents are centred well enough that their projection needs no bias
+	static const FLatentPreviewCoefficients SD1 = MakeCoefficients({
+		FVector(0.3512, 0.2297, 0.3227),
+		FVector(0.3250, 0.4974, 0.2350),
+		FVector(-0.2829, 0.1762, 0.2721),
+		FVector(-0.2120, -0.2616, -0.7177)
+	});
+
+	static const FLatentPreviewCoefficients SDXL = MakeCoefficients({
+		FVector(0.3651, 0.4232, 0.4341),
+		FVector(-0.2533, -0.0042, 0.1068),
+		FVector(0.1076, 0.1111, -0.0362),
+		FVector(-0.3165, -0.2492, -0.2188)
+	}, FVector(0.1084, -0.0175, -0.0011));
+
+	static const FLatentPreviewCoefficients SD3 = MakeCoefficients({
+		FVector(-0.0645, 0.0177, 0.1052),
+		FVector(0.0028, 0.0312, 0.0650),
+		FVector(0.1848, 0.0762, 0.0360),
+		FVector(0.0944, 0.0360, 0.0889),
+		FVector(0.0897, 0.0506, -0.0364),
+		FVector(-0.0020, 0.1203, 0.0284),
+		FVector(0.0855, 0.0118, 0.0283),
+		FVector(-0.0539, 0.0658, 0.1047),
+		FVector(-0.0057, 0.0116, 0.0700),
+		FVector(-0.0412, 0.0281, -0.0039),
+		FVector(0.1106, 0.1171, 0.1220),
+		FVector(-0.0248, 0.0682, -0.0481),
+		FVector(0.0815, 0.0846, 0.1207),
+		FVector(-0.0120, -0.0055, -0.0867),
+		FVector(-0.0749, -0.0634, -0.0456),
+		FVector(-0.1418, -0.1457, -0.1259)
+	});
+
+	if (Family == ELatentModelFamily::Auto) {
+		Family = GetFamilyFromChannelCount(NumChannels);
+	}
+
+	switch (Family) {
+	case ELatentModelFamily::SDXL:
+		return SDXL;
+	case ELatentModelFamily::SD3:
+		return SD3;
+	default:
+		return SD1;
+	}
+}
+
+ELatentModelFamily FLatentPreview::GetFamilyFromChannelCount(int32 NumChannels)
+{
+	return (NumChannels == 16) ? ELatentModelFamily::SD3 : ELatentModelFamily::SD1;
+}
+
+bool FLatentPreview::ProjectLatentsToColors(const TArrayView<const float> Latents, int32 NumChannels, const FIntPoint& LatentSize, const FLatentPreviewCoefficients& Coefficients, const FIntPoint& OutSize, TArray<FColor>& OutPixels)
+{
+	const int32 PlaneSize = LatentSize.X * LatentSize.Y;
+	if (NumChannels <= 0 || PlaneSize <= 0 || OutSize.X <= 0 || OutSize.Y <= 0) {
+		return false;
+	}
+
+	if (Latents.Num() != NumChannels * PlaneSize) {
+		UE_LOG(LogTemp, Warning, TEXT("Latent preview buffer has %d values but expected %d for a %dx%dx%d latent"), Latents.Num(), NumChannels * PlaneSize, NumChannels, LatentSize.X, LatentSize.Y);
+		return false;
+	}
+
+	if (Coefficients.NumChannels() != NumChannels) {
+		UE_LOG(LogTemp, Warning, TEXT("Latent preview coefficients have %d channels but the latents have %d"), Coefficients.NumChannels(), NumChannels);
+		return false;
+	}
+
+	// Project every latent pixel into RGB. Latents are planar so each channel is a contiguous plane.
+	TArray<VectorRegister4Float> Factors;
+	Factors.Reserve(NumChannels);
+	for (const FVector& Factor : Coefficients.ChannelFactors) {
+		Factors.Add(MakeVectorRegisterFloat((float)Factor.X, (float)Factor.Y, (float)Factor.Z, 0.0f));
+	}
+
+	const VectorRegister4Float Bias = MakeVectorRegisterFloat((float)Coefficients.Bias.X, (float)Coefficients.Bias.Y, (float)Coefficients.Bias.Z, 0.0f);
+	const VectorRegister4Float Half = VectorSetFloat1(0.5f);
+	const VectorRegister4Float Zero = VectorZeroFloat();
+	const VectorRegister4Float One = VectorOneFloat();
+
+	TArray<FLinearColor> Projected;
+	Projected.SetNumUninitialized(PlaneSize);
+	const float* LatentData = Latents.GetData();
+	for (int32 PixelIdx = 0; PixelIdx < PlaneSize; ++PixelIdx) {
+		VectorRegister4Float Color = Bias;
+		for (int32 Channel = 0; Channel < NumChannels; ++Channel) {
+			Color = VectorMultiplyAdd(VectorLoadFloat1(&LatentData[Channel * PlaneSize + PixelIdx]), Factors[Channel], Color);
+		}
+
+		// Remap from [-1, 1] into [0, 1]
+		Color = VectorMin(VectorMax(VectorMultiplyAdd(Color, Half, Half), Zero), One);
+		VectorStore(Color, &Projected[PixelIdx].R);
+	}
+
+	// Bilinear upscale from latent resolution to the output resolution
+	OutPixels.SetNumUninitialized(OutSize.X * OutSize.Y);
+	const float ScaleX = (float)LatentSize.X / (float)OutSize.X;
+	const float ScaleY = (float)LatentSize.Y / (float)OutSize.Y;
+	const VectorRegister4Float ByteScale = VectorSetFloat1(255.0f);
+
+	for (int32 Y = 0; Y < OutSize.Y; ++Y) {
+		const float SrcY = FMath::Clamp((Y + 0.5f) * ScaleY - 0.5f, 0.0f, (float)(LatentSize.Y - 1));
+		const int32 Y0 = (int32)SrcY;
+		const int32 Y1 = FMath::Min(Y0 + 1, LatentSize.Y - 1);
+		const VectorRegister4Float FracY = VectorSetFloat1(SrcY - Y0);
+
+		for (int32 X = 0; X < OutSize.X; ++X) {
+			const float SrcX = FMath::Clamp((X + 0.5f) * ScaleX - 0.5f, 0.0f, (float)(LatentSize.X - 1));
+			const int32 X0 = (int32)SrcX;
+			const int32 X1 = FMath::Min(X0 + 1, LatentSize.X - 1);
+			const VectorRegister4Float FracX = VectorSetFloat1(SrcX - X0);
+
+			const VectorRegister4Float C00 = VectorLoad(&Projected[Y0 * LatentSize.X + X0].R);
+			const VectorRegister4Float C10 = VectorLoad(&Projected[Y0 * LatentSize.X + X1].R);
+			const VectorRegister4Float C01 = VectorLoad(&Projected[Y1 * LatentSize.X + X0].R);
+			const VectorRegister4Float C11 = VectorLoad(&Projected[Y1 * LatentSize.X + X1].R);
+
+			const VectorRegister4Float Top = VectorLerp(C00, C10, FracX);
+			const VectorRegister4Float Bottom = VectorLerp(C01, C11, FracX);
+			const VectorRegister4Float Color = VectorMultiply(VectorLerp(Top, Bottom, FracY), ByteScale);
+
+			alignas(16) float Out[4];
+			VectorStoreAligned(Color, Out);
+			OutPixels[Y * OutSize.X + X] = FColor((uint8)(Out[0] + 0.5f), (uint8)(Out[1] + 0.5f), (uint8)(Out[2] + 0.5f), 255);
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,48 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "LayerCaptureSet.h"
+#include "LayerProcessorBase.h"
+
+bool FLayerCaptureSet::Find(const FLayerProcessorContext& Layer, const FIntPoint& Size, FLayerProcessorContext& OutLayer)
+{
+	NumRequested++;
+
+	const FLayerProcessorContext* Found = Captured.Find(GetKey(Layer, Size));
+	if (!Found)
+		return false;
+
+	// Latents come from the request itself so only the pixels are shared
+	OutLayer.SharedLayerPixels = Found->SharedLayerPixels;
+	OutLayer.HalfFloatLayerPixels = Found->HalfFloatLayerPixels;
+	OutLayer.FloatLayerPixels = Found->FloatLayerPixels;
+	return true;
+}
+
+void FLayerCaptureSet::Add(const FLayerProcessorContext& CapturedLayer, const FIntPoint& Size)
+{
+	Captured.Add(GetKey(CapturedLayer, Size), CapturedLayer);
+}
+
+void FLayerCaptureSet::LogSummary(const TCHAR* Context) const
+{
+	UE_LOG(LogTemp, Log, TEXT("%s: captured %d distinct layers for %d layer requests, saving %d captures"), Context, Captured.Num(), NumRequested, FMath::Max(NumRequested - Captured.Num(), 0));
+}
+
+FString FLayerCaptureSet::GetKey(const FLayerProcessorContext& Layer, const FIntPoint& Size)
+{
+	FString Key = FString::Printf(TEXT("%s|%dx%d"), Layer.Processor ? *Layer.Processor->GetPathName() : TEXT("None"), Size.X, Size.Y);
+	if (Layer.Processor) {
+		Key += FString::Printf(TEXT("|%d"), (int32)Layer.Processor->GetOutputBitDepth());
+	}
+
+	// Options are usually instanced per layer so compare them by value
+	if (const ULayerProcessorOptions* Options = Layer.ProcessorOptions) {
+		Key += TEXT("|") + Options->GetClass()->GetPathName();
+		for (TFieldIterator<FProperty> It(Options->GetClass()); It; ++It) {
+			FString Value;
+			It->ExportTextItem_InContainer(Value, Options, nullptr, nullptr, PPF_None);
+			Key += TEXT("|") + Value;
+		}
+	}
+	return Key;
+}
@@ -40,8 +40,8 @@ void ULayerProcessorBase::BeginCaptureLayer_Implementation(UWorld* World, FIntPo
 		//auto LastBlendables = CaptureSource->PostProcessSettings.WeightedBlendables;
 		//auto LastAlwaysPersist = CaptureSource->bAlwaysPersistRenderingState;
 
-		// Set capture overrides
-		CaptureSource->bCaptureEveryFrame = true;
+		// Set capture overrides. Layers are rendered on demand by CaptureLayer instead of every tick.
+		CaptureSource->bCaptureEveryFrame = false;
 		CaptureSource->bCaptureOnMovement = false;
 		CaptureSource->CompositeMode = SCCM_Overwrite;
 		CaptureSource->bAlwaysPersistRenderingState = true;
@@ -118,6 +118,65 @@ TArray<FLinearColor> ULayerProcessorBase::ProcessLinearLayer(UTextureRenderTarge
 	return MoveTemp(FinalColor);
 }
 
+TArray<FFloat16Color> ULayerProcessorBase::ProcessHalfFloatLayer(UTextureRenderTarget2D* Layer)
+{
+	TArray<FFloat16Color> FinalColor;
+	if (IsValid(Layer)) {
+		FTextureRenderTargetResource* FullFrameRT_TexRes = Layer->GameThread_GetRenderTargetResource();
+		FullFrameRT_TexRes->ReadFloat16Pixels(FinalColor);
+	}
+	return MoveTemp(FinalColor);
+}
+
+void ULayerProcessorBase::ProcessLayerPixels(UTextureRenderTarget2D* Layer, FLayerProcessorContext& Context)
+{
+	Context.ResetPixels();
+
+	switch (GetOutputBitDepth()) {
+	case SixteenBit:
+		Context.HalfFloatLayerPixels = ProcessHalfFloatLayer(Layer);
+		break;
+	case ThirtyTwoBit:
+		Context.FloatLayerPixels = ProcessLinearLayer(Layer);
+		break;
+	default:
+		Context.SharedLayerPixels = ProcessLayer(Layer);
+		break;
+	}
+}
+
+ELayerBitDepth ULayerProcessorBase::GetOutputBitDepth() const
+{
+	return FMath::Min(OutputBitDepth.GetValue(), CaptureBitDepth.GetValue());
+}
+
+bool ULayerProcessorBase::ReadRenderTargetPixels(FRenderTarget* RenderTarget, ELayerBitDepth BitDepth, FLayerProcessorContext& Context)
+{
+	if (!RenderTarget)
+		return false;
+
+	// Reuse the context's buffers if nothing else shares them
+	bool bSuccess = false;
+	switch (BitDepth) {
+	case SixteenBit:
+		bSuccess = RenderTarget->ReadFloat16Pixels(Context.HalfFloatLayerPixels.GetMutable());
+		Context.SharedLayerPixels.Reset();
+		Context.FloatLayerPixels.Reset();
+		break;
+	case ThirtyTwoBit:
+		bSuccess = RenderTarget->ReadLinearColorPixels(Context.FloatLayerPixels.GetMutable(), FReadSurfaceDataFlags());
+		Context.SharedLayerPixels.Reset();
+		Context.HalfFloatLayerPixels.Reset();
+		break;
+	default:
+		bSuccess = RenderTarget->ReadPixels(Context.SharedLayerPixels.GetMutable(), FReadSurfaceDataFlags());
+		Context.HalfFloatLayerPixels.Reset();
+		Context.FloatLayerPixels.Reset();
+		break;
+	}
+	return bSuccess;
+}
+
 UMaterialInterface* ULayerProcessorBase::GetActivePostMaterial()
 {
 	return ActivePostMaterialInstance;
@@ -125,9 +184,17 @@ UMaterialInterface* ULayerProcessorBase::GetActivePostMaterial()
 
 UTextureRenderTarget2D* ULayerProcessorBase::GetOrAllocateRenderTarget(FIntPoint Size)
 {
-	if (!RenderTarget->IsValidLowLevel() || RenderTarget->SizeX != Size.X || RenderTarget->SizeY != Size.Y) {
+	EPixelFormat Format = PF_R8G8B8A8;
+	if (CaptureBitDepth == SixteenBit) {
+		Format = PF_FloatRGBA;
+	}
+	else if (CaptureBitDepth == ThirtyTwoBit) {
+		Format = PF_A32B32G32R32F;
+	}
+
+	if (!RenderTarget->IsValidLowLevel() || RenderTarget->SizeX != Size.X || RenderTarget->SizeY != Size.Y || RenderTarget->GetFormat() != Format) {
 		RenderTarget = NewObject<UTextureRenderTarget2D>(this);
-		RenderTarget->InitCustomFormat(Size.X, Size.Y, (CaptureBitDepth == EightBit) ? PF_R8G8B8A8 : PF_FloatRGBA, false);
+		RenderTarget->InitCustomFormat(Size.X, Size.Y, Format, false);
 		RenderTarget->UpdateResourceImmediate(true);
 	}	
 	check(RenderTarget);
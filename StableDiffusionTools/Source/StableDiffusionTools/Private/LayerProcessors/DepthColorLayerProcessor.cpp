@@ -6,6 +6,7 @@
 UDepthLayerProcessor::UDepthLayerProcessor()
 {
 	CaptureBitDepth = SixteenBit;
+	bLinearData = true;
 }
 
 ULayerProcessorOptions* UDepthLayerProcessor::AllocateLayerOptions_Implementation()
@@ -59,3 +60,25 @@ TArray<FColor> UDepthLayerProcessor::ProcessLayer(UTextureRenderTarget2D* Layer)
 
 	return DepthPixels;
 }
+
+TArray<FLinearColor> UDepthLayerProcessor::ProcessLinearLayer(UTextureRenderTarget2D* Layer)
+{
+	// Depth is only stored in the red channel
+	TArray<FLinearColor> DepthPixels = Super::ProcessLinearLayer(Layer);
+	for (FLinearColor& Pixel : DepthPixels) {
+		Pixel = FLinearColor(Pixel.R, Pixel.R, Pixel.R, 1.0f);
+	}
+	return DepthPixels;
+}
+
+TArray<FFloat16Color> UDepthLayerProcessor::ProcessHalfFloatLayer(UTextureRenderTarget2D* Layer)
+{
+	TArray<FFloat16Color> DepthPixels = Super::ProcessHalfFloatLayer(Layer);
+	const FFloat16 One(1.0f);
+	for (FFloat16Color& Pixel : DepthPixels) {
+		Pixel.G = Pixel.R;
+		Pixel.B = Pixel.R;
+		Pixel.A = One;
+	}
+	return DepthPixels;
+}
@@ -1,3 +1,8 @@
 #include "LayerProcessors/NormalLayerProcessor.h"
 #include "Components/SceneCaptureComponent2D.h"
 #include "Engine/TextureRenderTarget2D.h"
+
+UNormalLayerProcessor::UNormalLayerProcessor()
+{
+	bLinearData = true;
+}
@@ -0,0 +1,119 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "PreviewQualityController.h"
+
+namespace
+{
+	// Resolution scales are quantised so measurements can be matched up again
+	constexpr float ScaleStep = 0.125f;
+
+	double GetWork(float Scale, int32 Iterations)
+	{
+		return (double)Scale * Scale * Iterations;
+	}
+
+	bool IsOnScaleGrid(float Scale)
+	{
+		return FMath::IsNearlyEqual(FMath::GridSnap(Scale, ScaleStep), Scale, KINDA_SMALL_NUMBER);
+	}
+}
+
+FPreviewQualitySettings FPreviewQualityController::Choose(const FAdaptiveQualityOptions& Options, float MaxScale, int32 MaxIterations, const TArray<FString>& CompatibleSchedulers) const
+{
+	// Only scales on the grid are chosen so every measurement has a key of its own
+	const float MinScale = FMath::Clamp(FMath::CeilToFloat(Options.MinResolutionScale / ScaleStep - KINDA_SMALL_NUMBER) * ScaleStep, ScaleStep, 1.0f);
+	MaxScale = FMath::Clamp(FMath::FloorToFloat(MaxScale / ScaleStep + KINDA_SMALL_NUMBER) * ScaleStep, MinScale, 1.0f);
+	const int32 MinIterations = FMath::Clamp(Options.MinIterations, 1, FMath::Max(MaxIterations, 1));
+	MaxIterations = FMath::Max(MaxIterations, MinIterations);
+
+	FString FastScheduler;
+	if (Options.bAdaptScheduler) {
+		if (const FString* Found = Options.FastSchedulers.FindByPredicate([&CompatibleSchedulers](const FString& Scheduler) { return CompatibleSchedulers.Contains(Scheduler); })) {
+			FastScheduler = *Found;
+		}
+	}
+
+	FScopeLock Lock(&ControllerLock);
+
+	FPreviewQualitySettings Best;
+	Best.ResolutionScale = MinScale;
+	Best.Iterations = MinIterations;
+	double BestWork = -1.0;
+
+	// Try every scale from the top down and keep the configuration with the most work that fits the budget
+	for (float Scale = MaxScale; Scale >= MinScale - KINDA_SMALL_NUMBER; Scale = FMath::GridSnap(Scale - ScaleStep, ScaleStep)) {
+		for (int32 Iterations = MaxIterations; Iterations >= MinIterations; --Iterations) {
+			const FString Scheduler = (!FastScheduler.IsEmpty() && Iterations <= Options.FastSchedulerMaxIterations) ? FastScheduler : FString();
+			const double Predicted = Predict(Scale, Iterations, Scheduler);
+
+			// Nothing measured yet so start at full quality and adapt from there
+			if (Predicted < 0.0) {
+				Best.ResolutionScale = MaxScale;
+				Best.Iterations = MaxIterations;
+				Best.Scheduler = (!FastScheduler.IsEmpty() && MaxIterations <= Options.FastSchedulerMaxIterations) ? FastScheduler : FString();
+				Best.PredictedLatency = -1.0f;
+				return Best;
+			}
+
+			const double Work = GetWork(Scale, Iterations);
+			if (Predicted <= Options.TargetLatency && Work > BestWork) {
+				Best.ResolutionScale = Scale;
+				Best.Iterations = Iterations;
+				Best.Scheduler = Scheduler;
+				Best.PredictedLatency = Predicted;
+				BestWork = Work;
+				break;
+			}
+		}
+	}
+
+	// Nothing fits so go as cheap as allowed
+	if (BestWork < 0.0) {
+		Best.Scheduler = (!FastScheduler.IsEmpty() && MinIterations <= Options.FastSchedulerMaxIterations) ? FastScheduler : FString();
+		Best.PredictedLatency = Predict(MinScale, MinIterations, Best.Scheduler);
+	}
+	return Best;
+}
+
+void FPreviewQualityController::Record(const FPreviewQualitySettings& Settings, double Seconds)
+{
+	if (Seconds <= 0.0 || Settings.Iterations <= 0)
+		return;
+
+	FScopeLock Lock(&ControllerLock);
+
+	// Scales off the grid, like fixed draft scales, would share a key with a neighbouring grid scale. They still feed the cost model.
+	if (IsOnScaleGrid(Settings.ResolutionScale)) {
+		double& Latency = ConfigLatency.FindOrAdd(GetConfigKey(Settings.ResolutionScale, Settings.Iterations, Settings.Scheduler), Seconds);
+		Latency = FMath::Lerp(Latency, Seconds, Smoothing);
+	}
+
+	const double Cost = Seconds / GetWork(Settings.ResolutionScale, Settings.Iterations);
+	double& AverageCost = SecondsPerWork.FindOrAdd(Settings.Scheduler, Cost);
+	AverageCost = FMath::Lerp(AverageCost, Cost, Smoothing);
+}
+
+void FPreviewQualityController::Reset()
+{
+	FScopeLock Lock(&ControllerLock);
+	ConfigLatency.Empty();
+	SecondsPerWork.Empty();
+}
+
+FString FPreviewQualityController::GetConfigKey(float Scale, int32 Iterations, const FString& Scheduler)
+{
+	return FString::Printf(TEXT("%d|%d|%s"), FMath::RoundToInt(Scale / ScaleStep), Iterations, *Scheduler);
+}
+
+double FPreviewQualityController::Predict(float Scale, int32 Iterations, const FString& Scheduler) const
+{
+	if (const double* Measured = ConfigLatency.Find(GetConfigKey(Scale, Iterations, Scheduler)))
+		return *Measured;
+
+	// Fall back to the default scheduler's costs for schedulers that haven't been tried yet
+	const double* Cost = SecondsPerWork.Find(Scheduler);
+	if (!Cost) {
+		Cost = SecondsPerWork.Find(FString());
+	}
+	return Cost ? *Cost * GetWork(Scale, Iterations) : -1.0;
+}
@@ -0,0 +1,273 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "SceneChangeTrigger.h"
+#include "Editor.h"
+#include "Components/PrimitiveComponent.h"
+#include "Components/LightComponent.h"
+#include "Engine/SceneCapture.h"
+#include "Materials/Material.h"
+#include "Materials/MaterialInstance.h"
+#include "Materials/MaterialInstanceDynamic.h"
+#include "Kismet/GameplayStatics.h"
+#include "SceneManagement.h"
+#include "ConvexVolume.h"
+#include "UObject/UObjectIterator.h"
+
+namespace
+{
+	// Adds the bounds of everything Object can be seen through. Returns false if Object has no bounds to test.
+	bool GatherBounds(UObject* Object, TArray<FBoxSphereBounds>& OutBounds)
+	{
+		if (UPrimitiveComponent* Primitive = Cast<UPrimitiveComponent>(Object)) {
+			OutBounds.Add(Primitive->Bounds);
+			return true;
+		}
+		if (ULightComponent* Light = Cast<ULightComponent>(Object)) {
+			OutBounds.Add(FBoxSphereBounds(Light->GetBoundingSphere()));
+			return true;
+		}
+		if (UActorComponent* Component = Cast<UActorComponent>(Object)) {
+			return Component->GetOwner() ? GatherBounds(Component->GetOwner(), OutBounds) : false;
+		}
+		if (AActor* Actor = Cast<AActor>(Object)) {
+			const int32 NumBounds = OutBounds.Num();
+			Actor->ForEachComponent(false, [&OutBounds](UActorComponent* Component) {
+				if (Component->IsA<UPrimitiveComponent>() || Component->IsA<ULightComponent>())
+					GatherBounds(Component, OutBounds);
+			});
+			return OutBounds.Num() > NumBounds;
+		}
+		return false;
+	}
+
+	bool UsesMaterial(UMaterialInterface* Used, const UMaterialInterface* Changed)
+	{
+		// Edits to a parent show up in all of its instances
+		while (Used) {
+			if (Used == Changed)
+				return true;
+			UMaterialInstance* Instance = Cast<UMaterialInstance>(Used);
+			Used = Instance ? Instance->Parent.Get() : nullptr;
+		}
+		return false;
+	}
+
+	// Skips helpers such as the aspect overlay and the scene captures spawned for every capture, and anything outside the editor world
+	bool IsLevelObject(UObject* Object)
+	{
+		UWorld* EditorWorld = GEditor ? GEditor->GetEditorWorldContext().World() : nullptr;
+		if (const UMaterialInterface* Material = Cast<UMaterialInterface>(Object)) {
+			// Dynamic instances such as the ones layer processors create for every capture are edited all the time
+			if (Material->HasAnyFlags(RF_Transient) || Material->IsIn(GetTransientPackage()))
+				return false;
+			if (Material->IsAsset())
+				return true;
+
+			// Instances saved with the level
+			const ULevel* Level = Material->GetTypedOuter<ULevel>();
+			return Level && !Material->IsA<UMaterialInstanceDynamic>() && Level->GetWorld() == EditorWorld;
+		}
+
+		const AActor* Actor = Cast<AActor>(Object);
+		if (const UActorComponent* Component = Cast<UActorComponent>(Object)) {
+			Actor = Component->GetOwner();
+		}
+		if (!Actor || Actor->HasAnyFlags(RF_Transient) || Actor->IsA<ASceneCapture>())
+			return false;
+
+		return EditorWorld && Actor->GetWorld() == EditorWorld;
+	}
+}
+
+FSceneChangeTrigger::~FSceneChangeTrigger()
+{
+	Stop();
+}
+
+void FSceneChangeTrigger::Start(const FSceneChangeTriggerOptions& InOptions, TFunction<FMinimalViewInfo()> InGetView, TFunction<void()> InOnSceneChanged)
+{
+	check(IsInGameThread());
+	Stop();
+
+	if (!InOptions.bEnabled || !GEditor)
+		return;
+
+	Options = InOptions;
+	GetView = MoveTemp(InGetView);
+	OnSceneChanged = MoveTemp(InOnSceneChanged);
+	bRunning = true;
+
+	ActorMovedHandle = GEngine->OnActorMoved().AddRaw(this, &FSceneChangeTrigger::OnActorMoved);
+	ActorAddedHandle = GEngine->OnLevelActorAdded().AddRaw(this, &FSceneChangeTrigger::OnActorAddedOrRemoved);
+	ActorDeletedHandle = GEngine->OnLevelActorDeleted().AddRaw(this, &FSceneChangeTrigger::OnActorAddedOrRemoved);
+	BeginMovementHandle = GEditor->OnBeginObjectMovement().AddRaw(this, &FSceneChangeTrigger::OnBeginObjectMovement);
+	PropertyChangedHandle = FCoreUObjectDelegates::OnObjectPropertyChanged.AddRaw(this, &FSceneChangeTrigger::OnObjectPropertyChanged);
+	MaterialCompiledHandle = UMaterial::OnMaterialCompilationFinished().AddRaw(this, &FSceneChangeTrigger::OnMaterialCompiled);
+}
+
+void FSceneChangeTrigger::Stop()
+{
+	if (!bRunning)
+		return;
+	bRunning = false;
+
+	if (GEngine) {
+		GEngine->OnActorMoved().Remove(ActorMovedHandle);
+		GEngine->OnLevelActorAdded().Remove(ActorAddedHandle);
+		GEngine->OnLevelActorDeleted().Remove(ActorDeletedHandle);
+	}
+	if (GEditor) {
+		GEditor->OnBeginObjectMovement().Remove(BeginMovementHandle);
+	}
+	FCoreUObjectDelegates::OnObjectPropertyChanged.Remove(PropertyChangedHandle);
+	UMaterial::OnMaterialCompilationFinished().Remove(MaterialCompiledHandle);
+	ActorMovedHandle.Reset();
+	ActorAddedHandle.Reset();
+	ActorDeletedHandle.Reset();
+	BeginMovementHandle.Reset();
+	PropertyChangedHandle.Reset();
+	MaterialCompiledHandle.Reset();
+
+	if (TickerHandle.IsValid()) {
+		FTSTicker::GetCoreTicker().RemoveTicker(TickerHandle);
+		TickerHandle.Reset();
+	}
+	ChangedObjects.Reset();
+	ChangedBounds.Reset();
+	bUnboundedChange = false;
+}
+
+void FSceneChangeTrigger::OnActorMoved(AActor* Actor)
+{
+	AddChange(Actor);
+}
+
+void FSceneChangeTrigger::OnActorAddedOrRemoved(AActor* Actor)
+{
+	if (!Actor || !IsLevelObject(Actor))
+		return;
+
+	// Deleted actors are gone by the time the burst is checked so their bounds are kept instead
+	if (!GatherBounds(Actor, ChangedBounds)) {
+		bUnboundedChange = true;
+	}
+	AddChange(nullptr);
+}
+
+void FSceneChangeTrigger::OnBeginObjectMovement(UObject& Object)
+{
+	// Something moved out of view changes the capture as much as something moved into it
+	if (IsLevelObject(&Object)) {
+		GatherBounds(&Object, ChangedBounds);
+	}
+}
+
+void FSceneChangeTrigger::OnObjectPropertyChanged(UObject* Object, FPropertyChangedEvent& Event)
+{
+	if (Object && (Object->IsA<AActor>() || Object->IsA<UActorComponent>() || Object->IsA<UMaterialInterface>()))
+		AddChange(Object);
+}
+
+void FSceneChangeTrigger::OnMaterialCompiled(UMaterialInterface* Material)
+{
+	AddChange(Material);
+}
+
+void FSceneChangeTrigger::AddChange(UObject* Object)
+{
+	if (Object) {
+		if (!IsLevelObject(Object))
+			return;
+		ChangedObjects.Add(Object);
+	}
+
+	LastChangeTime = FPlatformTime::Seconds();
+	if (!TickerHandle.IsValid()) {
+		FirstChangeTime = LastChangeTime;
+		TickerHandle = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateRaw(this, &FSceneChangeTrigger::Tick));
+	}
+}
+
+bool FSceneChangeTrigger::Tick(float DeltaTime)
+{
+	// Wait for the burst to settle, but don't let a steady stream of edits hold the preview back forever
+	const double Now = FPlatformTime::Seconds();
+	if (Now - LastChangeTime < Options.DebounceTime && Now - FirstChangeTime < Options.MaxDelay)
+		return true;
+
+	const bool bVisible = !Options.bOnlyVisibleChanges || IsAnyChangeVisible();
+	ChangedObjects.Reset();
+	ChangedBounds.Reset();
+	bUnboundedChange = false;
+	TickerHandle.Reset();
+
+	if (bVisible && OnSceneChanged) {
+		OnSceneChanged();
+	}
+	return false;
+}
+
+bool FSceneChangeTrigger::IsAnyChangeVisible() const
+{
+	if (bUnboundedChange || !GetView)
+		return true;
+
+	FMinimalViewInfo View = GetView();
+	FMatrix ViewMatrix, ProjectionMatrix, ViewProjectionMatrix;
+	UGameplayStatics::GetViewProjectionMatrix(View, ViewMatrix, ProjectionMatrix, ViewProjectionMatrix);
+	FConvexVolume Frustum;
+	GetViewFrustumBounds(Frustum, ViewProjectionMatrix, false);
+
+	auto IsInView = [&Frustum](const FBoxSphereBounds& Bounds) {
+		return Frustum.IntersectBox(Bounds.Origin, Bounds.BoxExtent);
+	};
+
+	for (const FBoxSphereBounds& Bounds : ChangedBounds) {
+		if (IsInView(Bounds))
+			return true;
+	}
+
+	TArray<const UMaterialInterface*> ChangedMaterials;
+	TArray<FBoxSphereBounds> ObjectBounds;
+	for (const TWeakObjectPtr<UObject>& WeakObject : ChangedObjects) {
+		UObject* Object = WeakObject.Get();
+		if (!Object)
+			continue;
+
+		if (const UMaterialInterface* Material = Cast<UMaterialInterface>(Object)) {
+			ChangedMaterials.Add(Material);
+			continue;
+		}
+
+		// Actors without anything to render, like fog or sky settings, can change the whole frame
+		ObjectBounds.Reset();
+		if (!GatherBounds(Object, ObjectBounds))
+			return true;
+		for (const FBoxSphereBounds& Bounds : ObjectBounds) {
+			if (IsInView(Bounds))
+				return true;
+		}
+	}
+
+	if (ChangedMaterials.Num() == 0)
+		return false;
+
+	// Material edits only matter if something in view is drawn with them
+	UWorld* World = GEditor ? GEditor->GetEditorWorldContext().World() : nullptr;
+	TArray<UMaterialInterface*> UsedMaterials;
+	for (TObjectIterator<UPrimitiveComponent> It; It; ++It) {
+		UPrimitiveComponent* Primitive = *It;
+		if (Primitive->GetWorld() != World || !Primitive->IsRegistered() || !IsInView(Primitive->Bounds))
+			continue;
+
+		UsedMaterials.Reset();
+		Primitive->GetUsedMaterials(UsedMaterials);
+		for (UMaterialInterface* Used : UsedMaterials) {
+			for (const UMaterialInterface* Changed : ChangedMaterials) {
+				if (UsesMaterial(Used, Changed))
+					return true;
+			}
+		}
+	}
+	return false;
+}
@@ -0,0 +1,73 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "ScopedTexturePixels.h"
+#include "StableDiffusionBlueprintLibrary.h"
+
+FScopedTexturePixels::FScopedTexturePixels(UTexture2D* Texture)
+{
+	if (!::IsValid(Texture))
+		return;
+
+	const int32 NumPixels = Texture->GetSizeX() * Texture->GetSizeY();
+	if (NumPixels <= 0)
+		return;
+
+	// Generated textures keep their pixels in an uncompressed platform mip
+	FTexturePlatformData* PlatformData = Texture->GetPlatformData();
+	if (PlatformData && PlatformData->Mips.Num() && PlatformData->PixelFormat == PF_B8G8R8A8) {
+		FTexture2DMipMap& Mip = PlatformData->Mips[0];
+		if (Mip.BulkData.GetBulkDataSize() >= NumPixels * (int64)sizeof(FColor)) {
+			if (const void* Data = Mip.BulkData.LockReadOnly()) {
+				LockedBulkData = &Mip.BulkData;
+				Size = FIntPoint(Mip.SizeX, Mip.SizeY);
+				Pixels = TArrayView<const FColor>(static_cast<const FColor*>(Data), Size.X * Size.Y);
+				return;
+			}
+		}
+	}
+
+	// Saved results may have compressed platform data so fall back to the source pixels
+	if (Texture->Source.IsValid() && Texture->Source.GetFormat() == TSF_BGRA8) {
+		if (const uint8* Data = Texture->Source.LockMipReadOnly(0)) {
+			LockedSource = &Texture->Source;
+			Size = FIntPoint(Texture->Source.GetSizeX(), Texture->Source.GetSizeY());
+			Pixels = TArrayView<const FColor>(reinterpret_cast<const FColor*>(Data), Size.X * Size.Y);
+			return;
+		}
+	}
+
+	UE_LOG(LogTemp, Warning, TEXT("Texture %s has no readable BGRA8 pixel data"), *Texture->GetName());
+}
+
+FScopedTexturePixels::~FScopedTexturePixels()
+{
+	if (LockedBulkData) {
+		LockedBulkData->Unlock();
+	}
+	if (LockedSource) {
+		LockedSource->UnlockMip(0);
+	}
+}
+
+FColor FScopedTexturePixels::SampleUV(const FVector2D& UV) const
+{
+	if (!IsValid())
+		return FColor::Black;
+
+	// Calculate pixel coordinates from UV
+	const float PixelX = UV.X * Size.X;
+	const float PixelY = UV.Y * Size.Y;
+
+	// Get the four surrounding pixels
+	const int32 PixelLeft = FMath::Clamp(FMath::FloorToInt(PixelX), 0, Size.X - 1);
+	const int32 PixelRight = FMath::Clamp(FMath::CeilToInt(PixelX), 0, Size.X - 1);
+	const int32 PixelUp = FMath::Clamp(FMath::FloorToInt(PixelY), 0, Size.Y - 1);
+	const int32 PixelDown = FMath::Clamp(FMath::CeilToInt(PixelY), 0, Size.Y - 1);
+
+	// Interpolate colors based on UV distance
+	const float LerpX = PixelX - PixelLeft;
+	const float LerpY = PixelY - PixelUp;
+	const FColor TopRowColor = UStableDiffusionBlueprintLibrary::LerpColor(Pixels[PixelUp * Size.X + PixelLeft], Pixels[PixelUp * Size.X + PixelRight], LerpX);
+	const FColor BottomRowColor = UStableDiffusionBlueprintLibrary::LerpColor(Pixels[PixelDown * Size.X + PixelLeft], Pixels[PixelDown * Size.X + PixelRight], LerpX);
+	return UStableDiffusionBlueprintLibrary::LerpColor(TopRowColor, BottomRowColor, LerpY);
+}
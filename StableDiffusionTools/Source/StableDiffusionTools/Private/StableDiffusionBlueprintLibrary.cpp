@@ -15,6 +15,8 @@
 #include "AssetRegistry/AssetRegistryModule.h"
 #include "Engine/Texture2D.h"
 #include "Rendering/Texture2DResource.h"
+#include "RenderUtils.h"
+#include "StableDiffusionLatent.h"
 #include "Kismet/GameplayStatics.h"
 #include "GeometryScript/GeometryScriptSelectionTypes.h"
 #include "Parameterization/DynamicMeshUVEditor.h"
@@ -28,6 +30,33 @@
 
 using namespace UE::Geometry;
 
+namespace
+{
+	// Resizes the single platform mip of a transient texture. Returns true if the size changed.
+	bool ResizePlatformMip(UTexture2D* Texture, const FIntPoint& Size)
+	{
+		FTexturePlatformData* PlatformData = Texture->GetPlatformData();
+		check(PlatformData && PlatformData->Mips.Num());
+
+		if (PlatformData->Mips.Num() > 1) {
+			PlatformData->Mips.RemoveAt(1, PlatformData->Mips.Num() - 1);
+		}
+
+		FTexture2DMipMap& Mip = PlatformData->Mips[0];
+		if (Mip.SizeX == Size.X && Mip.SizeY == Size.Y)
+			return false;
+
+		PlatformData->SizeX = Size.X;
+		PlatformData->SizeY = Size.Y;
+		Mip.SizeX = Size.X;
+		Mip.SizeY = Size.Y;
+		Mip.BulkData.Lock(LOCK_READ_WRITE);
+		Mip.BulkData.Realloc(CalculateImageBytes(Size.X, Size.Y, 0, PlatformData->PixelFormat));
+		Mip.BulkData.Unlock();
+		return true;
+	}
+}
+
 #define LOCTEXT_NAMESPACE "StableDiffusionBlueprintLibrary"
 
 UStableDiffusionSubsystem* UStableDiffusionBlueprintLibrary::GetStableDiffusionSubsystem() {
@@ -127,9 +156,14 @@ FMatrix UStableDiffusionBlueprintLibrary::GetEditorViewportViewMatrix()
 }
 
 FMinimalViewInfo UStableDiffusionBlueprintLibrary::GetEditorViewportViewInfo()
+{
+	return GetViewportViewInfo(UStableDiffusionSubsystem::GetCapturingViewport().Get());
+}
+
+FMinimalViewInfo UStableDiffusionBlueprintLibrary::GetViewportViewInfo(FSceneViewport* Viewport)
 {
 	FMinimalViewInfo ViewInfo;
-	if (FSceneView* View = UStableDiffusionBlueprintLibrary::CalculateEditorView(UStableDiffusionSubsystem::GetCapturingViewport().Get())) {
+	if (FSceneView* View = UStableDiffusionBlueprintLibrary::CalculateEditorView(Viewport)) {
 		ViewInfo.AspectRatio = (float)View->UnconstrainedViewRect.Width() / (float)View->UnconstrainedViewRect.Height();
 		ViewInfo.FOV = View->FOV;
 		ViewInfo.Location = View->ViewLocation;
@@ -225,15 +259,21 @@ UTexture2D* UStableDiffusionBlueprintLibrary::ColorBufferToTexture(const TArray<
 TArray<FColor> UStableDiffusionBlueprintLibrary::ReadPixels(UTexture* Texture)
 {
 	TArray<FColor> Pixels;
+	ReadPixels(Texture, Pixels);
+	return Pixels;
+}
+
+bool UStableDiffusionBlueprintLibrary::ReadPixels(UTexture* Texture, TArray<FColor>& OutPixels)
+{
+	OutPixels.Reset();
 
 	if (!IsValid(Texture))
-		return Pixels;
+		return false;
 
 	if (auto Tex2D = Cast<UTexture2D>(Texture)) {
-		auto Mip = Tex2D->GetPlatformData()->Mips[0];
-		FColor* RawPixels = static_cast<FColor*>(Mip.BulkData.Lock(LOCK_READ_ONLY));
-		Pixels = TArray<FColor>(RawPixels, Mip.BulkData.GetBulkDataSize() / 4);
-		Mip.BulkData.Unlock();
+		FScopedTexturePixels Pixels(Tex2D);
+		OutPixels.Append(Pixels.GetPixels().GetData(), Pixels.Num());
+		return Pixels.IsValid();
 	}
 	else if (auto RenderTarget2D = Cast<UTextureRenderTarget2D>(Texture)) {
 		FTextureRenderTargetResource* RT_Resource = nullptr;
@@ -244,10 +284,10 @@ TArray<FColor> UStableDiffusionBlueprintLibrary::ReadPixels(UTexture* Texture)
 			RT_Resource = RenderTarget2D->GetRenderTargetResource();
 		}
 		
-		RT_Resource->ReadPixels(Pixels, FReadSurfaceDataFlags(RCM_MinMax));
+		return RT_Resource && RT_Resource->ReadPixels(OutPixels, FReadSurfaceDataFlags(RCM_MinMax));
 	}
 
-	return MoveTemp(Pixels);
+	return false;
 }
 
 void UStableDiffusionBlueprintLibrary::UpdateTextureSync(UTexture* Texture)
@@ -255,6 +295,12 @@ void UStableDiffusionBlueprintLibrary::UpdateTextureSync(UTexture* Texture)
 	if(!IsValid(Texture))
 		return;
 
+	// Direct upload textures have no source data to compile or stream
+	if (IsDirectUploadTexture(Texture)) {
+		UploadTexturePlatformData(CastChecked<UTexture2D>(Texture));
+		return;
+	}
+
 	Texture->UpdateResource();
 
 	int NumChecks = 25;
@@ -272,15 +318,27 @@ UTexture2D* UStableDiffusionBlueprintLibrary::ColorBufferToTexture(const uint8*
 	if (!FrameData) 
 		return nullptr;
 
-	ETextureSourceFormat TexFormat = ETextureSourceFormat::TSF_BGRA8;
-	if (OutTex) {
-		TexFormat = (OutTex->Source.GetFormat() != ETextureSourceFormat::TSF_Invalid) ? OutTex->Source.GetFormat() : TSF_BGRA8;
-	} else {
-		TObjectPtr<UTexture2D> NewTex = UTexture2D::CreateTransient(FrameSize.X, FrameSize.Y, EPixelFormat::PF_B8G8R8A8);
-		OutTex = NewTex;
-		//UE_LOG(LogTemp, Log, TEXT("Creating transient texture to hold color buffer. Input Width: %d, Height: %d. Texture Width: %d, Height: %d"), FrameSize.X, FrameSize.Y, NewTex->GetSizeX(), NewTex->GetSizeY());
+	if (!OutTex) {
+		OutTex = UTexture2D::CreateTransient(FrameSize.X, FrameSize.Y, EPixelFormat::PF_B8G8R8A8);
+	}
+
+	// Fast path for transient textures. Write the platform mip directly and skip building source data.
+	if (IsDirectUploadTexture(OutTex) && OutTex->GetPixelFormat() == PF_B8G8R8A8) {
+		ResizePlatformMip(OutTex, FrameSize);
+
+		FTexture2DMipMap& Mip = OutTex->GetPlatformData()->Mips[0];
+		void* MipData = Mip.BulkData.Lock(LOCK_READ_WRITE);
+		FMemory::Memcpy(MipData, FrameData, sizeof(FColor) * FrameSize.X * FrameSize.Y);
+		Mip.BulkData.Unlock();
+
+		if (!DeferUpdate) {
+			UploadTexturePlatformData(OutTex);
+		}
+		return OutTex;
 	}
 
+	ETextureSourceFormat TexFormat = (OutTex->Source.GetFormat() != ETextureSourceFormat::TSF_Invalid) ? OutTex->Source.GetFormat() : TSF_BGRA8;
+
 	OutTex->Source.Init(FrameSize.X, FrameSize.Y, 1, 1, TexFormat);//ETextureSourceFormat::TSF_RGBA8);
 	OutTex->MipGenSettings = TMGS_NoMipmaps;
 	OutTex->SRGB = true;
@@ -303,6 +361,40 @@ UTexture2D* UStableDiffusionBlueprintLibrary::ColorBufferToTexture(const uint8*
 	return OutTex;
 }
 
+bool UStableDiffusionBlueprintLibrary::IsDirectUploadTexture(const UTexture* Texture)
+{
+	return IsValid(Texture) && Texture->IsA<UTexture2D>() && Texture->GetOutermost() == GetTransientPackage() && !Texture->Source.IsValid();
+}
+
+void UStableDiffusionBlueprintLibrary::UploadTexturePlatformData(UTexture2D* Texture)
+{
+	if (!IsValid(Texture) || !Texture->GetPlatformData() || !Texture->GetPlatformData()->Mips.Num())
+		return;
+
+	FTexturePlatformData* PlatformData = Texture->GetPlatformData();
+	FTexture2DMipMap& Mip = PlatformData->Mips[0];
+
+	// A new or resized texture needs its resource recreated from the mip data
+	FTextureResource* Resource = Texture->GetResource();
+	if (!Resource || Resource->GetSizeX() != Mip.SizeX || Resource->GetSizeY() != Mip.SizeY) {
+		Texture->UpdateResource();
+		return;
+	}
+
+	// Copy the mip so the render thread owns the data it uploads
+	const int64 NumBytes = Mip.BulkData.GetBulkDataSize();
+	const uint32 BytesPerPixel = GPixelFormats[PlatformData->PixelFormat].BlockBytes;
+	uint8* UploadData = static_cast<uint8*>(FMemory::Malloc(NumBytes));
+	FMemory::Memcpy(UploadData, Mip.BulkData.Lock(LOCK_READ_ONLY), NumBytes);
+	Mip.BulkData.Unlock();
+
+	FUpdateTextureRegion2D* Region = new FUpdateTextureRegion2D(0, 0, 0, 0, Mip.SizeX, Mip.SizeY);
+	Texture->UpdateTextureRegions(0, 1, Region, Mip.SizeX * BytesPerPixel, BytesPerPixel, UploadData, [](uint8* SrcData, const FUpdateTextureRegion2D* Regions) {
+		FMemory::Free(SrcData);
+		delete Regions;
+	});
+}
+
 FString UStableDiffusionBlueprintLibrary::LayerTypeToString(ELayerImageType LayerType)
 {
 	if(ULayerProcessorBase::ReverseLayerImageTypeLookup.Contains(LayerType))
@@ -411,12 +503,17 @@ UStableDiffusionImageResultAsset* UStableDiffusionBlueprintLibrary::CreateImageR
 	UPackage* Package = CreatePackage(*FullPackagePath);
 	Package->FullyLoad();
 
-	// Duplicate texture
-	auto SrcMipData = Texture->Source.LockMip(0);// GetPlatformMips()[0].BulkData;
+	// Duplicate texture. Direct upload results only hold their pixels in the platform mip so source data is built here when the result is saved.
 	FString TexName = "T_" + Name;
 	UTexture2D* NewTexture = NewObject<UTexture2D>(Package, *TexName, RF_Public | RF_Standalone);
-	NewTexture = UStableDiffusionBlueprintLibrary::ColorBufferToTexture(SrcMipData, Size, NewTexture);
-	Texture->Source.UnlockMip(0);
+	{
+		FScopedTexturePixels SrcPixels(Texture);
+		if (!SrcPixels.IsValid() || SrcPixels.GetSize() != Size) {
+			UE_LOG(LogTemp, Error, TEXT("Could not read %dx%d pixels from texture %s to create result asset %s"), Size.X, Size.Y, *Texture->GetName(), *Name);
+			return nullptr;
+		}
+		NewTexture = UStableDiffusionBlueprintLibrary::ColorBufferToTexture(reinterpret_cast<const uint8*>(SrcPixels.GetPixels().GetData()), Size, NewTexture);
+	}
 
 	// Create data asset
 	FString AssetName = "DA_" + Name;
@@ -466,6 +563,9 @@ void UStableDiffusionBlueprintLibrary::CopyTextureDataUsingUVs(UTexture2D* Sourc
 
 	// Fill interim pixel array
 	TArray<FColor> TargetPixelColors = ReadPixels(TargetTexture);
+
+	// Keep the source mip locked for the whole copy instead of locking it for every sampled pixel
+	FScopedTexturePixels SourcePixels(SourceTexture);
 	//TargetPixelColors.Init(FColor(0, 0, 0, 0), TargetWidth * TargetHeight);
 	//for (size_t idx = 0; idx < TargetPixelColors.Num(); ++idx) {
 	//	TargetPixelColors[idx] = TargetTextureRawData[idx];
@@ -548,7 +648,7 @@ void UStableDiffusionBlueprintLibrary::CopyTextureDataUsingUVs(UTexture2D* Sourc
 
 								// Only write to pixels that haven't already been written to in a previous capture pass
 								if (TargetPixelColors[TargetIndex].A < 255 || ClearCoverageMask) {
-									TargetPixelColors[TargetIndex] = GetUVPixelFromTexture(SourceTexture, FVector2D(SourceUV));
+									TargetPixelColors[TargetIndex] = SourcePixels.SampleUV(FVector2D(SourceUV));
 								}
 							}
 						}
@@ -569,43 +669,8 @@ FColor UStableDiffusionBlueprintLibrary::GetUVPixelFromTexture(UTexture2D* Textu
 		return FColor::Black;
 	}
 
-	// Get texture size
-	int32 TextureWidth = Texture->GetSizeX();
-	int32 TextureHeight = Texture->GetSizeY();
-
-	// Calculate pixel coordinates from UV
-	float PixelX = UV.X * TextureWidth;
-	float PixelY = UV.Y * TextureHeight;
-
-	// Get the four surrounding pixels
-	int32 PixelLeft = FMath::Clamp(FMath::FloorToInt(PixelX), 0, TextureWidth - 1);
-	int32 PixelRight = FMath::Clamp(FMath::CeilToInt(PixelX), 0, TextureWidth - 1);
-	int32 PixelUp = FMath::Clamp(FMath::FloorToInt(PixelY), 0, TextureHeight - 1);
-	int32 PixelDown = FMath::Clamp(FMath::CeilToInt(PixelY), 0, TextureHeight - 1);
-
-	// Get raw texture data
-	FTexture2DMipMap* Mip = &Texture->PlatformData->Mips[0];
-	FByteBulkData* RawImageData = &Mip->BulkData;
-	FColor* RawData = static_cast<FColor*>(RawImageData->Lock(LOCK_READ_ONLY));
-
-	// Read pixel colors from raw data
-	FColor PixelColorUpperLeft = RawData[PixelUp * TextureWidth + PixelLeft];
-	FColor PixelColorUpperRight = RawData[PixelUp * TextureWidth + PixelRight];
-	FColor PixelColorLowerLeft = RawData[PixelDown * TextureWidth + PixelLeft];
-	FColor PixelColorLowerRight = RawData[PixelDown * TextureWidth + PixelRight];
-
-	// Interpolate colors based on UV distance
-	float LerpX = PixelX - PixelLeft;
-	float LerpY = PixelY - PixelUp;
-
-	auto TopRowColor = LerpColor(PixelColorUpperLeft, PixelColorUpperRight, LerpX);
-	auto BottomRowColor = LerpColor(PixelColorLowerLeft, PixelColorLowerRight, LerpX);
-	FColor InterpolatedColor = LerpColor(TopRowColor, BottomRowColor, LerpY);
-
-	// Lock texture
-	RawImageData->Unlock();
-
-	return InterpolatedColor;
+	FScopedTexturePixels Pixels(Texture);
+	return Pixels.SampleUV(UV);
 }
 
 UTexture2D* UStableDiffusionBlueprintLibrary::CreateTransientTexture(int32 InSizeX, int32 InSizeY, EPixelFormat InFormat, const FName InName) {
@@ -726,6 +791,108 @@ UMaterialInstanceConstant* UStableDiffusionBlueprintLibrary::CreateMaterialInsta
 	return MaterialInstance;
 }
 
+TArray<FColor> UStableDiffusionBlueprintLibrary::GetLayerPixels(const FLayerProcessorContext& Layer)
+{
+	TArray<FColor> Pixels;
+	switch (Layer.GetPixelBitDepth()) {
+	case SixteenBit:
+		Pixels.SetNumUninitialized(Layer.HalfFloatLayerPixels.Num());
+		for (int32 Idx = 0; Idx < Pixels.Num(); ++Idx) {
+			Pixels[Idx] = FLinearColor(Layer.HalfFloatLayerPixels.Get()[Idx]).ToFColor(false);
+		}
+		break;
+	case ThirtyTwoBit:
+		Pixels.SetNumUninitialized(Layer.FloatLayerPixels.Num());
+		for (int32 Idx = 0; Idx < Pixels.Num(); ++Idx) {
+			Pixels[Idx] = Layer.FloatLayerPixels.Get()[Idx].ToFColor(false);
+		}
+		break;
+	default:
+		Pixels = Layer.SharedLayerPixels ? Layer.SharedLayerPixels.Get() : Layer.LayerPixels;
+		break;
+	}
+	return Pixels;
+}
+
+TArray<uint8> UStableDiffusionBlueprintLibrary::GetLayerPixelData(const FLayerProcessorContext& Layer, TEnumAsByte<ELayerBitDepth>& BitDepth)
+{
+	BitDepth = Layer.GetPixelBitDepth();
+	switch (BitDepth) {
+	case SixteenBit:
+		return TArray<uint8>(reinterpret_cast<const uint8*>(Layer.HalfFloatLayerPixels.GetData()), (int32)Layer.HalfFloatLayerPixels.NumBytes());
+	case ThirtyTwoBit:
+		return TArray<uint8>(reinterpret_cast<const uint8*>(Layer.FloatLayerPixels.GetData()), (int32)Layer.FloatLayerPixels.NumBytes());
+	default: {
+		const TArray<FColor>& Pixels = Layer.SharedLayerPixels ? Layer.SharedLayerPixels.Get() : Layer.LayerPixels;
+		return TArray<uint8>(reinterpret_cast<const uint8*>(Pixels.GetData()), Pixels.Num() * (int32)sizeof(FColor));
+	}
+	}
+}
+
+void UStableDiffusionBlueprintLibrary::SetLayerPixels(FLayerProcessorContext& Layer, const TArray<FColor>& Pixels)
+{
+	Layer.ResetPixels();
+	Layer.SharedLayerPixels = TArray<FColor>(Pixels);
+}
+
+TArray<uint8> UStableDiffusionBlueprintLibrary::GetLayerLatentData(const FLayerProcessorContext& Layer)
+{
+	return Layer.SharedLatentData ? Layer.SharedLatentData.Get() : Layer.LatentData;
+}
+
+void UStableDiffusionBlueprintLibrary::SetLayerLatentData(FLayerProcessorContext& Layer, const TArray<uint8>& LatentData)
+{
+	Layer.SharedLatentData = TArray<uint8>(LatentData);
+	Layer.LatentData.Reset();
+}
+
+TArray<uint8> UStableDiffusionBlueprintLibrary::GetResultLatentData(const FStableDiffusionImageResult& Result)
+{
+	return Result.SharedOutLatent ? Result.SharedOutLatent.Get() : Result.OutLatent;
+}
+
+void UStableDiffusionBlueprintLibrary::SetResultLatentData(FStableDiffusionImageResult& Result, const TArray<uint8>& LatentData)
+{
+	Result.SharedOutLatent = TArray<uint8>(LatentData);
+	Result.OutLatent.Reset();
+}
+
+void UStableDiffusionBlueprintLibrary::SetResultFloatPixels(FStableDiffusionImageResult& Result, const TArray<uint8>& HalfFloatPixelData)
+{
+	TArray<FFloat16Color> Pixels;
+	Pixels.SetNumUninitialized(HalfFloatPixelData.Num() / sizeof(FFloat16Color));
+	FMemory::Memcpy(Pixels.GetData(), HalfFloatPixelData.GetData(), Pixels.Num() * sizeof(FFloat16Color));
+	Result.OutHalfFloatPixels = MoveTemp(Pixels);
+}
+
+TArray<uint8> UStableDiffusionBlueprintLibrary::GetResultFloatPixelData(const FStableDiffusionImageResult& Result)
+{
+	return TArray<uint8>(reinterpret_cast<const uint8*>(Result.OutHalfFloatPixels.GetData()), (int32)Result.OutHalfFloatPixels.NumBytes());
+}
+
+bool UStableDiffusionBlueprintLibrary::HasFloatPixels(const FStableDiffusionImageResult& Result)
+{
+	return Result.OutHalfFloatPixels.Num() > 0 && Result.OutHalfFloatPixels.Num() == Result.OutWidth * Result.OutHeight;
+}
+
+bool UStableDiffusionBlueprintLibrary::SaveResultLatentToFile(const FStableDiffusionImageResult& Result, const FString& Filename)
+{
+	return FStableDiffusionLatent::SaveToFile(Result.SharedOutLatent.Get(), Filename);
+}
+
+bool UStableDiffusionBlueprintLibrary::LoadResultLatentFromFile(FStableDiffusionImageResult& Result, const FString& Filename)
+{
+	// The result owns its latent so the file is read straight into the buffer instead of being mapped
+	TArray<uint8> Latent;
+	if (!FStableDiffusionLatent::LoadFromFile(Filename, Latent))
+		return false;
+
+	Result.SharedOutLatent = MoveTemp(Latent);
+	Result.OutLatent.Reset();
+	Result.OutputType = EImageType::Latent;
+	return true;
+}
+
 FColor UStableDiffusionBlueprintLibrary::LerpColor(const FColor& ColorA, const FColor& ColorB, float Alpha)
 {
 	return FColor(
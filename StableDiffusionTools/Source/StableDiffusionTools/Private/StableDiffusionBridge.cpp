@@ -3,6 +3,8 @@
 #include "Math/Color.h"
 #include "Async/Async.h"
 #include "StableDiffusionToolsSettings.h"
+#include "StableDiffusionBlueprintLibrary.h"
+#include "LatentPreview.h"
 
 UStableDiffusionBridge::UStableDiffusionBridge(const FObjectInitializer& initializer) : Super(initializer) {
     //CachedToken = initializer.CreateDefaultSubobject<USDBridgeToken>(this, FName(TEXT("CachedToken")));
@@ -49,7 +51,11 @@ FDirectoryPath UStableDiffusionBridge::GetSettingsModelSavePath()
 void UStableDiffusionBridge::UpdateImageProgress(FString prompt, int32 step, int32 timestep, float progress, int32 width, int32 height, UTexture2D* Texture)
 {
     AsyncTask(ENamedThreads::GameThread, [this, prompt, step, timestep, progress, width, height, Texture] {
-        if (IsValid(Texture)) {
+        if (UStableDiffusionBlueprintLibrary::IsDirectUploadTexture(Texture)) {
+            // Transient previews are uploaded straight from their platform mip
+            UStableDiffusionBlueprintLibrary::UploadTexturePlatformData(Texture);
+        }
+        else if (IsValid(Texture)) {
             Texture->UpdateResource();
             while (!Texture->IsAsyncCacheComplete()) {
                 FPlatformProcess::Sleep(0.0f);
@@ -63,7 +69,64 @@ void UStableDiffusionBridge::UpdateImageProgress(FString prompt, int32 step, int
 	});
 }
 
+void UStableDiffusionBridge::UpdateImageProgressFromLatents(FString prompt, int32 step, int32 timestep, float progress, const TArray<uint8>& Latents, int32 LatentChannels, int32 LatentWidth, int32 LatentHeight, ELatentModelFamily LatentFamily, UTexture2D* Texture)
+{
+    FIntPoint PreviewSize(0, 0);
+    if (IsValid(Texture)) {
+        PreviewSize = FIntPoint(Texture->GetSizeX(), Texture->GetSizeY());
+
+        const UStableDiffusionToolsSettings* Settings = GetDefault<UStableDiffusionToolsSettings>();
+        const FLatentPreviewCoefficients& Coefficients = Settings->GetLatentPreviewCoefficients(LatentFamily, LatentChannels);
+        const TArrayView<const float> LatentValues(reinterpret_cast<const float*>(Latents.GetData()), Latents.Num() / sizeof(float));
+
+        TArray<FColor> PreviewPixels;
+        if (FLatentPreview::ProjectLatentsToColors(LatentValues, LatentChannels, FIntPoint(LatentWidth, LatentHeight), Coefficients, PreviewSize, PreviewPixels)) {
+            UStableDiffusionBlueprintLibrary::ColorBufferToTexture(PreviewPixels, PreviewSize, Texture, true);
+        }
+        else {
+            PreviewSize = FIntPoint(0, 0);
+        }
+    }
+
+    UpdateImageProgress(prompt, step, timestep, progress, PreviewSize.X, PreviewSize.Y, PreviewSize.X > 0 ? Texture : nullptr);
+}
+
+TArray<FStableDiffusionImageResult> UStableDiffusionBridge::UpsampleImageBatch_Implementation(const TArray<FStableDiffusionImageResult>& input_results) const
+{
+    TArray<FStableDiffusionImageResult> Results;
+    Results.Reserve(input_results.Num());
+    for (const FStableDiffusionImageResult& Input : input_results) {
+        Results.Add(UpsampleImage(Input, nullptr));
+    }
+    return Results;
+}
+
 void UStableDiffusionBridge::SaveProperties()
 {
     //CachedToken->SaveConfig();
 }
+
+bool UStableDiffusionBridge::AttachLORA_Implementation(UStableDiffusionLORAAsset* LoraAsset)
+{
+    return false;
+}
+
+bool UStableDiffusionBridge::DetachLORA_Implementation()
+{
+    return false;
+}
+
+bool UStableDiffusionBridge::AttachTextualInversion_Implementation(UStableDiffusionTextualInversionAsset* TextualInversionAsset)
+{
+    return false;
+}
+
+bool UStableDiffusionBridge::DetachTextualInversion_Implementation()
+{
+    return false;
+}
+
+bool UStableDiffusionBridge::SetScheduler_Implementation(const FString& Scheduler)
+{
+    return false;
+}
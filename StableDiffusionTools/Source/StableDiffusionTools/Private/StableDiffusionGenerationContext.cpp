@@ -0,0 +1,409 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "StableDiffusionGenerationContext.h"
+#include "Editor.h"
+#include "Async/Async.h"
+#include "Components/SceneCaptureComponent2D.h"
+#include "Engine/TextureRenderTarget2D.h"
+#include "StableDiffusionBlueprintLibrary.h"
+
+UStableDiffusionSubsystem* UStableDiffusionGenerationContext::GetSubsystem() const
+{
+	return CastChecked<UStableDiffusionSubsystem>(GetOuter());
+}
+
+void UStableDiffusionGenerationContext::BindViewport(TSharedPtr<FSceneViewport> Viewport)
+{
+	BoundViewport = Viewport;
+	bBoundToViewport = Viewport.IsValid();
+}
+
+TSharedPtr<FSceneViewport> UStableDiffusionGenerationContext::GetViewport() const
+{
+	return bBoundToViewport ? BoundViewport.Pin() : UStableDiffusionSubsystem::GetCapturingViewport();
+}
+
+void UStableDiffusionGenerationContext::BeginDestroy()
+{
+	// Unbinds the camera delegates and timers that point back at this context
+	StopLivePreviewStream();
+	Super::BeginDestroy();
+}
+
+void UStableDiffusionGenerationContext::StartLivePreviewStream(FStableDiffusionInput Input, EInputImageSource ImageSourceType, FLivePreviewStreamOptions Options, USceneCaptureComponent2D* CaptureSource)
+{
+	StopLivePreviewStream();
+
+	UStableDiffusionSubsystem* Subsystem = GetSubsystem();
+	if (bBoundToViewport && !BoundViewport.IsValid()) {
+		UE_LOG(LogTemp, Warning, TEXT("Can't start a live preview stream for a viewport that has been closed"));
+		return;
+	}
+
+	LivePreviewInput = MoveTemp(Input);
+	LivePreviewInput.CaptureSource = CaptureSource ? CaptureSource : LivePreviewInput.CaptureSource;
+	LivePreviewSourceType = ImageSourceType;
+	LivePreviewOptions = Options;
+	LivePreviewCaptureSource = CaptureSource;
+	LastCameraInfo = FEditorCameraLivePreview();
+	bLivePreviewStreaming = true;
+
+	// Latencies measured for a different model or output size don't apply anymore
+	const FString QualityContext = FString::Printf(TEXT("%s|%dx%d"), *Subsystem->ModelOptions.Model, LivePreviewInput.Options.OutSizeX, LivePreviewInput.Options.OutSizeY);
+	if (QualityContext != PreviewQualityContext) {
+		PreviewQualityController.Reset();
+		PreviewQualityContext = QualityContext;
+	}
+	const bool bAdaptScheduler = LivePreviewOptions.AdaptiveQuality.bEnabled && LivePreviewOptions.AdaptiveQuality.bAdaptScheduler;
+	LivePreviewSchedulers = (bAdaptScheduler && Subsystem->GetModelStatus().ModelStatus == EModelStatus::Loaded) ? Subsystem->GetCompatibleSchedulers() : TArray<FString>();
+	{
+		FScopeLock Lock(&Subsystem->LivePreviewLock);
+		DirtyRegionBaselines.Empty();
+		bWarnedDirtyRegionsNeedInpaint = false;
+	}
+
+	// Viewport previews read the newest streamed frame instead of stalling on a readback
+	if (ImageSourceType == EInputImageSource::Viewport && LivePreviewOptions.bStreamViewportFrames && (bBoundToViewport || !Subsystem->IsViewportFrameStreaming())) {
+		StartFrameStream();
+	}
+
+	if (CaptureSource) {
+		CameraMovedHandle = CaptureSource->TransformUpdated.AddWeakLambda(this, [this, CaptureSource](USceneComponent* UpdatedComponent, EUpdateTransformFlags UpdateTransformFlags, ETeleportType Teleport) {
+			FEditorCameraLivePreview CameraInfo;
+			CameraInfo.Location = UpdatedComponent->GetComponentTransform().GetLocation();
+			CameraInfo.Rotation = UpdatedComponent->GetComponentTransform().GetRotation().Rotator();
+			CameraInfo.ViewportType = CaptureSource->ProjectionType == ECameraProjectionMode::Type::Perspective ? ELevelViewportType::LVT_Perspective : ELevelViewportType::LVT_OrthoFreelook;
+			CameraInfo.ViewportIndex = 0;
+			OnCameraMoved(CameraInfo);
+		});
+	}
+	else {
+		CameraMovedHandle = FEditorDelegates::OnEditorCameraMoved.AddWeakLambda(this, [this](const FVector& Location, const FRotator& Rotation, ELevelViewportType ViewportType, int32 ViewportIndex) {
+			// Bound contexts only follow the camera of their own viewport
+			if (bBoundToViewport) {
+				TSharedPtr<FSceneViewport> Viewport = BoundViewport.Pin();
+				FLevelEditorViewportClient* ViewportClient = UStableDiffusionSubsystem::FindViewportClient(Viewport.Get());
+				if (!ViewportClient || !ViewportClient->GetViewLocation().Equals(Location) || !ViewportClient->GetViewRotation().Equals(Rotation))
+					return;
+			}
+
+			FEditorCameraLivePreview CameraInfo;
+			CameraInfo.Location = Location;
+			CameraInfo.Rotation = Rotation;
+			CameraInfo.ViewportType = ViewportType;
+			CameraInfo.ViewportIndex = ViewportIndex;
+			OnCameraMoved(CameraInfo);
+		});
+	}
+
+	TWeakObjectPtr<USceneCaptureComponent2D> WeakSource = CaptureSource;
+	SceneTrigger.Start(LivePreviewOptions.SceneChanges, [this, WeakSource]() {
+		return GetSubsystem()->GetLivePreviewView(WeakSource.Get(), float(LivePreviewInput.Options.OutSizeX) / float(LivePreviewInput.Options.OutSizeY), GetViewport().Get());
+	}, [this]() {
+		OnSceneChanged();
+	});
+
+	// Show something for the current view straight away
+	QueueLivePreview(true);
+}
+
+void UStableDiffusionGenerationContext::StopLivePreviewStream()
+{
+	if (!bLivePreviewStreaming)
+		return;
+
+	bLivePreviewStreaming = false;
+	if (USceneCaptureComponent2D* CaptureSource = LivePreviewCaptureSource.Get()) {
+		CaptureSource->TransformUpdated.Remove(CameraMovedHandle);
+	}
+	else {
+		FEditorDelegates::OnEditorCameraMoved.Remove(CameraMovedHandle);
+	}
+	CameraMovedHandle.Reset();
+	LivePreviewCaptureSource.Reset();
+	SceneTrigger.Stop();
+
+	if (GEditor) {
+		GEditor->GetTimerManager()->ClearTimer(DraftTimer);
+		GEditor->GetTimerManager()->ClearTimer(RefineTimer);
+	}
+	CancelLivePreview();
+	StopFrameStream();
+}
+
+void UStableDiffusionGenerationContext::StartFrameStream()
+{
+	TSharedPtr<FSceneViewport> Viewport = GetViewport();
+	if (!Viewport.IsValid())
+		return;
+
+	// Frames are grabbed continuously so editor widgets have to stay hidden for the whole stream
+	FLevelEditorViewportClient* ViewportClient = UStableDiffusionSubsystem::FindViewportClient(Viewport.Get());
+	if (ViewportClient && !ViewportClient->IsInGameView() && !GEditor->IsPlaySessionInProgress()) {
+		ViewportClient->SetGameView(true);
+		bFrameStreamRestoreGameView = true;
+	}
+
+	const float Aspect = float(LivePreviewInput.Options.OutSizeX) / float(LivePreviewInput.Options.OutSizeY);
+	TWeakPtr<FSceneViewport> WeakViewport = Viewport;
+	FrameStreamViewport = Viewport;
+	FrameStream = MakeShared<FViewportFrameStream>();
+	const bool bStarted = FrameStream->Start(Viewport.ToSharedRef(), [WeakViewport, Aspect]() {
+		TSharedPtr<FSceneViewport> PinnedViewport = WeakViewport.Pin();
+		return PinnedViewport.IsValid() ? UStableDiffusionSubsystem::CalculateViewportOverlayBounds(PinnedViewport.Get(), Aspect) : FIntRect();
+	});
+
+	if (!bStarted) {
+		UE_LOG(LogTemp, Warning, TEXT("Could not start grabbing viewport frames. Viewport captures will read the viewport back instead"));
+		StopFrameStream();
+	}
+}
+
+void UStableDiffusionGenerationContext::StopFrameStream()
+{
+	if (FrameStream.IsValid()) {
+		FrameStream->Stop();
+		FrameStream.Reset();
+	}
+
+	if (bFrameStreamRestoreGameView) {
+		TSharedPtr<FSceneViewport> Viewport = FrameStreamViewport.Pin();
+		if (FLevelEditorViewportClient* ViewportClient = UStableDiffusionSubsystem::FindViewportClient(Viewport.Get())) {
+			ViewportClient->SetGameView(false);
+		}
+	}
+	bFrameStreamRestoreGameView = false;
+	FrameStreamViewport.Reset();
+}
+
+void UStableDiffusionGenerationContext::OnCameraMoved(const FEditorCameraLivePreview& CameraInfo)
+{
+	if (LastCameraInfo == CameraInfo)
+		return;
+	LastCameraInfo = CameraInfo;
+
+	// Anything generated for the previous view is out of date now
+	CancelLivePreview();
+	GEditor->GetTimerManager()->ClearTimer(RefineTimer);
+	GEditor->GetTimerManager()->SetTimer(DraftTimer, FTimerDelegate::CreateUObject(this, &UStableDiffusionGenerationContext::QueueLivePreview, true), FMath::Max(LivePreviewOptions.DraftDelay, 0.01f), false);
+}
+
+void UStableDiffusionGenerationContext::OnSceneChanged()
+{
+	if (!bLivePreviewStreaming)
+		return;
+
+	// The camera hasn't moved, so when only part of the frame changed it can be inpainted at full quality straight away
+	CancelLivePreview();
+	GEditor->GetTimerManager()->ClearTimer(DraftTimer);
+	GEditor->GetTimerManager()->ClearTimer(RefineTimer);
+	QueueLivePreview(!LivePreviewOptions.DirtyRegions.bEnabled);
+}
+
+void UStableDiffusionGenerationContext::QueueLivePreview(bool bDraft)
+{
+	UStableDiffusionSubsystem* Subsystem = GetSubsystem();
+	if (!bLivePreviewStreaming || !Subsystem->GeneratorBridge)
+		return;
+
+	if (Subsystem->GetModelStatus().ModelStatus != EModelStatus::Loaded) {
+		UE_LOG(LogTemp, Warning, TEXT("Live preview stream is waiting for a model to be loaded"));
+		return;
+	}
+
+	FLivePreviewRequest Request;
+	Request.Input = LivePreviewInput;
+	Request.Input.bIsDraft = bDraft;
+	Request.Quality.ResolutionScale = 1.0f;
+	Request.Quality.Iterations = LivePreviewInput.Options.Iterations;
+	if (bDraft) {
+		Request.Quality.ResolutionScale = FMath::Clamp(LivePreviewOptions.DraftScale, 0.1f, 1.0f);
+		Request.Quality.Iterations = FMath::Min(LivePreviewOptions.DraftIterations, LivePreviewInput.Options.Iterations);
+		if (LivePreviewOptions.AdaptiveQuality.bEnabled) {
+			Request.Quality = PreviewQualityController.Choose(LivePreviewOptions.AdaptiveQuality, Request.Quality.ResolutionScale, Request.Quality.Iterations, LivePreviewSchedulers);
+			Request.Input.SchedulerOverride = Request.Quality.Scheduler;
+		}
+
+		// Keep draft sizes on multiples of 8 so they stay valid latent sizes
+		Request.Input.Options.OutSizeX = FMath::Max(FMath::RoundToInt(LivePreviewInput.Options.OutSizeX * Request.Quality.ResolutionScale / 8.0f) * 8, 64);
+		Request.Input.Options.OutSizeY = FMath::Max(FMath::RoundToInt(LivePreviewInput.Options.OutSizeY * Request.Quality.ResolutionScale / 8.0f) * 8, 64);
+		Request.Input.Options.Iterations = Request.Quality.Iterations;
+	}
+	Request.Id = ++LatestLivePreviewId;
+
+	Subsystem->ScheduleLivePreview(this, MoveTemp(Request));
+}
+
+void UStableDiffusionGenerationContext::CancelLivePreview()
+{
+	++LatestLivePreviewId;
+
+	UStableDiffusionSubsystem* Subsystem = GetSubsystem();
+	FScopeLock Lock(&Subsystem->LivePreviewLock);
+	LivePreviewMailbox.Reset();
+
+	// Only this context's own job is stopped. Jobs of other contexts keep running.
+	if (bLivePreviewGenerating && Subsystem->GeneratorBridge) {
+		Subsystem->GeneratorBridge->StopImageGeneration();
+	}
+}
+
+void UStableDiffusionGenerationContext::GenerateLivePreview(FLivePreviewRequest& Request)
+{
+	UStableDiffusionSubsystem* Subsystem = GetSubsystem();
+	const double StartTime = FPlatformTime::Seconds();
+	Subsystem->CaptureLayers(Request.Input, LivePreviewSourceType, nullptr, this);
+
+	// A newer request may have arrived while we were capturing
+	{
+		FScopeLock Lock(&Subsystem->LivePreviewLock);
+		if (Request.Id != LatestLivePreviewId)
+			return;
+		bLivePreviewGenerating = true;
+	}
+
+	FStableDiffusionImageResult Result;
+	if (!GenerateLivePreviewRegion(Request.Input, Result)) {
+		Result = Subsystem->GenerateImageFromCapturedInput(Request.Input);
+	}
+	{
+		FScopeLock Lock(&Subsystem->LivePreviewLock);
+		bLivePreviewGenerating = false;
+	}
+
+	if (Result.Completed && Request.Id == LatestLivePreviewId) {
+		UpdateDirtyRegionBaseline(Request.Input, Result);
+	}
+
+	// Cancelled generations and partial frames say nothing about how long a full one takes
+	Result.PreviewQuality = Request.Quality;
+	if (Result.Completed && Request.Id == LatestLivePreviewId && Result.RegeneratedSize == FIntPoint(Result.OutWidth, Result.OutHeight)) {
+		Result.PreviewQuality.MeasuredLatency = FPlatformTime::Seconds() - StartTime;
+		PreviewQualityController.Record(Request.Quality, Result.PreviewQuality.MeasuredLatency);
+		UE_LOG(LogTemp, Log, TEXT("Live preview %s at %.0f%% size, %d steps%s took %.2fs (predicted %.2fs)"),
+			Request.Input.bIsDraft ? TEXT("draft") : TEXT("refinement"),
+			Request.Quality.ResolutionScale * 100.0f,
+			Request.Quality.Iterations,
+			Request.Quality.Scheduler.IsEmpty() ? TEXT("") : *FString::Printf(TEXT(" with %s"), *Request.Quality.Scheduler),
+			Result.PreviewQuality.MeasuredLatency,
+			Request.Quality.PredictedLatency);
+	}
+
+	AsyncTask(ENamedThreads::GameThread, [WeakThis = TWeakObjectPtr<UStableDiffusionGenerationContext>(this), WeakPool = TWeakObjectPtr<UStableDiffusionTexturePool>(Subsystem->TexturePool), Result = MoveTemp(Result), Id = Request.Id]() {
+		UStableDiffusionGenerationContext* Context = WeakThis.Get();
+		if (!Context || Id != Context->LatestLivePreviewId || !Result.Completed || !Context->bLivePreviewStreaming) {
+			// Nobody will see this frame so its texture goes straight back to the pool
+			if (UStableDiffusionTexturePool* TexturePool = WeakPool.Get())
+				TexturePool->Release(Result.OutTexture);
+			return;
+		}
+
+		Context->OnLivePreviewResultEx.Broadcast(Result);
+		Context->GetSubsystem()->OnGenerationContextResult(Context, Result);
+		if (Result.bIsDraft && Context->LivePreviewOptions.RefineDelay >= 0.0f) {
+			GEditor->GetTimerManager()->SetTimer(Context->RefineTimer, FTimerDelegate::CreateUObject(Context, &UStableDiffusionGenerationContext::QueueLivePreview, false), FMath::Max(Context->LivePreviewOptions.RefineDelay, 0.01f), false);
+		}
+	});
+}
+
+bool UStableDiffusionGenerationContext::GenerateLivePreviewRegion(const FStableDiffusionInput& Input, FStableDiffusionImageResult& OutResult)
+{
+	UStableDiffusionSubsystem* Subsystem = GetSubsystem();
+	const FDirtyRegionOptions& Options = LivePreviewOptions.DirtyRegions;
+	if (!Options.bEnabled || Input.bFloatOutput || Input.OutputType != EImageType::Image)
+		return false;
+
+	UStableDiffusionPipelineAsset* PipelineAsset = Subsystem->PipelineAsset;
+	if (!PipelineAsset || !(PipelineAsset->Options.Capabilities & (int32)EPipelineCapabilities::INPAINT)) {
+		if (!bWarnedDirtyRegionsNeedInpaint) {
+			UE_LOG(LogTemp, Warning, TEXT("Dirty region previews need a pipeline with the INPAINT capability. Generating whole frames instead"));
+			bWarnedDirtyRegionsNeedInpaint = true;
+		}
+		return false;
+	}
+
+	const FIntPoint OutSize(Input.Options.OutSizeX, Input.Options.OutSizeY);
+	FDirtyRegionBaseline Baseline;
+	{
+		FScopeLock Lock(&Subsystem->LivePreviewLock);
+		if (const FDirtyRegionBaseline* Found = DirtyRegionBaselines.Find(OutSize)) {
+			Baseline = *Found;
+		}
+	}
+
+	FDirtyRegion Region;
+	if (!FDirtyRegionInpainter::FindDirtyRegion(Baseline, Input, Options, Region))
+		return false;
+
+	const float RegionFraction = float(Region.Bounds.Area()) / (OutSize.X * OutSize.Y);
+	if (RegionFraction > Options.MaxRegionFraction)
+		return false;
+
+	// Nothing visible changed so the last preview is still current
+	FStableDiffusionImageResult RegionResult = Baseline.Result;
+	FStableDiffusionInput RegionInput;
+	if (!Region.IsEmpty()) {
+		if (!FDirtyRegionInpainter::MakeRegionInput(Baseline, Input, Region, RegionInput))
+			return false;
+
+		RegionResult = Subsystem->GenerateImageFromCapturedInput(RegionInput);
+		if (!RegionResult.Completed) {
+			OutResult = RegionResult;
+			return true;
+		}
+	}
+
+	// Composite from the pixels the bridge returned. The crop's texture may still be uploading on the game thread.
+	const FIntPoint RegionSize(RegionResult.OutWidth, RegionResult.OutHeight);
+	if (!Region.IsEmpty() && (!RegionResult.OutPixels || RegionResult.OutPixels.Num() != RegionSize.X * RegionSize.Y)) {
+		UE_LOG(LogTemp, Warning, TEXT("Inpainted region has no pixels. Generating the whole frame instead"));
+		Subsystem->TexturePool->Release(RegionResult.OutTexture);
+		return false;
+	}
+	FSharedPixelBuffer Pixels = FDirtyRegionInpainter::Composite(Baseline, Region, Region.IsEmpty() ? TArrayView<const FColor>() : RegionResult.OutPixels.View(), RegionSize);
+
+	UTexture2D* OutTexture = Subsystem->UploadToPooledTexture(Pixels, OutSize);
+
+	// The crop only existed to be composited. Its own upload was queued on the game thread before ours so it has finished by now.
+	if (!Region.IsEmpty()) {
+		Subsystem->TexturePool->Release(RegionResult.OutTexture);
+	}
+
+	OutResult = RegionResult;
+	OutResult.Input = Input;
+	OutResult.View = Input.View;
+	OutResult.bIsDraft = Input.bIsDraft;
+	OutResult.OutTexture = OutTexture;
+	OutResult.OutPixels = MoveTemp(Pixels);
+	OutResult.OutWidth = OutSize.X;
+	OutResult.OutHeight = OutSize.Y;
+	OutResult.RegeneratedOffset = Region.Bounds.Min;
+	OutResult.RegeneratedSize = Region.Bounds.Size();
+	OutResult.Completed = true;
+
+	UE_LOG(LogTemp, Log, TEXT("Live preview inpainted a %dx%d region at %d,%d, %.0f%% of the frame"),
+		Region.Bounds.Width(), Region.Bounds.Height(), Region.Bounds.Min.X, Region.Bounds.Min.Y, RegionFraction * 100.0f);
+	return true;
+}
+
+void UStableDiffusionGenerationContext::UpdateDirtyRegionBaseline(const FStableDiffusionInput& Input, const FStableDiffusionImageResult& Result)
+{
+	if (!LivePreviewOptions.DirtyRegions.bEnabled)
+		return;
+
+	// The result's texture may still be uploading on the game thread so the baseline shares its CPU pixels instead
+	const FIntPoint Size(Input.Options.OutSizeX, Input.Options.OutSizeY);
+	if (FIntPoint(Result.OutWidth, Result.OutHeight) != Size || Result.OutPixels.Num() != Size.X * Size.Y)
+		return;
+
+	FDirtyRegionBaseline Baseline;
+	Baseline.Pixels = Result.OutPixels;
+	Baseline.Size = Size;
+	Baseline.Layers = Input.ProcessedLayers;
+	Baseline.CaptureSize = FDirtyRegionInpainter::GetCaptureSize(Input);
+	Baseline.Result = Result;
+	Baseline.Result.OutTexture = nullptr;
+
+	FScopeLock Lock(&GetSubsystem()->LivePreviewLock);
+	DirtyRegionBaselines.Add(Baseline.Size, MoveTemp(Baseline));
+}
@@ -1,6 +1,33 @@
 #include "StableDiffusionGenerationOptions.h"
 #include "StableDiffusionSubsystem.h"
 
+ELayerBitDepth FLayerProcessorContext::GetPixelBitDepth() const
+{
+	if (FloatLayerPixels)
+		return ThirtyTwoBit;
+	if (HalfFloatLayerPixels)
+		return SixteenBit;
+	return EightBit;
+}
+
+void FLayerProcessorContext::ResetPixels()
+{
+	SharedLayerPixels.Reset();
+	HalfFloatLayerPixels.Reset();
+	FloatLayerPixels.Reset();
+	LayerPixels.Reset();
+}
+
+void FLayerProcessorContext::AdoptReflectedData()
+{
+	if (LayerPixels.Num()) {
+		SharedLayerPixels = MoveTemp(LayerPixels);
+	}
+	if (LatentData.Num()) {
+		SharedLatentData = MoveTemp(LatentData);
+	}
+}
+
 void UImagePipelineStageAsset::PostEditChangeProperty(struct FPropertyChangedEvent& PropertyChangedEvent)
 {
 	Super::PostEditChangeProperty(PropertyChangedEvent);
@@ -0,0 +1,61 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "StableDiffusionImageResult.h"
+#include "StableDiffusionLatent.h"
+#include "Serialization/CustomVersion.h"
+#include "UObject/ObjectSaveContext.h"
+
+namespace
+{
+    struct FImageResultAssetVersion
+    {
+        enum Type
+        {
+            // Latents were serialized in the reflected OutLatent array
+            BeforeCustomVersion = 0,
+
+            // Latents are serialized in SavedOutLatent and shared at runtime
+            SharedLatentBuffer = 1,
+
+            VersionPlusOne,
+            LatestVersion = VersionPlusOne - 1
+        };
+
+        static const FGuid GUID;
+    };
+
+    const FGuid FImageResultAssetVersion::GUID(0x5D2B8E41, 0x3C7A4F19, 0x9A61E0B4, 0x27F3C85D);
+    FCustomVersionRegistration GRegisterImageResultAssetVersion(FImageResultAssetVersion::GUID, FImageResultAssetVersion::LatestVersion, TEXT("StableDiffusionImageResultAssetVer"));
+}
+
+void UStableDiffusionImageResultAsset::Serialize(FArchive& Ar)
+{
+    Ar.UsingCustomVersion(FImageResultAssetVersion::GUID);
+    Super::Serialize(Ar);
+}
+
+void UStableDiffusionImageResultAsset::PreSave(FObjectPreSaveContext SaveContext)
+{
+    Super::PreSave(SaveContext);
+
+    // Latent containers are stored compressed. Older torch pickles are stored as they are.
+    const TArray<uint8>& Latent = ImageOutput.SharedOutLatent ? ImageOutput.SharedOutLatent.Get() : ImageOutput.OutLatent;
+    if (!FStableDiffusionLatent::IsLatentContainer(Latent) || !FStableDiffusionLatent::Recompress(Latent, ELatentCompression::Zlib, SavedOutLatent)) {
+        SavedOutLatent = Latent;
+    }
+}
+
+void UStableDiffusionImageResultAsset::PostLoad()
+{
+    Super::PostLoad();
+
+    // Older assets kept the latent in the reflected array instead
+    if (SavedOutLatent.IsEmpty() && GetLinkerCustomVersion(FImageResultAssetVersion::GUID) < FImageResultAssetVersion::SharedLatentBuffer) {
+        SavedOutLatent = MoveTemp(ImageOutput.OutLatent);
+    }
+    ImageOutput.OutLatent.Empty();
+
+    if (SavedOutLatent.Num()) {
+        ImageOutput.SharedOutLatent = MoveTemp(SavedOutLatent);
+    }
+}
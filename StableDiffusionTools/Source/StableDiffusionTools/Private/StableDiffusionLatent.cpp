@@ -0,0 +1,284 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "StableDiffusionLatent.h"
+#include "Async/MappedFileHandle.h"
+#include "HAL/PlatformFileManager.h"
+#include "Misc/Compression.h"
+#include "Misc/FileHelper.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+
+namespace
+{
+	// Groups the n-th byte of every element together so zlib sees the slowly changing exponent bytes side by side
+	void ShuffleBytes(const uint8* Src, uint8* Dst, int64 NumElements, int32 ElementSize)
+	{
+		for (int64 Idx = 0; Idx < NumElements; ++Idx) {
+			for (int32 Byte = 0; Byte < ElementSize; ++Byte) {
+				Dst[Byte * NumElements + Idx] = Src[Idx * ElementSize + Byte];
+			}
+		}
+	}
+
+	void UnshuffleBytes(const uint8* Src, uint8* Dst, int64 NumElements, int32 ElementSize)
+	{
+		for (int32 Byte = 0; Byte < ElementSize; ++Byte) {
+			const uint8* Plane = Src + Byte * NumElements;
+			for (int64 Idx = 0; Idx < NumElements; ++Idx) {
+				Dst[Idx * ElementSize + Byte] = Plane[Idx];
+			}
+		}
+	}
+}
+
+int64 FStableDiffusionLatentHeader::GetNumElements() const
+{
+	int64 NumElements = NumDims ? 1 : 0;
+	for (int32 Dim = 0; Dim < NumDims; ++Dim) {
+		NumElements *= Shape[Dim];
+	}
+	return NumElements;
+}
+
+FArchive& operator<<(FArchive& Ar, FStableDiffusionLatentHeader& Header)
+{
+	uint8 Reserved8 = 0;
+	uint32 Reserved32 = 0;
+
+	Ar << Header.Magic;
+	Ar << Header.Version;
+	Ar << Header.DataType;
+	Ar << Header.Compression;
+	Ar << Header.Layout;
+	Ar << Header.Family;
+	Ar << Header.NumDims;
+	Ar << Reserved8;
+	for (int32 Dim = 0; Dim < FStableDiffusionLatentHeader::MaxDims; ++Dim) {
+		Ar << Header.Shape[Dim];
+	}
+	Ar << Header.RawSize;
+	Ar << Header.PayloadSize;
+	Ar << Reserved32;
+	return Ar;
+}
+
+bool FStableDiffusionLatent::IsLatentContainer(TArrayView<const uint8> Data)
+{
+	return Data.Num() >= FStableDiffusionLatentHeader::Size && FMemory::Memcmp(Data.GetData(), "SDLT", 4) == 0;
+}
+
+bool FStableDiffusionLatent::ReadHeader(TArrayView<const uint8> Data, FStableDiffusionLatentHeader& OutHeader)
+{
+	if (!IsLatentContainer(Data))
+		return false;
+
+	FMemoryReaderView Reader(Data);
+	Reader << OutHeader;
+
+	if (OutHeader.Version > FStableDiffusionLatentHeader::CurrentVersion) {
+		UE_LOG(LogTemp, Error, TEXT("Latent container version %d is newer than the supported version %d"), OutHeader.Version, FStableDiffusionLatentHeader::CurrentVersion);
+		return false;
+	}
+
+	if (OutHeader.NumDims == 0 || OutHeader.NumDims > FStableDiffusionLatentHeader::MaxDims || OutHeader.DataType > ELatentDataType::Float16 || OutHeader.Compression > ELatentCompression::Zlib) {
+		UE_LOG(LogTemp, Error, TEXT("Latent container header is invalid"));
+		return false;
+	}
+
+	if (OutHeader.RawSize != OutHeader.GetNumElements() * OutHeader.GetElementSize() || FStableDiffusionLatentHeader::Size + (int64)OutHeader.PayloadSize > Data.Num()) {
+		UE_LOG(LogTemp, Error, TEXT("Latent container is truncated or its shape doesn't match its size"));
+		return false;
+	}
+
+	return true;
+}
+
+bool FStableDiffusionLatent::Decode(TArrayView<const uint8> Data, TArray<float>& OutValues, FStableDiffusionLatentHeader* OutHeader)
+{
+	FStableDiffusionLatentHeader Header;
+	if (!ReadHeader(Data, Header))
+		return false;
+
+	const int64 NumElements = Header.GetNumElements();
+	const uint8* Payload = Data.GetData() + FStableDiffusionLatentHeader::Size;
+
+	// Decompress into a scratch buffer and undo the byte shuffle
+	TArray<uint8> Unpacked;
+	if (Header.Compression == ELatentCompression::Zlib) {
+		TArray<uint8> Shuffled;
+		Shuffled.SetNumUninitialized((int32)Header.RawSize);
+		if (!FCompression::UncompressMemory(NAME_Zlib, Shuffled.GetData(), Shuffled.Num(), Payload, (int32)Header.PayloadSize)) {
+			UE_LOG(LogTemp, Error, TEXT("Failed to decompress latent container"));
+			return false;
+		}
+		Unpacked.SetNumUninitialized((int32)Header.RawSize);
+		UnshuffleBytes(Shuffled.GetData(), Unpacked.GetData(), NumElements, Header.GetElementSize());
+		Payload = Unpacked.GetData();
+	}
+	else if (Header.PayloadSize != Header.RawSize) {
+		UE_LOG(LogTemp, Error, TEXT("Uncompressed latent container payload is %llu bytes but should be %llu"), Header.PayloadSize, Header.RawSize);
+		return false;
+	}
+
+	OutValues.SetNumUninitialized((int32)NumElements);
+	if (Header.DataType == ELatentDataType::Float16) {
+		const uint16* HalfValues = reinterpret_cast<const uint16*>(Payload);
+		for (int64 Idx = 0; Idx < NumElements; ++Idx) {
+			FFloat16 Half;
+			Half.Encoded = HalfValues[Idx];
+			OutValues[Idx] = Half.GetFloat();
+		}
+	}
+	else {
+		FMemory::Memcpy(OutValues.GetData(), Payload, Header.RawSize);
+	}
+
+	if (OutHeader) {
+		*OutHeader = Header;
+	}
+	return true;
+}
+
+TArray<uint8> FStableDiffusionLatent::Encode(TArrayView<const float> Values, TArrayView<const int32> Shape, ELatentModelFamily Family, ELatentDataType DataType, ELatentCompression Compression)
+{
+	TArray<uint8> Data;
+
+	FStableDiffusionLatentHeader Header;
+	if (Shape.Num() == 0 || Shape.Num() > FStableDiffusionLatentHeader::MaxDims) {
+		UE_LOG(LogTemp, Error, TEXT("Latents must have between 1 and %d dimensions"), FStableDiffusionLatentHeader::MaxDims);
+		return Data;
+	}
+
+	Header.NumDims = Shape.Num();
+	for (int32 Dim = 0; Dim < Shape.Num(); ++Dim) {
+		Header.Shape[Dim] = Shape[Dim];
+	}
+	if (Header.GetNumElements() != Values.Num()) {
+		UE_LOG(LogTemp, Error, TEXT("Latent shape holds %lld values but %d were given"), Header.GetNumElements(), Values.Num());
+		return Data;
+	}
+
+	Header.DataType = DataType;
+	Header.Compression = Compression;
+	Header.Family = Family;
+	Header.RawSize = Values.Num() * Header.GetElementSize();
+
+	// Convert to the storage type
+	TArray<uint8> Raw;
+	Raw.SetNumUninitialized((int32)Header.RawSize);
+	if (DataType == ELatentDataType::Float16) {
+		uint16* HalfValues = reinterpret_cast<uint16*>(Raw.GetData());
+		for (int32 Idx = 0; Idx < Values.Num(); ++Idx) {
+			HalfValues[Idx] = FFloat16(Values[Idx]).Encoded;
+		}
+	}
+	else {
+		FMemory::Memcpy(Raw.GetData(), Values.GetData(), Header.RawSize);
+	}
+
+	TArray<uint8> Payload;
+	if (Compression == ELatentCompression::Zlib) {
+		TArray<uint8> Shuffled;
+		Shuffled.SetNumUninitialized(Raw.Num());
+		ShuffleBytes(Raw.GetData(), Shuffled.GetData(), Values.Num(), Header.GetElementSize());
+
+		int32 CompressedSize = FCompression::CompressMemoryBound(NAME_Zlib, Shuffled.Num());
+		Payload.SetNumUninitialized(CompressedSize);
+		if (!FCompression::CompressMemory(NAME_Zlib, Payload.GetData(), CompressedSize, Shuffled.GetData(), Shuffled.Num())) {
+			UE_LOG(LogTemp, Error, TEXT("Failed to compress latent container"));
+			return Data;
+		}
+		Payload.SetNum(CompressedSize, false);
+	}
+	else {
+		Payload = MoveTemp(Raw);
+	}
+	Header.PayloadSize = Payload.Num();
+
+	Data.Reserve(FStableDiffusionLatentHeader::Size + Payload.Num());
+	FMemoryWriter Writer(Data);
+	Writer << Header;
+	check(Data.Num() == FStableDiffusionLatentHeader::Size);
+	Data.Append(Payload);
+	return Data;
+}
+
+bool FStableDiffusionLatent::Recompress(TArrayView<const uint8> Data, ELatentCompression Compression, TArray<uint8>& OutData)
+{
+	FStableDiffusionLatentHeader Header;
+	if (!ReadHeader(Data, Header))
+		return false;
+
+	if (Header.Compression == Compression) {
+		OutData = TArray<uint8>(Data.GetData(), (int32)(FStableDiffusionLatentHeader::Size + Header.PayloadSize));
+		return true;
+	}
+
+	// Half floats survive the round trip through float32 unchanged so this is lossless
+	TArray<float> Values;
+	if (!Decode(Data, Values))
+		return false;
+
+	OutData = Encode(Values, TArrayView<const int32>(Header.Shape, Header.NumDims), Header.Family, Header.DataType, Compression);
+	return OutData.Num() > 0;
+}
+
+bool FStableDiffusionLatent::SaveToFile(TArrayView<const uint8> Data, const FString& Filename)
+{
+	if (!IsLatentContainer(Data))
+		return false;
+
+	return FFileHelper::SaveArrayToFile(Data, *Filename);
+}
+
+bool FStableDiffusionLatent::LoadFromFile(const FString& Filename, TArray<uint8>& OutData)
+{
+	FStableDiffusionLatentHeader Header;
+	if (!FFileHelper::LoadFileToArray(OutData, *Filename) || !ReadHeader(OutData, Header)) {
+		UE_LOG(LogTemp, Error, TEXT("%s is not a valid latent file"), *Filename);
+		OutData.Reset();
+		return false;
+	}
+
+	// Anything after the payload isn't part of the container
+	OutData.SetNum((int32)(FStableDiffusionLatentHeader::Size + Header.PayloadSize));
+	return true;
+}
+
+TUniquePtr<FMappedLatentFile> FMappedLatentFile::Open(const FString& Filename)
+{
+	TUniquePtr<FMappedLatentFile> File(new FMappedLatentFile());
+	File->Handle.Reset(FPlatformFileManager::Get().GetPlatformFile().OpenMapped(*Filename));
+	if (!File->Handle) {
+		UE_LOG(LogTemp, Error, TEXT("Could not map latent file %s"), *Filename);
+		return nullptr;
+	}
+
+	File->Region.Reset(File->Handle->MapRegion(0, File->Handle->GetFileSize()));
+	if (!File->Region || !FStableDiffusionLatent::ReadHeader(File->GetData(), File->Header)) {
+		UE_LOG(LogTemp, Error, TEXT("%s is not a valid latent file"), *Filename);
+		return nullptr;
+	}
+
+	return File;
+}
+
+FMappedLatentFile::~FMappedLatentFile()
+{
+	// Regions have to be released before their file handle
+	Region.Reset();
+	Handle.Reset();
+}
+
+TArrayView<const uint8> FMappedLatentFile::GetData() const
+{
+	return Region ? TArrayView<const uint8>(Region->GetMappedPtr(), Region->GetMappedSize()) : TArrayView<const uint8>();
+}
+
+TArrayView<const float> FMappedLatentFile::GetFloatValues() const
+{
+	if (!Region || Header.DataType != ELatentDataType::Float32 || Header.Compression != ELatentCompression::None)
+		return TArrayView<const float>();
+
+	return TArrayView<const float>(reinterpret_cast<const float*>(Region->GetMappedPtr() + FStableDiffusionLatentHeader::Size), (int32)Header.GetNumElements());
+}
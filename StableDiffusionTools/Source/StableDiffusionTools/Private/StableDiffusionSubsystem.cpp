@@ -4,6 +4,7 @@
 #include "Engine/GameEngine.h"
 #include "Async/Async.h"
 #include "Async/TaskGraphInterfaces.h"
+#include "UObject/GCScopeLock.h"
 #include "UObject/SavePackage.h"
 #include "LevelEditor.h"
 #include "IPythonScriptPlugin.h"
@@ -22,21 +23,38 @@
 #include "Engine/TextureRenderTarget2D.h"
 #include "DesktopPlatformModule.h"
 #include "StableDiffusionBlueprintLibrary.h"
+#include "StableDiffusionGenerationContext.h"
+#include "TiledUpsampler.h"
+#include "GenerationSignature.h"
+#include "ScopedTexturePixels.h"
 #include "LayerProcessors/FinalColorLayerProcessor.h"
 
 #define LOCTEXT_NAMESPACE "StableDiffusionSubsystem"
 
 FString UStableDiffusionSubsystem::NormalMaterialAsset = TEXT("/StableDiffusionTools/Materials/M_Normals.M_Normals");
 
+namespace
+{
+	// Oldest streamed viewport frame, in frames, that viewport captures still accept
+	constexpr uint64 MaxStreamedFrameAge = 4;
+}
+
 
 bool FCapturedFramePayload::OnFrameReady_RenderThread(FColor* ColorBuffer, FIntPoint BufferSize, FIntPoint TargetSize) const
 {
 	OnFrameCapture.Broadcast(ColorBuffer, BufferSize, TargetSize);
-	return true;
+
+	// Listeners copy what they need so the grabber doesn't have to queue the frame as well
+	return false;
 }
 
 UStableDiffusionSubsystem::UStableDiffusionSubsystem(const FObjectInitializer& initializer)
 {
+	TexturePool = initializer.CreateDefaultSubobject<UStableDiffusionTexturePool>(this, TEXT("TexturePool"));
+	StageCache = MakeShared<FImagePipelineStageCache, ESPMode::ThreadSafe>();
+	DefaultGenerationContext = initializer.CreateDefaultSubobject<UStableDiffusionGenerationContext>(this, TEXT("DefaultGenerationContext"));
+	GenerationContexts.Add(DefaultGenerationContext);
+
 	// Wait for Python to load our derived classes before we construct the bridge
 	IPythonScriptPlugin& PythonModule = FModuleManager::LoadModuleChecked<IPythonScriptPlugin>(TEXT("PythonScriptPlugin"));
 	PythonModule.OnPythonInitialized().AddLambda([this]() {
@@ -58,6 +76,51 @@ bool UStableDiffusionSubsystem::IsBridgeLoaded()
 	return (GeneratorBridge == nullptr) ? false : true;
 }
 
+void UStableDiffusionSubsystem::Deinitialize()
+{
+	{
+		FScopeLock Lock(&LivePreviewLock);
+		bLivePreviewShutdown = true;
+	}
+
+	// Contexts hold delegates, timers and frame streams that call back into themselves and the subsystem
+	TArray<TObjectPtr<UStableDiffusionGenerationContext>> Contexts;
+	{
+		FScopeLock Lock(&LivePreviewLock);
+		Contexts = GenerationContexts;
+	}
+	for (UStableDiffusionGenerationContext* Context : Contexts) {
+		if (Context) {
+			Context->StopLivePreviewStream();
+		}
+	}
+	if (OnCaptureCameraUpdatedDlgHandle.IsValid() || LivePreviewSceneTrigger.IsRunning()) {
+		SetLivePreviewEnabled(false, 0.0f, LivePreviewSceneTriggerSource.Get());
+	}
+	if (PreviewedLayer) {
+		DisableLivePreviewForLayer();
+	}
+	StopViewportFrameStream();
+
+	// The worker finishes the job it is on. Its captures and uploads wait for the game thread so keep that ticking meanwhile.
+	const double WaitStart = FPlatformTime::Seconds();
+	while (true) {
+		FTaskGraphInterface::Get().ProcessThreadUntilIdle(ENamedThreads::GameThread);
+		{
+			FScopeLock Lock(&LivePreviewLock);
+			if (!bLivePreviewWorkerRunning)
+				break;
+		}
+		if (FPlatformTime::Seconds() - WaitStart > 30.0) {
+			UE_LOG(LogTemp, Warning, TEXT("Timed out waiting for the live preview worker to stop"));
+			break;
+		}
+		FPlatformProcess::Sleep(0.01f);
+	}
+
+	Super::Deinitialize();
+}
+
 void UStableDiffusionSubsystem::CreateBridge(TSubclassOf<UStableDiffusionBridge> BridgeClass)
 {
 	auto BaseClass = UStableDiffusionBridge::StaticClass();
@@ -177,38 +240,34 @@ void UStableDiffusionSubsystem::InitModel(
 	const TArray<FLayerProcessorContext>& Layers, 
 	bool Async, 
 	bool AllowNSFW, 
-	EPaddingMode PaddingMode)
+	EPaddingMode PaddingMode,
+	const FString& SchedulerOverride)
 {
 	if (GeneratorBridge) {
 		// Unload any loaded models first
 		//ReleaseModel();
 
+		// Results from the previous model can't stand in for new generations
+		{
+			FScopeLock Lock(&LastGenerationLock);
+			LastGenerationSignature = FGenerationSignature();
+		}
+
 		// Forward image updated event from bridge to subsystem
 		this->GeneratorBridge->OnImageProgressEx.AddUniqueDynamic(this, &UStableDiffusionSubsystem::UpdateImageProgress);
 
-		if (Async) {
-			AsyncTask(ENamedThreads::AnyBackgroundHiPriTask, [this, Model, Pipeline, Layers, LORAAsset, TextualInversionAsset, AllowNSFW, PaddingMode]() mutable {
-				auto Result = this->GeneratorBridge->InitModel(Model, Pipeline, LORAAsset, TextualInversionAsset, Layers, AllowNSFW, PaddingMode);
-				if (Result.ModelStatus == EModelStatus::Loaded) {
-					bIsModelDirty = false;
-					ModelOptions = Model;
-					PipelineAsset = Pipeline;
-					//this->LORAAsset = LORAAsset;
-				}
+		const FString Scheduler = (SchedulerOverride.IsEmpty() && Pipeline) ? Pipeline->Options.Scheduler : SchedulerOverride;
 
+		if (Async) {
+			AsyncTask(ENamedThreads::AnyBackgroundHiPriTask, [this, Model, Pipeline, Layers, LORAAsset, TextualInversionAsset, AllowNSFW, PaddingMode, Scheduler]() mutable {
+				auto Result = LoadModel(Model, Pipeline, LORAAsset, TextualInversionAsset, Layers, AllowNSFW, PaddingMode, Scheduler);
 				AsyncTask(ENamedThreads::GameThread, [this, Result]() {
 					this->OnModelInitializedEx.Broadcast(Result);
 					});
 				});
 		}
 		else {
-			auto Result = this->GeneratorBridge->InitModel(Model, Pipeline, LORAAsset, TextualInversionAsset, Layers, AllowNSFW, PaddingMode);
-			if (Result.ModelStatus == EModelStatus::Loaded) {
-				ModelOptions = Model;
-				PipelineAsset = Pipeline;
-				bIsModelDirty = false;
-			}
-
+			auto Result = LoadModel(Model, Pipeline, LORAAsset, TextualInversionAsset, Layers, AllowNSFW, PaddingMode, Scheduler);
 			AsyncTask(ENamedThreads::GameThread, [this, Result]() {
 				this->OnModelInitializedEx.Broadcast(Result);
 			});
@@ -216,6 +275,98 @@ void UStableDiffusionSubsystem::InitModel(
 	}
 }
 
+FStableDiffusionModelInitResult UStableDiffusionSubsystem::LoadModel(
+	const FStableDiffusionModelOptions& Model, 
+	UStableDiffusionPipelineAsset* Pipeline, 
+	UStableDiffusionLORAAsset* LORAAsset, 
+	UStableDiffusionTextualInversionAsset* TextualInversionAsset, 
+	const TArray<FLayerProcessorContext>& Layers, 
+	bool AllowNSFW, 
+	EPaddingMode PaddingMode,
+	const FString& Scheduler)
+{
+	// Adapters and the scheduler can be swapped on the resident pipeline as long as the base model it was built from hasn't changed
+	const FString BaseModelKey = MakeBaseModelKey(Model, Pipeline, Layers, AllowNSFW, PaddingMode);
+	if (!LoadedBaseModelKey.IsEmpty() && LoadedBaseModelKey == BaseModelKey && GeneratorBridge->ModelStatus.ModelStatus == EModelStatus::Loaded) {
+		if (SwapAdapters(LORAAsset, TextualInversionAsset) && SwapScheduler(Scheduler)) {
+			// Render scripts are read from the pipeline asset at generation time
+			GeneratorBridge->PipelineAsset = Pipeline;
+			PipelineAsset = Pipeline;
+			bIsModelDirty = false;
+			return GeneratorBridge->ModelStatus;
+		}
+		UE_LOG(LogTemp, Log, TEXT("Bridge couldn't swap adapters or the scheduler on the loaded model. Initialising the model again"));
+	}
+
+	LoadedBaseModelKey.Empty();
+	auto Result = this->GeneratorBridge->InitModel(Model, Pipeline, LORAAsset, TextualInversionAsset, Layers, AllowNSFW, PaddingMode);
+	if (Result.ModelStatus == EModelStatus::Loaded) {
+		ModelOptions = Model;
+		PipelineAsset = Pipeline;
+		LoadedBaseModelKey = BaseModelKey;
+		LoadedScheduler = Pipeline ? Pipeline->Options.Scheduler : FString();
+		bIsModelDirty = false;
+
+		if (!SwapScheduler(Scheduler)) {
+			UE_LOG(LogTemp, Warning, TEXT("Bridge couldn't switch the loaded model to the %s scheduler"), *Scheduler);
+		}
+	}
+	return Result;
+}
+
+bool UStableDiffusionSubsystem::SwapAdapters(UStableDiffusionLORAAsset* LORAAsset, UStableDiffusionTextualInversionAsset* TextualInversionAsset)
+{
+	if (GeneratorBridge->LORAAsset != LORAAsset) {
+		const bool bSwapped = LORAAsset ? GeneratorBridge->AttachLORA(LORAAsset) : GeneratorBridge->DetachLORA();
+		if (!bSwapped)
+			return false;
+	}
+
+	if (GeneratorBridge->CachedTextualInversionAsset != TextualInversionAsset) {
+		const bool bSwapped = TextualInversionAsset ? GeneratorBridge->AttachTextualInversion(TextualInversionAsset) : GeneratorBridge->DetachTextualInversion();
+		if (!bSwapped)
+			return false;
+	}
+	return true;
+}
+
+bool UStableDiffusionSubsystem::SwapScheduler(const FString& Scheduler)
+{
+	if (LoadedScheduler == Scheduler)
+		return true;
+
+	if (!GeneratorBridge->SetScheduler(Scheduler))
+		return false;
+
+	LoadedScheduler = Scheduler;
+	return true;
+}
+
+FString UStableDiffusionSubsystem::MakeBaseModelKey(const FStableDiffusionModelOptions& Model, const UStableDiffusionPipelineAsset* Pipeline, const TArray<FLayerProcessorContext>& Layers, bool AllowNSFW, EPaddingMode PaddingMode)
+{
+	FString Key;
+	FStableDiffusionModelOptions::StaticStruct()->ExportText(Key, &Model, nullptr, nullptr, PPF_None, nullptr);
+
+	// The scheduler is swapped separately
+	if (Pipeline) {
+		FStableDiffusionPipelineOptions PipelineOptions = Pipeline->Options;
+		PipelineOptions.Scheduler.Empty();
+		Key += Pipeline->GetPathName();
+		FStableDiffusionPipelineOptions::StaticStruct()->ExportText(Key, &PipelineOptions, nullptr, nullptr, PPF_None, nullptr);
+	}
+
+	// Layer init scripts add their own pipeline arguments
+	for (const FLayerProcessorContext& Layer : Layers) {
+		if (Layer.Processor) {
+			Key += Layer.Processor->GetPathName();
+			Key += Layer.Processor->PythonModelInitScript;
+		}
+	}
+
+	Key += FString::Printf(TEXT("|%d|%d"), AllowNSFW, (int32)PaddingMode);
+	return Key;
+}
+
 //void UStableDiffusionSubsystem::RunImagePipeline(TArray<UImagePipelineStageAsset*> Stages, FStableDiffusionInput Input, EInputImageSource ImageSourceType, bool Async, bool AllowNSFW, EPaddingMode PaddingMode)
 //{
 //	for (auto Stage : Stages) {
@@ -232,6 +383,7 @@ void UStableDiffusionSubsystem::InitModel(
 void UStableDiffusionSubsystem::ReleaseModel()
 {
 	if (GeneratorBridge) {
+		LoadedBaseModelKey.Empty();
 		GeneratorBridge->ReleaseModel();
 		this->GeneratorBridge->OnImageProgressEx.RemoveDynamic(this, &UStableDiffusionSubsystem::UpdateImageProgress);
 	}
@@ -308,7 +460,7 @@ void UStableDiffusionSubsystem::GenerateImage(FStableDiffusionInput Input, EInpu
 	if (!GeneratorBridge)
 		return;
 
-	AsyncTask(ENamedThreads::AnyBackgroundHiPriTask, [this, Input, ImageSourceType]() mutable
+	AsyncTask(ENamedThreads::AnyBackgroundHiPriTask, [this, Input=MoveTemp(Input), ImageSourceType]() mutable
 	{
 		GenerateImageSync(Input, ImageSourceType);
 	});
@@ -316,12 +468,20 @@ void UStableDiffusionSubsystem::GenerateImage(FStableDiffusionInput Input, EInpu
 
 FStableDiffusionImageResult UStableDiffusionSubsystem::GenerateImageSync(FStableDiffusionInput Input, EInputImageSource ImageSourceType)
 {
-	FStableDiffusionImageResult Result;
-
 	if (!GeneratorBridge)
-		return Result;
+		return FStableDiffusionImageResult();
 
 	bIsGenerating = true;
+	CaptureLayers(Input, ImageSourceType);
+	return GenerateImageFromCapturedInput(Input);
+}
+
+void UStableDiffusionSubsystem::CaptureLayers(FStableDiffusionInput& Input, EInputImageSource ImageSourceType, FLayerCaptureSet* SharedCaptures, UStableDiffusionGenerationContext* Context)
+{
+	// Blueprints may still hand over pixels and latents through the reflected arrays
+	for (FLayerProcessorContext& Layer : Input.InputLayers) {
+		Layer.AdoptReflectedData();
+	}
 
 	TSharedPtr<TPromise<bool>> GameThreadPromise = MakeShared<TPromise<bool>>();
 
@@ -333,44 +493,155 @@ FStableDiffusionImageResult UStableDiffusionSubsystem::GenerateImageSync(FStable
 		bool bPrevViewportGameViewEnabled = false;
 		GAreScreenMessagesEnabled = false;
 		ULevelEditorSubsystem* LevelEditorSubsystem = nullptr;
+		FLevelEditorViewportClient* BoundViewportClient = nullptr;
 
 	#if WITH_EDITOR
 		//Only set Game view when streaming in editor mode (so not on PIE, SIE or standalone) 
 		if (GEditor && !GEditor->IsPlaySessionInProgress())
 		{
-			LevelEditorSubsystem = GEditor->GetEditorSubsystem<ULevelEditorSubsystem>();
-			if (LevelEditorSubsystem)
-			{
-				bPrevViewportGameViewEnabled = LevelEditorSubsystem->EditorGetGameView();
-				LevelEditorSubsystem->EditorSetGameView(true);
+			// Contexts bound to a viewport may not be capturing the active one
+			if (Context && Context->IsBoundToViewport()) {
+				TSharedPtr<FSceneViewport> BoundViewport = Context->GetViewport();
+				BoundViewportClient = FindViewportClient(BoundViewport.Get());
+				if (BoundViewportClient) {
+					bPrevViewportGameViewEnabled = BoundViewportClient->IsInGameView();
+					BoundViewportClient->SetGameView(true);
+				}
+			}
+			else {
+				LevelEditorSubsystem = GEditor->GetEditorSubsystem<ULevelEditorSubsystem>();
+				if (LevelEditorSubsystem)
+				{
+					bPrevViewportGameViewEnabled = LevelEditorSubsystem->EditorGetGameView();
+					LevelEditorSubsystem->EditorSetGameView(true);
+				}
 			}
 		}
 	#endif
 		if (ImageSourceType == EInputImageSource::Viewport) {
-			CaptureFromViewportSource(Input);
+			CaptureFromViewportSource(Input, SharedCaptures, Context);
 		}
 		else if (ImageSourceType == EInputImageSource::SceneCapture2D) {
-			CaptureFromSceneCaptureSource(Input);
+			CaptureFromSceneCaptureSource(Input, SharedCaptures, Context);
 		}
 		else if (ImageSourceType == EInputImageSource::Texture) {
-			CaptureFromTextureSource(Input);
+			CaptureFromTextureSource(Input, SharedCaptures);
 		}
 
 		// Restore screen messages and UI
 		GAreScreenMessagesEnabled = bPrevGScreenMessagesEnabled;
 		if (LevelEditorSubsystem)
 			LevelEditorSubsystem->EditorSetGameView(bPrevViewportGameViewEnabled);
+		if (BoundViewportClient)
+			BoundViewportClient->SetGameView(bPrevViewportGameViewEnabled);
 
 		GameThreadPromise->SetValue(true);
 	});
 
 	// Block until game thread has finished setting up
 	GameThreadPromise->GetFuture().Wait();
+}
+
+FStableDiffusionImageResult UStableDiffusionSubsystem::GenerateImageFromCapturedInput(const FStableDiffusionInput& Input)
+{
+	if (!GeneratorBridge)
+		return FStableDiffusionImageResult();
+
+	bIsGenerating = true;
+
+	// Generating the exact same request again would only reproduce the last image. Random seeds are resolved by the bridge
+	// so those requests are expected to come out differently every time.
+	const UStableDiffusionToolsSettings* Settings = GetDefault<UStableDiffusionToolsSettings>();
+	const bool bCanSkip = Settings->GetSkipUnchangedGenerations() && Input.Options.Seed >= 0;
+	FGenerationSignature Signature;
+	if (bCanSkip) {
+		const FString ModelContext = ModelOptions.Model + TEXT("|") + (PipelineAsset ? PipelineAsset->GetPathName() : FString());
+		Signature = FGenerationSignature::Make(Input, ModelContext, Settings->GetUnchangedCaptureThreshold() > 0.0f);
+
+		FStableDiffusionImageResult PreviousResult;
+		bool bUnchanged = false;
+		{
+			FScopeLock Lock(&LastGenerationLock);
+			bUnchanged = Signature.Matches(LastGenerationSignature, Settings->GetUnchangedCaptureThreshold()) && LastGenerationResult.OutPixels.Num() > 0;
+			if (bUnchanged) {
+				PreviousResult = LastGenerationResult;
+			}
+		}
 
-	Result = StartImageGenerationSync(Input);
+		if (bUnchanged) {
+			UE_LOG(LogTemp, Log, TEXT("Inputs haven't changed since the last generation, reusing its result"));
+			PreviousResult.View = Input.View;
+			PreviousResult.bIsDraft = Input.bIsDraft;
+			PreviousResult.RegeneratedOffset = FIntPoint::ZeroValue;
+			PreviousResult.RegeneratedSize = FIntPoint::ZeroValue;
+			PreviousResult.OutTexture = UploadToPooledTexture(PreviousResult.OutPixels, FIntPoint(PreviousResult.OutWidth, PreviousResult.OutHeight));
+			bIsGenerating = false;
+			AsyncTask(ENamedThreads::GameThread, [this, PreviousResult]
+			{
+				this->OnImageGenerationCompleteEx.Broadcast(PreviousResult);
+			});
+			return PreviousResult;
+		}
+	}
+
+	FStableDiffusionImageResult Result = StartImageGenerationSync(Input);
+
+	if (bCanSkip && !bIsStopping && Result.Completed) {
+		// The texture may be released and reused by the time the result is wanted again so keep only its pixels
+		FGCScopeGuard GCGuard;
+		FScopeLock Lock(&LastGenerationLock);
+		LastGenerationSignature = MoveTemp(Signature);
+		LastGenerationResult = Result;
+		LastGenerationResult.OutTexture = nullptr;
+	}
 	return Result;
 }
 
+UTexture2D* UStableDiffusionSubsystem::UploadToPooledTexture(const FSharedPixelBuffer& Pixels, FIntPoint Size)
+{
+	if (!Pixels.Num() || Pixels.Num() != Size.X * Size.Y)
+		return nullptr;
+
+	UTexture2D* OutTexture = nullptr;
+	auto Upload = [this, &Pixels, &Size, &OutTexture]() {
+		OutTexture = UStableDiffusionBlueprintLibrary::ColorBufferToTexture(Pixels.Get(), Size, TexturePool->Acquire(Size), true);
+		UStableDiffusionBlueprintLibrary::UpdateTextureSync(OutTexture);
+#if WITH_EDITOR
+		if (OutTexture && !UStableDiffusionBlueprintLibrary::IsDirectUploadTexture(OutTexture))
+			OutTexture->PostEditChange();
+#endif
+		TexturePool->Publish(OutTexture);
+	};
+
+	if (IsInGameThread()) {
+		Upload();
+		return OutTexture;
+	}
+
+	TSharedPtr<TPromise<bool>> GameThreadPromise = MakeShared<TPromise<bool>>();
+	AsyncTask(ENamedThreads::GameThread, [&Upload, GameThreadPromise]() {
+		Upload();
+		GameThreadPromise->SetValue(true);
+	});
+	GameThreadPromise->GetFuture().Wait();
+	return OutTexture;
+}
+
+FImagePipelineStageCache& UStableDiffusionSubsystem::GetStageCache()
+{
+	const UStableDiffusionToolsSettings* Settings = GetDefault<UStableDiffusionToolsSettings>();
+	StageCache->MaxMemoryEntries = Settings->GetMaxCachedStageResults();
+	StageCache->MaxMemoryBytes = Settings->GetMaxStageCacheMemoryBytes();
+	StageCache->bUseDisk = Settings->GetCacheStageResultsOnDisk();
+	StageCache->MaxDiskBytes = Settings->GetMaxStageCacheDiskBytes();
+	return *StageCache;
+}
+
+void UStableDiffusionSubsystem::ClearStageCache(bool bIncludeDisk)
+{
+	StageCache->Clear(bIncludeDisk);
+}
+
 void UStableDiffusionSubsystem::StopGeneratingImage()
 {
 	bIsGenerating = false;
@@ -386,23 +657,29 @@ bool UStableDiffusionSubsystem::IsStopping() const
 void UStableDiffusionSubsystem::StartImageGeneration(FStableDiffusionInput Input)
 {
 	// Generate image
-	UTexture2D* OutTexture = UTexture2D::CreateTransient(Input.Options.OutSizeX, Input.Options.OutSizeY);
-	UTexture2D* PreviewTexture = UTexture2D::CreateTransient(Input.Options.OutSizeX, Input.Options.OutSizeY);
+	FIntPoint OutSize(Input.Options.OutSizeX, Input.Options.OutSizeY);
+	UTexture2D* OutTexture = TexturePool->Acquire(OutSize);
+	UTexture2D* PreviewTexture = TexturePool->Acquire(OutSize);
 
 	// Generate the image on a background thread
 	//CurrentRenderTask = TGraphTask<FSDRenderTask>::CreateTask().ConstructAndDispatchWhenReady(ENamedThreads::AnyBackgroundHiPriTask, MoveTemp([this, Input]()
-	AsyncTask(ENamedThreads::AnyBackgroundHiPriTask, [this, Input, OutTexture, PreviewTexture]()
+	AsyncTask(ENamedThreads::AnyBackgroundHiPriTask, [this, Input=MoveTemp(Input), OutTexture, PreviewTexture]()
 	{
 			FStableDiffusionImageResult result = this->GeneratorBridge->GenerateImageFromStartImage(Input, OutTexture, PreviewTexture);
 
 			// Create generated texture on game thread
-			AsyncTask(ENamedThreads::GameThread, [this, result, OutTexture]
+			AsyncTask(ENamedThreads::GameThread, [this, result=MoveTemp(result), OutTexture, PreviewTexture]
 			{
 				UStableDiffusionBlueprintLibrary::UpdateTextureSync(OutTexture);
 #if WITH_EDITOR
-				OutTexture->PostEditChange();
+				if (!UStableDiffusionBlueprintLibrary::IsDirectUploadTexture(OutTexture))
+					OutTexture->PostEditChange();
 #endif
 				this->OnImageGenerationCompleteEx.Broadcast(result);
+
+				// The result owns the output texture from here until a consumer releases it
+				TexturePool->Publish(OutTexture);
+				TexturePool->Release(PreviewTexture);
 			});
 	});
 	//);
@@ -411,24 +688,40 @@ void UStableDiffusionSubsystem::StartImageGeneration(FStableDiffusionInput Input
 FStableDiffusionImageResult UStableDiffusionSubsystem::StartImageGenerationSync(FStableDiffusionInput Input)
 {
 	// Generate image
-	UTexture2D* OutTexture = UTexture2D::CreateTransient(Input.Options.OutSizeX, Input.Options.OutSizeY);
-	UTexture2D* PreviewTexture = UTexture2D::CreateTransient(Input.Options.OutSizeX, Input.Options.OutSizeY);
+	FIntPoint OutSize(Input.Options.OutSizeX, Input.Options.OutSizeY);
+	UTexture2D* OutTexture = TexturePool->Acquire(OutSize);
+	UTexture2D* PreviewTexture = TexturePool->Acquire(OutSize);
 
 	FStableDiffusionImageResult result = this->GeneratorBridge->GenerateImageFromStartImage(Input, OutTexture, PreviewTexture);
 	
 	// Copy view info straight to the result
 	result.View = Input.View;
+	result.bIsDraft = Input.bIsDraft;
+	result.RegeneratedSize = FIntPoint(result.OutWidth, result.OutHeight);
+
+	// The bridge has written the pixels but nothing uploads them until the game thread runs, so copy them while no one else touches the texture
+	if (result.Completed && !result.OutPixels) {
+		FScopedTexturePixels Pixels(OutTexture);
+		if (Pixels.IsValid()) {
+			result.OutPixels = TArray<FColor>(Pixels.GetPixels());
+		}
+	}
 
 	bIsGenerating = false;
 
 	// Create generated texture on game thread
-	AsyncTask(ENamedThreads::GameThread, [this, result, OutTexture]
+	AsyncTask(ENamedThreads::GameThread, [this, result, OutTexture, PreviewTexture]
 	{
 		UStableDiffusionBlueprintLibrary::UpdateTextureSync(OutTexture);
 #if WITH_EDITOR
-		OutTexture->PostEditChange();
+		if (!UStableDiffusionBlueprintLibrary::IsDirectUploadTexture(OutTexture))
+			OutTexture->PostEditChange();
 #endif
 		this->OnImageGenerationCompleteEx.Broadcast(result);
+
+		// The result owns the output texture from here until a consumer releases it
+		TexturePool->Publish(OutTexture);
+		TexturePool->Release(PreviewTexture);
 	});
 
 	return result;
@@ -439,33 +732,77 @@ void UStableDiffusionSubsystem::ClearIsStopping()
 	bIsStopping = false;
 }
 
-void UStableDiffusionSubsystem::UpsampleImage(const FStableDiffusionImageResult& input)
+void UStableDiffusionSubsystem::UpsampleImage(const FStableDiffusionImageResult& input, float UpsampleFactor)
 {
 	if (!IsValid(GeneratorBridge) || !IsValid(input.OutTexture))
 		return;
 
-	bIsUpsampling = true;
-	size_t upsampled_width = input.OutTexture->GetSizeX() * 4;
-	size_t upsampled_height = input.OutTexture->GetSizeY() * 4;
+	// Tiles are sent to the bridge as linear half floats
+	FStableDiffusionImageResult Source = input;
+	{
+		FScopedTexturePixels Pixels(input.OutTexture);
+		if (!Pixels.IsValid())
+			return;
 
-	// Create output texature to hold our upsampled result
-	UTexture2D* OutTexture = UTexture2D::CreateTransient(upsampled_width, upsampled_height);
-	UStableDiffusionBlueprintLibrary::UpdateTextureSync(OutTexture);
+		TArray<FFloat16Color> SourcePixels;
+		SourcePixels.SetNumUninitialized(Pixels.Num());
+		for (int32 PixelIdx = 0; PixelIdx < Pixels.Num(); ++PixelIdx) {
+			SourcePixels[PixelIdx] = FFloat16Color(FLinearColor(Pixels[PixelIdx]));
+		}
+		Source.OutWidth = Pixels.GetSize().X;
+		Source.OutHeight = Pixels.GetSize().Y;
+		Source.OutHalfFloatPixels = MoveTemp(SourcePixels);
+		Source.UpsampleFactor = UpsampleFactor;
+	}
 
-	AsyncTask(ENamedThreads::AnyBackgroundHiPriTask, [this, input, upsampled_width, upsampled_height, OutTexture](){
+	bIsUpsampling = true;
+	const FUpsampleTilingOptions TilingOptions = GetDefault<UStableDiffusionToolsSettings>()->GetUpsampleTilingOptions();
+
+	AsyncTask(ENamedThreads::AnyBackgroundHiPriTask, [this, Source=MoveTemp(Source), TilingOptions](){
 		FTaskTagScope Scope(ETaskTag::EParallelRenderingThread);
 
-		auto result = GeneratorBridge->UpsampleImage(input, OutTexture);
+		// Keep the upsampler loaded for all the tiles
+		TArray<FFloat16Color> UpsampledPixels;
+		FIntPoint UpsampledSize(0, 0);
+		GeneratorBridge->StartUpsample();
+		const bool bUpsampled = FTiledUpsampler::UpsampleToBuffer(GeneratorBridge, Source, TilingOptions, UpsampledPixels, UpsampledSize);
+		GeneratorBridge->StopUpsample();
 		bIsUpsampling = false;
 
+		TArray<FColor> UpsampledColors;
+		if (bUpsampled) {
+			UpsampledColors.SetNumUninitialized(UpsampledPixels.Num());
+			for (int32 PixelIdx = 0; PixelIdx < UpsampledPixels.Num(); ++PixelIdx) {
+				UpsampledColors[PixelIdx] = FLinearColor(UpsampledPixels[PixelIdx]).ToFColor(true);
+			}
+		}
+		else {
+			UE_LOG(LogTemp, Error, TEXT("Failed to upsample image"));
+		}
+
 		// Process result on game thread
 		TSharedPtr<TPromise<bool>> GameThreadPromise = MakeShared<TPromise<bool>>();
-		AsyncTask(ENamedThreads::GameThread, [this, result=MoveTemp(result), OutTexture, GameThreadPromise]() {
-			UStableDiffusionBlueprintLibrary::UpdateTextureSync(OutTexture);
+		AsyncTask(ENamedThreads::GameThread, [this, &Source, UpsampledColors=MoveTemp(UpsampledColors), UpsampledSize, GameThreadPromise]() {
+			FStableDiffusionImageResult result = Source;
+			result.OutHalfFloatPixels.Reset();
+			result.OutTexture = nullptr;
+			result.OutWidth = UpsampledSize.X;
+			result.OutHeight = UpsampledSize.Y;
+			result.Upsampled = true;
+			result.Completed = UpsampledColors.Num() > 0;
+
+			// The output texture can only be sized once the bridge has picked a scale
+			UTexture2D* OutTexture = result.Completed ? TexturePool->Acquire(UpsampledSize) : nullptr;
+			if (OutTexture) {
+				result.OutTexture = UStableDiffusionBlueprintLibrary::ColorBufferToTexture(UpsampledColors, UpsampledSize, OutTexture, true);
+				UStableDiffusionBlueprintLibrary::UpdateTextureSync(OutTexture);
 #if WITH_EDITOR
-			OutTexture->PostEditChange();
+				if (!UStableDiffusionBlueprintLibrary::IsDirectUploadTexture(OutTexture))
+					OutTexture->PostEditChange();
 #endif
+			}
 			OnImageUpsampleCompleteEx.Broadcast(result);
+			TexturePool->Publish(OutTexture);
 
 			GameThreadPromise->SetValue(true);
 		});
@@ -473,6 +810,21 @@ void UStableDiffusionSubsystem::UpsampleImage(const FStableDiffusionImageResult&
 	});
 }
 
+void UStableDiffusionSubsystem::KeepResult(const FStableDiffusionImageResult& Result)
+{
+	TexturePool->Keep(Result.OutTexture);
+}
+
+void UStableDiffusionSubsystem::ReleaseResult(const FStableDiffusionImageResult& Result)
+{
+	TexturePool->Release(Result.OutTexture);
+}
+
+FStableDiffusionTexturePoolStats UStableDiffusionSubsystem::GetTexturePoolStats() const
+{
+	return TexturePool->GetStats();
+}
+
 void UStableDiffusionSubsystem::UpdateImageProgress(int32 Step, int32 Timestep, float Progress, FIntPoint Size, UTexture2D* Texture)
 {
 	OnImageProgressUpdated.Broadcast(Step, Timestep, Progress, Size, Texture);
@@ -523,7 +875,20 @@ void UStableDiffusionSubsystem::SetLivePreviewEnabled(bool Enabled, float Delay,
 				});
 			}
 		}
-		
+
+		// Edits to the level in view refresh the preview too, once they have settled for the same delay. The trigger is
+		// restarted when the source changes so edits are checked against the view that is actually previewed.
+		if (!LivePreviewSceneTrigger.IsRunning() || LivePreviewSceneTriggerSource != Source) {
+			FSceneChangeTriggerOptions SceneChanges;
+			SceneChanges.DebounceTime = Delay;
+			TWeakObjectPtr<USceneCaptureComponent2D> WeakSource = Source;
+			LivePreviewSceneTriggerSource = WeakSource;
+			LivePreviewSceneTrigger.Start(SceneChanges, [this, WeakSource]() {
+				return GetLivePreviewView(WeakSource.Get(), 0.0f);
+			}, [this]() {
+				LivePreviewUpdate();
+			});
+		}
 	}
 	else if (!Enabled) {
 		if (Source) {
@@ -535,10 +900,12 @@ void UStableDiffusionSubsystem::SetLivePreviewEnabled(bool Enabled, float Delay,
 		if (OnCaptureCameraUpdatedDlgHandle.IsValid()) {
 			OnCaptureCameraUpdatedDlgHandle.Reset();
 		}
+		LivePreviewSceneTrigger.Stop();
+		LivePreviewSceneTriggerSource.Reset();
 	}
 }
 
-UTextureRenderTarget2D* UStableDiffusionSubsystem::SetLivePreviewForLayer(FIntPoint Size, ULayerProcessorBase* Layer, USceneCaptureComponent2D* CaptureSource)
+UTextureRenderTarget2D* UStableDiffusionSubsystem::SetLivePreviewForLayer(FIntPoint Size, ULayerProcessorBase* Layer, USceneCaptureComponent2D* CaptureSource, float PreviewScale)
 {
 	check(Layer);
 
@@ -549,9 +916,12 @@ UTextureRenderTarget2D* UStableDiffusionSubsystem::SetLivePreviewForLayer(FIntPo
 
 	USceneCaptureComponent2D* ActiveCaptureComponent = nullptr;
 	
-	// Assign or create the capture source
+	// Assign or create the capture source. The preview is only rendered again when its camera moves.
 	if (CaptureSource->IsValidLowLevel()) {
 		ActiveCaptureComponent = CaptureSource;
+		LayerPreviewSourceMovedHandle = CaptureSource->TransformUpdated.AddLambda([this](USceneComponent* UpdatedComponent, EUpdateTransformFlags UpdateTransformFlags, ETeleportType Teleport) {
+			RefreshLayerPreview();
+		});
 	}
 	else {
 		if (!LayerPreviewCapture.SceneCapture) {
@@ -559,23 +929,60 @@ UTextureRenderTarget2D* UStableDiffusionSubsystem::SetLivePreviewForLayer(FIntPo
 			//DepthPreviewCapture.SceneCapture->SetIsTemporarilyHiddenInEditor(true);
 			
 			OnLayerPreviewUpdateHandle = FEditorDelegates::OnEditorCameraMoved.AddLambda([this](const FVector& Location, const FRotator& Rotation, ELevelViewportType ViewportType, int32 ViewportIndex) {
-				UpdateSceneCaptureCamera(LayerPreviewCapture);
-
-				// Update any previewed layers
-				if (PreviewedLayer->IsValidLowLevel() && LayerPreviewCapture.SceneCapture->IsValidLowLevel())
-					PreviewedLayer->CaptureLayer(LayerPreviewCapture.SceneCapture->GetCaptureComponent2D(), false);
+				if (LayerPreviewCapture.SceneCapture->IsValidLowLevel())
+					UpdateSceneCaptureCamera(LayerPreviewCapture);
+				RefreshLayerPreview();
 			});
 		}
 		ActiveCaptureComponent = LayerPreviewCapture.SceneCapture->GetCaptureComponent2D();
 	}
+	LayerPreviewComponent = ActiveCaptureComponent;
+
+	// Edits to the level change what the preview shows as well
+	LayerPreviewActorMovedHandle = GEngine->OnActorMoved().AddLambda([this](AActor* Actor) {
+		RefreshLayerPreview();
+	});
+	LayerPreviewPropertyChangedHandle = FCoreUObjectDelegates::OnObjectPropertyChanged.AddLambda([this](UObject* Object, FPropertyChangedEvent& Event) {
+		if (Object && (Object->IsA<AActor>() || Object->IsA<UActorComponent>()))
+			RefreshLayerPreview();
+	});
 
 	// Start capturing the scene
-	PreviewedLayer->BeginCaptureLayer(GEditor->GetWorld(), Size, ActiveCaptureComponent);
-	return PreviewedLayer->CaptureLayer(CaptureSource, false);
+	const FIntPoint PreviewSize(FMath::Max(FMath::RoundToInt(Size.X * PreviewScale), 1), FMath::Max(FMath::RoundToInt(Size.Y * PreviewScale), 1));
+	PreviewedLayer->BeginCaptureLayer(GEditor->GetWorld(), PreviewSize, ActiveCaptureComponent);
+	return PreviewedLayer->CaptureLayer(ActiveCaptureComponent, true);
+}
+
+void UStableDiffusionSubsystem::RefreshLayerPreview()
+{
+	// Any number of requests in one frame only render the preview once
+	if (!PreviewedLayer || LayerPreviewTickerHandle.IsValid())
+		return;
+
+	LayerPreviewTickerHandle = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateWeakLambda(this, [this](float DeltaTime) {
+		LayerPreviewTickerHandle.Reset();
+		if (PreviewedLayer->IsValidLowLevel() && LayerPreviewComponent.IsValid())
+			PreviewedLayer->CaptureLayer(LayerPreviewComponent.Get(), true);
+		return false;
+	}));
 }
 
 void UStableDiffusionSubsystem::DisableLivePreviewForLayer()
 {
+	if (USceneCaptureComponent2D* PreviewComponent = LayerPreviewComponent.Get()) {
+		PreviewComponent->TransformUpdated.Remove(LayerPreviewSourceMovedHandle);
+	}
+	LayerPreviewSourceMovedHandle.Reset();
+	LayerPreviewComponent.Reset();
+	GEngine->OnActorMoved().Remove(LayerPreviewActorMovedHandle);
+	LayerPreviewActorMovedHandle.Reset();
+	FCoreUObjectDelegates::OnObjectPropertyChanged.Remove(LayerPreviewPropertyChangedHandle);
+	LayerPreviewPropertyChangedHandle.Reset();
+	if (LayerPreviewTickerHandle.IsValid()) {
+		FTSTicker::GetCoreTicker().RemoveTicker(LayerPreviewTickerHandle);
+		LayerPreviewTickerHandle.Reset();
+	}
+
 	if (LayerPreviewCapture.SceneCapture && PreviewedLayer->IsValidLowLevel()) {
 		if (PreviewedLayer)
 			PreviewedLayer->EndCaptureLayer(GEditor->GetWorld(), LayerPreviewCapture.SceneCapture->GetCaptureComponent2D());
@@ -593,6 +1000,193 @@ void UStableDiffusionSubsystem::DisableLivePreviewForLayer()
 	PreviewedLayer = nullptr;
 }
 
+void UStableDiffusionSubsystem::StartLivePreviewStream(FStableDiffusionInput Input, EInputImageSource ImageSourceType, FLivePreviewStreamOptions Options, USceneCaptureComponent2D* CaptureSource)
+{
+	DefaultGenerationContext->StartLivePreviewStream(MoveTemp(Input), ImageSourceType, Options, CaptureSource);
+}
+
+void UStableDiffusionSubsystem::StopLivePreviewStream()
+{
+	DefaultGenerationContext->StopLivePreviewStream();
+}
+
+bool UStableDiffusionSubsystem::IsLivePreviewStreaming() const
+{
+	return DefaultGenerationContext->IsLivePreviewStreaming();
+}
+
+UStableDiffusionGenerationContext* UStableDiffusionSubsystem::CreateGenerationContext(bool bBindToActiveViewport)
+{
+	UStableDiffusionGenerationContext* Context = NewObject<UStableDiffusionGenerationContext>(this);
+	if (bBindToActiveViewport) {
+		TSharedPtr<FSceneViewport> Viewport = GetCapturingViewport();
+		if (!Viewport.IsValid()) {
+			UE_LOG(LogTemp, Warning, TEXT("No active viewport to bind the generation context to. It will follow the active viewport instead"));
+		}
+		Context->BindViewport(Viewport);
+	}
+
+	FScopeLock Lock(&LivePreviewLock);
+	GenerationContexts.Add(Context);
+	return Context;
+}
+
+void UStableDiffusionSubsystem::ReleaseGenerationContext(UStableDiffusionGenerationContext* Context)
+{
+	if (!Context)
+		return;
+
+	if (Context == DefaultGenerationContext) {
+		UE_LOG(LogTemp, Warning, TEXT("The default generation context can't be released"));
+		return;
+	}
+
+	Context->StopLivePreviewStream();
+
+	FScopeLock Lock(&LivePreviewLock);
+	GenerationContexts.Remove(Context);
+}
+
+UStableDiffusionGenerationContext* UStableDiffusionSubsystem::GetDefaultGenerationContext() const
+{
+	return DefaultGenerationContext;
+}
+
+bool UStableDiffusionSubsystem::StartViewportFrameStream(float Aspect)
+{
+	StopViewportFrameStream();
+
+	TSharedPtr<FSceneViewport> Viewport = GetCapturingViewport();
+	if (!Viewport.IsValid())
+		return false;
+
+	// Frames are grabbed continuously so editor widgets have to stay hidden for the whole stream
+#if WITH_EDITOR
+	if (GEditor && !GEditor->IsPlaySessionInProgress()) {
+		if (ULevelEditorSubsystem* LevelEditorSubsystem = GEditor->GetEditorSubsystem<ULevelEditorSubsystem>()) {
+			bFrameStreamRestoreGameView = !LevelEditorSubsystem->EditorGetGameView();
+			LevelEditorSubsystem->EditorSetGameView(true);
+		}
+	}
+#endif
+
+	FrameStreamAspect = Aspect;
+	ViewportFrameStream = MakeShared<FViewportFrameStream>();
+	const bool bStarted = ViewportFrameStream->Start(Viewport.ToSharedRef(), [this]() {
+		FIntPoint MinBounds, MaxBounds;
+		CalculateOverlayBounds(FrameStreamAspect, MinBounds, MaxBounds);
+		return FIntRect(MinBounds, MaxBounds);
+	});
+
+	if (!bStarted) {
+		UE_LOG(LogTemp, Warning, TEXT("Could not start grabbing viewport frames. Viewport captures will read the viewport back instead"));
+		StopViewportFrameStream();
+	}
+	return bStarted;
+}
+
+void UStableDiffusionSubsystem::StopViewportFrameStream()
+{
+	if (ViewportFrameStream.IsValid()) {
+		ViewportFrameStream->Stop();
+		ViewportFrameStream.Reset();
+	}
+
+#if WITH_EDITOR
+	if (bFrameStreamRestoreGameView && GEditor) {
+		if (ULevelEditorSubsystem* LevelEditorSubsystem = GEditor->GetEditorSubsystem<ULevelEditorSubsystem>()) {
+			LevelEditorSubsystem->EditorSetGameView(false);
+		}
+	}
+#endif
+	bFrameStreamRestoreGameView = false;
+}
+
+FMinimalViewInfo UStableDiffusionSubsystem::GetLivePreviewView(USceneCaptureComponent2D* CaptureSource, float AspectRatio, FSceneViewport* Viewport) const
+{
+	if (!CaptureSource)
+		return UStableDiffusionBlueprintLibrary::GetViewportViewInfo(Viewport ? Viewport : GetCapturingViewport().Get());
+
+	FMinimalViewInfo View;
+	CaptureSource->GetCameraView(0, View);
+	if (AspectRatio > 0.0f) {
+		View.AspectRatio = AspectRatio;
+	}
+	else if (CaptureSource->TextureTarget && CaptureSource->TextureTarget->SizeY > 0) {
+		View.AspectRatio = float(CaptureSource->TextureTarget->SizeX) / float(CaptureSource->TextureTarget->SizeY);
+	}
+	return View;
+}
+
+void UStableDiffusionSubsystem::ScheduleLivePreview(UStableDiffusionGenerationContext* Context, FLivePreviewRequest Request)
+{
+	bool bStartWorker = false;
+	{
+		FScopeLock Lock(&LivePreviewLock);
+		if (bLivePreviewShutdown)
+			return;
+
+		Context->LivePreviewMailbox = MoveTemp(Request);
+		bStartWorker = !bLivePreviewWorkerRunning;
+		bLivePreviewWorkerRunning = true;
+
+		// Only the context's own job is out of date. Other contexts keep their turn.
+		if (Context->bLivePreviewGenerating) {
+			GeneratorBridge->StopImageGeneration();
+		}
+	}
+
+	if (bStartWorker) {
+		RunLivePreviewWorker();
+	}
+}
+
+UStableDiffusionGenerationContext* UStableDiffusionSubsystem::TakeNextLivePreview(FLivePreviewRequest& OutRequest)
+{
+	// Contexts take turns, so one that keeps queueing jobs can't starve the others
+	const int32 NumContexts = GenerationContexts.Num();
+	for (int32 Offset = 0; Offset < NumContexts; ++Offset) {
+		const int32 ContextIdx = (NextLivePreviewContext + Offset) % NumContexts;
+		UStableDiffusionGenerationContext* Context = GenerationContexts[ContextIdx];
+		if (Context && Context->LivePreviewMailbox.IsSet()) {
+			OutRequest = MoveTemp(Context->LivePreviewMailbox.GetValue());
+			Context->LivePreviewMailbox.Reset();
+			NextLivePreviewContext = (ContextIdx + 1) % NumContexts;
+			return Context;
+		}
+	}
+	return nullptr;
+}
+
+void UStableDiffusionSubsystem::RunLivePreviewWorker()
+{
+	AsyncTask(ENamedThreads::AnyBackgroundHiPriTask, [this]() {
+		while (true) {
+			UStableDiffusionGenerationContext* Context = nullptr;
+			FLivePreviewRequest Request;
+			{
+				FGCScopeGuard GCGuard;
+				FScopeLock Lock(&LivePreviewLock);
+				Context = TakeNextLivePreview(Request);
+				ScheduledContext = Context;
+				if (!Context) {
+					bLivePreviewWorkerRunning = false;
+					return;
+				}
+			}
+
+			Context->GenerateLivePreview(Request);
+		}
+	});
+}
+
+void UStableDiffusionSubsystem::OnGenerationContextResult(UStableDiffusionGenerationContext* Context, const FStableDiffusionImageResult& Result)
+{
+	if (Context == DefaultGenerationContext) {
+		OnLivePreviewResultEx.Broadcast(Result);
+	}
+}
+
 void UStableDiffusionSubsystem::ShowAspectOverlay()
 {
 	FActorSpawnParameters Params;
@@ -619,41 +1213,67 @@ void UStableDiffusionSubsystem::UpdateAspectOverlay(float aspect)
 }
 
 void UStableDiffusionSubsystem::CalculateOverlayBounds(float Aspect, FIntPoint& MinBounds, FIntPoint& MaxBounds)
+{
+	const FIntRect Result = CalculateViewportOverlayBounds(UStableDiffusionSubsystem::GetCapturingViewport().Get(), Aspect);
+	MinBounds = Result.Min;
+	MaxBounds = Result.Max;
+}
+
+FIntRect UStableDiffusionSubsystem::CalculateViewportOverlayBounds(FSceneViewport* Viewport, float Aspect)
 {
 	FIntRect Result;
-	auto EditorViewport = UStableDiffusionSubsystem::GetCapturingViewport();
-	auto Client = EditorViewport->GetClient();
+	if (!Viewport)
+		return Result;
+
+	auto Client = Viewport->GetClient();
 	if (FEditorViewportClient* EditorClient = StaticCast<FEditorViewportClient*>(Client)) {
-		FSceneViewFamilyContext ViewFamily(FSceneViewFamily::ConstructionValues(EditorViewport.Get(), EditorClient->GetScene(), EditorClient->EngineShowFlags));
+		FSceneViewFamilyContext ViewFamily(FSceneViewFamily::ConstructionValues(Viewport, EditorClient->GetScene(), EditorClient->EngineShowFlags));
 		FSceneView* View = EditorClient->CalcSceneView(&ViewFamily);
-		Result = EditorViewport->CalculateViewExtents(Aspect, View->UnconstrainedViewRect);
-		MinBounds = Result.Min;
-		MaxBounds = Result.Max;
+		Result = Viewport->CalculateViewExtents(Aspect, View->UnconstrainedViewRect);
 	}
+	return Result;
+}
+
+FLevelEditorViewportClient* UStableDiffusionSubsystem::FindViewportClient(const FViewport* Viewport)
+{
+	if (!Viewport || !GEditor)
+		return nullptr;
+
+	for (FLevelEditorViewportClient* LevelVC : GEditor->GetLevelViewportClients()) {
+		if (LevelVC && LevelVC->Viewport == Viewport)
+			return LevelVC;
+	}
+	return nullptr;
 }
 
 FViewportSceneCapture UStableDiffusionSubsystem::CreateSceneCaptureFromEditorViewport()
 {
-	FViewportSceneCapture SceneCapture;
+	return CreateSceneCaptureForViewport(nullptr);
+}
 
-	bool FoundViewport = false;
-	FVector CameraLocation = FVector::ZeroVector;
-	FRotator CameraRotation = FRotator::ZeroRotator;
-	float HorizFov = 0.0f;
+FViewportSceneCapture UStableDiffusionSubsystem::CreateSceneCaptureForViewport(const FViewport* Viewport)
+{
+	FViewportSceneCapture SceneCapture;
 
-	for (FLevelEditorViewportClient* LevelVC : GEditor->GetLevelViewportClients())
-	{
-		if (LevelVC && LevelVC->IsPerspective())
+	// Follow the given viewport's camera, or the first perspective one if it has none
+	FLevelEditorViewportClient* ViewportClient = FindViewportClient(Viewport);
+	if (!ViewportClient || !ViewportClient->IsPerspective()) {
+		ViewportClient = nullptr;
+		for (FLevelEditorViewportClient* LevelVC : GEditor->GetLevelViewportClients())
 		{
-			FoundViewport = true;
-			SceneCapture.ViewportClient = LevelVC;
-			break;
+			if (LevelVC && LevelVC->IsPerspective())
+			{
+				ViewportClient = LevelVC;
+				break;
+			}
 		}
 	}
+	const bool FoundViewport = ViewportClient != nullptr;
+	SceneCapture.ViewportClient = ViewportClient;
 
 	if (FoundViewport){
 		SceneCapture.SceneCapture = GEditor->GetEditorWorldContext().World()->SpawnActor<ASceneCapture2D>();
-		SceneCapture.SceneCapture->GetCaptureComponent2D()->bCaptureEveryFrame = true;
+		SceneCapture.SceneCapture->GetCaptureComponent2D()->bCaptureEveryFrame = false;
 		SceneCapture.SceneCapture->GetCaptureComponent2D()->bCaptureOnMovement = false;
 		SceneCapture.SceneCapture->GetCaptureComponent2D()->bAlwaysPersistRenderingState = true;
 		SceneCapture.SceneCapture->GetCaptureComponent2D()->CompositeMode = SCCM_Overwrite;
@@ -673,47 +1293,73 @@ void UStableDiffusionSubsystem::UpdateSceneCaptureCamera(FViewportSceneCapture&
 	CaptureComponent->FOVAngle = SceneCapture.ViewportClient->FOVAngle;
 }
 
-void UStableDiffusionSubsystem::CaptureFromViewportSource(FStableDiffusionInput& Input)
+void UStableDiffusionSubsystem::CaptureFromViewportSource(FStableDiffusionInput& Input, FLayerCaptureSet* SharedCaptures, UStableDiffusionGenerationContext* Context)
 {
 	check(IsInGameThread());
 
-	auto ViewportSize = GetCapturingViewport()->GetSizeXY();
+	TSharedPtr<FSceneViewport> Viewport = Context ? Context->GetViewport() : GetCapturingViewport();
+	if (!Viewport.IsValid()) {
+		UE_LOG(LogTemp, Warning, TEXT("No viewport to capture from"));
+		return;
+	}
 
-	FIntPoint MinBounds, MaxBounds;
-	CalculateOverlayBounds(float(Input.Options.OutSizeX) / float(Input.Options.OutSizeY), MinBounds, MaxBounds);
-	FIntRect FrameBounds(MinBounds.X, MinBounds.Y, MaxBounds.X, MaxBounds.Y);
+	const FIntRect FrameBounds = CalculateViewportOverlayBounds(Viewport.Get(), float(Input.Options.OutSizeX) / float(Input.Options.OutSizeY));
 
 	// Process each layer the model has requested
+	TArray<int32> CapturedLayerIndices;
 	if (Input.InputLayers.Num()) {
 		Input.ProcessedLayers.Reset();
 		Input.ProcessedLayers.Reserve(Input.InputLayers.Num());
-		Input.View = UStableDiffusionBlueprintLibrary::GetEditorViewportViewInfo();
+		Input.View = UStableDiffusionBlueprintLibrary::GetViewportViewInfo(Viewport.Get());
 
-		// Create a scene capture
-		auto SceneCapture = CreateSceneCaptureFromEditorViewport();
+		// The scene capture is only created once a layer actually needs capturing
+		FViewportSceneCapture SceneCapture;
 
 		for (auto& Layer : Input.InputLayers) {
 			// Copy layer
 			FLayerProcessorContext TargetLayer = Layer;
-			TargetLayer.Processor->BeginCaptureLayer(SceneCapture.SceneCapture->GetWorld(), FrameBounds.Size(), SceneCapture.SceneCapture->GetCaptureComponent2D(), Layer.ProcessorOptions);
-			auto ResultRT = TargetLayer.Processor->CaptureLayer(SceneCapture.SceneCapture->GetCaptureComponent2D(), true, Layer.ProcessorOptions);
-			TargetLayer.Processor->EndCaptureLayer(SceneCapture.SceneCapture->GetWorld(), SceneCapture.SceneCapture->GetCaptureComponent2D());
-			TargetLayer.LayerPixels = TargetLayer.Processor->ProcessLayer(ResultRT);
+			if (!SharedCaptures || !SharedCaptures->Find(Layer, FrameBounds.Size(), TargetLayer)) {
+				if (!SceneCapture.SceneCapture) {
+					SceneCapture = CreateSceneCaptureForViewport(Viewport.Get());
+				}
+				TargetLayer.Processor->BeginCaptureLayer(SceneCapture.SceneCapture->GetWorld(), FrameBounds.Size(), SceneCapture.SceneCapture->GetCaptureComponent2D(), Layer.ProcessorOptions);
+				auto ResultRT = TargetLayer.Processor->CaptureLayer(SceneCapture.SceneCapture->GetCaptureComponent2D(), true, Layer.ProcessorOptions);
+				TargetLayer.Processor->EndCaptureLayer(SceneCapture.SceneCapture->GetWorld(), SceneCapture.SceneCapture->GetCaptureComponent2D());
+				TargetLayer.Processor->ProcessLayerPixels(ResultRT, TargetLayer);
+				CapturedLayerIndices.Add(Input.ProcessedLayers.Num());
+			}
 			Input.ProcessedLayers.Add(MoveTemp(TargetLayer));
 		}
 
 		// Cleanup
-		SceneCapture.SceneCapture->Destroy();
+		if (SceneCapture.SceneCapture) {
+			SceneCapture.SceneCapture->Destroy();
+		}
 	}
 
-	// Take the screenshot of the active viewport
-	TArray<FColor> Pixels;
-	GetViewportScreenShot(UStableDiffusionSubsystem::GetCapturingViewport().Get(), Pixels, FrameBounds);
+	// Find a final colour layer as a destination for a screenshot of the active viewport. Shared final colour layers already hold one.
+	const int32 FinalColorIdx = Input.ProcessedLayers.IndexOfByPredicate([](const FLayerProcessorContext& Layer) { return Layer.Processor->IsA<UFinalColorLayerProcessor>(); });
+	if (FinalColorIdx != INDEX_NONE && (!SharedCaptures || CapturedLayerIndices.Contains(FinalColorIdx))) {
+		// Recent streamed frames of the same bounds are as good as a fresh readback
+		TArray<FColor> Pixels;
+		FStreamedViewportFrame StreamedFrame;
+		const FViewportFrameStream* FrameStream = (Context && Context->GetFrameStream()) ? Context->GetFrameStream() : ViewportFrameStream.Get();
+		if (FrameStream && FrameStream->GetLatestFrame(StreamedFrame) && StreamedFrame.Bounds == FrameBounds && StreamedFrame.FrameNumber + MaxStreamedFrameAge >= GFrameNumber) {
+			Pixels = MoveTemp(StreamedFrame.Pixels);
+		}
+		else {
+			GetViewportScreenShot(Viewport.Get(), Pixels, FrameBounds);
+		}
 
-	// Find a final colour layer as a destination for our captured frame
-	auto FinalColorProcessor = Input.ProcessedLayers.FindByPredicate([](const FLayerProcessorContext& Layer) { return Layer.Processor->IsA<UFinalColorLayerProcessor>(); });
-	if (FinalColorProcessor) {
-		FinalColorProcessor->LayerPixels = MoveTemp(Pixels);
+		FLayerProcessorContext& FinalColorProcessor = Input.ProcessedLayers[FinalColorIdx];
+		FinalColorProcessor.ResetPixels();
+		FinalColorProcessor.SharedLayerPixels = MoveTemp(Pixels);
+	}
+
+	if (SharedCaptures) {
+		for (int32 LayerIdx : CapturedLayerIndices) {
+			SharedCaptures->Add(Input.ProcessedLayers[LayerIdx], FrameBounds.Size());
+		}
 	}
 
 	// Set size from viewport
@@ -721,15 +1367,16 @@ void UStableDiffusionSubsystem::CaptureFromViewportSource(FStableDiffusionInput&
 	Input.Options.InSizeY = FrameBounds.Size().Y;
 }
 
-void UStableDiffusionSubsystem::CaptureFromSceneCaptureSource(FStableDiffusionInput& Input)
+void UStableDiffusionSubsystem::CaptureFromSceneCaptureSource(FStableDiffusionInput& Input, FLayerCaptureSet* SharedCaptures, UStableDiffusionGenerationContext* Context)
 {
 	check(IsInGameThread());
 
 	// Use chosen scene capture component or create a default one
 	USceneCaptureComponent2D* CaptureComponent = nullptr;
+	FViewportSceneCapture CurrentSceneCapture;
 	if (!Input.CaptureSource) {
 		// Create a default SceneCapture2D that will capture our editor viewport
-		CurrentSceneCapture = CreateSceneCaptureFromEditorViewport();
+		CurrentSceneCapture = CreateSceneCaptureForViewport(Context ? Context->GetViewport().Get() : nullptr);
 		CaptureComponent = CurrentSceneCapture.SceneCapture->GetCaptureComponent2D();
 	}
 	else {
@@ -750,10 +1397,15 @@ void UStableDiffusionSubsystem::CaptureFromSceneCaptureSource(FStableDiffusionIn
 	Input.ProcessedLayers.Reset();
 	Input.ProcessedLayers.Reserve(Input.InputLayers.Num());
 	for (auto Layer : Input.InputLayers) {
-		Layer.Processor->BeginCaptureLayer(CaptureComponent->GetWorld(), CaptureSize, CaptureComponent, Layer.ProcessorOptions);
-		auto ResultRT = Layer.Processor->CaptureLayer(CaptureComponent, true, Layer.ProcessorOptions);
-		Layer.Processor->EndCaptureLayer(CaptureComponent->GetWorld(), CaptureComponent);
-		Layer.LayerPixels = Layer.Processor->ProcessLayer(ResultRT);
+		if (!SharedCaptures || !SharedCaptures->Find(Layer, CaptureSize, Layer)) {
+			Layer.Processor->BeginCaptureLayer(CaptureComponent->GetWorld(), CaptureSize, CaptureComponent, Layer.ProcessorOptions);
+			auto ResultRT = Layer.Processor->CaptureLayer(CaptureComponent, true, Layer.ProcessorOptions);
+			Layer.Processor->EndCaptureLayer(CaptureComponent->GetWorld(), CaptureComponent);
+			Layer.Processor->ProcessLayerPixels(ResultRT, Layer);
+			if (SharedCaptures) {
+				SharedCaptures->Add(Layer, CaptureSize);
+			}
+		}
 		Input.ProcessedLayers.Add(MoveTemp(Layer));
 	}
 
@@ -761,17 +1413,17 @@ void UStableDiffusionSubsystem::CaptureFromSceneCaptureSource(FStableDiffusionIn
 	Input.Options.InSizeX = CaptureSize.X;
 	Input.Options.InSizeY = CaptureSize.Y;
 
-	if (!Input.CaptureSource && this->CurrentSceneCapture.SceneCapture) {
+	if (!Input.CaptureSource && CurrentSceneCapture.SceneCapture) {
 		// Cleanup created scene capture once we've captured all our pixel data
-		this->CurrentSceneCapture.SceneCapture->Destroy();
-		this->CurrentSceneCapture.ViewportClient = nullptr;
+		CurrentSceneCapture.SceneCapture->Destroy();
+		CurrentSceneCapture.ViewportClient = nullptr;
 	}
 	else {
 		
 	}
 }
 
-void UStableDiffusionSubsystem::CaptureFromTextureSource(FStableDiffusionInput& Input)
+void UStableDiffusionSubsystem::CaptureFromTextureSource(FStableDiffusionInput& Input, FLayerCaptureSet* SharedCaptures)
 {
 	check(IsInGameThread());
 
@@ -781,19 +1433,32 @@ void UStableDiffusionSubsystem::CaptureFromTextureSource(FStableDiffusionInput&
 	// Process each layer the model has requested
 	Input.ProcessedLayers.Reset();
 	Input.ProcessedLayers.Reserve(Input.InputLayers.Num());
+	TArray<int32> CapturedLayerIndices;
 	for (auto Layer : Input.InputLayers) {
-		Layer.Processor->BeginCaptureLayer(GEditor->GetEditorWorldContext().World(), CaptureSize);
-		auto ResultRT = Layer.Processor->CaptureLayer(nullptr);
-		Layer.Processor->EndCaptureLayer(GEditor->GetEditorWorldContext().World());
-		Layer.LayerPixels = Layer.Processor->ProcessLayer(ResultRT);
+		if (!SharedCaptures || !SharedCaptures->Find(Layer, CaptureSize, Layer)) {
+			Layer.Processor->BeginCaptureLayer(GEditor->GetEditorWorldContext().World(), CaptureSize);
+			auto ResultRT = Layer.Processor->CaptureLayer(nullptr);
+			Layer.Processor->EndCaptureLayer(GEditor->GetEditorWorldContext().World());
+			Layer.Processor->ProcessLayerPixels(ResultRT, Layer);
+			CapturedLayerIndices.Add(Input.ProcessedLayers.Num());
+		}
 		Input.ProcessedLayers.Add(MoveTemp(Layer));
 	}
 
-	// Find a final colour layer as a destination for our texture
-	auto FinalColorProcessor = Input.ProcessedLayers.FindByPredicate([](const FLayerProcessorContext& Layer) { return Layer.Processor->IsA<UFinalColorLayerProcessor>(); });
-	if (FinalColorProcessor) {
+	// Find a final colour layer as a destination for our texture. Shared final colour layers already hold it.
+	const int32 FinalColorIdx = Input.ProcessedLayers.IndexOfByPredicate([](const FLayerProcessorContext& Layer) { return Layer.Processor->IsA<UFinalColorLayerProcessor>(); });
+	if (FinalColorIdx != INDEX_NONE && (!SharedCaptures || CapturedLayerIndices.Contains(FinalColorIdx))) {
 		if (auto Tex = Input.OverrideTextureInput) {
-			FinalColorProcessor->LayerPixels = UStableDiffusionBlueprintLibrary::ReadPixels(Input.OverrideTextureInput);
+			FLayerProcessorContext& FinalColorProcessor = Input.ProcessedLayers[FinalColorIdx];
+			FinalColorProcessor.HalfFloatLayerPixels.Reset();
+			FinalColorProcessor.FloatLayerPixels.Reset();
+			UStableDiffusionBlueprintLibrary::ReadPixels(Input.OverrideTextureInput, FinalColorProcessor.SharedLayerPixels.GetMutable());
+		}
+	}
+
+	if (SharedCaptures) {
+		for (int32 LayerIdx : CapturedLayerIndices) {
+			SharedCaptures->Add(Input.ProcessedLayers[LayerIdx], CaptureSize);
 		}
 	}
 }
@@ -850,22 +1515,9 @@ FStableDiffusionModelInitResult UStableDiffusionSubsystem::GetModelStatus() cons
 
 TArray<FColor> UStableDiffusionSubsystem::CopyFrameData(FIntRect Bounds, FIntPoint BufferSize, const FColor* ColorBuffer)
 {
-	// Copy frame data
 	TArray<FColor> CopiedFrame;
-
-	CopiedFrame.InsertUninitialized(0, Bounds.Size().X * Bounds.Size().Y);
-	FColor* Dest = &CopiedFrame[0];
-	const int32 MaxWidth = FMath::Min(Bounds.Size().X, BufferSize.X);
-
-	ColorBuffer += Bounds.Min.Y * BufferSize.X;
-	for (int32 Row = Bounds.Min.Y; Row < FMath::Min(Bounds.Max.Y, BufferSize.Y); ++Row)
-	{
-		FMemory::Memcpy(Dest, ColorBuffer + Bounds.Min.X, sizeof(FColor) * MaxWidth);
-		ColorBuffer += BufferSize.X;
-		Dest += MaxWidth;
-	}
-
-	return std::move(CopiedFrame);
+	FViewportFrameStream::CopyFrame(ColorBuffer, BufferSize, Bounds, CopiedFrame);
+	return CopiedFrame;
 }
 
 
@@ -0,0 +1,124 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "StableDiffusionTexturePool.h"
+#include "UObject/GCScopeLock.h"
+#include "UObject/UObjectGlobals.h"
+
+UTexture2D* UStableDiffusionTexturePool::Acquire(FIntPoint Size, EPixelFormat Format)
+{
+	if (Size.X <= 0 || Size.Y <= 0)
+		return nullptr;
+
+	// Textures may be requested from generation threads so keep the GC away while we touch the pool
+	FGCScopeGuard GCGuard;
+	FScopeLock Lock(&PoolLock);
+
+	UTexture2D* Texture = nullptr;
+	int32 FreeIdx = FreeTextures.IndexOfByPredicate([&Size, Format](const TObjectPtr<UTexture2D>& Free) {
+		return IsValid(Free) && Free->GetSizeX() == Size.X && Free->GetSizeY() == Size.Y && Free->GetPixelFormat() == Format;
+	});
+
+	if (FreeIdx != INDEX_NONE) {
+		Texture = FreeTextures[FreeIdx];
+		FreeTextures.RemoveAtSwap(FreeIdx);
+		Stats.NumReused++;
+	}
+	else {
+		Texture = UTexture2D::CreateTransient(Size.X, Size.Y, Format);
+		Stats.NumCreated++;
+	}
+
+	if (!Texture)
+		return nullptr;
+
+	LeasedTextures.Add(Texture);
+	return Texture;
+}
+
+void UStableDiffusionTexturePool::Publish(UTexture2D* Texture)
+{
+	if (!Texture)
+		return;
+
+	FScopeLock Lock(&PoolLock);
+	if (LeasedTextures.RemoveSingleSwap(Texture) > 0) {
+		PublishedTextures.Add(Texture);
+	}
+
+	// Forget results that were garbage collected without being released
+	for (auto It = PublishedTextures.CreateIterator(); It; ++It) {
+		if (!It->IsValid()) {
+			It.RemoveCurrent();
+		}
+	}
+}
+
+void UStableDiffusionTexturePool::Release(UTexture2D* Texture)
+{
+	if (!Texture)
+		return;
+
+	FGCScopeGuard GCGuard;
+	FScopeLock Lock(&PoolLock);
+
+	// Textures that aren't ours, were kept or have been released already are left alone
+	if (LeasedTextures.RemoveSingleSwap(Texture) == 0) {
+		if (PublishedTextures.Remove(Texture) == 0)
+			return;
+		Stats.NumReleased++;
+	}
+
+	if (FreeTextures.Num() < MaxFreeTextures && IsValid(Texture)) {
+		FreeTextures.Add(Texture);
+	}
+}
+
+void UStableDiffusionTexturePool::Keep(UTexture2D* Texture)
+{
+	if (!Texture)
+		return;
+
+	FScopeLock Lock(&PoolLock);
+	if (LeasedTextures.RemoveSingleSwap(Texture) > 0 || PublishedTextures.Remove(Texture) > 0) {
+		Stats.NumKept++;
+	}
+}
+
+void UStableDiffusionTexturePool::Trim()
+{
+	FScopeLock Lock(&PoolLock);
+	FreeTextures.Reset();
+}
+
+FStableDiffusionTexturePoolStats UStableDiffusionTexturePool::GetStats() const
+{
+	FScopeLock Lock(&PoolLock);
+
+	FStableDiffusionTexturePoolStats Result = Stats;
+	Result.NumFree = FreeTextures.Num();
+	Result.NumLeased = LeasedTextures.Num();
+	Result.NumPublished = 0;
+	Result.PooledBytes = 0;
+	for (const TObjectPtr<UTexture2D>& Texture : FreeTextures) {
+		Result.PooledBytes += GetTextureBytes(Texture);
+	}
+	for (const TObjectPtr<UTexture2D>& Texture : LeasedTextures) {
+		Result.PooledBytes += GetTextureBytes(Texture);
+	}
+	for (const TWeakObjectPtr<UTexture2D>& Texture : PublishedTextures) {
+		if (Texture.IsValid()) {
+			Result.NumPublished++;
+			Result.PooledBytes += GetTextureBytes(Texture.Get());
+		}
+	}
+	return Result;
+}
+
+int64 UStableDiffusionTexturePool::GetTextureBytes(const UTexture2D* Texture)
+{
+	if (!IsValid(Texture))
+		return 0;
+
+	const FPixelFormatInfo& FormatInfo = GPixelFormats[Texture->GetPixelFormat()];
+	return (int64)Texture->GetSizeX() * Texture->GetSizeY() * FormatInfo.BlockBytes / (FormatInfo.BlockSizeX * FormatInfo.BlockSizeY);
+}
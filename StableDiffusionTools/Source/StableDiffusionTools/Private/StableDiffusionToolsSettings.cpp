@@ -54,6 +54,27 @@ FDirectoryPath UStableDiffusionToolsSettings::GetPythonSitePackagesOverridePath(
 	return AbsPath;
 }
 
+const FLatentPreviewCoefficients& UStableDiffusionToolsSettings::GetLatentPreviewCoefficients(ELatentModelFamily Family, int32 NumChannels) const
+{
+	if (Family == ELatentModelFamily::Auto) {
+		Family = FLatentPreview::GetFamilyFromChannelCount(NumChannels);
+	}
+
+	// Only use configured coefficients if they match the latents we've been given
+	const FLatentPreviewCoefficients* Coefficients = LatentPreviewCoefficients.Find(Family);
+	if (Coefficients && Coefficients->NumChannels() == NumChannels) {
+		return *Coefficients;
+	}
+
+	const FLatentPreviewCoefficients& Defaults = FLatentPreview::GetDefaultCoefficients(Family, NumChannels);
+	if (Defaults.NumChannels() == NumChannels) {
+		return Defaults;
+	}
+
+	// Family doesn't match the latent shape so fall back to whatever family has the right channel count
+	return FLatentPreview::GetDefaultCoefficients(ELatentModelFamily::Auto, NumChannels);
+}
+
 void UStableDiffusionToolsSettings::AddGeneratorToken(const FName& Generator)
 {
 	if (!GeneratorTokens.Contains(Generator)) {
@@ -0,0 +1,206 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "TiledUpsampler.h"
+#include "StableDiffusionBridge.h"
+#include "StableDiffusionBlueprintLibrary.h"
+#include "ImageResampler.h"
+
+namespace
+{
+	// Tile starts along one axis. The last tile is pulled back so it ends on the image edge instead of hanging over it,
+	// which means neighbouring tiles always share at least Length - Step pixels.
+	TArray<int32> GetTileStarts(int32 Length, int32 TileLength, int32 Step)
+	{
+		TArray<int32> Starts;
+		for (int32 Start = 0; ; Start += Step) {
+			if (Start + TileLength >= Length) {
+				Starts.Add(FMath::Max(Length - TileLength, 0));
+				break;
+			}
+			Starts.Add(Start);
+		}
+		return Starts;
+	}
+
+	int32 ToOutput(int32 InputPos, float Factor)
+	{
+		return FMath::RoundToInt(InputPos * Factor);
+	}
+
+	// Placement of every tile along one output axis along with its blend weights. Tiles ramp up and down across their
+	// overlaps and the weights are normalised so they sum to one at every pixel. The 2D weight of a tile is the product
+	// of its weights on both axes.
+	struct FTileAxis
+	{
+		TArray<int32> OutStarts;
+		TArray<int32> OutLengths;
+		TArray<TArray<float>> Weights;
+	};
+
+	FTileAxis GetTileAxis(const TArray<int32>& Starts, int32 TileLength, int32 Length, float Factor, int32 Ramp)
+	{
+		FTileAxis Axis;
+		TArray<float> WeightSums;
+		WeightSums.SetNumZeroed(ToOutput(Length, Factor));
+
+		for (int32 TileIdx = 0; TileIdx < Starts.Num(); ++TileIdx) {
+			const int32 OutStart = ToOutput(Starts[TileIdx], Factor);
+			const int32 OutLength = ToOutput(Starts[TileIdx] + TileLength, Factor) - OutStart;
+			const bool bFeatherStart = Starts[TileIdx] > 0;
+			const bool bFeatherEnd = Starts[TileIdx] + TileLength < Length;
+			Axis.OutStarts.Add(OutStart);
+			Axis.OutLengths.Add(OutLength);
+
+			TArray<float>& TileWeights = Axis.Weights.AddDefaulted_GetRef();
+			TileWeights.SetNumUninitialized(OutLength);
+			for (int32 Pos = 0; Pos < OutLength; ++Pos) {
+				float Weight = 1.0f;
+				if (bFeatherStart)
+					Weight = FMath::Min(Weight, (Pos + 0.5f) / Ramp);
+				if (bFeatherEnd)
+					Weight = FMath::Min(Weight, (OutLength - Pos - 0.5f) / Ramp);
+				TileWeights[Pos] = Weight;
+				WeightSums[OutStart + Pos] += Weight;
+			}
+		}
+
+		for (int32 TileIdx = 0; TileIdx < Starts.Num(); ++TileIdx) {
+			for (int32 Pos = 0; Pos < Axis.OutLengths[TileIdx]; ++Pos) {
+				Axis.Weights[TileIdx][Pos] /= WeightSums[Axis.OutStarts[TileIdx] + Pos];
+			}
+		}
+		return Axis;
+	}
+}
+
+FIntPoint FTiledUpsampler::GetOutputSize(const FIntPoint& InputSize, float UpsampleFactor)
+{
+	const float Factor = (UpsampleFactor > 0.0f) ? UpsampleFactor : 4.0f;
+	return FIntPoint(FMath::Max(ToOutput(InputSize.X, Factor), 1), FMath::Max(ToOutput(InputSize.Y, Factor), 1));
+}
+
+bool FTiledUpsampler::Upsample(UStableDiffusionBridge* Bridge, const FStableDiffusionImageResult& Source, const FUpsampleTilingOptions& Options, FUpsampledRowsCallback OnRows)
+{
+	if (!IsValid(Bridge) || !UStableDiffusionBlueprintLibrary::HasFloatPixels(Source))
+		return false;
+
+	const FIntPoint InSize(Source.OutWidth, Source.OutHeight);
+	const float Factor = (Source.UpsampleFactor > 0.0f) ? Source.UpsampleFactor : 4.0f;
+	const FIntPoint OutSize = GetOutputSize(InSize, Factor);
+	const int32 TileSize = (Options.TileSize > 0) ? Options.TileSize : FMath::Max(InSize.X, InSize.Y);
+	const FIntPoint TileExtent(FMath::Min(TileSize, InSize.X), FMath::Min(TileSize, InSize.Y));
+	const int32 Overlap = FMath::Clamp(Options.Overlap, 0, FMath::Min(TileExtent.X, TileExtent.Y) - 1);
+	const int32 BatchSize = FMath::Max(Options.BatchSize, 1);
+	const int32 Ramp = FMath::Max(ToOutput(Overlap, Factor), 1);
+	const TArray<int32> XStarts = GetTileStarts(InSize.X, TileExtent.X, TileExtent.X - Overlap);
+	const TArray<int32> YStarts = GetTileStarts(InSize.Y, TileExtent.Y, TileExtent.Y - Overlap);
+	const FTileAxis XAxis = GetTileAxis(XStarts, TileExtent.X, InSize.X, Factor, Ramp);
+	const FTileAxis YAxis = GetTileAxis(YStarts, TileExtent.Y, InSize.Y, Factor, Ramp);
+	const TArrayView<const FFloat16Color> SourcePixels = Source.OutHalfFloatPixels.View();
+
+	// Output rows from BandTop to the bottom of the current band. Rounding can make bands differ by a row.
+	int32 BandHeight = 0;
+	for (int32 Length : YAxis.OutLengths) {
+		BandHeight = FMath::Max(BandHeight, Length);
+	}
+	TArray<FLinearColor> Band;
+	Band.SetNumZeroed(BandHeight * OutSize.X);
+	TArray<FFloat16Color> FinishedRows;
+	TArray<FFloat16Color> ResampledTile;
+	int32 BandTop = 0;
+	int32 NumResampledTiles = 0;
+
+	for (int32 Row = 0; Row < YStarts.Num(); ++Row) {
+		for (int32 FirstTile = 0; FirstTile < XStarts.Num(); FirstTile += BatchSize) {
+			const int32 NumTiles = FMath::Min(BatchSize, XStarts.Num() - FirstTile);
+
+			// Copy the tiles out of the source frame
+			TArray<FStableDiffusionImageResult> Batch;
+			Batch.Reserve(NumTiles);
+			for (int32 TileIdx = FirstTile; TileIdx < FirstTile + NumTiles; ++TileIdx) {
+				TArray<FFloat16Color> TilePixels;
+				TilePixels.SetNumUninitialized(TileExtent.X * TileExtent.Y);
+				for (int32 Y = 0; Y < TileExtent.Y; ++Y) {
+					const int32 SourceOffset = (YStarts[Row] + Y) * InSize.X + XStarts[TileIdx];
+					FMemory::Memcpy(&TilePixels[Y * TileExtent.X], &SourcePixels[SourceOffset], TileExtent.X * sizeof(FFloat16Color));
+				}
+
+				FStableDiffusionImageResult& Tile = Batch.Add_GetRef(Source);
+				Tile.OutTexture = nullptr;
+				Tile.OutWidth = TileExtent.X;
+				Tile.OutHeight = TileExtent.Y;
+				Tile.UpsampleFactor = Factor;
+				Tile.OutHalfFloatPixels = MoveTemp(TilePixels);
+			}
+
+			TArray<FStableDiffusionImageResult> Results = Bridge->UpsampleImageBatch(Batch);
+			if (Results.Num() != NumTiles) {
+				UE_LOG(LogTemp, Error, TEXT("Upsampler returned %d tiles but %d were requested"), Results.Num(), NumTiles);
+				return false;
+			}
+
+			for (int32 ResultIdx = 0; ResultIdx < NumTiles; ++ResultIdx) {
+				const FStableDiffusionImageResult& Result = Results[ResultIdx];
+				const int32 TileIdx = FirstTile + ResultIdx;
+				const FIntPoint TargetSize(XAxis.OutLengths[TileIdx], YAxis.OutLengths[Row]);
+				if (!UStableDiffusionBlueprintLibrary::HasFloatPixels(Result)) {
+					UE_LOG(LogTemp, Error, TEXT("Upsampler returned a tile without float pixels"));
+					return false;
+				}
+
+				// Bridges may only support fixed factors, so bring the tile to the requested size ourselves
+				TArrayView<const FFloat16Color> TilePixels = Result.OutHalfFloatPixels.View();
+				if (Result.OutWidth != TargetSize.X || Result.OutHeight != TargetSize.Y) {
+					FImageResampler::ResampleLanczos(TilePixels, FIntPoint(Result.OutWidth, Result.OutHeight), TargetSize, ResampledTile);
+					TilePixels = ResampledTile;
+					NumResampledTiles++;
+				}
+
+				// Blend the tile into the band
+				const int32 OutX = XAxis.OutStarts[TileIdx];
+				const int32 BandY = YAxis.OutStarts[Row] - BandTop;
+				const TArray<float>& TileXWeights = XAxis.Weights[TileIdx];
+				const TArray<float>& TileYWeights = YAxis.Weights[Row];
+				for (int32 Y = 0; Y < TargetSize.Y; ++Y) {
+					FLinearColor* BandRow = &Band[(BandY + Y) * OutSize.X + OutX];
+					const FFloat16Color* TileRow = &TilePixels[Y * TargetSize.X];
+					for (int32 X = 0; X < TargetSize.X; ++X) {
+						BandRow[X] += FLinearColor(TileRow[X]) * (TileXWeights[X] * TileYWeights[Y]);
+					}
+				}
+			}
+		}
+
+		// Rows above the next band are final
+		const int32 BandBottom = YAxis.OutStarts[Row] + YAxis.OutLengths[Row];
+		const int32 FinishedEnd = (Row + 1 < YStarts.Num()) ? YAxis.OutStarts[Row + 1] : OutSize.Y;
+		const int32 NumFinishedRows = FinishedEnd - BandTop;
+		FinishedRows.SetNumUninitialized(NumFinishedRows * OutSize.X, false);
+		for (int32 PixelIdx = 0; PixelIdx < FinishedRows.Num(); ++PixelIdx) {
+			FinishedRows[PixelIdx] = FFloat16Color(Band[PixelIdx]);
+		}
+		OnRows(OutSize, BandTop, NumFinishedRows, FinishedRows);
+
+		// Move the rows shared with the next band to the top and clear the rest
+		const int32 NumCarriedPixels = FMath::Max(BandBottom - FinishedEnd, 0) * OutSize.X;
+		if (NumCarriedPixels > 0) {
+			FMemory::Memmove(Band.GetData(), &Band[NumFinishedRows * OutSize.X], NumCarriedPixels * sizeof(FLinearColor));
+		}
+		FMemory::Memzero(Band.GetData() + NumCarriedPixels, (Band.Num() - NumCarriedPixels) * sizeof(FLinearColor));
+		BandTop = FinishedEnd;
+	}
+
+	if (NumResampledTiles) {
+		UE_LOG(LogTemp, Log, TEXT("Resampled %d upsampled tiles to reach a %.2fx factor"), NumResampledTiles, Factor);
+	}
+	return true;
+}
+
+bool FTiledUpsampler::UpsampleToBuffer(UStableDiffusionBridge* Bridge, const FStableDiffusionImageResult& Source, const FUpsampleTilingOptions& Options, TArray<FFloat16Color>& OutPixels, FIntPoint& OutSize)
+{
+	OutSize = GetOutputSize(FIntPoint(Source.OutWidth, Source.OutHeight), Source.UpsampleFactor);
+	OutPixels.SetNumUninitialized(OutSize.X * OutSize.Y);
+	return Upsample(Bridge, Source, Options, [&OutPixels](const FIntPoint& Size, int32 FirstRow, int32 NumRows, TArrayView<const FFloat16Color> Rows) {
+		FMemory::Memcpy(&OutPixels[FirstRow * Size.X], Rows.GetData(), Rows.Num() * sizeof(FFloat16Color));
+	});
+}
@@ -0,0 +1,195 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "ViewportFrameStream.h"
+#include "StableDiffusionSubsystem.h"
+#include "FrameGrabber.h"
+#include "RenderingThread.h"
+#include "Engine/Engine.h"
+
+namespace
+{
+	// Screen messages are global so they are restored once the last stream stops
+	int32 NumStreamsHidingScreenMessages = 0;
+	bool bPrevScreenMessagesEnabled = true;
+}
+
+struct FViewportFrameStream::FFramePayload : public IFramePayload
+{
+	FViewportFrameStream* Stream = nullptr;
+	FIntRect Bounds;
+	uint64 FrameNumber = 0;
+
+	virtual bool OnFrameReady_RenderThread(FColor* ColorBuffer, FIntPoint BufferSize, FIntPoint TargetSize) const override
+	{
+		Stream->OnFrameReady_RenderThread(ColorBuffer, BufferSize, Bounds, FrameNumber);
+
+		// The frame has been copied into the ring so the grabber doesn't have to queue it as well
+		return false;
+	}
+};
+
+FViewportFrameStream::~FViewportFrameStream()
+{
+	Stop();
+}
+
+bool FViewportFrameStream::Start(TSharedRef<FSceneViewport> InViewport, TFunction<FIntRect()> InGetBounds)
+{
+	check(IsInGameThread());
+	Stop();
+
+	Viewport = InViewport;
+	GetBounds = MoveTemp(InGetBounds);
+
+	RestartGrabber();
+	if (!FrameGrabber.IsValid())
+		return false;
+
+	// Frames are grabbed continuously so messages have to stay hidden for the whole stream, like the editor widgets
+	if (NumStreamsHidingScreenMessages++ == 0) {
+		bPrevScreenMessagesEnabled = GAreScreenMessagesEnabled;
+		GAreScreenMessagesEnabled = false;
+	}
+	bHidingScreenMessages = true;
+
+	TickerHandle = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateRaw(this, &FViewportFrameStream::Tick));
+	return true;
+}
+
+void FViewportFrameStream::Stop()
+{
+	if (TickerHandle.IsValid()) {
+		FTSTicker::GetCoreTicker().RemoveTicker(TickerHandle);
+		TickerHandle.Reset();
+	}
+
+	if (FrameGrabber.IsValid()) {
+		FrameGrabber->StopCapturingFrames();
+		FrameGrabber->Shutdown();
+		FrameGrabber.Reset();
+
+		// Frames still in flight call back into the ring
+		FlushRenderingCommands();
+	}
+	GrabberSize = FIntPoint::ZeroValue;
+
+	if (bHidingScreenMessages) {
+		bHidingScreenMessages = false;
+		if (--NumStreamsHidingScreenMessages == 0) {
+			GAreScreenMessagesEnabled = bPrevScreenMessagesEnabled;
+		}
+	}
+
+	FScopeLock Lock(&SlotLock);
+	LatestSlot = INDEX_NONE;
+}
+
+void FViewportFrameStream::RestartGrabber()
+{
+	if (FrameGrabber.IsValid()) {
+		FrameGrabber->StopCapturingFrames();
+		FrameGrabber->Shutdown();
+		FrameGrabber.Reset();
+		FlushRenderingCommands();
+	}
+
+	TSharedPtr<FSceneViewport> PinnedViewport = Viewport.Pin();
+	if (!PinnedViewport.IsValid())
+		return;
+
+	// Grab at the viewport's own size so the crop bounds map straight onto the buffer
+	GrabberSize = PinnedViewport->GetSizeXY();
+	if (GrabberSize.X <= 0 || GrabberSize.Y <= 0)
+		return;
+
+	FrameGrabber = MakeShared<FFrameGrabber>(PinnedViewport.ToSharedRef(), GrabberSize, PF_B8G8R8A8, NumSlots);
+	FrameGrabber->StartCapturingFrames();
+}
+
+bool FViewportFrameStream::Tick(float DeltaTime)
+{
+	TSharedPtr<FSceneViewport> PinnedViewport = Viewport.Pin();
+	if (!PinnedViewport.IsValid()) {
+		UE_LOG(LogTemp, Warning, TEXT("Viewport frame stream lost its viewport"));
+		Stop();
+		return false;
+	}
+
+	if (PinnedViewport->GetSizeXY() != GrabberSize) {
+		RestartGrabber();
+	}
+	if (!FrameGrabber.IsValid())
+		return true;
+
+	// The readback lands a few frames later so the frame is stamped with what it was grabbed with
+	TSharedRef<FFramePayload, ESPMode::ThreadSafe> Payload = MakeShared<FFramePayload, ESPMode::ThreadSafe>();
+	Payload->Stream = this;
+	Payload->Bounds = GetBounds ? GetBounds() : FIntRect(FIntPoint::ZeroValue, GrabberSize);
+	Payload->FrameNumber = GFrameNumber;
+	FrameGrabber->CaptureThisFrame(Payload);
+	return true;
+}
+
+void FViewportFrameStream::OnFrameReady_RenderThread(FColor* ColorBuffer, FIntPoint BufferSize, const FIntRect& Bounds, uint64 FrameNumber)
+{
+	int32 WriteSlot = INDEX_NONE;
+	{
+		FScopeLock Lock(&SlotLock);
+		for (int32 SlotIdx = 0; SlotIdx < NumSlots; ++SlotIdx) {
+			if (SlotIdx != LatestSlot && SlotIdx != ReadingSlot) {
+				WriteSlot = SlotIdx;
+				break;
+			}
+		}
+	}
+
+	// The slot is neither published nor being read so it can be filled without holding the lock
+	FStreamedViewportFrame& Frame = Slots[WriteSlot];
+	CopyFrame(ColorBuffer, BufferSize, Bounds, Frame.Pixels);
+	Frame.Bounds = Bounds;
+	Frame.FrameNumber = FrameNumber;
+
+	FScopeLock Lock(&SlotLock);
+	LatestSlot = WriteSlot;
+}
+
+bool FViewportFrameStream::GetLatestFrame(FStreamedViewportFrame& OutFrame) const
+{
+	int32 Slot = INDEX_NONE;
+	{
+		FScopeLock Lock(&SlotLock);
+		if (LatestSlot == INDEX_NONE)
+			return false;
+		Slot = ReadingSlot = LatestSlot;
+	}
+
+	const FStreamedViewportFrame& Frame = Slots[Slot];
+	OutFrame.Pixels = Frame.Pixels;
+	OutFrame.Bounds = Frame.Bounds;
+	OutFrame.FrameNumber = Frame.FrameNumber;
+
+	FScopeLock Lock(&SlotLock);
+	ReadingSlot = INDEX_NONE;
+	return true;
+}
+
+void FViewportFrameStream::CopyFrame(const FColor* ColorBuffer, const FIntPoint& BufferSize, const FIntRect& Bounds, TArray<FColor>& OutPixels)
+{
+	const FIntPoint Size = Bounds.Size();
+	OutPixels.SetNumUninitialized(FMath::Max(Size.X, 0) * FMath::Max(Size.Y, 0), false);
+
+	// Only the part of the bounds inside the buffer has anything to copy
+	const int32 FirstX = FMath::Max(Bounds.Min.X, 0);
+	const int32 LastX = FMath::Min(Bounds.Max.X, BufferSize.X);
+	const int32 FirstY = FMath::Max(Bounds.Min.Y, 0);
+	const int32 LastY = FMath::Min(Bounds.Max.Y, BufferSize.Y);
+	if (FirstX != Bounds.Min.X || LastX != Bounds.Max.X || FirstY != Bounds.Min.Y || LastY != Bounds.Max.Y) {
+		FMemory::Memzero(OutPixels.GetData(), OutPixels.Num() * sizeof(FColor));
+	}
+	if (LastX <= FirstX)
+		return;
+
+	for (int32 Row = FirstY; Row < LastY; ++Row) {
+		FMemory::Memcpy(&OutPixels[(Row - Bounds.Min.Y) * Size.X + FirstX - Bounds.Min.X], ColorBuffer + Row * BufferSize.X + FirstX, (LastX - FirstX) * sizeof(FColor));
+	}
+}
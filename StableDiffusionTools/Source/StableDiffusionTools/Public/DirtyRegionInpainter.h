@@ -0,0 +1,92 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "StableDiffusionImageResult.h"
+#include "DirtyRegionInpainter.generated.h"
+
+USTRUCT(BlueprintType)
+struct STABLEDIFFUSIONTOOLS_API FDirtyRegionOptions
+{
+	GENERATED_BODY()
+public:
+	/* Only inpaint the part of the frame that changed since the last preview. Needs a pipeline with the INPAINT capability. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "StableDiffusion|Preview")
+	bool bEnabled = false;
+
+	/* Smallest change of any colour channel, from 0 to 1, that marks a captured pixel as changed */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "StableDiffusion|Preview", meta = (EditCondition = "bEnabled", ClampMin = 0, ClampMax = 1))
+	float ChangeThreshold = 0.04f;
+
+	/* Output pixels the changed area is grown by so the inpainted content has room to blend in */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "StableDiffusion|Preview", meta = (EditCondition = "bEnabled", ClampMin = 0))
+	int32 Dilation = 24;
+
+	/* Output pixels the inpainted region fades into the previous preview over */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "StableDiffusion|Preview", meta = (EditCondition = "bEnabled", ClampMin = 0))
+	int32 Feather = 8;
+
+	/* Fraction of the frame above which the whole frame is generated instead */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "StableDiffusion|Preview", meta = (EditCondition = "bEnabled", ClampMin = 0, ClampMax = 1))
+	float MaxRegionFraction = 0.5f;
+};
+
+
+/** Last live preview and the layers it was generated from. New captures are diffed against it. */
+struct STABLEDIFFUSIONTOOLS_API FDirtyRegionBaseline
+{
+	TArray<FLayerProcessorContext> Layers;
+	FIntPoint CaptureSize = FIntPoint::ZeroValue;
+
+	// Result without its texture, which belongs to the texture pool
+	FStableDiffusionImageResult Result;
+	FSharedPixelBuffer Pixels;
+	FIntPoint Size = FIntPoint::ZeroValue;
+
+	bool IsValid() const { return Pixels.Num() > 0 && Pixels.Num() == Size.X * Size.Y; }
+	void Reset() { *this = FDirtyRegionBaseline(); }
+};
+
+
+/** Changed part of a frame in output pixels. */
+struct STABLEDIFFUSIONTOOLS_API FDirtyRegion
+{
+	FIntRect Bounds;
+
+	// Pixels to regenerate, 255 where changed. Bounds sized.
+	TArray<uint8> Mask;
+
+	// Weight of the regenerated pixels when compositing. Bounds sized.
+	TArray<float> Alpha;
+
+	bool IsEmpty() const { return Bounds.Area() <= 0; }
+};
+
+
+/**
+ * Regenerates only what changed between two live previews. Captured layers are diffed against the ones behind the last
+ * preview, the changed pixels are dilated and their bounding box is inpainted at native resolution. The inpainted pixels are
+ * then feathered into the last preview.
+ */
+class STABLEDIFFUSIONTOOLS_API FDirtyRegionInpainter
+{
+public:
+	/**
+	* Finds the changed region of Input's captured layers. Returns false if the layers can't be compared with the baseline,
+	* for example because their size or setup changed. OutRegion is empty if nothing changed.
+	*/
+	static bool FindDirtyRegion(const FDirtyRegionBaseline& Baseline, const FStableDiffusionInput& Input, const FDirtyRegionOptions& Options, FDirtyRegion& OutRegion);
+
+	/**
+	* Builds an inpaint input covering just the region. Layers are cropped and resampled to the region's output size, the
+	* img2img layer shows the last preview outside the changed pixels and a mask_image layer marks the pixels to regenerate.
+	*/
+	static bool MakeRegionInput(const FDirtyRegionBaseline& Baseline, const FStableDiffusionInput& Input, const FDirtyRegion& Region, FStableDiffusionInput& OutInput);
+
+	/** Feathers the inpainted region into a copy of the baseline pixels. */
+	static TArray<FColor> Composite(const FDirtyRegionBaseline& Baseline, const FDirtyRegion& Region, TArrayView<const FColor> RegionPixels, const FIntPoint& RegionPixelsSize);
+
+	/** Size the layers of an input were captured at. */
+	static FIntPoint GetCaptureSize(const FStableDiffusionInput& Input);
+};
@@ -0,0 +1,35 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "StableDiffusionGenerationOptions.h"
+
+/**
+ * Fingerprint of a generation request whose layers have been captured. Used to recognise requests that would produce the
+ * same image as the previous one.
+ */
+struct STABLEDIFFUSIONTOOLS_API FGenerationSignature
+{
+	/** Options, prompts, layer setup and latents. These always have to match exactly. */
+	uint64 SettingsHash = 0;
+
+	/** Captured layer pixels. */
+	uint64 PixelHash = 0;
+
+	/** Small luminance thumbnail of each pixel layer, only built when captures are compared perceptually. */
+	TArray<TArray<float>> Thumbnails;
+
+	bool IsSet() const { return SettingsHash != 0; }
+
+	/** Width and height of the thumbnails. */
+	static constexpr int32 ThumbnailSize = 16;
+
+	static FGenerationSignature Make(const FStableDiffusionInput& Input, const FString& ModelContext, bool bBuildThumbnails);
+
+	/**
+	* True if both requests would produce the same image. Captures count as unchanged if their pixels are identical or, when
+	* Threshold is above 0, no layer's thumbnail differs by more than Threshold on average on a 0 to 1 scale.
+	*/
+	bool Matches(const FGenerationSignature& Other, float Threshold) const;
+};
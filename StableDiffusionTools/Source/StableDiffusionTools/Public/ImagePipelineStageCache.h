@@ -0,0 +1,76 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "StableDiffusionImageResult.h"
+
+class UImagePipelineStageAsset;
+
+/**
+ * Output of a pipeline stage without any UObjects so it can outlive the pooled texture it was read from.
+ */
+struct STABLEDIFFUSIONTOOLS_API FCachedStageResult
+{
+	TEnumAsByte<EImageType> OutputType = EImageType::Image;
+	FIntPoint Size = FIntPoint::ZeroValue;
+
+	// sRGB pixels of the stage's output texture
+	FSharedPixelBuffer Pixels;
+	TSharedImmutableBuffer<FFloat16Color> HalfFloatPixels;
+	FSharedByteBuffer Latent;
+
+	int64 GetNumBytes() const { return Pixels.NumBytes() + HalfFloatPixels.NumBytes() + Latent.NumBytes(); }
+};
+
+
+/**
+ * Remembers the results of image pipeline stages by a fingerprint of everything that went into them so unchanged stages
+ * don't have to be generated again. Recent results are held in memory and can also be written to
+ * Saved/StableDiffusionTools/StageCache so they survive editor restarts.
+ */
+class STABLEDIFFUSIONTOOLS_API FImagePipelineStageCache
+{
+public:
+	/**
+	* Fingerprints a stage from its asset properties, its model, pipeline and adapter assets, the resolved input options,
+	* the captured layer pixels and the fingerprint of the stage before it. Latent layers are covered by the upstream fingerprint.
+	*/
+	static FString HashStage(const UImagePipelineStageAsset* Stage, const FStableDiffusionInput& Input, const FString& UpstreamHash, bool AllowNSFW, EPaddingMode PaddingMode);
+
+	/** Finds a result in memory or on disk. Results loaded from disk are kept in memory afterwards. */
+	bool Find(const FString& Key, FCachedStageResult& OutResult);
+
+	void Add(const FString& Key, FCachedStageResult Result);
+
+	/** Drops every result held in memory and optionally every result on disk. */
+	void Clear(bool bIncludeDisk);
+
+	/** Maximum number of results held in memory. The least recently used ones are dropped first. */
+	int32 MaxMemoryEntries = 16;
+
+	/** Maximum number of bytes of results held in memory. The least recently used ones are dropped first. */
+	int64 MaxMemoryBytes = 1024ll * 1024 * 1024;
+
+	/** Whether results are written to and read from disk. */
+	bool bUseDisk = false;
+
+	/** Maximum number of bytes of results kept on disk. The least recently used files are deleted first. */
+	int64 MaxDiskBytes = 2048ll * 1024 * 1024;
+
+	static FString GetCacheDirectory();
+
+private:
+	FString GetCachePath(const FString& Key) const;
+	bool LoadFromDisk(const FString& Key, FCachedStageResult& OutResult) const;
+	void SaveToDisk(const FString& Key, const FCachedStageResult& Result) const;
+	void TrimDisk() const;
+	void AddToMemory(const FString& Key, const FCachedStageResult& Result);
+
+	mutable FCriticalSection CacheLock;
+	TMap<FString, FCachedStageResult> Entries;
+	int64 MemoryBytes = 0;
+
+	// Least recently used first
+	TArray<FString> UseOrder;
+};
@@ -0,0 +1,15 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class STABLEDIFFUSIONTOOLS_API FImageResampler
+{
+public:
+	/**
+	* Resizes linear half float pixels with a separable Lanczos filter. When shrinking, the kernel is widened by the scale so
+	* the result doesn't alias. Used to get from an upsampler's native factor to the factor that was asked for.
+	*/
+	static void ResampleLanczos(TArrayView<const FFloat16Color> Source, const FIntPoint& SourceSize, const FIntPoint& TargetSize, TArray<FFloat16Color>& OutPixels, int32 Lobes = 3);
+};
@@ -0,0 +1,43 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "StableDiffusionGenerationOptions.h"
+#include "LatentPreview.generated.h"
+
+/*
+* Linear projection from a latent space into RGB. Each latent channel contributes its own RGB factor to every output pixel.
+*/
+USTRUCT(BlueprintType)
+struct STABLEDIFFUSIONTOOLS_API FLatentPreviewCoefficients
+{
+	GENERATED_BODY()
+public:
+	/* One RGB factor per latent channel. The number of entries must match the channel count of the model's latents. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Latent preview")
+	TArray<FVector> ChannelFactors;
+
+	/* Added to the projected colour before it is remapped from [-1, 1] to [0, 1]. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Latent preview")
+	FVector Bias = FVector::ZeroVector;
+
+	int32 NumChannels() const { return ChannelFactors.Num(); }
+};
+
+
+class STABLEDIFFUSIONTOOLS_API FLatentPreview
+{
+public:
+	/** Built-in projection for a model family. Auto resolves to the family whose channel count matches. */
+	static const FLatentPreviewCoefficients& GetDefaultCoefficients(ELatentModelFamily Family, int32 NumChannels = 4);
+
+	/** Guesses a model family from the number of latent channels. */
+	static ELatentModelFamily GetFamilyFromChannelCount(int32 NumChannels);
+
+	/**
+	* Projects planar float32 latents (C x H x W) into an RGB image and bilinearly scales it to OutSize.
+	* Returns false if the latent buffer doesn't match the given shape or the coefficients don't match the channel count.
+	*/
+	static bool ProjectLatentsToColors(const TArrayView<const float> Latents, int32 NumChannels, const FIntPoint& LatentSize, const FLatentPreviewCoefficients& Coefficients, const FIntPoint& OutSize, TArray<FColor>& OutPixels);
+};
@@ -0,0 +1,31 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "StableDiffusionGenerationOptions.h"
+
+/**
+ * Layers captured for several generation requests that look through the same view. Layers that share a processor,
+ * processor options, bit depth and capture size are only captured once and every request gets the same shared buffers.
+ */
+class STABLEDIFFUSIONTOOLS_API FLayerCaptureSet
+{
+public:
+	/** Copies the pixel buffers of a matching captured layer into OutLayer. Returns false if nothing matching has been captured yet. */
+	bool Find(const FLayerProcessorContext& Layer, const FIntPoint& Size, FLayerProcessorContext& OutLayer);
+
+	void Add(const FLayerProcessorContext& CapturedLayer, const FIntPoint& Size);
+
+	/** Number of layers that were asked for and how many of them actually had to be captured. */
+	int32 GetNumRequested() const { return NumRequested; }
+	int32 GetNumCaptured() const { return Captured.Num(); }
+
+	void LogSummary(const TCHAR* Context) const;
+
+private:
+	static FString GetKey(const FLayerProcessorContext& Layer, const FIntPoint& Size);
+
+	TMap<FString, FLayerProcessorContext> Captured;
+	int32 NumRequested = 0;
+};
@@ -40,6 +40,21 @@ public:
 	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Stable Diffusion|Layer source")
 	TEnumAsByte<ELayerBitDepth> CaptureBitDepth = EightBit;
 
+	/*
+	* Bit depth of the pixels handed to the bridge, capped at the capture bit depth. Layers above 8 bit reach python as float
+	* tensors instead of PIL images so only raise it for pipelines and scripts that expect them.
+	*/
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Stable Diffusion|Layer source")
+	TEnumAsByte<ELayerBitDepth> OutputBitDepth = EightBit;
+
+	ELayerBitDepth GetOutputBitDepth() const;
+
+	/*
+	* Float layers holding data such as depth or normals are handed to python as is. Colour layers are sRGB encoded first.
+	*/
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Stable Diffusion|Layer source")
+	bool bLinearData = false;
+
 	UFUNCTION(BlueprintNativeEvent, BlueprintCallable, Category = "Layer processor")
 	void BeginCaptureLayer(UWorld* World, FIntPoint Size, USceneCaptureComponent2D* CaptureSource = nullptr, UObject* LayerOptions = nullptr);
 
@@ -62,6 +77,22 @@ public:
 	/// <returns></returns>
 	virtual TArray<FLinearColor> ProcessLinearLayer(UTextureRenderTarget2D* Layer);
 
+	/// <summary>
+	/// Read a captured half float layer without quantising it
+	/// </summary>
+	virtual TArray<FFloat16Color> ProcessHalfFloatLayer(UTextureRenderTarget2D* Layer);
+
+	/// <summary>
+	/// Process a captured layer into the context's pixel buffer matching the output bit depth. 8 bit layers go through ProcessLayer,
+	/// 16 and 32 bit layers keep their full precision.
+	/// </summary>
+	void ProcessLayerPixels(UTextureRenderTarget2D* Layer, FLayerProcessorContext& Context);
+
+	/// <summary>
+	/// Read a render target straight into the context's pixel buffer for the given bit depth
+	/// </summary>
+	static bool ReadRenderTargetPixels(FRenderTarget* RenderTarget, ELayerBitDepth BitDepth, FLayerProcessorContext& Context);
+
 	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Stable Diffusion|Layer source")
 	UMaterialInterface* PostMaterial;
 
@@ -30,6 +30,8 @@ public:
 	virtual UTextureRenderTarget2D* CaptureLayer(USceneCaptureComponent2D* CaptureSource, bool SingleFrame = true, UObject* LayerOptions = nullptr) override;
 	virtual void EndCaptureLayer_Implementation(UWorld* World, USceneCaptureComponent2D* CaptureSource = nullptr) override;
 	virtual TArray<FColor> ProcessLayer(UTextureRenderTarget2D* Layer) override;
+	virtual TArray<FLinearColor> ProcessLinearLayer(UTextureRenderTarget2D* Layer) override;
+	virtual TArray<FFloat16Color> ProcessHalfFloatLayer(UTextureRenderTarget2D* Layer) override;
 
 private:
 	UPROPERTY(Transient)
@@ -9,4 +9,5 @@ class STABLEDIFFUSIONTOOLS_API UNormalLayerProcessor: public ULayerProcessorBase
 {
 	GENERATED_BODY()
 public:
+	UNormalLayerProcessor();
 };
@@ -0,0 +1,70 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "StableDiffusionImageResult.h"
+#include "PreviewQualityController.generated.h"
+
+USTRUCT(BlueprintType)
+struct STABLEDIFFUSIONTOOLS_API FAdaptiveQualityOptions
+{
+	GENERATED_BODY()
+public:
+	/* Pick the resolution, steps and scheduler of previews to meet the latency target */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "StableDiffusion|Preview")
+	bool bEnabled = false;
+
+	/* Seconds from the camera coming to rest to the preview arriving */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "StableDiffusion|Preview", meta = (EditCondition = "bEnabled", ClampMin = 0.05))
+	float TargetLatency = 1.0f;
+
+	/* Smallest fraction of the output size the controller may drop to */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "StableDiffusion|Preview", meta = (EditCondition = "bEnabled", ClampMin = 0.1, ClampMax = 1))
+	float MinResolutionScale = 0.25f;
+
+	/* Fewest steps the controller may drop to */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "StableDiffusion|Preview", meta = (EditCondition = "bEnabled", ClampMin = 1))
+	int32 MinIterations = 4;
+
+	/* Switch to one of FastSchedulers when the step count drops to FastSchedulerMaxIterations or below */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "StableDiffusion|Preview", meta = (EditCondition = "bEnabled"))
+	bool bAdaptScheduler = false;
+
+	/* Schedulers that hold up at low step counts, in order of preference. Only ones the model is compatible with are used. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "StableDiffusion|Preview", meta = (EditCondition = "bAdaptScheduler"))
+	TArray<FString> FastSchedulers = { TEXT("DPMSolverMultistepScheduler"), TEXT("EulerAncestralDiscreteScheduler") };
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "StableDiffusion|Preview", meta = (EditCondition = "bAdaptScheduler", ClampMin = 1))
+	int32 FastSchedulerMaxIterations = 12;
+};
+
+
+/**
+ * Picks preview settings that fit a latency budget from recent measurements. Every configuration that has been measured keeps
+ * an moving average of its latency. Configurations that haven't been measured yet are predicted from the average cost per
+ * unit of work, where work is the squared resolution scale times the step count.
+ */
+class STABLEDIFFUSIONTOOLS_API FPreviewQualityController
+{
+public:
+	/** Chooses the highest quality settings expected to meet the target without going above MaxScale and MaxIterations. Scales are multiples of 1/8. */
+	FPreviewQualitySettings Choose(const FAdaptiveQualityOptions& Options, float MaxScale, int32 MaxIterations, const TArray<FString>& CompatibleSchedulers) const;
+
+	/** Records how long a generation with the given settings took end to end. */
+	void Record(const FPreviewQualitySettings& Settings, double Seconds);
+
+	/** Forgets all measurements, for example when the model or output size changes. */
+	void Reset();
+
+	/** Weight of the newest measurement in the moving averages. */
+	static constexpr double Smoothing = 0.3;
+
+private:
+	static FString GetConfigKey(float Scale, int32 Iterations, const FString& Scheduler);
+	double Predict(float Scale, int32 Iterations, const FString& Scheduler) const;
+
+	mutable FCriticalSection ControllerLock;
+	TMap<FString, double> ConfigLatency;
+	TMap<FString, double> SecondsPerWork;
+};
@@ -0,0 +1,80 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/Ticker.h"
+#include "Camera/CameraTypes.h"
+#include "SceneChangeTrigger.generated.h"
+
+class UMaterialInterface;
+
+USTRUCT(BlueprintType)
+struct STABLEDIFFUSIONTOOLS_API FSceneChangeTriggerOptions
+{
+	GENERATED_BODY()
+public:
+	/* Refresh the preview when actors, components, materials or lights in view are edited */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "StableDiffusion|Preview")
+	bool bEnabled = true;
+
+	/* Seconds without further edits before a burst of edits triggers a refresh */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "StableDiffusion|Preview", meta = (EditCondition = "bEnabled", ClampMin = 0))
+	float DebounceTime = 0.3f;
+
+	/* Longest a continuous stream of edits can hold back a refresh */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "StableDiffusion|Preview", meta = (EditCondition = "bEnabled", ClampMin = 0))
+	float MaxDelay = 2.0f;
+
+	/* Ignore edits to objects outside the captured view */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "StableDiffusion|Preview", meta = (EditCondition = "bEnabled"))
+	bool bOnlyVisibleChanges = true;
+};
+
+
+/**
+ * Watches the editor for changes to the level that could show up in a capture. Edits are collected until none have arrived
+ * for the debounce time and are then checked against the capture frustum once. OnSceneChanged fires if any of them were in
+ * view. Nothing runs between bursts of edits.
+ */
+class STABLEDIFFUSIONTOOLS_API FSceneChangeTrigger
+{
+public:
+	~FSceneChangeTrigger();
+
+	/** Starts listening. GetView returns the current capture view and is only called when a burst is checked. */
+	void Start(const FSceneChangeTriggerOptions& Options, TFunction<FMinimalViewInfo()> GetView, TFunction<void()> OnSceneChanged);
+	void Stop();
+	bool IsRunning() const { return bRunning; }
+
+private:
+	void OnActorMoved(AActor* Actor);
+	void OnActorAddedOrRemoved(AActor* Actor);
+	void OnBeginObjectMovement(UObject& Object);
+	void OnObjectPropertyChanged(UObject* Object, struct FPropertyChangedEvent& Event);
+	void OnMaterialCompiled(UMaterialInterface* Material);
+
+	void AddChange(UObject* Object);
+	bool Tick(float DeltaTime);
+	bool IsAnyChangeVisible() const;
+
+	FSceneChangeTriggerOptions Options;
+	TFunction<FMinimalViewInfo()> GetView;
+	TFunction<void()> OnSceneChanged;
+	bool bRunning = false;
+
+	// Edits collected since the last check
+	TSet<TWeakObjectPtr<UObject>> ChangedObjects;
+	TArray<FBoxSphereBounds> ChangedBounds;
+	bool bUnboundedChange = false;
+	double FirstChangeTime = 0.0;
+	double LastChangeTime = 0.0;
+	FTSTicker::FDelegateHandle TickerHandle;
+
+	FDelegateHandle ActorMovedHandle;
+	FDelegateHandle ActorAddedHandle;
+	FDelegateHandle ActorDeletedHandle;
+	FDelegateHandle BeginMovementHandle;
+	FDelegateHandle PropertyChangedHandle;
+	FDelegateHandle MaterialCompiledHandle;
+};
@@ -0,0 +1,36 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/Texture2D.h"
+
+/**
+ * Read-only view of the BGRA8 pixels of a texture's first mip. The platform mip (or the editor source data when the platform
+ * data isn't uncompressed BGRA8) stays locked for the lifetime of the view so callers can read a whole frame without copying it.
+ */
+class STABLEDIFFUSIONTOOLS_API FScopedTexturePixels
+{
+public:
+	explicit FScopedTexturePixels(UTexture2D* Texture);
+	~FScopedTexturePixels();
+
+	FScopedTexturePixels(const FScopedTexturePixels&) = delete;
+	FScopedTexturePixels& operator=(const FScopedTexturePixels&) = delete;
+
+	bool IsValid() const { return Pixels.Num() > 0; }
+	const TArrayView<const FColor>& GetPixels() const { return Pixels; }
+	const FIntPoint& GetSize() const { return Size; }
+	int32 Num() const { return Pixels.Num(); }
+
+	const FColor& operator[](int32 Index) const { return Pixels[Index]; }
+
+	/** Bilinearly samples the view at a normalized UV coordinate. */
+	FColor SampleUV(const FVector2D& UV) const;
+
+private:
+	FByteBulkData* LockedBulkData = nullptr;
+	FTextureSource* LockedSource = nullptr;
+	TArrayView<const FColor> Pixels;
+	FIntPoint Size = FIntPoint::ZeroValue;
+};
@@ -0,0 +1,81 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Templates/SharedPointer.h"
+
+/**
+ * Reference counted array that is shared between copies of the structs that hold it. Copying the buffer only bumps a
+ * thread-safe reference count so pixel and latent payloads can travel through lambdas and delegates for free.
+ * The contents are treated as immutable while shared; GetMutable detaches a private copy first (copy-on-write).
+ */
+template<typename ElementType>
+class TSharedImmutableBuffer
+{
+public:
+	using ArrayType = TArray<ElementType>;
+
+	TSharedImmutableBuffer() = default;
+	TSharedImmutableBuffer(ArrayType&& InData) { *this = MoveTemp(InData); }
+	explicit TSharedImmutableBuffer(const ArrayType& InData) { *this = ArrayType(InData); }
+
+	TSharedImmutableBuffer& operator=(ArrayType&& InData)
+	{
+		if (InData.Num()) {
+			Data = MakeShared<ArrayType, ESPMode::ThreadSafe>(MoveTemp(InData));
+		}
+		else {
+			Data.Reset();
+		}
+		return *this;
+	}
+
+	const ArrayType& Get() const { return Data.IsValid() ? *Data : GetEmpty(); }
+	TArrayView<const ElementType> View() const { return TArrayView<const ElementType>(Get()); }
+	const ElementType* GetData() const { return Get().GetData(); }
+	int32 Num() const { return Data.IsValid() ? Data->Num() : 0; }
+	int64 NumBytes() const { return (int64)Num() * sizeof(ElementType); }
+	bool IsEmpty() const { return Num() == 0; }
+	explicit operator bool() const { return !IsEmpty(); }
+
+	/** True if both buffers point at the same shared allocation. */
+	bool SharesDataWith(const TSharedImmutableBuffer& Other) const { return Data.IsValid() && Data == Other.Data; }
+
+	/** Returns an array that is safe to modify, copying the shared contents first if anything else still references them. */
+	ArrayType& GetMutable()
+	{
+		if (!Data.IsValid()) {
+			Data = MakeShared<ArrayType, ESPMode::ThreadSafe>();
+		}
+		else if (!Data.IsUnique()) {
+			Data = MakeShared<ArrayType, ESPMode::ThreadSafe>(*Data);
+		}
+		return *Data;
+	}
+
+	/** Takes the contents out of the buffer. The allocation is moved if this was the last reference, otherwise it is copied. */
+	ArrayType Release()
+	{
+		ArrayType Result;
+		if (Data.IsValid()) {
+			Result = Data.IsUnique() ? MoveTemp(*Data) : ArrayType(*Data);
+			Data.Reset();
+		}
+		return Result;
+	}
+
+	void Reset() { Data.Reset(); }
+
+private:
+	static const ArrayType& GetEmpty()
+	{
+		static const ArrayType Empty;
+		return Empty;
+	}
+
+	TSharedPtr<ArrayType, ESPMode::ThreadSafe> Data;
+};
+
+using FSharedPixelBuffer = TSharedImmutableBuffer<FColor>;
+using FSharedByteBuffer = TSharedImmutableBuffer<uint8>;
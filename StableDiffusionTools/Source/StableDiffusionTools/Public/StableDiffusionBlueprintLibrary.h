@@ -14,6 +14,7 @@
 #include "Layers/LayersSubsystem.h"
 #include "ProjectionBakeSession.h"
 #include "StableDiffusionToolsSettings.h"
+#include "ScopedTexturePixels.h"
 #include "StableDiffusionBlueprintLibrary.generated.h"
 
 /**
@@ -57,6 +58,9 @@ public:
 	UFUNCTION(BlueprintCallable, Category = "Camera")
 	static FMinimalViewInfo GetEditorViewportViewInfo();
 
+	/** View of a specific editor viewport rather than the active one. */
+	static FMinimalViewInfo GetViewportViewInfo(FSceneViewport* Viewport);
+
 	UFUNCTION(BlueprintCallable, Category = "Camera")
 	static FIntPoint GetEditorViewportSize();
 
@@ -111,6 +115,48 @@ public:
 	UFUNCTION(BlueprintCallable, Category = "Texture")
 	static UProjectionBakeSessionAsset* CreateProjectionBakeSessionAsset(const FProjectionBakeSession& Session, const FString& AssetPath, const FString& Name);
 
+	/** 8 bit layer pixels. High bit depth layers are quantised on demand. */
+	UFUNCTION(BlueprintCallable, BlueprintPure, Category = "StableDiffusion|Layers")
+	static TArray<FColor> GetLayerPixels(const FLayerProcessorContext& Layer);
+
+	/** Raw bytes of the layer's pixel buffer at its captured bit depth: BGRA8 for 8 bit, RGBA half floats for 16 bit and RGBA floats for 32 bit. */
+	UFUNCTION(BlueprintCallable, Category = "StableDiffusion|Layers")
+	static TArray<uint8> GetLayerPixelData(const FLayerProcessorContext& Layer, TEnumAsByte<ELayerBitDepth>& BitDepth);
+
+	UFUNCTION(BlueprintCallable, Category = "StableDiffusion|Layers")
+	static void SetLayerPixels(UPARAM(ref) FLayerProcessorContext& Layer, const TArray<FColor>& Pixels);
+
+	UFUNCTION(BlueprintCallable, BlueprintPure, Category = "StableDiffusion|Layers")
+	static TArray<uint8> GetLayerLatentData(const FLayerProcessorContext& Layer);
+
+	UFUNCTION(BlueprintCallable, Category = "StableDiffusion|Layers")
+	static void SetLayerLatentData(UPARAM(ref) FLayerProcessorContext& Layer, const TArray<uint8>& LatentData);
+
+	UFUNCTION(BlueprintCallable, BlueprintPure, Category = "StableDiffusion|Results")
+	static TArray<uint8> GetResultLatentData(const FStableDiffusionImageResult& Result);
+
+	UFUNCTION(BlueprintCallable, Category = "StableDiffusion|Results")
+	static void SetResultLatentData(UPARAM(ref) FStableDiffusionImageResult& Result, const TArray<uint8>& LatentData);
+
+	/** Stores half float RGBA pixels, packed as raw bytes, as the result's float output. */
+	UFUNCTION(BlueprintCallable, Category = "StableDiffusion|Results")
+	static void SetResultFloatPixels(UPARAM(ref) FStableDiffusionImageResult& Result, const TArray<uint8>& HalfFloatPixelData);
+
+	/** Gets the result's linear half float RGBA pixels packed as raw bytes. */
+	UFUNCTION(BlueprintCallable, BlueprintPure, Category = "StableDiffusion|Results")
+	static TArray<uint8> GetResultFloatPixelData(const FStableDiffusionImageResult& Result);
+
+	UFUNCTION(BlueprintCallable, BlueprintPure, Category = "StableDiffusion|Results")
+	static bool HasFloatPixels(const FStableDiffusionImageResult& Result);
+
+	/** Writes the result's latent container to disk. Fails if the result has no latent or it was saved in the old pickle format. */
+	UFUNCTION(BlueprintCallable, Category = "StableDiffusion|Results")
+	static bool SaveResultLatentToFile(const FStableDiffusionImageResult& Result, const FString& Filename);
+
+	/** Maps a latent container file and copies it into the result. */
+	UFUNCTION(BlueprintCallable, Category = "StableDiffusion|Results")
+	static bool LoadResultLatentFromFile(UPARAM(ref) FStableDiffusionImageResult& Result, const FString& Filename);
+
 	UFUNCTION(BlueprintCallable, Category = "Texture")
 	static FColor LerpColor(const FColor& ColorA, const FColor& ColorB, float Alpha);
 
@@ -119,6 +165,15 @@ public:
 
 	static UTexture2D* ColorBufferToTexture(const uint8* FrameData, const FIntPoint& FrameSize, UTexture2D* OutTex, bool DeferUpdate = false);
 
+	/** Reads texture pixels into an existing buffer so its allocation can be reused between frames. Use FScopedTexturePixels instead when the pixels only need to be read. */
+	static bool ReadPixels(UTexture* Texture, TArray<FColor>& OutPixels);
+
+	/** Transient textures without source data. Their pixels are written straight into the platform mip and uploaded without a texture build. */
+	static bool IsDirectUploadTexture(const UTexture* Texture);
+
+	/** Copies the platform mip of a direct upload texture to its RHI resource, recreating the resource only if the size changed. */
+	static void UploadTexturePlatformData(UTexture2D* Texture);
+
 	UFUNCTION(BlueprintCallable, BlueprintPure, Category = "Texture")
 	static FString LayerTypeToString(ELayerImageType LayerType);
 
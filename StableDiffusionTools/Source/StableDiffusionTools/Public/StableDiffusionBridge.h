@@ -67,12 +67,33 @@ public:
     UFUNCTION(BlueprintImplementableEvent, Category = "StableDiffusion|Bridge")
     void ReleaseModel();
 
+    /**
+    * Adapter entry points for swapping a LoRA or textual inversion on the loaded pipeline without initialising the model again.
+    * They return false if the bridge can't swap adapters in place, in which case the model has to be initialised again.
+    * The LoRA weight is applied per generation from the generation options so reweighting doesn't need a call of its own.
+    */
+    UFUNCTION(BlueprintNativeEvent, Category = "StableDiffusion|Bridge")
+    bool AttachLORA(UStableDiffusionLORAAsset* LoraAsset);
+
+    UFUNCTION(BlueprintNativeEvent, Category = "StableDiffusion|Bridge")
+    bool DetachLORA();
+
+    UFUNCTION(BlueprintNativeEvent, Category = "StableDiffusion|Bridge")
+    bool AttachTextualInversion(UStableDiffusionTextualInversionAsset* TextualInversionAsset);
+
+    UFUNCTION(BlueprintNativeEvent, Category = "StableDiffusion|Bridge")
+    bool DetachTextualInversion();
+
 	UFUNCTION(BlueprintImplementableEvent, Category = "StableDiffusion|Bridge")
 	TArray<FString> AvailableSchedulers();
 
     UFUNCTION(BlueprintImplementableEvent, Category = "StableDiffusion|Bridge")
     FString GetScheduler() const;
 
+    /** Replaces the scheduler of the loaded pipeline. An empty name restores the scheduler the model was loaded with. Returns false if the bridge can't swap schedulers in place. */
+    UFUNCTION(BlueprintNativeEvent, Category = "StableDiffusion|Bridge")
+    bool SetScheduler(const FString& Scheduler);
+
     UPROPERTY(BlueprintReadOnly, Category = "StableDiffusion|Model")
     bool ModelInitialising = false;
 
@@ -88,12 +109,20 @@ public:
     UFUNCTION(BlueprintImplementableEvent, Category = "StableDiffusion|Bridge")
     FStableDiffusionImageResult UpsampleImage(const FStableDiffusionImageResult& input_result, UTexture2D* OutTexture) const;
 
+    /** Upsamples several images in one call. Used for tiles, which are passed as float pixels without textures. Defaults to calling UpsampleImage for each input. */
+    UFUNCTION(BlueprintNativeEvent, Category = "StableDiffusion|Bridge")
+    TArray<FStableDiffusionImageResult> UpsampleImageBatch(const TArray<FStableDiffusionImageResult>& input_results) const;
+
     UFUNCTION(BlueprintImplementableEvent, Category = "StableDiffusion|Bridge")
     void StopUpsample();
 
     UFUNCTION(BlueprintCallable, Category = "StableDiffusion|Bridge")
     void UpdateImageProgress(FString prompt, int32 step, int32 timestep, float progress, int32 width, int32 height, UTexture2D* Texture);
 
+    /** Builds a preview by projecting raw planar float32 latents (C x H x W) to RGB instead of decoding them with the VAE. */
+    UFUNCTION(BlueprintCallable, Category = "StableDiffusion|Bridge")
+    void UpdateImageProgressFromLatents(FString prompt, int32 step, int32 timestep, float progress, const TArray<uint8>& Latents, int32 LatentChannels, int32 LatentWidth, int32 LatentHeight, ELatentModelFamily LatentFamily, UTexture2D* Texture);
+
     UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "StableDiffusion|Bridge")
     FStableDiffusionModelOptions ModelOptions;
 
@@ -0,0 +1,104 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/NoExportTypes.h"
+#include "StableDiffusionSubsystem.h"
+#include "StableDiffusionGenerationContext.generated.h"
+
+/**
+ * Live preview state for one viewport or scene capture. Every context has its own capture source, camera tracking, frame
+ * stream, dirty region baseline and single slot job mailbox, so several previews can run side by side. Contexts share the
+ * subsystem's bridge and loaded model, and the subsystem takes their jobs in turn.
+ */
+UCLASS(BlueprintType)
+class STABLEDIFFUSIONTOOLS_API UStableDiffusionGenerationContext : public UObject
+{
+	GENERATED_BODY()
+public:
+	/**
+	* Generates previews natively whenever the camera comes to rest. A cheap draft is generated first and refined at full
+	* quality if the camera stays put. Only the newest camera state is ever generated and anything in flight is cancelled
+	* as soon as it is out of date. The model has to be initialised already.
+	*/
+	UFUNCTION(BlueprintCallable, Category = "StableDiffusion|Preview")
+	void StartLivePreviewStream(FStableDiffusionInput Input, EInputImageSource ImageSourceType, FLivePreviewStreamOptions Options, USceneCaptureComponent2D* CaptureSource = nullptr);
+
+	UFUNCTION(BlueprintCallable, Category = "StableDiffusion|Preview")
+	void StopLivePreviewStream();
+
+	UFUNCTION(BlueprintCallable, BlueprintPure, Category = "StableDiffusion|Preview")
+	bool IsLivePreviewStreaming() const { return bLivePreviewStreaming; }
+
+	/** True if the context captures a viewport of its own instead of whichever one is active. */
+	UFUNCTION(BlueprintCallable, BlueprintPure, Category = "StableDiffusion|Preview")
+	bool IsBoundToViewport() const { return bBoundToViewport; }
+
+	/* Drafts and refined images from this context's live preview stream that are still current */
+	UPROPERTY(BlueprintAssignable, Category = "StableDiffusion|Preview")
+	FImageGenerationCompleteEx OnLivePreviewResultEx;
+
+	/** Captures go to Viewport from now on. A null viewport follows the active one. */
+	void BindViewport(TSharedPtr<FSceneViewport> Viewport);
+
+	/** Viewport this context captures from. */
+	TSharedPtr<FSceneViewport> GetViewport() const;
+
+	/** Frame stream of this context's viewport while a viewport preview is streaming. */
+	const FViewportFrameStream* GetFrameStream() const { return FrameStream.Get(); }
+
+	virtual void BeginDestroy() override;
+
+private:
+	friend class UStableDiffusionSubsystem;
+
+	UStableDiffusionSubsystem* GetSubsystem() const;
+
+	void OnCameraMoved(const FEditorCameraLivePreview& CameraInfo);
+	void OnSceneChanged();
+	void QueueLivePreview(bool bDraft);
+	void CancelLivePreview();
+	void StartFrameStream();
+	void StopFrameStream();
+
+	// Runs a job taken from the mailbox on the subsystem's preview worker
+	void GenerateLivePreview(FLivePreviewRequest& Request);
+	bool GenerateLivePreviewRegion(const FStableDiffusionInput& Input, FStableDiffusionImageResult& OutResult);
+	void UpdateDirtyRegionBaseline(const FStableDiffusionInput& Input, const FStableDiffusionImageResult& Result);
+
+	// Capture rig
+	TWeakPtr<FSceneViewport> BoundViewport;
+	bool bBoundToViewport = false;
+
+	FStableDiffusionInput LivePreviewInput;
+	EInputImageSource LivePreviewSourceType;
+	FLivePreviewStreamOptions LivePreviewOptions;
+	TWeakObjectPtr<USceneCaptureComponent2D> LivePreviewCaptureSource;
+	FDelegateHandle CameraMovedHandle;
+	FSceneChangeTrigger SceneTrigger;
+	FEditorCameraLivePreview LastCameraInfo;
+	FTimerHandle DraftTimer;
+	FTimerHandle RefineTimer;
+	bool bLivePreviewStreaming = false;
+
+	// Job stream. The mailbox and generating flag are guarded by the subsystem's LivePreviewLock.
+	TOptional<FLivePreviewRequest> LivePreviewMailbox;
+	std::atomic<int32> LatestLivePreviewId = 0;
+	bool bLivePreviewGenerating = false;
+
+	// Latency measurements of this context's generations
+	FPreviewQualityController PreviewQualityController;
+	FString PreviewQualityContext;
+	TArray<FString> LivePreviewSchedulers;
+
+	// Continuous capture of the previewed viewport
+	TSharedPtr<FViewportFrameStream> FrameStream;
+	TWeakPtr<FSceneViewport> FrameStreamViewport;
+	bool bFrameStreamRestoreGameView = false;
+
+	// Last preview of each output size that changed regions are inpainted into. Drafts and refinements are generated at
+	// different sizes so each is diffed against the last one of its own size. Guarded by the subsystem's LivePreviewLock.
+	TMap<FIntPoint, FDirtyRegionBaseline> DirtyRegionBaselines;
+	bool bWarnedDirtyRegionsNeedInpaint = false;
+};
@@ -5,6 +5,7 @@
 #include "ActorLayerUtilities.h"
 //#include "LayerProcessorBase.h"
 #include "Components/SceneCaptureComponent2D.h"
+#include "SharedImmutableBuffer.h"
 
 #include "StableDiffusionGenerationOptions.generated.h"
 
@@ -64,11 +65,20 @@ enum class EModelType : uint8 {
 };
 ENUM_CLASS_FLAGS(EModelType);
 
-UENUM()
+UENUM(BlueprintType)
+enum class ELatentModelFamily : uint8 {
+	Auto UMETA(DisplayName = "Auto"),
+	SD1 UMETA(DisplayName = "Stable Diffusion 1.x/2.x"),
+	SDXL UMETA(DisplayName = "Stable Diffusion XL"),
+	SD3 UMETA(DisplayName = "Stable Diffusion 3")
+};
+
+UENUM(BlueprintType)
 enum ELayerBitDepth
 {
 	EightBit UMETA(DisplayName = "8 bit channel bit depth"),
 	SixteenBit UMETA(DisplayName = "16 bit channel bit depth"),
+	ThirtyTwoBit UMETA(DisplayName = "32 bit float channel bit depth"),
 	LayerBitDepth_MAX
 };
 
@@ -92,6 +102,24 @@ struct STABLEDIFFUSIONTOOLS_API FLayerProcessorContext
 {
 	GENERATED_USTRUCT_BODY()
 public:
+	/*
+	* Captured layer pixels and latents are shared between copies of the context. Blueprints and python access them through the blueprint library.
+	*/
+	FSharedPixelBuffer SharedLayerPixels;
+
+	/*
+	* Linear pixels for layers captured at 16 or 32 bit. Only one of the pixel buffers is filled for a captured layer.
+	*/
+	TSharedImmutableBuffer<FFloat16Color> HalfFloatLayerPixels;
+
+	TSharedImmutableBuffer<FLinearColor> FloatLayerPixels;
+
+	FSharedByteBuffer SharedLatentData;
+
+	/*
+	* Reflected arrays kept for blueprints built against them. Pixels and latents set here are moved into the shared buffers
+	* when the layer is used. Captures only fill the shared buffers so read them with GetLayerPixels and GetLayerLatentData.
+	*/
 	UPROPERTY(BlueprintReadWrite, Transient)
 		TArray<FColor> LayerPixels;
 
@@ -115,6 +143,14 @@ public:
 	*/
 	UPROPERTY(BlueprintReadWrite, EditAnywhere, meta = (Category = "Layers", EditCondition = "LayerType == ELayerImageType::custom", EditConditionHides))
 		FString Role = "image";
+
+	/* Bit depth of the pixel buffer that holds this layer's pixels */
+	ELayerBitDepth GetPixelBitDepth() const;
+
+	void ResetPixels();
+
+	/* Moves pixels and latents set through the reflected arrays into the shared buffers */
+	void AdoptReflectedData();
 };
 
 
@@ -151,6 +187,12 @@ public:
 	UPROPERTY(BlueprintReadWrite, EditAnywhere, meta = (Category = "Model", EditCondition = "ModelType == EModelType::Diffusers", EditConditionHides))
 		FDirectoryPath LocalFolderPath;
 
+	/*
+	* Latent space family of this model. Used to pick the projection for fast latent previews. Auto will guess from the pipeline and latent channel count.
+	*/
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, meta = (Category = "Model", AdvancedDisplay))
+		ELatentModelFamily LatentFamily = ELatentModelFamily::Auto;
+
 	bool IsValid() const {
 		return !Model.IsEmpty() || !ExternalURL.IsEmpty();
 	}
@@ -445,9 +487,33 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Generation")
 	int32 PreviewIterationRate = 25;
 
+	/*
+	* Build in-progress previews by projecting the latents straight to RGB instead of running the VAE decoder. Much cheaper but lower fidelity.
+	*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Generation")
+	bool bFastPreview = false;
+
+	/*
+	* Ask the bridge to return the generated image as half float pixels instead of writing it to the output texture. Bridges that can't produce float images fall back to the texture.
+	*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Generation")
+	bool bFloatOutput = false;
+
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Generation")
 	bool DebugPythonImages = false;
 
+	/*
+	* Set on live preview drafts that were generated at a reduced size and step count.
+	*/
+	UPROPERTY(BlueprintReadWrite, Category = "Generation")
+	bool bIsDraft = false;
+
+	/*
+	* Scheduler to generate this image with instead of the pipeline's. The pipeline's scheduler is restored afterwards. Empty keeps the current scheduler.
+	*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Generation")
+	FString SchedulerOverride;
+
 	UPROPERTY(BlueprintReadWrite, Category = "Generation")
 	FMinimalViewInfo View;
 
@@ -4,6 +4,31 @@
 #include "StableDiffusionGenerationOptions.h"
 #include "StableDIffusionImageResult.generated.h"
 
+USTRUCT(BlueprintType)
+struct STABLEDIFFUSIONTOOLS_API FPreviewQualitySettings
+{
+    GENERATED_BODY()
+public:
+    UPROPERTY(BlueprintReadOnly, Category = "Preview")
+    float ResolutionScale = 1.0f;
+
+    UPROPERTY(BlueprintReadOnly, Category = "Preview")
+    int32 Iterations = 0;
+
+    // Empty when the pipeline's own scheduler was used
+    UPROPERTY(BlueprintReadOnly, Category = "Preview")
+    FString Scheduler;
+
+    // Seconds the controller expected the generation to take. Negative if it had no measurements yet.
+    UPROPERTY(BlueprintReadOnly, Category = "Preview")
+    float PredictedLatency = -1.0f;
+
+    // Seconds from capture to result. Only filled in on results.
+    UPROPERTY(BlueprintReadOnly, Category = "Preview")
+    float MeasuredLatency = -1.0f;
+};
+
+
 USTRUCT(BlueprintType)
 struct STABLEDIFFUSIONTOOLS_API FStableDiffusionImageResult
 {
@@ -27,8 +52,18 @@ public:
     UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Outputs")
     UTexture2D* OutTexture = nullptr;
 
+    // Shared between copies of the result. Blueprints and python access it through the blueprint library.
+    FSharedByteBuffer SharedOutLatent;
+
+    // Reflected array kept for blueprints built against it and for assets saved before the shared buffer. Read latents with GetResultLatentData.
     UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Outputs")
     TArray<uint8> OutLatent;
+
+    // Linear RGBA pixels of size OutWidth x OutHeight returned by bridges when float output was requested
+    TSharedImmutableBuffer<FFloat16Color> OutHalfFloatPixels;
+
+    // sRGB pixels of OutTexture copied before it was uploaded. Worker threads read these instead of the texture the game thread owns.
+    FSharedPixelBuffer OutPixels;
     
     UPROPERTY(BlueprintReadWrite, Category = "Outputs")
     int32 OutWidth = 0;
@@ -39,9 +74,29 @@ public:
     UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Outputs")
     bool Upsampled = false;
 
+    // Requested scale when passed to an upsampler. Bridges set it to the factor they actually produced, which may differ if their model only supports fixed factors.
+    UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Outputs")
+    float UpsampleFactor = 4.0f;
+
     UPROPERTY(BlueprintReadWrite, Category = "Outputs")
     bool Completed = false;
 
+    // Live preview draft generated at reduced size and steps. A full quality result follows if the view stays put.
+    UPROPERTY(BlueprintReadWrite, Category = "Outputs")
+    bool bIsDraft = false;
+
+    // Settings the adaptive preview controller picked for this result
+    UPROPERTY(BlueprintReadOnly, Category = "Outputs")
+    FPreviewQualitySettings PreviewQuality;
+
+    // Top left corner of the part of the image that was generated. Live previews may only inpaint the part that changed.
+    UPROPERTY(BlueprintReadOnly, Category = "Outputs")
+    FIntPoint RegeneratedOffset = FIntPoint::ZeroValue;
+
+    // Size of the part of the image that was generated. Zero when a previous result was reused as is.
+    UPROPERTY(BlueprintReadOnly, Category = "Outputs")
+    FIntPoint RegeneratedSize = FIntPoint::ZeroValue;
+
     UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Outputs")
     FMinimalViewInfo View;
 };
@@ -57,4 +112,13 @@ public:
 
     UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Outputs")
     FStableDiffusionImageResult ImageOutput;
+
+    virtual void Serialize(FArchive& Ar) override;
+    virtual void PreSave(FObjectPreSaveContext SaveContext) override;
+    virtual void PostLoad() override;
+
+private:
+    // Serialized copy of the output latent since the shared buffer isn't a property
+    UPROPERTY()
+    TArray<uint8> SavedOutLatent;
 };
@@ -0,0 +1,109 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "StableDiffusionGenerationOptions.h"
+
+class IMappedFileHandle;
+class IMappedFileRegion;
+
+enum class ELatentDataType : uint8
+{
+	Float32 = 0,
+	Float16 = 1
+};
+
+enum class ELatentCompression : uint8
+{
+	None = 0,
+	// zlib over byte-shuffled elements
+	Zlib = 1
+};
+
+enum class ELatentLayout : uint8
+{
+	NCHW = 0
+};
+
+/**
+ * Header of a latent container. Containers are a 48 byte little endian header followed by the raw or compressed latent values.
+ * The layout is documented in Content/Python/latentformat.py which writes them on the python side.
+ */
+struct STABLEDIFFUSIONTOOLS_API FStableDiffusionLatentHeader
+{
+	static constexpr uint32 MagicValue = 'S' | ('D' << 8) | ('L' << 16) | ('T' << 24);
+	static constexpr uint16 CurrentVersion = 1;
+	static constexpr int64 Size = 48;
+	static constexpr int32 MaxDims = 4;
+
+	uint32 Magic = MagicValue;
+	uint16 Version = CurrentVersion;
+	ELatentDataType DataType = ELatentDataType::Float32;
+	ELatentCompression Compression = ELatentCompression::None;
+	ELatentLayout Layout = ELatentLayout::NCHW;
+	ELatentModelFamily Family = ELatentModelFamily::Auto;
+	uint8 NumDims = 0;
+	int32 Shape[MaxDims] = { 1, 1, 1, 1 };
+	uint64 RawSize = 0;
+	uint64 PayloadSize = 0;
+
+	int64 GetNumElements() const;
+	int32 GetElementSize() const { return DataType == ELatentDataType::Float16 ? 2 : 4; }
+
+	/** Channels, height and width assuming an NCHW layout. */
+	int32 GetChannels() const { return NumDims >= 3 ? Shape[NumDims - 3] : 1; }
+	FIntPoint GetSpatialSize() const { return NumDims >= 2 ? FIntPoint(Shape[NumDims - 1], Shape[NumDims - 2]) : FIntPoint::ZeroValue; }
+
+	friend FArchive& operator<<(FArchive& Ar, FStableDiffusionLatentHeader& Header);
+};
+
+
+class STABLEDIFFUSIONTOOLS_API FStableDiffusionLatent
+{
+public:
+	static bool IsLatentContainer(TArrayView<const uint8> Data);
+
+	/** Reads and validates the header. Returns false if the data isn't a latent container or is truncated. */
+	static bool ReadHeader(TArrayView<const uint8> Data, FStableDiffusionLatentHeader& OutHeader);
+
+	/** Decompresses and converts the container's values to float32. */
+	static bool Decode(TArrayView<const uint8> Data, TArray<float>& OutValues, FStableDiffusionLatentHeader* OutHeader = nullptr);
+
+	/** Packs float32 values into a container, optionally storing them as float16 and compressing them. */
+	static TArray<uint8> Encode(TArrayView<const float> Values, TArrayView<const int32> Shape, ELatentModelFamily Family, ELatentDataType DataType = ELatentDataType::Float16, ELatentCompression Compression = ELatentCompression::None);
+
+	/** Rewrites a container with a different compression, keeping its data type. */
+	static bool Recompress(TArrayView<const uint8> Data, ELatentCompression Compression, TArray<uint8>& OutData);
+
+	static bool SaveToFile(TArrayView<const uint8> Data, const FString& Filename);
+
+	/** Reads a latent file into OutData. Use FMappedLatentFile instead to read the values in place. */
+	static bool LoadFromFile(const FString& Filename, TArray<uint8>& OutData);
+};
+
+
+/**
+ * Latent container file mapped into memory. Uncompressed float32 latents can be read in place without loading the file.
+ */
+class STABLEDIFFUSIONTOOLS_API FMappedLatentFile
+{
+public:
+	static TUniquePtr<FMappedLatentFile> Open(const FString& Filename);
+	~FMappedLatentFile();
+
+	TArrayView<const uint8> GetData() const;
+	const FStableDiffusionLatentHeader& GetHeader() const { return Header; }
+
+	/** The mapped values when they are stored as uncompressed float32, empty otherwise. */
+	TArrayView<const float> GetFloatValues() const;
+
+	bool Decode(TArray<float>& OutValues) const { return FStableDiffusionLatent::Decode(GetData(), OutValues); }
+
+private:
+	FMappedLatentFile() = default;
+
+	TUniquePtr<IMappedFileHandle> Handle;
+	TUniquePtr<IMappedFileRegion> Region;
+	FStableDiffusionLatentHeader Header;
+};
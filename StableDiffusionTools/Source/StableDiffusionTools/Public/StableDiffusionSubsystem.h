@@ -3,6 +3,7 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include <atomic>
 #include "EditorSubsystem.h"
 #include "FrameGrabber.h"
 #include "Slate/SceneViewport.h"
@@ -11,9 +12,19 @@
 #include "StableDiffusionBridge.h"
 #include "DependencyManager.h"
 #include "StableDiffusionImageResult.h"
+#include "StableDiffusionTexturePool.h"
+#include "ImagePipelineStageCache.h"
+#include "LayerCaptureSet.h"
+#include "PreviewQualityController.h"
+#include "GenerationSignature.h"
+#include "DirtyRegionInpainter.h"
+#include "ViewportFrameStream.h"
+#include "SceneChangeTrigger.h"
 #include "VPFullScreenUserWidgetActor.h"
 #include "StableDiffusionSubsystem.generated.h"
 
+class UStableDiffusionGenerationContext;
+
 DECLARE_MULTICAST_DELEGATE_ThreeParams(FFrameCaptureComplete, FColor*, FIntPoint, FIntPoint);
 
 DECLARE_MULTICAST_DELEGATE_OneParam(FImageGenerationComplete, FStableDiffusionImageResult);
@@ -82,6 +93,53 @@ public:
 DECLARE_DYNAMIC_MULTICAST_DELEGATE_OneParam(FOnEditorCameraMovedEx, FEditorCameraLivePreview, CameraInfo);
 
 
+USTRUCT(BlueprintType)
+struct STABLEDIFFUSIONTOOLS_API FLivePreviewStreamOptions
+{
+	GENERATED_BODY()
+public:
+	/* Seconds the camera has to rest before a draft is generated */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "StableDiffusion|Preview", meta = (ClampMin = 0))
+	float DraftDelay = 0.1f;
+
+	/* Fraction of the output size that drafts are generated at */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "StableDiffusion|Preview", meta = (ClampMin = 0.1, ClampMax = 1))
+	float DraftScale = 0.5f;
+
+	/* Iterations used for drafts */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "StableDiffusion|Preview", meta = (ClampMin = 1))
+	int32 DraftIterations = 10;
+
+	/* Seconds the camera has to rest after a draft before it is refined at full quality. Negative values never refine. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "StableDiffusion|Preview")
+	float RefineDelay = 1.0f;
+
+	/* Adapts the draft resolution, steps and scheduler to a latency target. DraftScale and DraftIterations become upper limits. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "StableDiffusion|Preview")
+	FAdaptiveQualityOptions AdaptiveQuality;
+
+	/* Inpaints only the part of the frame that changed since the last preview so the rest of it stays stable */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "StableDiffusion|Preview")
+	FDirtyRegionOptions DirtyRegions;
+
+	/* Keep grabbing viewport frames in the background so viewport previews pick up the newest one instead of reading the viewport back */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "StableDiffusion|Preview")
+	bool bStreamViewportFrames = true;
+
+	/* Refresh the preview when the level is edited in view, not just when the camera moves */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "StableDiffusion|Preview")
+	FSceneChangeTriggerOptions SceneChanges;
+};
+
+/* Pending live preview generation. Only the latest one is ever kept. */
+struct FLivePreviewRequest
+{
+	FStableDiffusionInput Input;
+	FPreviewQualitySettings Quality;
+	int32 Id = 0;
+};
+
+
 ///** Graph task for simple fire-and-forget asynchronous functions. */
 //class FSDRenderTask
 //	: public TAsyncGraphTask<void>
@@ -127,6 +185,9 @@ class STABLEDIFFUSIONTOOLS_API UStableDiffusionSubsystem : public UEditorSubsyst
 public:
 	UStableDiffusionSubsystem(const FObjectInitializer& initializer);
 
+	/** Stops every generation context and waits for the live preview worker before the subsystem goes away. */
+	virtual void Deinitialize() override;
+
 	static FString NormalMaterialAsset;
 	static FString StencilLayerMaterialAsset;
 	
@@ -192,7 +253,7 @@ public:
 	void ConvertRawModel(UStableDiffusionModelAsset* InModelAsset, bool DeleteOriginal = true);
 
 	UFUNCTION(BlueprintCallable, Category = "StableDiffusion|Model")
-	void InitModel(const FStableDiffusionModelOptions& Model, UStableDiffusionPipelineAsset* Pipeline, UStableDiffusionLORAAsset* LORAAsset, UStableDiffusionTextualInversionAsset* TextualInversionAsset, const TArray<FLayerProcessorContext>& Layers, bool Async, bool AllowNSFW, EPaddingMode PaddingMode);
+	void InitModel(const FStableDiffusionModelOptions& Model, UStableDiffusionPipelineAsset* Pipeline, UStableDiffusionLORAAsset* LORAAsset, UStableDiffusionTextualInversionAsset* TextualInversionAsset, const TArray<FLayerProcessorContext>& Layers, bool Async, bool AllowNSFW, EPaddingMode PaddingMode, const FString& SchedulerOverride = TEXT(""));
 
 	//UFUNCTION(BlueprintCallable, Category = "StableDiffusion|Model")
 	//void RunImagePipeline(TArray<UImagePipelineStageAsset*> Stages, FStableDiffusionInput Input, EInputImageSource ImageSourceType, bool Async, bool AllowNSFW, EPaddingMode PaddingMode);
@@ -212,6 +273,25 @@ public:
 	UFUNCTION(BlueprintCallable, Category = "StableDiffusion|Generation")
 	FStableDiffusionImageResult GenerateImageSync(FStableDiffusionInput Input, EInputImageSource ImageSourceType);
 
+	/**
+	* Fills Input.ProcessedLayers from the image source on the game thread. Blocks when called from any other thread.
+	* Layers already in SharedCaptures are reused instead of being captured again and new captures are added to it.
+	* Viewport and editor camera captures come from Context's viewport if one is given.
+	*/
+	void CaptureLayers(FStableDiffusionInput& Input, EInputImageSource ImageSourceType, FLayerCaptureSet* SharedCaptures = nullptr, UStableDiffusionGenerationContext* Context = nullptr);
+
+	/** Generates an image from an input whose layers have already been captured with CaptureLayers. */
+	FStableDiffusionImageResult GenerateImageFromCapturedInput(const FStableDiffusionInput& Input);
+
+	/** Uploads pixels to a texture from the pool and publishes it. Blocks until the game thread has finished the upload. */
+	UTexture2D* UploadToPooledTexture(const FSharedPixelBuffer& Pixels, FIntPoint Size);
+
+	/** Results of image pipeline stages kept so unchanged stages can be skipped. */
+	FImagePipelineStageCache& GetStageCache();
+
+	UFUNCTION(BlueprintCallable, Category = "StableDiffusion|Generation")
+	void ClearStageCache(bool bIncludeDisk = false);
+
 	UFUNCTION(BlueprintCallable, Category = "StableDiffusion|Generation")
 	void StopGeneratingImage();
 
@@ -222,7 +302,22 @@ public:
 	void ClearIsStopping();
 
 	UFUNCTION(BlueprintCallable, Category = "StableDiffusion|Outputs")
-	void UpsampleImage(const FStableDiffusionImageResult& input);
+	void UpsampleImage(const FStableDiffusionImageResult& input, float UpsampleFactor = 4.0f);
+
+	/** Output and preview textures are recycled once their results are released. */
+	UPROPERTY(BlueprintReadOnly, Category = "StableDiffusion|Outputs")
+	TObjectPtr<UStableDiffusionTexturePool> TexturePool;
+
+	/** Stops the result's output texture from ever being recycled by the texture pool. */
+	UFUNCTION(BlueprintCallable, Category = "StableDiffusion|Outputs")
+	void KeepResult(const FStableDiffusionImageResult& Result);
+
+	/** Returns the result's output texture to the texture pool once it is no longer displayed. The texture may be overwritten by any later generation. */
+	UFUNCTION(BlueprintCallable, Category = "StableDiffusion|Outputs")
+	void ReleaseResult(const FStableDiffusionImageResult& Result);
+
+	UFUNCTION(BlueprintCallable, BlueprintPure, Category = "StableDiffusion|Outputs")
+	FStableDiffusionTexturePoolStats GetTexturePoolStats() const;
 
 	UPROPERTY(BlueprintAssignable, Category = "StableDiffusion|Outputs")
 	FImageGenerationCompleteEx OnImageUpsampleCompleteEx;
@@ -254,8 +349,16 @@ public:
 	UFUNCTION(BlueprintCallable, Category = "StableDiffusion|Preview")
 	void SetLivePreviewEnabled(bool Enabled, float Delay = 0.5f, USceneCaptureComponent2D* CaptureSource = nullptr);
 
+	/**
+	* Previews a layer in a render target. The preview is only rendered again when the camera moves, an actor is edited or
+	* RefreshLayerPreview is called. PreviewScale renders it at a fraction of Size.
+	*/
 	UFUNCTION(BlueprintCallable, Category = "StableDiffusion|Preview")
-	UTextureRenderTarget2D* SetLivePreviewForLayer(FIntPoint Size, ULayerProcessorBase* Layer, USceneCaptureComponent2D* CaptureSource = nullptr);
+	UTextureRenderTarget2D* SetLivePreviewForLayer(FIntPoint Size, ULayerProcessorBase* Layer, USceneCaptureComponent2D* CaptureSource = nullptr, float PreviewScale = 1.0f);
+
+	/** Renders the layer preview again on the next tick. */
+	UFUNCTION(BlueprintCallable, Category = "StableDiffusion|Preview")
+	void RefreshLayerPreview();
 
 	UPROPERTY(BlueprintReadOnly, Category = "StableDiffusion|Preview")
 	ULayerProcessorBase* PreviewedLayer;
@@ -263,6 +366,48 @@ public:
 	UFUNCTION(BlueprintCallable, Category = "StableDiffusion|Preview")
 	void DisableLivePreviewForLayer();
 
+	/** Starts a live preview stream in the default generation context, which follows the active viewport. */
+	UFUNCTION(BlueprintCallable, Category = "StableDiffusion|Preview")
+	void StartLivePreviewStream(FStableDiffusionInput Input, EInputImageSource ImageSourceType, FLivePreviewStreamOptions Options, USceneCaptureComponent2D* CaptureSource = nullptr);
+
+	UFUNCTION(BlueprintCallable, Category = "StableDiffusion|Preview")
+	void StopLivePreviewStream();
+
+	UFUNCTION(BlueprintCallable, BlueprintPure, Category = "StableDiffusion|Preview")
+	bool IsLivePreviewStreaming() const;
+
+	/* Drafts and refined images from the default context's live preview stream that are still current */
+	UPROPERTY(BlueprintAssignable, Category = "StableDiffusion|Preview")
+	FImageGenerationCompleteEx OnLivePreviewResultEx;
+
+	/**
+	* Creates a context that runs a live preview stream of its own next to the default one. Bound contexts keep capturing the
+	* viewport that is active now, even after another viewport gets focus. All contexts share the loaded model and take
+	* turns generating.
+	*/
+	UFUNCTION(BlueprintCallable, Category = "StableDiffusion|Preview")
+	UStableDiffusionGenerationContext* CreateGenerationContext(bool bBindToActiveViewport = true);
+
+	/** Stops a context's live preview stream and forgets it. The default context can't be released. */
+	UFUNCTION(BlueprintCallable, Category = "StableDiffusion|Preview")
+	void ReleaseGenerationContext(UStableDiffusionGenerationContext* Context);
+
+	UFUNCTION(BlueprintCallable, BlueprintPure, Category = "StableDiffusion|Preview")
+	UStableDiffusionGenerationContext* GetDefaultGenerationContext() const;
+
+	/**
+	* Grabs every frame of the capturing viewport, cropped to the overlay bounds for Aspect. Viewport captures use the newest
+	* grabbed frame for their final colour layer instead of reading the viewport back while the stream is running.
+	*/
+	UFUNCTION(BlueprintCallable, Category = "StableDiffusion|Preview")
+	bool StartViewportFrameStream(float Aspect);
+
+	UFUNCTION(BlueprintCallable, Category = "StableDiffusion|Preview")
+	void StopViewportFrameStream();
+
+	UFUNCTION(BlueprintCallable, BlueprintPure, Category = "StableDiffusion|Preview")
+	bool IsViewportFrameStreaming() const { return ViewportFrameStream.IsValid() && ViewportFrameStream->IsRunning(); }
+
 	UFUNCTION(BlueprintCallable, Category = "StableDiffusion|Overlay")
 	void ShowAspectOverlay();
 
@@ -297,6 +442,12 @@ public:
 
 	static TSharedPtr<FSceneViewport> GetCapturingViewport();
 
+	/** Part of the viewport covered by the aspect overlay for Aspect, in viewport pixels. */
+	static FIntRect CalculateViewportOverlayBounds(FSceneViewport* Viewport, float Aspect);
+
+	/** Level editor client drawing the viewport, if there is one. */
+	static FLevelEditorViewportClient* FindViewportClient(const FViewport* Viewport);
+
 	UPROPERTY(BlueprintReadWrite, Category = "StableDiffusion|Overlay")
 	TSubclassOf<AFullScreenUserWidgetActor> AspectOverlayActorClass;
 
@@ -309,17 +460,22 @@ protected:
 	void UpdateImageProgress(int32 Step, int32 Timestep, float Progress, FIntPoint Size, UTexture2D* Texture);
 
 private:
-	// Scene Capture Component capture
-	FViewportSceneCapture CurrentSceneCapture;
+	friend class UStableDiffusionGenerationContext;
 
-	// Capture from the currently active viewport
-	void CaptureFromViewportSource(FStableDiffusionInput& Input);
+	// Capture from the context's viewport or the currently active one
+	void CaptureFromViewportSource(FStableDiffusionInput& Input, FLayerCaptureSet* SharedCaptures, UStableDiffusionGenerationContext* Context);
 
-	// Capture from a provided SceneCapture2D actor
-	void CaptureFromSceneCaptureSource(FStableDiffusionInput& Input);
+	// Capture from a provided SceneCapture2D actor, or one placed at the context's editor camera
+	void CaptureFromSceneCaptureSource(FStableDiffusionInput& Input, FLayerCaptureSet* SharedCaptures, UStableDiffusionGenerationContext* Context);
 	
 	// Capture from a provided texture
-	void CaptureFromTextureSource(FStableDiffusionInput& Input);
+	void CaptureFromTextureSource(FStableDiffusionInput& Input, FLayerCaptureSet* SharedCaptures);
+
+	// Loads the model on the calling thread. Only swaps the adapters and scheduler if the loaded pipeline was built from the same base model.
+	FStableDiffusionModelInitResult LoadModel(const FStableDiffusionModelOptions& Model, UStableDiffusionPipelineAsset* Pipeline, UStableDiffusionLORAAsset* LORAAsset, UStableDiffusionTextualInversionAsset* TextualInversionAsset, const TArray<FLayerProcessorContext>& Layers, bool AllowNSFW, EPaddingMode PaddingMode, const FString& Scheduler);
+	bool SwapAdapters(UStableDiffusionLORAAsset* LORAAsset, UStableDiffusionTextualInversionAsset* TextualInversionAsset);
+	bool SwapScheduler(const FString& Scheduler);
+	static FString MakeBaseModelKey(const FStableDiffusionModelOptions& Model, const UStableDiffusionPipelineAsset* Pipeline, const TArray<FLayerProcessorContext>& Layers, bool AllowNSFW, EPaddingMode PaddingMode);
 
 	// Kick off an async render
 	void StartImageGeneration(FStableDiffusionInput Input);
@@ -340,17 +496,69 @@ private:
 	// Aspect overlay
 	TObjectPtr<AActor> AspectOverlayActor;
 
+	// Legacy single preview state behind SetLivePreviewEnabled and SetLivePreviewForLayer. These still live on the subsystem
+	// rather than on a generation context because PreviewedLayer and the camera broadcasts are part of its Blueprint API.
 	//FDelegateHandle OnEditorCameraUpdatedDlgHandle;
 	FDelegateHandle OnCaptureCameraUpdatedDlgHandle;
 	FEditorCameraLivePreview LastPreviewCameraInfo;
 	FTimerHandle IdleCameraTimer;
+	FSceneChangeTrigger LivePreviewSceneTrigger;
+	TWeakObjectPtr<USceneCaptureComponent2D> LivePreviewSceneTriggerSource;
 
 	FViewportSceneCapture LayerPreviewCapture;
 	FDelegateHandle OnLayerPreviewUpdateHandle;
+	TWeakObjectPtr<USceneCaptureComponent2D> LayerPreviewComponent;
+	FDelegateHandle LayerPreviewSourceMovedHandle;
+	FDelegateHandle LayerPreviewActorMovedHandle;
+	FDelegateHandle LayerPreviewPropertyChangedHandle;
+	FTSTicker::FDelegateHandle LayerPreviewTickerHandle;
+
+	// Live preview streams
+	FMinimalViewInfo GetLivePreviewView(USceneCaptureComponent2D* CaptureSource, float AspectRatio, FSceneViewport* Viewport = nullptr) const;
+	FViewportSceneCapture CreateSceneCaptureForViewport(const FViewport* Viewport);
+	void ScheduleLivePreview(UStableDiffusionGenerationContext* Context, FLivePreviewRequest Request);
+	UStableDiffusionGenerationContext* TakeNextLivePreview(FLivePreviewRequest& OutRequest);
+	void RunLivePreviewWorker();
+	void OnGenerationContextResult(UStableDiffusionGenerationContext* Context, const FStableDiffusionImageResult& Result);
+
+	UPROPERTY()
+	TObjectPtr<UStableDiffusionGenerationContext> DefaultGenerationContext;
+
+	// Contexts take turns on the bridge in this order. Guarded by LivePreviewLock.
+	UPROPERTY()
+	TArray<TObjectPtr<UStableDiffusionGenerationContext>> GenerationContexts;
+
+	// Context the preview worker is generating for, kept alive until it is done
+	UPROPERTY()
+	TObjectPtr<UStableDiffusionGenerationContext> ScheduledContext;
+
+	// Guards the contexts' mailboxes and the worker state
+	FCriticalSection LivePreviewLock;
+	int32 NextLivePreviewContext = 0;
+	bool bLivePreviewWorkerRunning = false;
+	bool bLivePreviewShutdown = false;
+
+	// Continuous viewport capture
+	TSharedPtr<FViewportFrameStream> ViewportFrameStream;
+	float FrameStreamAspect = 1.0f;
+	bool bFrameStreamRestoreGameView = false;
 
 	// Model state
 	bool bIsModelDirty = true;
 
+	// Everything the loaded pipeline was built from apart from its adapters and scheduler. Empty while no model is loaded.
+	FString LoadedBaseModelKey;
+	FString LoadedScheduler;
+
 	// Generation state
 	bool bIsStopping = false;
+
+	// Last completed generation so requests with unchanged inputs can return it again. Its texture belongs to whoever received
+	// the result so only the pixels are held and every reuse uploads them to a texture of its own.
+	FCriticalSection LastGenerationLock;
+	FGenerationSignature LastGenerationSignature;
+	UPROPERTY()
+	FStableDiffusionImageResult LastGenerationResult;
+
+	TSharedPtr<FImagePipelineStageCache, ESPMode::ThreadSafe> StageCache;
 };
@@ -0,0 +1,101 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/NoExportTypes.h"
+#include "Engine/Texture2D.h"
+#include "StableDiffusionTexturePool.generated.h"
+
+USTRUCT(BlueprintType)
+struct STABLEDIFFUSIONTOOLS_API FStableDiffusionTexturePoolStats
+{
+	GENERATED_BODY()
+public:
+	/* Textures waiting in the pool to be reused */
+	UPROPERTY(BlueprintReadOnly, Category = "StableDiffusion|Textures")
+	int32 NumFree = 0;
+
+	/* Textures currently being written to by generation requests */
+	UPROPERTY(BlueprintReadOnly, Category = "StableDiffusion|Textures")
+	int32 NumLeased = 0;
+
+	/* Textures handed over to results that can still be released back to the pool */
+	UPROPERTY(BlueprintReadOnly, Category = "StableDiffusion|Textures")
+	int32 NumPublished = 0;
+
+	/* Textures that have been detached from the pool with Keep */
+	UPROPERTY(BlueprintReadOnly, Category = "StableDiffusion|Textures")
+	int32 NumKept = 0;
+
+	/* Total number of textures the pool had to create */
+	UPROPERTY(BlueprintReadOnly, Category = "StableDiffusion|Textures")
+	int32 NumCreated = 0;
+
+	/* Total number of requests that were served with a recycled texture */
+	UPROPERTY(BlueprintReadOnly, Category = "StableDiffusion|Textures")
+	int32 NumReused = 0;
+
+	/* Total number of published textures returned to the pool with Release */
+	UPROPERTY(BlueprintReadOnly, Category = "StableDiffusion|Textures")
+	int32 NumReleased = 0;
+
+	/* Approximate size of the pixel data owned by the pool in bytes */
+	UPROPERTY(BlueprintReadOnly, Category = "StableDiffusion|Textures")
+	int64 PooledBytes = 0;
+};
+
+
+/**
+ * Recycles transient output and preview textures keyed by size and pixel format so generation requests don't allocate new UObjects and GPU resources every time.
+ * Ownership is explicit. A published texture belongs to its result and only comes back to the pool when the consumer releases it. Textures
+ * that are never released are left to the garbage collector like any other texture.
+ */
+UCLASS(BlueprintType)
+class STABLEDIFFUSIONTOOLS_API UStableDiffusionTexturePool : public UObject
+{
+	GENERATED_BODY()
+public:
+	/** Gets a texture matching the size and format from the pool, creating a new one if none are free. The texture stays in flight until it is published or released. */
+	UFUNCTION(BlueprintCallable, Category = "StableDiffusion|Textures")
+	UTexture2D* Acquire(FIntPoint Size, EPixelFormat Format = PF_B8G8R8A8);
+
+	/** Hands an in-flight texture over to a result. The pool only reuses it once it is released. */
+	UFUNCTION(BlueprintCallable, Category = "StableDiffusion|Textures")
+	void Publish(UTexture2D* Texture);
+
+	/** Returns a leased or published texture to the pool. Nothing may display or write to the texture afterwards. */
+	UFUNCTION(BlueprintCallable, Category = "StableDiffusion|Textures")
+	void Release(UTexture2D* Texture);
+
+	/** Detaches a leased or published texture from the pool so releasing it later does nothing. */
+	UFUNCTION(BlueprintCallable, Category = "StableDiffusion|Textures")
+	void Keep(UTexture2D* Texture);
+
+	/** Drops every free texture so they can be garbage collected. */
+	UFUNCTION(BlueprintCallable, Category = "StableDiffusion|Textures")
+	void Trim();
+
+	UFUNCTION(BlueprintCallable, BlueprintPure, Category = "StableDiffusion|Textures")
+	FStableDiffusionTexturePoolStats GetStats() const;
+
+	/** Maximum number of free textures to hold on to. Extra textures are left for the garbage collector. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "StableDiffusion|Textures")
+	int32 MaxFreeTextures = 8;
+
+private:
+	static int64 GetTextureBytes(const UTexture2D* Texture);
+
+	UPROPERTY(Transient)
+	TArray<TObjectPtr<UTexture2D>> FreeTextures;
+
+	// Textures still being written to by generation requests
+	UPROPERTY(Transient)
+	TArray<TObjectPtr<UTexture2D>> LeasedTextures;
+
+	// Textures owned by results. Only weakly held so results that are never released can be garbage collected.
+	TSet<TWeakObjectPtr<UTexture2D>> PublishedTextures;
+
+	mutable FCriticalSection PoolLock;
+	FStableDiffusionTexturePoolStats Stats;
+};
@@ -6,6 +6,8 @@
 #include "UObject/NoExportTypes.h"
 #include "IDetailCustomization.h"
 #include "StableDiffusionBridge.h"
+#include "LatentPreview.h"
+#include "TiledUpsampler.h"
 #include "StableDiffusionToolsSettings.generated.h"
 
 /**
@@ -39,6 +41,30 @@ public:
 	UFUNCTION(BlueprintCallable, meta = (Category = "Options"))
 	FDirectoryPath GetPythonSitePackagesOverridePath();
 
+	/** Gets the latent to RGB projection used for fast previews of a model family. Falls back to the built-in coefficients when none are configured.*/
+	const FLatentPreviewCoefficients& GetLatentPreviewCoefficients(ELatentModelFamily Family, int32 NumChannels) const;
+
+	/** Gets how frames are split into tiles before they are upsampled.*/
+	const FUpsampleTilingOptions& GetUpsampleTilingOptions() const { return UpsampleTiling; }
+
+	/** Gets how many image pipeline stage results are kept in memory.*/
+	int32 GetMaxCachedStageResults() const { return MaxCachedStageResults; }
+
+	/** Gets how many bytes of image pipeline stage results may be kept in memory.*/
+	int64 GetMaxStageCacheMemoryBytes() const { return (int64)FMath::Max(MaxStageCacheMemorySizeMB, 0) * 1024 * 1024; }
+
+	/** Gets whether image pipeline stage results are also stored in the project's Saved folder.*/
+	bool GetCacheStageResultsOnDisk() const { return bCacheStageResultsOnDisk; }
+
+	/** Gets how many bytes of image pipeline stage results may be stored on disk.*/
+	int64 GetMaxStageCacheDiskBytes() const { return (int64)FMath::Max(MaxStageCacheDiskSizeMB, 0) * 1024 * 1024; }
+
+	/** Gets whether generations with unchanged inputs return the previous result.*/
+	bool GetSkipUnchangedGenerations() const { return bSkipUnchangedGenerations; }
+
+	/** Gets how far captured layers may drift before they count as changed.*/
+	float GetUnchangedCaptureThreshold() const { return UnchangedCaptureThreshold; }
+
 	void AddGeneratorToken(const FName& Generator);
 
 private:
@@ -66,6 +92,38 @@ private:
 	/** Overriden python site-packages folder. */
 	UPROPERTY(config, EditAnywhere, AdvancedDisplay, meta = (DisplayName = "Python package installation directory", Category = "Options", EditCondition = "bOverridePythonSitePackagesPath", EditConditionHides))
 	FDirectoryPath PythonSitePackagesPath;
+
+	/** Overrides for the latent to RGB projections used by fast previews. Families without an entry use the built-in coefficients. */
+	UPROPERTY(config, EditAnywhere, AdvancedDisplay, meta = (DisplayName = "Latent preview coefficients", Category = "Preview"))
+	TMap<ELatentModelFamily, FLatentPreviewCoefficients> LatentPreviewCoefficients;
+
+	/** Large frames are upsampled in overlapping tiles so memory use stays bounded. */
+	UPROPERTY(config, EditAnywhere, meta = (DisplayName = "Upsample tiling", Category = "Upsampling"))
+	FUpsampleTilingOptions UpsampleTiling;
+
+	/** Number of image pipeline stage results kept in memory so unchanged stages don't have to be generated again. 0 disables the memory cache. */
+	UPROPERTY(config, EditAnywhere, AdvancedDisplay, meta = (DisplayName = "Cached stage results", Category = "Pipelines", ClampMin = 0))
+	int32 MaxCachedStageResults = 16;
+
+	/** Size in megabytes the in memory stage cache may grow to before the least recently used results are dropped. */
+	UPROPERTY(config, EditAnywhere, AdvancedDisplay, meta = (DisplayName = "Stage cache memory budget (MB)", Category = "Pipelines", ClampMin = 0))
+	int32 MaxStageCacheMemorySizeMB = 1024;
+
+	/** Also write image pipeline stage results to Saved/StableDiffusionTools/StageCache so they survive editor restarts. */
+	UPROPERTY(config, EditAnywhere, AdvancedDisplay, meta = (DisplayName = "Cache stage results on disk", Category = "Pipelines"))
+	bool bCacheStageResultsOnDisk = false;
+
+	/** Size in megabytes the on disk stage cache may grow to before the least recently used results are deleted. */
+	UPROPERTY(config, EditAnywhere, AdvancedDisplay, meta = (DisplayName = "Stage cache disk budget (MB)", Category = "Pipelines", ClampMin = 0, EditCondition = "bCacheStageResultsOnDisk"))
+	int32 MaxStageCacheDiskSizeMB = 2048;
+
+	/** Return the previous result instead of generating again when the options, layers and captured pixels haven't changed. Requests with a random seed always generate. */
+	UPROPERTY(config, EditAnywhere, AdvancedDisplay, meta = (DisplayName = "Skip unchanged generations", Category = "Generation"))
+	bool bSkipUnchangedGenerations = true;
+
+	/** Average luminance difference between captures, from 0 to 1, below which they still count as unchanged. Absorbs capture noise such as temporal AA jitter. 0 only skips identical captures. */
+	UPROPERTY(config, EditAnywhere, AdvancedDisplay, meta = (DisplayName = "Unchanged capture threshold", Category = "Generation", ClampMin = 0, ClampMax = 1, EditCondition = "bSkipUnchangedGenerations"))
+	float UnchangedCaptureThreshold = 0.0f;
 };
 
 
@@ -0,0 +1,52 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "StableDiffusionImageResult.h"
+#include "TiledUpsampler.generated.h"
+
+class UStableDiffusionBridge;
+
+/*
+* Controls how large frames are split up before they are sent to the upsampler.
+*/
+USTRUCT(BlueprintType)
+struct STABLEDIFFUSIONTOOLS_API FUpsampleTilingOptions
+{
+	GENERATED_BODY()
+public:
+	/* Width and height of each tile in input pixels. 0 sends the whole frame as one tile. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Upsampling", meta = (ClampMin = 0))
+	int32 TileSize = 512;
+
+	/* Input pixels shared between neighbouring tiles. The seams are feathered across the overlap. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Upsampling", meta = (ClampMin = 0))
+	int32 Overlap = 32;
+
+	/* Number of tiles sent to the bridge in one call. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Upsampling", meta = (ClampMin = 1))
+	int32 BatchSize = 4;
+};
+
+/** Receives finished rows of the upsampled frame, top to bottom. OutSize is the size of the whole upsampled frame. */
+using FUpsampledRowsCallback = TFunctionRef<void(const FIntPoint& OutSize, int32 FirstRow, int32 NumRows, TArrayView<const FFloat16Color> Rows)>;
+
+class STABLEDIFFUSIONTOOLS_API FTiledUpsampler
+{
+public:
+	/**
+	* Upsamples the linear half float pixels of Source by Source.UpsampleFactor one band of tiles at a time. Tiles in a band are
+	* sent to the bridge in batches, resampled if the bridge returned them at a different factor, blended into the band with
+	* feathered seams and every row that no later band touches is passed to OnRows.
+	* Only one band of output rows is held at a time so memory depends on the tile size and the frame width, not the frame height.
+	* Returns false if Source has no float pixels or the bridge fails to upsample a tile.
+	*/
+	static bool Upsample(UStableDiffusionBridge* Bridge, const FStableDiffusionImageResult& Source, const FUpsampleTilingOptions& Options, FUpsampledRowsCallback OnRows);
+
+	/** Size of the frame Upsample produces for an input size and factor. Factors of 0 or less use the default 4x. */
+	static FIntPoint GetOutputSize(const FIntPoint& InputSize, float UpsampleFactor);
+
+	/** Upsamples Source into a single buffer. */
+	static bool UpsampleToBuffer(UStableDiffusionBridge* Bridge, const FStableDiffusionImageResult& Source, const FUpsampleTilingOptions& Options, TArray<FFloat16Color>& OutPixels, FIntPoint& OutSize);
+};
@@ -0,0 +1,67 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/Ticker.h"
+
+class FFrameGrabber;
+class FSceneViewport;
+
+/** Viewport frame cropped by the frame stream. */
+struct STABLEDIFFUSIONTOOLS_API FStreamedViewportFrame
+{
+	TArray<FColor> Pixels;
+
+	// Part of the viewport the pixels were cropped from
+	FIntRect Bounds;
+
+	// Game thread frame number the frame was grabbed in
+	uint64 FrameNumber = 0;
+};
+
+
+/**
+ * Continuously grabs the viewport's back buffer with a frame grabber. Every frame is cropped to the capture bounds on the
+ * render thread into a three slot ring so the newest frame can be picked up at any time without another readback or a
+ * render thread flush. On-screen debug messages are hidden while any stream is running.
+ */
+class STABLEDIFFUSIONTOOLS_API FViewportFrameStream
+{
+public:
+	~FViewportFrameStream();
+
+	/** Starts grabbing frames. GetBounds is polled on the game thread every frame for the crop rectangle in viewport pixels. */
+	bool Start(TSharedRef<FSceneViewport> Viewport, TFunction<FIntRect()> GetBounds);
+	void Stop();
+	bool IsRunning() const { return FrameGrabber.IsValid(); }
+
+	/** Copies the newest frame into OutFrame. Returns false if no frame has arrived yet. */
+	bool GetLatestFrame(FStreamedViewportFrame& OutFrame) const;
+
+	/** Copies the Bounds part of a BufferSize frame into OutPixels. Rows or columns outside the frame are left black. */
+	static void CopyFrame(const FColor* ColorBuffer, const FIntPoint& BufferSize, const FIntRect& Bounds, TArray<FColor>& OutPixels);
+
+	static constexpr int32 NumSlots = 3;
+
+private:
+	// Carries the crop rectangle and frame number of a grab to its readback a few frames later
+	struct FFramePayload;
+
+	bool Tick(float DeltaTime);
+	void OnFrameReady_RenderThread(FColor* ColorBuffer, FIntPoint BufferSize, const FIntRect& Bounds, uint64 FrameNumber);
+	void RestartGrabber();
+
+	TWeakPtr<FSceneViewport> Viewport;
+	TFunction<FIntRect()> GetBounds;
+	TSharedPtr<FFrameGrabber> FrameGrabber;
+	FTSTicker::FDelegateHandle TickerHandle;
+	FIntPoint GrabberSize = FIntPoint::ZeroValue;
+	bool bHidingScreenMessages = false;
+
+	// The render thread writes into a slot that is neither the newest one nor the one being read
+	mutable FCriticalSection SlotLock;
+	FStreamedViewportFrame Slots[NumSlots];
+	int32 LatestSlot = INDEX_NONE;
+	mutable int32 ReadingSlot = INDEX_NONE;
+};